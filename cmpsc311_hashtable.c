@@ -0,0 +1,340 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : cmpsc311_hashtable.c
+//  Description   : This is a simple hash table of values (pointers) indexed
+//                  by 32-bit keys, for the 311 homework assignments.
+//
+//  Author   : agent
+//  Created  : Sat Oct 17 02:53:36 UTC 2026
+//
+
+// System include files
+#include <stdlib.h>
+#include <stdint.h>
+
+// Project Include Files
+#include <cmpsc311_hashtable.h>
+#include <cmpsc311_util.h>
+#include <cmpsc311_log.h>
+
+//
+// Defines
+
+// The bucket of a key (multiplicative hash, size is a power of two)
+#define HASHTABLE_BUCKET(ht, key) ((((key) * 2654435761U) >> 7) & ((ht)->size - 1))
+
+//
+// Local functions
+
+int growHashTable( HashTable *ht );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initHashTable
+// Description  : Initialize an empty table
+//
+// Inputs       : ht - the table
+//                size - the number of buckets wanted (rounded up to a power
+//                       of two, at least HASHTABLE_MIN_BUCKETS)
+// Outputs      : 0 if successful, -1 if failure
+
+int initHashTable( HashTable *ht, uint32_t size ) {
+
+	// Size the bucket array, then allocate it
+	ht->size = HASHTABLE_MIN_BUCKETS;
+	while ( ht->size < size ) {
+		ht->size <<= 1;
+	}
+	ht->count = 0;
+	if ( (ht->buckets = calloc(ht->size, sizeof(HashTableEntry *))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "initHashTable : allocation of %u buckets failed", ht->size );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insertValueInHashTable
+// Description  : Insert a value under a key, growing the table if needed
+//
+// Inputs       : ht - the table
+//                key - the index value
+//                value - the value to store
+// Outputs      : 0 if successful, -1 if failure (or the key is in the table)
+
+int insertValueInHashTable( HashTable *ht, uint32_t key, void *value ) {
+
+	// Local variables
+	HashTableEntry *entry;
+	uint32_t bucket;
+
+	// Check for duplicates, grow if the table is getting full
+	if ( findValueInHashTable(ht, key) != NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Duplicate index value %u inserted into hash table", key );
+		return( -1 );
+	}
+	if ( (ht->count >= ht->size * HASHTABLE_MAX_LOAD) && growHashTable(ht) ) {
+		return( -1 );
+	}
+
+	// Put the entry at the front of its bucket
+	if ( (entry = malloc(sizeof(HashTableEntry))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "insertValueInHashTable : entry allocation failed" );
+		return( -1 );
+	}
+	bucket = HASHTABLE_BUCKET( ht, key );
+	entry->key = key;
+	entry->value = value;
+	entry->next = ht->buckets[bucket];
+	ht->buckets[bucket] = entry;
+	ht->count++;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findValueInHashTable
+// Description  : Find the value under a key
+//
+// Inputs       : ht - the table
+//                key - the index value
+// Outputs      : the value, NULL if the key is not in the table
+
+void *findValueInHashTable( HashTable *ht, uint32_t key ) {
+
+	// Local variables
+	HashTableEntry *entry;
+
+	// Walk the bucket of the key
+	for ( entry = ht->buckets[HASHTABLE_BUCKET(ht, key)]; entry != NULL; entry = entry->next ) {
+		if ( entry->key == key ) {
+			return( entry->value );
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deleteValueFromHashTable
+// Description  : Remove the value under a key
+//
+// Inputs       : ht - the table
+//                key - the index value
+// Outputs      : the value removed, NULL if the key is not in the table
+
+void *deleteValueFromHashTable( HashTable *ht, uint32_t key ) {
+
+	// Local variables
+	HashTableEntry **link, *entry;
+	void *value;
+
+	// Find the link to the entry, unlink and free it
+	for ( link = &ht->buckets[HASHTABLE_BUCKET(ht, key)]; *link != NULL; link = &(*link)->next ) {
+		if ( (*link)->key == key ) {
+			entry = *link;
+			value = entry->value;
+			*link = entry->next;
+			free( entry );
+			ht->count--;
+			return( value );
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initHashTableIterator
+// Description  : Start a walk over the values of a table (the table must not
+//                change during the walk)
+//
+// Inputs       : ht - the table
+//                it - the iterator
+// Outputs      : none
+
+void initHashTableIterator( HashTable *ht, HashTableIterator *it ) {
+	it->table = ht;
+	it->bucket = 0;
+	it->entry = ht->buckets[0];
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : iterateHashTable
+// Description  : Get the next value of a walk
+//
+// Inputs       : it - the iterator
+//                key - the place to put the key of the value (if not NULL)
+// Outputs      : the value, NULL at the end of the table
+
+void *iterateHashTable( HashTableIterator *it, uint32_t *key ) {
+
+	// Local variables
+	HashTableEntry *entry;
+
+	// Move on to the next non-empty bucket
+	while ( it->entry == NULL ) {
+		if ( ++it->bucket >= it->table->size ) {
+			it->bucket = it->table->size;
+			return( NULL );
+		}
+		it->entry = it->table->buckets[it->bucket];
+	}
+
+	// Return the entry, step past it
+	entry = it->entry;
+	it->entry = entry->next;
+	if ( key != NULL ) {
+		*key = entry->key;
+	}
+	return( entry->value );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cleanupHashTable
+// Description  : Empty the table and free its buckets
+//
+// Inputs       : ht - the table
+//                release - function freeing each value (NULL to keep them)
+// Outputs      : none
+
+void cleanupHashTable( HashTable *ht, void (*release)(void *value) ) {
+
+	// Local variables
+	HashTableEntry *entry, *next;
+	uint32_t i;
+
+	// Free each chain, then the bucket array
+	for ( i=0; (ht->buckets != NULL) && (i<ht->size); i++ ) {
+		for ( entry = ht->buckets[i]; entry != NULL; entry = next ) {
+			next = entry->next;
+			if ( release != NULL ) {
+				release( entry->value );
+			}
+			free( entry );
+		}
+	}
+	free( ht->buckets );
+	ht->buckets = NULL;
+	ht->size = ht->count = 0;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashTableUnitTest
+// Description  : Insert, find, walk and delete random values in a table
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int hashTableUnitTest( void ) {
+
+	// Local variables
+	HashTable ht;
+	HashTableIterator it;
+	uint32_t keys[1000], i, key, seen = 0;
+	uintptr_t value;
+
+	// Insert values under distinct random keys (the table has to grow)
+	if ( initHashTable(&ht, 0) ) {
+		return( -1 );
+	}
+	for ( i=0; i<1000; i++ ) {
+		do {
+			keys[i] = getRandomValue( 0, -1 );
+		} while ( findValueInHashTable(&ht, keys[i]) != NULL );
+		if ( insertValueInHashTable(&ht, keys[i], (void *)(uintptr_t)(i+1)) ) {
+			logMessage( LOG_ERROR_LEVEL, "HT Unit Test: Failure inserting hashtable entry %u", i );
+			cleanupHashTable( &ht, NULL );
+			return( -1 );
+		}
+	}
+
+	// Find each, then walk the table
+	for ( i=0; i<1000; i++ ) {
+		if ( (uintptr_t)findValueInHashTable(&ht, keys[i]) != i+1 ) {
+			logMessage( LOG_ERROR_LEVEL, "HT Unit Test: Failure finding hashtable entry %u", i );
+			cleanupHashTable( &ht, NULL );
+			return( -1 );
+		}
+	}
+	initHashTableIterator( &ht, &it );
+	while ( (value = (uintptr_t)iterateHashTable(&it, &key)) != 0 ) {
+		if ( keys[value-1] != key ) {
+			logMessage( LOG_ERROR_LEVEL, "HT Unit Test: Incorrect iterator entry %u", key );
+			cleanupHashTable( &ht, NULL );
+			return( -1 );
+		}
+		seen++;
+	}
+
+	// Delete every other value, check the rest are still found
+	for ( i=0; i<1000; i+=2 ) {
+		if ( (uintptr_t)deleteValueFromHashTable(&ht, keys[i]) != i+1 ) {
+			logMessage( LOG_ERROR_LEVEL, "HT Unit Test: Failure deleting hashtable entry %u", i );
+			cleanupHashTable( &ht, NULL );
+			return( -1 );
+		}
+	}
+	for ( i=0; i<1000; i++ ) {
+		if ( (uintptr_t)findValueInHashTable(&ht, keys[i]) != ((i%2) ? i+1 : 0) ) {
+			logMessage( LOG_ERROR_LEVEL, "HT Unit Test: Incorrect find in hashtable, entry %u", i );
+			cleanupHashTable( &ht, NULL );
+			return( -1 );
+		}
+	}
+
+	// Cleanup, check the counts and return
+	i = ht.count;
+	cleanupHashTable( &ht, NULL );
+	if ( (seen != 1000) || (i != 500) ) {
+		logMessage( LOG_ERROR_LEVEL, "HT Unit Test: Bad counts (%u walked, %u left)", seen, i );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "HT Unit Test: successful." );
+	return( 0 );
+}
+
+//
+// Local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : growHashTable
+// Description  : Double the bucket array, moving the entries over
+//
+// Inputs       : ht - the table
+// Outputs      : 0 if successful, -1 if failure
+
+int growHashTable( HashTable *ht ) {
+
+	// Local variables
+	HashTableEntry **old = ht->buckets, *entry, *next;
+	uint32_t i, oldsize = ht->size, bucket;
+
+	// Allocate the new array, then rehash the entries into it
+	if ( (ht->buckets = calloc(oldsize * 2, sizeof(HashTableEntry *))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "growHashTable : allocation of %u buckets failed", oldsize * 2 );
+		ht->buckets = old;
+		return( -1 );
+	}
+	ht->size = oldsize * 2;
+	for ( i=0; i<oldsize; i++ ) {
+		for ( entry = old[i]; entry != NULL; entry = next ) {
+			next = entry->next;
+			bucket = HASHTABLE_BUCKET( ht, entry->key );
+			entry->next = ht->buckets[bucket];
+			ht->buckets[bucket] = entry;
+		}
+	}
+	free( old );
+	return( 0 );
+}
@@ -0,0 +1,74 @@
+#ifndef CMPSC311_HASHTABLE_INCLUDED
+#define CMPSC311_HASHTABLE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : cmpsc311_hashtable.h
+//  Description   : This is a simple hash table of values (pointers) indexed
+//                  by 32-bit keys, for the 311 homework assignments.  The
+//                  table doubles its bucket array as it fills, so lookups
+//                  stay short however many values are inserted.
+//
+//  Author   : agent
+//  Created  : Sat Oct 17 02:53:36 UTC 2026
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define HASHTABLE_MIN_BUCKETS 64  // Smallest bucket array (a power of two)
+#define HASHTABLE_MAX_LOAD    2   // Values per bucket before the table grows
+
+//
+// Type definitions
+
+// This is an entry in a bucket chain
+typedef struct HashTableEntry {
+	uint32_t               key;   // The index value
+	void                  *value; // The value stored under the key
+	struct HashTableEntry *next;  // The next entry in the bucket
+} HashTableEntry;
+
+// This is the hash table
+typedef struct {
+	HashTableEntry **buckets;  // The bucket chains
+	uint32_t         size;     // Number of buckets (a power of two)
+	uint32_t         count;    // Number of values in the table
+} HashTable;
+
+// This is an iterator over the values of a table
+typedef struct {
+	HashTable      *table;   // The table being walked
+	uint32_t        bucket;  // The bucket of the next entry
+	HashTableEntry *entry;   // The next entry, NULL at the end of a bucket
+} HashTableIterator;
+
+//
+// Functional prototypes
+
+int initHashTable( HashTable *ht, uint32_t size );
+	// Initialize an empty table with (at least) size buckets
+
+int insertValueInHashTable( HashTable *ht, uint32_t key, void *value );
+	// Insert a value under a key (which must not be in the table)
+
+void *findValueInHashTable( HashTable *ht, uint32_t key );
+	// Find the value under a key, NULL if none
+
+void *deleteValueFromHashTable( HashTable *ht, uint32_t key );
+	// Remove the value under a key, returning it (NULL if none)
+
+void initHashTableIterator( HashTable *ht, HashTableIterator *it );
+	// Start a walk over the values of a table
+
+void *iterateHashTable( HashTableIterator *it, uint32_t *key );
+	// The next value (and its key) of the walk, NULL at the end
+
+void cleanupHashTable( HashTable *ht, void (*release)(void *value) );
+	// Empty the table and free it, releasing each value if release is set
+
+int hashTableUnitTest( void );
+	// Hash table unit test
+
+#endif
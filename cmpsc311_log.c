@@ -5,6 +5,19 @@
 //                  library.  It provides access enable log events,
 //                  whose levels are registered by the calling programs.
 //
+//                  In asynchronous mode each thread formats its entries
+//                  into a queue of its own (a ring only it writes to and
+//                  only the writer thread reads from, so no lock is taken),
+//                  and the writer thread gathers what the queues hold into
+//                  large writes.
+//
+//                  In binary mode the log is a stream of records: a session
+//                  header, the level descriptors, each format the first
+//                  time it is used, and the entries (format id, levels,
+//                  time and raw arguments; strings are copied).  Entries
+//                  whose format cannot be recorded raw are kept as text.
+//                  Records are in host byte order.
+//
 //  Author   : Patrick McDaniel
 //  Created  : Sat Sep 14 10:19:45 EDT 2013
 //
@@ -19,6 +32,10 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 // Project Include Files
 #include <cmpsc311_log.h>
@@ -33,9 +50,89 @@ int fileHandle = -1;				// This is the filehandle that we are using to write.
 int echoHandle = -1;				// This is descriptor to echo the content with
 int errored = 0;					// Is the log permanently errored?
 
+// This is the queue of entries of one thread (asynchronous mode)
+typedef struct logQueue {
+	char *ring;					// The entries, LOG_QUEUE_SIZE bytes
+	unsigned long head;			// Bytes ever queued (moved only by the owner)
+	unsigned long tail;			// Bytes ever written (moved only by the writer)
+	int orphaned;				// Has the owning thread exited?
+	struct logQueue *next;		// Next queue of the writer
+} LogQueue;
+
+int asyncLogging = 0;				// Are entries going through the writer thread?
+int asyncStopping = 0;				// Is the writer thread to exit?
+int writerRunning = 0;				// Is the writer thread running?
+LogQueue *logQueues = NULL;			// The queues of the threads that have logged
+pthread_t logWriter;				// The writer thread
+pthread_key_t logQueueKey;			// Finds the queue of an exiting thread
+pthread_mutex_t logQueueLock = PTHREAD_MUTEX_INITIALIZER;	// Guards adding queues
+pthread_mutex_t logWriterLock = PTHREAD_MUTEX_INITIALIZER;	// Guards the writer's sleep
+pthread_cond_t logWriterWake = PTHREAD_COND_INITIALIZER;	// Wakes the writer
+pthread_cond_t logDrained = PTHREAD_COND_INITIALIZER;		// Signals the queues are empty
+__thread LogQueue *threadQueue = NULL;	// The queue of this thread
+__thread time_t stampSecond = 0;		// Second of the cached timestamp
+__thread char stampText[32];			// The cached timestamp
+__thread int stampLength = 0;			// ... and its length
+
+// The records of a binary log
+typedef enum {
+	LOG_RECORD_HEADER = 1,		// Session start (id: magic, levels: version)
+	LOG_RECORD_LEVEL  = 2,		// Level descriptor (id: level bit), the name follows
+	LOG_RECORD_FORMAT = 3,		// Format (id), the format string follows
+	LOG_RECORD_ENTRY  = 4,		// Entry (id: format), the raw arguments follow
+	LOG_RECORD_TEXT   = 5,		// Entry kept as text, the message follows
+} LOG_RECORD_TYPES;
+
+// The raw arguments of an entry
+typedef enum {
+	LOG_ARG_NONE   = 0,		// No argument (%%)
+	LOG_ARG_INT    = 1,		// int (4 bytes)
+	LOG_ARG_LONG   = 2,		// long (8 bytes)
+	LOG_ARG_DOUBLE = 3,		// double (8 bytes)
+	LOG_ARG_PTR    = 4,		// pointer (8 bytes)
+	LOG_ARG_STRING = 5,		// string (16 bit length, then the bytes)
+	LOG_ARG_BAD    = 6,		// conversion we cannot record
+} LOG_ARG_TYPES;
+
+// This is the head of each record
+typedef struct {
+	uint16_t length;			// Bytes in the record, head included
+	uint8_t  type;				// LOG_RECORD_TYPES
+	uint8_t  unused;			// Zero
+	uint32_t id;				// Format id (or as noted in LOG_RECORD_TYPES)
+	uint32_t levels;			// Levels of the entry
+	uint32_t time;				// Time of the entry
+} LogRecord;
+
+// This is a format seen in binary mode
+typedef struct {
+	const char *format;			// The format, NULL if the slot is unused
+	int nargs;					// Number of arguments, -1 if kept as text
+	uint8_t types[LOG_MAX_ARGS];	// The argument types
+} LogFormat;
+
+int binaryLogging = 0;				// Are entries recorded unformatted?
+LogFormat logFormats[LOG_FORMAT_TABLE];	// The formats seen, by address
+pthread_mutex_t logFormatLock = PTHREAD_MUTEX_INITIALIZER;	// Guards adding formats
+
 // Functional prototypes
 int openLog( void );
 int closeLog( void );
+int formatLogEntry( char *buf, unsigned long lvl, const char *fmt, va_list args );
+int emitLogEntry( const char *buf, int len );
+int parseLogConversion( const char *spec, int *stars, int *type );
+LogFormat *findLogFormat( const char *fmt, int *added );
+int encodeLogEntry( char *buf, unsigned long lvl, const char *fmt, va_list args );
+int encodeLogRecord( char *buf, int type, uint32_t id, const char *text );
+int renderLogEntry( char *out, int size, const char *fmt, const char *args, const char *end );
+int writeLogEntry( int fh, const char *buf, int len );
+LogQueue *getLogQueue( void );
+void queueLogEntry( LogQueue *q, const char *buf, int len );
+int logQueuesEmpty( void );
+int drainLogQueues( void );
+void wakeLogWriter( void );
+void *logWriterThread( void *arg );
+void releaseLogQueue( void *q );
 
 //
 // Functions
@@ -173,6 +270,10 @@ unsigned long registerLogLevel( const char *descriptor, int enable ) {
 			lvl = 1<<i;
 			if ( enable ) enableLogLevels(lvl);
 			descriptors[i] = strdup(descriptor);
+			if ( binaryLogging ) {
+				char rec[MAX_LOG_ENTRY_SIZE];
+				emitLogEntry( rec, encodeLogRecord(rec, LOG_RECORD_LEVEL, i, descriptors[i]) );
+			}
             return( lvl );
 		}
 	}
@@ -193,7 +294,7 @@ unsigned long registerLogLevel( const char *descriptor, int enable ) {
 // Inputs       : lvl - the levels to log on, format (etc)
 // Outputs      : 0 if successful, -1 if failure
 
-int logMessage( unsigned long lvl, const char *fmt, ...) {
+int (logMessage)( unsigned long lvl, const char *fmt, ...) {
 
     // Call the the va list version of the logging message
 	va_list args;
@@ -218,9 +319,8 @@ int logMessage( unsigned long lvl, const char *fmt, ...) {
 int vlogMessage( unsigned long lvl, const char *fmt, va_list args ) {
 
 	// Local variables
-    char msg[MAX_LOG_MESSAGE_SIZE], tbuf[MAX_LOG_MESSAGE_SIZE];
-    int first = 1, ret, writelen, i;
-    time_t tm;
+    char tbuf[MAX_LOG_ENTRY_SIZE];
+    int writelen;
 
 	// Bail out if not read, open file if necessary
     if ( !levelEnabled(lvl) ) {
@@ -237,50 +337,13 @@ int vlogMessage( unsigned long lvl, const char *fmt, va_list args ) {
     	return( errored );
     }
 
-    // Add header with descriptor names
-    time(&tm);
-    strncpy(tbuf, ctime((const time_t *)&tm), MAX_LOG_MESSAGE_SIZE);
-    tbuf[strlen(tbuf)-1] = 0x0;
-    strncat(tbuf, " [", MAX_LOG_MESSAGE_SIZE);
-    for ( i=0; i<MAX_LOG_LEVEL; i++ ) {
-        if ( levelEnabled((1<<i)&lvl) ) {
-
-        	// Comma separate the levels if necessary
-            if ( !first ) {
-            	strncat(tbuf, ",", MAX_LOG_MESSAGE_SIZE);
-            } else {
-            	first = 0;
-            }
-
-            // Add the level descriptor
-            if ( descriptors[i] == NULL ) {
-            	strncat(tbuf, "*BAD LEVEL*", MAX_LOG_MESSAGE_SIZE);
-            } else {
-                strncat(tbuf, descriptors[i], MAX_LOG_MESSAGE_SIZE);
-            }
-          }
-    }
-    strncat(tbuf, "] ", MAX_LOG_MESSAGE_SIZE);
-
-    // Setup the "printf" like message, get write len
-	vsnprintf( msg, MAX_LOG_MESSAGE_SIZE, fmt, args );
-    strncat(tbuf, msg, MAX_LOG_MESSAGE_SIZE);
-    writelen = strlen(tbuf);
-
-    // Check if we need to CR/LF the line
-    if ( tbuf[writelen-1] != '\n' ) {
-    	strncat(tbuf, "\n", MAX_LOG_MESSAGE_SIZE);
-        writelen = strlen(tbuf);
-    }
-
-    // Echo, then Write the entry to the log and return
-    if (echoHandle != -1 ) {
-    	ret = write( echoHandle, tbuf, writelen );
-    }
-    if ( (ret=write(fileHandle, tbuf, strlen(tbuf))) != writelen ) {
-    	fprintf( stderr, "Error writing to log : %s [%s] (%d)", tbuf, logFilename, ret );
+    // Format (or encode) the entry, then write or queue it
+    if ( binaryLogging ) {
+    	writelen = encodeLogEntry( tbuf, lvl, fmt, args );
+    } else {
+    	writelen = formatLogEntry( tbuf, lvl, fmt, args );
     }
-    return( ret );
+    return( emitLogEntry(tbuf, writelen) );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -304,12 +367,260 @@ int logAssert( int expr, const char *file, int line, const char *fmt, ...) {
 	va_start(args, fmt);
 	int ret = vlogMessage( LOG_ERROR_LEVEL, fmt, args );
     va_end(args);
+    flushLog();
     assert( 0 );
 
     // Return the log return (UNREACHABLE)
     return( ret );
 }
 
+//
+// Asynchronous logging
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : enableAsyncLog
+// Description  : Start the writer thread and queue entries for it from now
+//                on.  What is queued is written out at exit.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int enableAsyncLog( void ) {
+
+	// Local variables
+	static int keyCreated = 0;
+
+	// Nothing to do if already running
+	if ( writerRunning ) {
+		return( 0 );
+	}
+
+	// Setup the queue key (once), then start the writer
+	if ( !keyCreated ) {
+		if ( pthread_key_create(&logQueueKey, releaseLogQueue) != 0 ) {
+			fprintf( stderr, "Error starting asynchronous log [%s]", logFilename );
+			return( -1 );
+		}
+		atexit( disableAsyncLog );
+		keyCreated = 1;
+	}
+	asyncStopping = 0;
+	if ( pthread_create(&logWriter, NULL, logWriterThread, NULL) != 0 ) {
+		fprintf( stderr, "Error starting log writer thread [%s]", logFilename );
+		return( -1 );
+	}
+	writerRunning = 1;
+	asyncLogging = 1;
+
+    // Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : disableAsyncLog
+// Description  : Stop queueing entries, stop the writer thread once it has
+//                written out the queues, and write anything left behind
+//
+// Inputs       : none
+// Outputs      : none
+
+void disableAsyncLog( void ) {
+
+	// Nothing to do if not running
+	if ( !writerRunning ) {
+		return;
+	}
+
+	// Have the writer empty the queues and exit
+	asyncLogging = 0;
+	pthread_mutex_lock( &logWriterLock );
+	asyncStopping = 1;
+	pthread_cond_signal( &logWriterWake );
+	pthread_mutex_unlock( &logWriterLock );
+	pthread_join( logWriter, NULL );
+	writerRunning = 0;
+
+	// Entries queued as the writer was leaving
+	drainLogQueues();
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushLog
+// Description  : Wait until the writer thread has written every queued entry
+//
+// Inputs       : none
+// Outputs      : none
+
+void flushLog( void ) {
+
+	// Wake the writer until it reports the queues empty
+	pthread_mutex_lock( &logWriterLock );
+	while ( writerRunning && !logQueuesEmpty() ) {
+		pthread_cond_signal( &logWriterWake );
+		pthread_cond_wait( &logDrained, &logWriterLock );
+	}
+	pthread_mutex_unlock( &logWriterLock );
+	return;
+}
+
+//
+// Binary logging
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : enableBinaryLog
+// Description  : Record entries unformatted from now on, starting a session
+//                (header and level descriptors) in the log
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int enableBinaryLog( void ) {
+
+	// Local variables
+	char rec[MAX_LOG_ENTRY_SIZE];
+	int i;
+
+	// Nothing to do if already recording, open the log if needed
+	if ( binaryLogging ) {
+		return( 0 );
+	}
+	if ( (fileHandle == -1) && openLog() ) {
+		return( -1 );
+	}
+
+	// Session header, then the descriptors of the levels
+	emitLogEntry( rec, encodeLogRecord(rec, LOG_RECORD_HEADER, LOG_BINARY_MAGIC, NULL) );
+	for ( i=0; i<MAX_LOG_LEVEL; i++ ) {
+		if ( descriptors[i] != NULL ) {
+			emitLogEntry( rec, encodeLogRecord(rec, LOG_RECORD_LEVEL, i, descriptors[i]) );
+		}
+	}
+	binaryLogging = 1;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : renderBinaryLog
+// Description  : Write a binary log as the text log it stands for.  Each
+//                session is read twice, first for its descriptors and
+//                formats (threads may record an entry ahead of the format
+//                another thread is recording), then for its entries.
+//
+// Inputs       : in - the file handle of the binary log
+//                out - the file handle to write the text to
+// Outputs      : 0 if successful, -1 if failure
+
+int renderBinaryLog( int in, int out ) {
+
+	// Local variables
+	const char *names[MAX_LOG_LEVEL], **formats;
+	char *log = NULL, *pos, *session, *end, line[MAX_LOG_ENTRY_SIZE];
+	int size = 0, got, len, first, i, ret = 0;
+	struct stat st;
+	LogRecord rec;
+	time_t tm;
+
+	// Read the whole log in
+	if ( (fstat(in, &st) == -1) || ((log = malloc(st.st_size + 1)) == NULL) ||
+			((formats = calloc(LOG_FORMAT_TABLE, sizeof(char *))) == NULL) ) {
+		fprintf( stderr, "Error reading binary log (%s)\n", strerror(errno) );
+		free( log );
+		return( -1 );
+	}
+	while ( (size < st.st_size) && ((got = read(in, &log[size], st.st_size - size)) > 0) ) {
+		size += got;
+	}
+	end = &log[size];
+
+	// Render the log a session at a time
+	for ( session = log; (session < end) && (ret == 0); session = pos ) {
+
+		// First pass, the descriptors and formats of the session
+		memset( names, 0x0, sizeof(names) );
+		memset( formats, 0x0, LOG_FORMAT_TABLE * sizeof(char *) );
+		for ( pos = session; pos + sizeof(LogRecord) <= end; pos += rec.length ) {
+			memcpy( &rec, pos, sizeof(LogRecord) );
+			if ( (rec.length < sizeof(LogRecord)) || (pos + rec.length > end) ) {
+				fprintf( stderr, "Bad record in binary log at byte %ld\n", (long)(pos - log) );
+				ret = -1;
+				break;
+			}
+			if ( (rec.type == LOG_RECORD_HEADER) && (pos != session) ) {
+				break;
+			}
+			if ( (rec.type == LOG_RECORD_HEADER) && ((rec.id != LOG_BINARY_MAGIC) || (rec.levels != LOG_BINARY_VERSION)) ) {
+				fprintf( stderr, "Not a binary log (version %d)\n", LOG_BINARY_VERSION );
+				ret = -1;
+				break;
+			}
+			if ( (rec.type == LOG_RECORD_LEVEL) && (rec.id < MAX_LOG_LEVEL) ) {
+				names[rec.id] = pos + sizeof(LogRecord);
+			}
+			if ( (rec.type == LOG_RECORD_FORMAT) && (rec.id < LOG_FORMAT_TABLE) ) {
+				formats[rec.id] = pos + sizeof(LogRecord);
+			}
+		}
+
+		// Second pass, each entry as logMessage would have written it
+		for ( pos = session; (ret == 0) && (pos + sizeof(LogRecord) <= end); pos += rec.length ) {
+			memcpy( &rec, pos, sizeof(LogRecord) );
+			if ( (rec.type == LOG_RECORD_HEADER) && (pos != session) ) {
+				break;
+			}
+			if ( (rec.type != LOG_RECORD_ENTRY) && (rec.type != LOG_RECORD_TEXT) ) {
+				continue;
+			}
+
+			// The header: time and level descriptors
+			tm = rec.time;
+			ctime_r( &tm, line );
+			len = strlen(line) - 1;
+			len += sprintf( &line[len], " [" );
+			for ( i=0, first=1; i<MAX_LOG_LEVEL; i++ ) {
+				if ( rec.levels & (1<<i) ) {
+					len += snprintf( &line[len], MAX_LOG_MESSAGE_SIZE - len, "%s%s", (first) ? "" : ",",
+							(names[i] == NULL) ? "*BAD LEVEL*" : names[i] );
+					first = 0;
+				}
+			}
+			len += sprintf( &line[len], "] " );
+
+			// Then the message
+			if ( rec.type == LOG_RECORD_TEXT ) {
+				len += snprintf( &line[len], sizeof(line) - len - 1, "%.*s",
+						(int)(rec.length - sizeof(LogRecord)), pos + sizeof(LogRecord) );
+			} else if ( (rec.id < LOG_FORMAT_TABLE) && (formats[rec.id] != NULL) ) {
+				len += renderLogEntry( &line[len], MAX_LOG_MESSAGE_SIZE, formats[rec.id],
+						pos + sizeof(LogRecord), pos + rec.length );
+			} else {
+				len += snprintf( &line[len], sizeof(line) - len - 1, "*MISSING FORMAT %u*", rec.id );
+			}
+
+			// A long message is cut short, leaving room for the newline
+			if ( len > (int)sizeof(line) - 2 ) {
+				len = sizeof(line) - 2;
+			}
+			if ( line[len-1] != '\n' ) {
+				line[len++] = '\n';
+			}
+			if ( writeLogEntry(out, line, len) ) {
+				ret = -1;
+			}
+		}
+	}
+
+	// Cleanup and return
+	free( formats );
+	free( log );
+	return( ret );
+}
+
 //
 // Private Interfaces
 
@@ -365,4 +676,686 @@ int closeLog( void ) {
     return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatLogEntry
+// Description  : Format a log entry: timestamp, level descriptors and the
+//                message, ending in a newline.  The timestamp is formatted
+//                again only when the second changes.
+//
+// Inputs       : buf - the place to put the entry (MAX_LOG_ENTRY_SIZE bytes)
+//                lvl - the levels of the entry
+//                fmt - format (etc)
+//                args - the list of arguments for log message
+// Outputs      : the length of the entry
+
+int formatLogEntry( char *buf, unsigned long lvl, const char *fmt, va_list args ) {
+
+	// Local variables
+	int len, first = 1, i, n;
+	const char *desc;
+	time_t tm;
+
+	// Add header with the (cached) timestamp and descriptor names
+	time(&tm);
+	if ( (stampLength == 0) || (tm != stampSecond) ) {
+		ctime_r( &tm, stampText );
+		stampLength = strlen(stampText) - 1;
+		stampSecond = tm;
+	}
+	memcpy( buf, stampText, stampLength );
+	len = stampLength;
+	buf[len++] = ' ';
+	buf[len++] = '[';
+	for ( i=0; i<MAX_LOG_LEVEL; i++ ) {
+		if ( levelEnabled((1<<i)&lvl) ) {
+
+			// Comma separate the levels if necessary, add the descriptor
+			desc = (descriptors[i] == NULL) ? "*BAD LEVEL*" : descriptors[i];
+			n = strlen(desc);
+			if ( len + n + 1 >= MAX_LOG_MESSAGE_SIZE - 2 ) {
+				break;
+			}
+			if ( !first ) {
+				buf[len++] = ',';
+			}
+			first = 0;
+			memcpy( &buf[len], desc, n );
+			len += n;
+		}
+	}
+	buf[len++] = ']';
+	buf[len++] = ' ';
+
+	// Setup the "printf" like message
+	n = vsnprintf( &buf[len], MAX_LOG_MESSAGE_SIZE, fmt, args );
+	len += (n < 0) ? 0 : ((n >= MAX_LOG_MESSAGE_SIZE) ? MAX_LOG_MESSAGE_SIZE-1 : n);
+
+	// Check if we need to CR/LF the line
+	if ( buf[len-1] != '\n' ) {
+		buf[len++] = '\n';
+	}
+	buf[len] = 0x0;
+	return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeLogEntry
+// Description  : Write a buffer of entries, carrying on after short writes
+//
+// Inputs       : fh - the file handle to write to
+//                buf - the entries
+//                len - the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int writeLogEntry( int fh, const char *buf, int len ) {
+
+	// Local variables
+	int ret;
+
+	while ( len > 0 ) {
+		if ( (ret = write(fh, buf, len)) < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			fprintf( stderr, "Error writing to log : [%s] (%s)", logFilename, strerror(errno) );
+			return( -1 );
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getLogQueue
+// Description  : Get the queue of the calling thread, taking over the
+//                (empty) queue of an exited thread or adding one
+//
+// Inputs       : none
+// Outputs      : the queue, NULL if failure
+
+LogQueue *getLogQueue( void ) {
+
+	// Local variables
+	LogQueue *q;
+
+	// Threads keep their queue once they have one
+	if ( threadQueue != NULL ) {
+		return( threadQueue );
+	}
+
+	// Reuse an orphaned queue the writer has emptied, or add a new one
+	pthread_mutex_lock( &logQueueLock );
+	for ( q = logQueues; q != NULL; q = q->next ) {
+		if ( q->orphaned && (q->head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) ) {
+			q->orphaned = 0;
+			break;
+		}
+	}
+	if ( (q == NULL) && ((q = calloc(1, sizeof(LogQueue))) != NULL) ) {
+		if ( (q->ring = malloc(LOG_QUEUE_SIZE)) == NULL ) {
+			free( q );
+			q = NULL;
+		} else {
+			q->next = logQueues;
+			__atomic_store_n( &logQueues, q, __ATOMIC_RELEASE );
+		}
+	}
+	pthread_mutex_unlock( &logQueueLock );
+
+	// Remember it, so it is given up when the thread exits
+	if ( q != NULL ) {
+		threadQueue = q;
+		pthread_setspecific( logQueueKey, q );
+	}
+	return( q );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueLogEntry
+// Description  : Put an entry on the queue of the calling thread.  If the
+//                writer has fallen a whole queue behind, this waits for it
+//                rather than dropping the entry.
+//
+// Inputs       : q - the queue of the calling thread
+//                buf - the entry
+//                len - its length
+// Outputs      : none
+
+void queueLogEntry( LogQueue *q, const char *buf, int len ) {
+
+	// Local variables
+	unsigned long head = q->head, start, part;
+
+	// Wait for room, keeping the writer awake
+	while ( LOG_QUEUE_SIZE - (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) < (unsigned long)len ) {
+		wakeLogWriter();
+		sched_yield();
+	}
+
+	// Copy the entry in (wrapping around the end), then publish it
+	start = head & (LOG_QUEUE_SIZE-1);
+	part = (LOG_QUEUE_SIZE - start < (unsigned long)len) ? LOG_QUEUE_SIZE - start : (unsigned long)len;
+	memcpy( &q->ring[start], buf, part );
+	memcpy( q->ring, &buf[part], len - part );
+	__atomic_store_n( &q->head, head + len, __ATOMIC_RELEASE );
+
+	// Wake the writer early if the queue is getting full
+	if ( head + len - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= LOG_QUEUE_SIZE/2 ) {
+		wakeLogWriter();
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logQueuesEmpty
+// Description  : Has everything queued been written?
+//
+// Inputs       : none
+// Outputs      : 1 if every queue is empty, 0 otherwise
+
+int logQueuesEmpty( void ) {
+
+	// Local variables
+	LogQueue *q;
+
+	for ( q = __atomic_load_n(&logQueues, __ATOMIC_ACQUIRE); q != NULL; q = q->next ) {
+		if ( __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) ) {
+			return( 0 );
+		}
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drainLogQueues
+// Description  : Gather what the queues hold into batches of up to
+//                LOG_WRITE_BATCH bytes and write them (the writer thread,
+//                or the caller once it has stopped)
+//
+// Inputs       : none
+// Outputs      : the number of bytes written
+
+int drainLogQueues( void ) {
+
+	// Local variables
+	static char batch[LOG_WRITE_BATCH];
+	unsigned long head, tail, n, start, part;
+	int used = 0, moved = 0;
+	LogQueue *q;
+
+	// Take each queue up to its head, writing whenever the batch fills
+	for ( q = __atomic_load_n(&logQueues, __ATOMIC_ACQUIRE); q != NULL; q = q->next ) {
+		head = __atomic_load_n( &q->head, __ATOMIC_ACQUIRE );
+		tail = q->tail;
+		while ( head != tail ) {
+			if ( used == LOG_WRITE_BATCH ) {
+				if ( echoHandle != -1 ) {
+					writeLogEntry( echoHandle, batch, used );
+				}
+				writeLogEntry( fileHandle, batch, used );
+				moved += used;
+				used = 0;
+			}
+			n = (head - tail < (unsigned long)(LOG_WRITE_BATCH - used)) ? head - tail : (unsigned long)(LOG_WRITE_BATCH - used);
+			start = tail & (LOG_QUEUE_SIZE-1);
+			part = (LOG_QUEUE_SIZE - start < n) ? LOG_QUEUE_SIZE - start : n;
+			memcpy( &batch[used], &q->ring[start], part );
+			memcpy( &batch[used+part], q->ring, n - part );
+			used += n;
+			tail += n;
+			__atomic_store_n( &q->tail, tail, __ATOMIC_RELEASE );
+		}
+	}
+
+	// Write what is left in the batch
+	if ( used > 0 ) {
+		if ( echoHandle != -1 ) {
+			writeLogEntry( echoHandle, batch, used );
+		}
+		writeLogEntry( fileHandle, batch, used );
+		moved += used;
+	}
+	return( moved );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wakeLogWriter
+// Description  : Wake the writer thread
+//
+// Inputs       : none
+// Outputs      : none
+
+void wakeLogWriter( void ) {
+	pthread_mutex_lock( &logWriterLock );
+	pthread_cond_signal( &logWriterWake );
+	pthread_mutex_unlock( &logWriterLock );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logWriterThread
+// Description  : The writer thread: write out the queues, then sleep until
+//                woken (or LOG_WRITER_SLEEP_MS passes), until told to stop
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *logWriterThread( void *arg ) {
+
+	// Local variables
+	struct timespec wake;
+
+	while ( 1 ) {
+
+		// Keep going while there is something to write
+		if ( drainLogQueues() > 0 ) {
+			continue;
+		}
+
+		// Tell the flushers, leave if stopping, sleep otherwise
+		pthread_mutex_lock( &logWriterLock );
+		if ( logQueuesEmpty() ) {
+			pthread_cond_broadcast( &logDrained );
+			if ( asyncStopping ) {
+				pthread_mutex_unlock( &logWriterLock );
+				break;
+			}
+			clock_gettime( CLOCK_REALTIME, &wake );
+			wake.tv_nsec += LOG_WRITER_SLEEP_MS * 1000000L;
+			if ( wake.tv_nsec >= 1000000000L ) {
+				wake.tv_sec ++;
+				wake.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait( &logWriterWake, &logWriterLock, &wake );
+		}
+		pthread_mutex_unlock( &logWriterLock );
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseLogQueue
+// Description  : Give up the queue of an exiting thread (the writer still
+//                empties it, then another thread may take it over)
+//
+// Inputs       : q - the queue
+// Outputs      : none
+
+void releaseLogQueue( void *q ) {
+	pthread_mutex_lock( &logQueueLock );
+	((LogQueue *)q)->orphaned = 1;
+	pthread_mutex_unlock( &logQueueLock );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : emitLogEntry
+// Description  : Queue an entry for the writer thread if asynchronous,
+//                write it (and its echo) otherwise
+//
+// Inputs       : buf - the entry (or binary records)
+//                len - its length
+// Outputs      : the bytes written or queued
+
+int emitLogEntry( const char *buf, int len ) {
+
+	// Local variables
+	LogQueue *q;
+	int ret = 0;
+
+	// Queue the entry for the writer thread if asynchronous
+	if ( asyncLogging && ((q = getLogQueue()) != NULL) ) {
+		queueLogEntry( q, buf, len );
+		return( len );
+	}
+
+	// Echo, then Write the entry to the log and return
+	if (echoHandle != -1 ) {
+		ret = write( echoHandle, buf, len );
+	}
+	if ( (ret=write(fileHandle, buf, len)) != len ) {
+		fprintf( stderr, "Error writing to log : %.*s [%s] (%d)", len, buf, logFilename, ret );
+	}
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseLogConversion
+// Description  : Parse a "printf" conversion: its flags, width, precision
+//                and length modifier, and the argument it takes
+//
+// Inputs       : spec - the conversion, starting at the '%'
+//                stars - the place to put the number of '*' (int) arguments
+//                type - the place to put the argument type (LOG_ARG_TYPES)
+// Outputs      : the length of the conversion
+
+int parseLogConversion( const char *spec, int *stars, int *type ) {
+
+	// Local variables
+	int i = 1, longs = 0, shorts = 0;
+
+	// Flags, width and precision
+	*stars = 0;
+	while ( (spec[i] != 0x0) && (strchr("-+ #0'", spec[i]) != NULL) ) {
+		i++;
+	}
+	for ( ; (spec[i] == '*') || (spec[i] == '.') || ((spec[i] >= '0') && (spec[i] <= '9')); i++ ) {
+		*stars += (spec[i] == '*');
+	}
+
+	// Length modifier, then the conversion
+	for ( ; (spec[i] != 0x0) && (strchr("hlLqjzt", spec[i]) != NULL); i++ ) {
+		longs += (spec[i] != 'h');
+		shorts += (spec[i] == 'h');
+	}
+	switch ( spec[i] ) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		*type = (longs) ? LOG_ARG_LONG : LOG_ARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		*type = (longs || shorts) ? LOG_ARG_BAD : LOG_ARG_DOUBLE;
+		break;
+	case 's':
+		*type = (longs || shorts) ? LOG_ARG_BAD : LOG_ARG_STRING;
+		break;
+	case 'p':
+		*type = LOG_ARG_PTR;
+		break;
+	case '%':
+		*type = LOG_ARG_NONE;
+		break;
+	default:
+		*type = LOG_ARG_BAD;
+		return( (spec[i] == 0x0) ? i : i+1 );
+	}
+	return( i+1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findLogFormat
+// Description  : Find the slot of a format (by its address), adding it the
+//                first time it is seen.  Lookups take no lock: a slot is
+//                filled in before its format pointer is published.
+//
+// Inputs       : fmt - the format
+//                added - set to 1 if the format was just added
+// Outputs      : the slot, NULL if the table is full
+
+LogFormat *findLogFormat( const char *fmt, int *added ) {
 
+	// Local variables
+	uint32_t slot = (uint32_t)(((uintptr_t)fmt >> 3) * 2654435761U) & (LOG_FORMAT_TABLE-1), i;
+	const char *seen, *c;
+	int stars, type, n;
+	LogFormat *f;
+
+	// Probe for it, taking the lock only to add it
+	*added = 0;
+	for ( i=0; i<LOG_FORMAT_TABLE; i++, slot = (slot + 1) & (LOG_FORMAT_TABLE-1) ) {
+		f = &logFormats[slot];
+		if ( (seen = __atomic_load_n(&f->format, __ATOMIC_ACQUIRE)) == fmt ) {
+			return( f );
+		}
+		if ( seen != NULL ) {
+			continue;
+		}
+		pthread_mutex_lock( &logFormatLock );
+		if ( (seen = f->format) == NULL ) {
+
+			// Work out the arguments, -1 if the entries stay text
+			f->nargs = (strlen(fmt) + sizeof(LogRecord) < MAX_LOG_MESSAGE_SIZE) ? 0 : -1;
+			for ( c = fmt; (f->nargs >= 0) && ((c = strchr(c, '%')) != NULL); c += n ) {
+				n = parseLogConversion( c, &stars, &type );
+				if ( (type == LOG_ARG_BAD) || (f->nargs + stars + 1 > LOG_MAX_ARGS) ) {
+					f->nargs = -1;
+					break;
+				}
+				for ( ; stars > 0; stars-- ) {
+					f->types[f->nargs++] = LOG_ARG_INT;
+				}
+				if ( type != LOG_ARG_NONE ) {
+					f->types[f->nargs++] = type;
+				}
+			}
+			__atomic_store_n( &f->format, fmt, __ATOMIC_RELEASE );
+			*added = 1;
+			seen = fmt;
+		}
+		pthread_mutex_unlock( &logFormatLock );
+		if ( seen == fmt ) {
+			return( f );
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : encodeLogRecord
+// Description  : Lay out a header, level or format record
+//
+// Inputs       : buf - the place to put the record
+//                type - the record type
+//                id - its id
+//                text - the text following it (NUL included), NULL for none
+// Outputs      : the length of the record
+
+int encodeLogRecord( char *buf, int type, uint32_t id, const char *text ) {
+
+	// Local variables
+	LogRecord rec;
+	int n = (text == NULL) ? 0 : strlen(text) + 1;
+
+	memset( &rec, 0x0, sizeof(rec) );
+	rec.length = sizeof(LogRecord) + n;
+	rec.type = type;
+	rec.id = id;
+	rec.levels = (type == LOG_RECORD_HEADER) ? LOG_BINARY_VERSION : 0;
+	memcpy( buf, &rec, sizeof(rec) );
+	memcpy( &buf[sizeof(rec)], text, n );
+	return( rec.length );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : encodeLogEntry
+// Description  : Record an entry without formatting it: its format (the
+//                first time it is used), then the format id and the raw
+//                arguments, or the formatted message if the format cannot
+//                be recorded
+//
+// Inputs       : buf - the place to put the records (MAX_LOG_ENTRY_SIZE bytes)
+//                lvl - the levels of the entry
+//                fmt - format (etc)
+//                args - the list of arguments for log message
+// Outputs      : the length of the records
+
+int encodeLogEntry( char *buf, unsigned long lvl, const char *fmt, va_list args ) {
+
+	// Local variables
+	int len = 0, added, n, i, ival;
+	char *entry, *str;
+	double dval;
+	long lval;
+	void *pval;
+	uint16_t slen;
+	LogRecord rec;
+	LogFormat *f = findLogFormat( fmt, &added );
+
+	// The format goes in ahead of its first entry
+	if ( added && (f->nargs >= 0) ) {
+		len = encodeLogRecord( buf, LOG_RECORD_FORMAT, f - logFormats, fmt );
+	}
+
+	// The entry head (the levels as the text header would list them)
+	entry = &buf[len];
+	memset( &rec, 0x0, sizeof(rec) );
+	rec.levels = lvl & logLevel;
+	rec.time = time( NULL );
+	n = sizeof(LogRecord);
+
+	// Entries without a usable format keep the message
+	if ( (f == NULL) || (f->nargs < 0) ) {
+		rec.type = LOG_RECORD_TEXT;
+		i = vsnprintf( &entry[n], MAX_LOG_MESSAGE_SIZE - n, fmt, args );
+		n += (i < 0) ? 0 : ((i >= MAX_LOG_MESSAGE_SIZE - n) ? MAX_LOG_MESSAGE_SIZE - n - 1 : i);
+	} else {
+
+		// Otherwise the raw arguments, strings copied (as far as they fit)
+		rec.type = LOG_RECORD_ENTRY;
+		rec.id = f - logFormats;
+		for ( i=0; i<f->nargs; i++ ) {
+			switch ( f->types[i] ) {
+			case LOG_ARG_INT:
+				ival = va_arg( args, int );
+				memcpy( &entry[n], &ival, sizeof(ival) );
+				n += sizeof(ival);
+				break;
+			case LOG_ARG_LONG:
+				lval = va_arg( args, long );
+				memcpy( &entry[n], &lval, sizeof(lval) );
+				n += sizeof(lval);
+				break;
+			case LOG_ARG_DOUBLE:
+				dval = va_arg( args, double );
+				memcpy( &entry[n], &dval, sizeof(dval) );
+				n += sizeof(dval);
+				break;
+			case LOG_ARG_PTR:
+				pval = va_arg( args, void * );
+				memcpy( &entry[n], &pval, sizeof(pval) );
+				n += sizeof(pval);
+				break;
+			default:
+				str = va_arg( args, char * );
+				str = (str == NULL) ? "(null)" : str;
+				slen = strnlen( str, MAX_LOG_MESSAGE_SIZE );
+				if ( n + sizeof(slen) + slen + (f->nargs - i - 1) * sizeof(long) > MAX_LOG_MESSAGE_SIZE ) {
+					slen = MAX_LOG_MESSAGE_SIZE - n - sizeof(slen) - (f->nargs - i - 1) * sizeof(long);
+				}
+				memcpy( &entry[n], &slen, sizeof(slen) );
+				memcpy( &entry[n+sizeof(slen)], str, slen );
+				n += sizeof(slen) + slen;
+				break;
+			}
+		}
+	}
+	rec.length = n;
+	memcpy( entry, &rec, sizeof(rec) );
+	return( len + n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : renderLogEntry
+// Description  : Format the raw arguments of an entry with its format, a
+//                conversion at a time
+//
+// Inputs       : out - the place to put the message
+//                size - its size
+//                fmt - the format
+//                args - the raw arguments
+//                end - the end of the arguments
+// Outputs      : the length of the message
+
+int renderLogEntry( char *out, int size, const char *fmt, const char *args, const char *end ) {
+
+	// Local variables
+	char spec[64];
+	int len = 0, n, stars, type, star[2], s, ival;
+	uint16_t slen;
+	double dval;
+	long lval;
+	void *pval;
+	const char *c;
+
+	// Copy the text between conversions, format each conversion alone
+	for ( c = fmt; (*c != 0x0) && (len < size - 1); c += n ) {
+		if ( *c != '%' ) {
+			n = strcspn( c, "%" );
+			n = (n > size - 1 - len) ? size - 1 - len : n;
+			memcpy( &out[len], c, n );
+			len += n;
+			continue;
+		}
+		n = parseLogConversion( c, &stars, &type );
+		if ( (n >= (int)sizeof(spec)) || (stars > 2) ) {
+			break;
+		}
+		memcpy( spec, c, n );
+		spec[n] = 0x0;
+
+		// Pull the '*' arguments, then the value
+		for ( s=0; s<stars; s++ ) {
+			if ( args + sizeof(int) > end ) {
+				return( len );
+			}
+			memcpy( &star[s], args, sizeof(int) );
+			args += sizeof(int);
+		}
+#define LOG_RENDER(val) ( (stars == 0) ? snprintf(&out[len], size - len, spec, val) : \
+		(stars == 1) ? snprintf(&out[len], size - len, spec, star[0], val) : \
+		snprintf(&out[len], size - len, spec, star[0], star[1], val) )
+		switch ( type ) {
+		case LOG_ARG_NONE:
+			out[len++] = '%';
+			continue;
+		case LOG_ARG_INT:
+			if ( args + sizeof(ival) > end ) return( len );
+			memcpy( &ival, args, sizeof(ival) );
+			args += sizeof(ival);
+			s = LOG_RENDER( ival );
+			break;
+		case LOG_ARG_LONG:
+			if ( args + sizeof(lval) > end ) return( len );
+			memcpy( &lval, args, sizeof(lval) );
+			args += sizeof(lval);
+			s = LOG_RENDER( lval );
+			break;
+		case LOG_ARG_DOUBLE:
+			if ( args + sizeof(dval) > end ) return( len );
+			memcpy( &dval, args, sizeof(dval) );
+			args += sizeof(dval);
+			s = LOG_RENDER( dval );
+			break;
+		case LOG_ARG_PTR:
+			if ( args + sizeof(pval) > end ) return( len );
+			memcpy( &pval, args, sizeof(pval) );
+			args += sizeof(pval);
+			s = LOG_RENDER( pval );
+			break;
+		case LOG_ARG_STRING:
+			if ( args + sizeof(slen) > end ) return( len );
+			memcpy( &slen, args, sizeof(slen) );
+			args += sizeof(slen);
+			if ( args + slen > end ) return( len );
+			{
+				char str[MAX_LOG_MESSAGE_SIZE+1];
+				memcpy( str, args, slen );
+				str[slen] = 0x0;
+				args += slen;
+				s = LOG_RENDER( str );
+			}
+			break;
+		default:
+			return( len );
+		}
+#undef LOG_RENDER
+		len += (s < 0) ? 0 : ((s >= size - len) ? size - len - 1 : s);
+	}
+	out[len] = 0x0;
+	return( len );
+}
@@ -12,6 +12,13 @@
 //         functions operate on bit masks of levels (lvl).  Log entries are
 //         given a level which is checked at run-time.  If the log level is
 //         enabled, then the entry it written to the log, and not otherwise.
+//         Levels left out of LOG_COMPILED_LEVELS are also removed at compile
+//         time: logMessage is a macro, and its calls on those levels (with
+//         their arguments) compile to nothing.
+//
+//         In binary mode entries are not formatted: the format is recorded
+//         once, then each entry holds its id and the raw arguments, and
+//         renderBinaryLog turns the log into text later.
 //
 //  Author   : Patrick McDaniel
 //  Created  : Sat Sep 14 10:19:45 EDT 2013
@@ -39,9 +46,28 @@
 #define MAX_LOG_LEVEL			32
 #define DEFAULT_LOG_LEVEL		LOG_ERROR_LEVEL|LOG_WARNING_LEVEL|LOG_OUTPUT_LEVEL
 #define MAX_LOG_MESSAGE_SIZE	1024
+#define MAX_LOG_ENTRY_SIZE		(MAX_LOG_MESSAGE_SIZE*2)	// Message plus timestamp and levels
+#define LOG_QUEUE_SIZE			0x40000		// Bytes queued by each thread (asynchronous mode)
+#define LOG_WRITE_BATCH			0x10000		// Most bytes the writer thread writes at once
+#define LOG_WRITER_SLEEP_MS		10			// Longest the writer thread sleeps with entries queued
+#define LOG_BINARY_MAGIC		0x474f4c43	// "CLOG", starts each session of a binary log
+#define LOG_BINARY_VERSION		1			// Version of the binary log records
+#define LOG_MAX_ARGS			16			// Most arguments of an entry recorded raw
+#define LOG_FORMAT_TABLE		4096		// Distinct formats recorded raw (a power of two)
+
+// Log levels compiled in (e.g. -DLOG_COMPILED_LEVELS=0xb leaves out INFO)
+#ifndef LOG_COMPILED_LEVELS
+#define LOG_COMPILED_LEVELS		0xffffffffUL
+#endif
+
 #define CMPSC311_LOG_STDOUT 1
 #define CMPSC311_LOG_STDERR 2
 
+//
+// Global data
+
+extern unsigned long logLevel;		// This is the current log level
+
 //
 // Interface
 
@@ -69,12 +95,33 @@ int initializeLogWithFilename( const char *logname );
 int initializeLogWithFilehandle( int out );
 	// Create a log with a fixed file handle
 
+int enableAsyncLog( void );
+	// Queue entries for a writer thread instead of writing them in the caller
+
+void disableAsyncLog( void );
+	// Write out the queued entries and go back to writing in the caller
+
+void flushLog( void );
+	// Wait until every queued entry is written
+
+int enableBinaryLog( void );
+	// Record entries unformatted (format id plus raw arguments)
+
+int renderBinaryLog( int in, int out );
+	// Write a binary log (read from in) as text (to out)
+
 //
 // Logging functions
 
-int logMessage( unsigned long lvl, const char *fmt, ...);
+int (logMessage)( unsigned long lvl, const char *fmt, ...);
 	// Log a "printf"-style message
 
+// Skip the call (and the arguments) unless the level is compiled in and on
+#define logMessage(lvl, ...) ({ int logRet_ = 0; \
+	if ( ((lvl) & LOG_COMPILED_LEVELS) && (logLevel & (lvl)) ) \
+		logRet_ = (logMessage)( (lvl), __VA_ARGS__ ); \
+	logRet_; })
+
 int vlogMessage( unsigned long lvl, const char *fmt, va_list args );
 	// Log call the vararg list version
 
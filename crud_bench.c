@@ -0,0 +1,445 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_bench.c
+//  Description    : This is the implementation of the benchmark mode of the
+//                   CRUD simulator.  Values under 2^CRUD_BENCH_SUB_BITS are
+//                   counted exactly; past that each power of two is split
+//                   into 2^(CRUD_BENCH_SUB_BITS-1) equal buckets, so every
+//                   value is known to within 1/64 (about 1.6%) without
+//                   keeping any of them.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:40:44 UTC 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_BENCH_HALF (1U << (CRUD_BENCH_SUB_BITS - 1)) // Buckets per power of two
+
+//
+// Global data
+
+int crud_bench_enabled = 0; // Are the latencies being recorded?
+
+//
+// Module static data
+
+static CrudHistogram bench_commands[CRUD_WL_MAXVAL]; // Latency of each workload command
+static CrudHistogram bench_requests[CRUD_MAXVAL];    // Latency of each CRUD request type
+static uint64_t bench_started = 0;   // Time recording started
+static uint64_t bench_elapsed = 0;   // Time from start to stop
+static const char *bench_names[CRUD_BENCH_SETTINGS];  // Settings noted for the run
+static long bench_values[CRUD_BENCH_SETTINGS];        // ... and their values
+static int bench_nsettings = 0;      // Number of settings
+static pthread_mutex_t bench_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the histograms
+
+static const char *bench_command_names[CRUD_WL_MAXVAL] = {
+	"FORMAT", "MOUNT", "UNMOUNT", "WRITE", "WRITEAT", "SEEK", "READ"
+};
+static const char *bench_request_names[CRUD_MAXVAL] = {
+	"CRUD_INIT", "CRUD_FORMAT", "CRUD_CREATE", "CRUD_READ", "CRUD_UPDATE", "CRUD_DELETE",
+	"CRUD_CLOSE", "CRUD_READ_RANGE", "CRUD_APPEND", "CRUD_UPDATE_RANGE", "CRUD_BATCH", "CRUD_UNKNOWN"
+};
+
+// The percentiles reported
+#define CRUD_BENCH_PERCENTILES 4
+static const double bench_percentiles[CRUD_BENCH_PERCENTILES] = { 50.0, 90.0, 99.0, 99.9 };
+static const char *bench_percentile_names[CRUD_BENCH_PERCENTILES] = { "p50", "p90", "p99", "p999" };
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_hist_index
+// Description  : Find the bucket of a value
+//
+// Inputs       : value - the value
+// Outputs      : the bucket index
+
+static uint32_t crud_hist_index(uint64_t value) {
+
+	// Local variables
+	uint32_t shift;
+
+	// Small values have a bucket each, larger ones share by power of two
+	if (value >= (1ULL << CRUD_BENCH_MAX_BITS)) {
+		return(CRUD_BENCH_BUCKETS - 1);
+	}
+	if (value < 2 * CRUD_BENCH_HALF) {
+		return((uint32_t)value);
+	}
+	shift = (63 - __builtin_clzll(value)) - CRUD_BENCH_SUB_BITS + 1;
+	return((shift * CRUD_BENCH_HALF) + (uint32_t)(value >> shift));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_hist_highest
+// Description  : Get the largest value that falls in a bucket
+//
+// Inputs       : index - the bucket index
+// Outputs      : the value
+
+static uint64_t crud_hist_highest(uint32_t index) {
+
+	// Local variables
+	uint32_t shift;
+
+	if (index < 2 * CRUD_BENCH_HALF) {
+		return(index);
+	}
+	shift = (index / CRUD_BENCH_HALF) - 1;
+	return((((uint64_t)(index - shift * CRUD_BENCH_HALF) + 1) << shift) - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_log
+// Description  : Log the line of results for one histogram
+//
+// Inputs       : name - the name of the command or request
+//                hist - its histogram
+// Outputs      : none
+
+static void crud_bench_log(const char *name, CrudHistogram *hist) {
+
+	// Local variables
+	double pct[CRUD_BENCH_PERCENTILES];
+	int i;
+
+	for (i=0; i<CRUD_BENCH_PERCENTILES; i++) {
+		pct[i] = crud_hist_percentile(hist, bench_percentiles[i]) / 1000.0;
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD bench : %-17s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f",
+			name, hist->count, (double)hist->sum / hist->count / 1000.0, hist->min / 1000.0,
+			pct[0], pct[1], pct[2], pct[3], hist->max / 1000.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_json
+// Description  : Write the JSON object for one histogram
+//
+// Inputs       : out - the file to write to
+//                name - the name of the command or request
+//                hist - its histogram
+//                first - is this the first object of the list?
+// Outputs      : none
+
+static void crud_bench_json(FILE *out, const char *name, CrudHistogram *hist, int first) {
+
+	// Local variables
+	int i;
+
+	fprintf(out, "%s\n    {\"name\": \"%s\", \"count\": %lu, \"bytes\": %lu, \"mean_ns\": %.1f, \"min_ns\": %lu",
+			(first) ? "" : ",", name, hist->count, hist->bytes, (double)hist->sum / hist->count, hist->min);
+	for (i=0; i<CRUD_BENCH_PERCENTILES; i++) {
+		fprintf(out, ", \"%s_ns\": %lu", bench_percentile_names[i], crud_hist_percentile(hist, bench_percentiles[i]));
+	}
+	fprintf(out, ", \"max_ns\": %lu}", hist->max);
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_hist_reset
+// Description  : Empty a histogram
+//
+// Inputs       : hist - the histogram
+// Outputs      : none
+
+void crud_hist_reset(CrudHistogram *hist) {
+	memset(hist, 0x0, sizeof(CrudHistogram));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_hist_record
+// Description  : Record a value in a histogram (the caller serializes)
+//
+// Inputs       : hist - the histogram
+//                value - the value
+//                bytes - the bytes moved by the operation
+// Outputs      : none
+
+void crud_hist_record(CrudHistogram *hist, uint64_t value, uint32_t bytes) {
+	if ((hist->count == 0) || (value < hist->min)) {
+		hist->min = value;
+	}
+	if (value > hist->max) {
+		hist->max = value;
+	}
+	hist->count ++;
+	hist->sum += value;
+	hist->bytes += bytes;
+	hist->counts[crud_hist_index(value)] ++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_hist_percentile
+// Description  : Find the value at a percentile, to the precision of its
+//                bucket (never past the largest value recorded)
+//
+// Inputs       : hist - the histogram
+//                percentile - the percentile (0 to 100)
+// Outputs      : the value, 0 if the histogram is empty
+
+uint64_t crud_hist_percentile(CrudHistogram *hist, double percentile) {
+
+	// Local variables
+	uint64_t target, seen = 0, value;
+	uint32_t i;
+
+	// Walk the buckets until enough values are under us
+	if (hist->count == 0) {
+		return(0);
+	}
+	target = (uint64_t)((percentile / 100.0) * hist->count + 0.5);
+	if (target < 1) {
+		target = 1;
+	}
+	for (i=0; i<CRUD_BENCH_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+	value = crud_hist_highest(i);
+	return((value > hist->max) ? hist->max : value);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_now
+// Description  : Get the time for measuring latencies
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds (monotonic)
+
+uint64_t crud_bench_now(void) {
+
+	// Local variables
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_start
+// Description  : Empty the histograms and start recording
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_bench_start(void) {
+
+	// Local variables
+	int i;
+
+	pthread_mutex_lock(&bench_lock);
+	for (i=0; i<CRUD_WL_MAXVAL; i++) {
+		crud_hist_reset(&bench_commands[i]);
+	}
+	for (i=0; i<CRUD_MAXVAL; i++) {
+		crud_hist_reset(&bench_requests[i]);
+	}
+	bench_elapsed = 0;
+	bench_started = crud_bench_now();
+	crud_bench_enabled = 1;
+	pthread_mutex_unlock(&bench_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_stop
+// Description  : Stop recording
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_bench_stop(void) {
+	pthread_mutex_lock(&bench_lock);
+	crud_bench_enabled = 0;
+	bench_elapsed = crud_bench_now() - bench_started;
+	pthread_mutex_unlock(&bench_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_setting
+// Description  : Note a setting of the run (cache size, server version ...)
+//                so results of different runs can be told apart
+//
+// Inputs       : name - the name of the setting (kept, not copied)
+//                value - its value
+// Outputs      : none
+
+void crud_bench_setting(const char *name, long value) {
+
+	// Local variables
+	int i;
+
+	// Replace the setting if we have it, add it otherwise
+	for (i=0; (i<bench_nsettings) && strcmp(bench_names[i], name); i++);
+	if (i == CRUD_BENCH_SETTINGS) {
+		logMessage(LOG_WARNING_LEVEL, "CRUD bench : too many settings, [%s] dropped.", name);
+		return;
+	}
+	bench_names[i] = name;
+	bench_values[i] = value;
+	if (i == bench_nsettings) {
+		bench_nsettings ++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_command
+// Description  : Record the latency of a workload command
+//
+// Inputs       : cmd - the command
+//                start - the time the command started
+//                bytes - the bytes read or written
+// Outputs      : none
+
+void crud_bench_command(CRUD_WORKLOAD_OPS cmd, uint64_t start, uint32_t bytes) {
+
+	// Local variables
+	uint64_t now = crud_bench_now();
+
+	pthread_mutex_lock(&bench_lock);
+	if (crud_bench_enabled && (cmd < CRUD_WL_MAXVAL)) {
+		crud_hist_record(&bench_commands[cmd], now - start, bytes);
+	}
+	pthread_mutex_unlock(&bench_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_request
+// Description  : Record the latency of a CRUD request, from the time it was
+//                sent to the time its response was received
+//
+// Inputs       : req - the request type
+//                start - the time the request was sent
+// Outputs      : none
+
+void crud_bench_request(CRUD_REQUEST_TYPES req, uint64_t start) {
+
+	// Local variables
+	uint64_t now = crud_bench_now();
+
+	pthread_mutex_lock(&bench_lock);
+	if (crud_bench_enabled && (req < CRUD_MAXVAL)) {
+		crud_hist_record(&bench_requests[req], now - start, 0);
+	}
+	pthread_mutex_unlock(&bench_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bench_report
+// Description  : Log the throughput and latency percentiles of the run (in
+//                microseconds), by command then by request type, and write
+//                the same as JSON (in nanoseconds) if asked
+//
+// Inputs       : workload - the name of the workload run
+//                path - the file for the JSON results, "-" for stdout,
+//                       NULL for none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_bench_report(const char *workload, const char *path) {
+
+	// Local variables
+	uint64_t commands = 0, bytes = 0, requests = 0;
+	double seconds = bench_elapsed / 1e9;
+	FILE *out;
+	int i, first;
+
+	// Total up the run
+	for (i=0; i<CRUD_WL_MAXVAL; i++) {
+		commands += bench_commands[i].count;
+		bytes += bench_commands[i].bytes;
+	}
+	for (i=0; i<CRUD_MAXVAL; i++) {
+		requests += bench_requests[i].count;
+	}
+	if (seconds <= 0.0) {
+		seconds = 1e-9;
+	}
+
+	// Log the summary, then a line per command and request type
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD bench : [%s] %lu commands, %lu requests in %.3f s, "
+			"%.0f commands/s, %.0f requests/s, %.2f MB/s",
+			workload, commands, requests, seconds, commands / seconds, requests / seconds,
+			bytes / seconds / 1e6);
+	for (i=0; i<bench_nsettings; i++) {
+		logMessage(LOG_OUTPUT_LEVEL, "CRUD bench : setting %s = %ld", bench_names[i], bench_values[i]);
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD bench : %-17s %8s %10s %10s %10s %10s %10s %10s %10s",
+			"(usec)", "count", "mean", "min", "p50", "p90", "p99", "p99.9", "max");
+	for (i=0; i<CRUD_WL_MAXVAL; i++) {
+		if (bench_commands[i].count > 0) {
+			crud_bench_log(bench_command_names[i], &bench_commands[i]);
+		}
+	}
+	for (i=0; i<CRUD_MAXVAL; i++) {
+		if (bench_requests[i].count > 0) {
+			crud_bench_log(bench_request_names[i], &bench_requests[i]);
+		}
+	}
+
+	// Now the JSON, if asked for
+	if (path == NULL) {
+		return(0);
+	}
+	if ((out = (strcmp(path, "-") == 0) ? stdout : fopen(path, "w")) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD bench : failed to open results file [%s].", path);
+		return(-1);
+	}
+	fprintf(out, "{\n  \"workload\": \"%s\",\n  \"elapsed_ns\": %lu,\n  \"commands\": %lu,\n"
+			"  \"requests\": %lu,\n  \"bytes\": %lu,\n  \"commands_per_sec\": %.1f,\n"
+			"  \"requests_per_sec\": %.1f,\n  \"bytes_per_sec\": %.1f,\n  \"settings\": {",
+			workload, bench_elapsed, commands, requests, bytes,
+			commands / seconds, requests / seconds, bytes / seconds);
+	for (i=0; i<bench_nsettings; i++) {
+		fprintf(out, "%s\"%s\": %ld", (i) ? ", " : "", bench_names[i], bench_values[i]);
+	}
+	fprintf(out, "},\n  \"by_command\": [");
+	for (i=0, first=1; i<CRUD_WL_MAXVAL; i++) {
+		if (bench_commands[i].count > 0) {
+			crud_bench_json(out, bench_command_names[i], &bench_commands[i], first);
+			first = 0;
+		}
+	}
+	fprintf(out, "\n  ],\n  \"by_request\": [");
+	for (i=0, first=1; i<CRUD_MAXVAL; i++) {
+		if (bench_requests[i].count > 0) {
+			crud_bench_json(out, bench_request_names[i], &bench_requests[i], first);
+			first = 0;
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+	if (out == stdout) {
+		fflush(out);
+	} else if (fclose(out)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD bench : failed writing results file [%s].", path);
+		return(-1);
+	}
+	return(0);
+}
@@ -0,0 +1,80 @@
+#ifndef CRUD_BENCH_INCLUDED
+#define CRUD_BENCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_bench.h
+//  Description    : This is the header file for the benchmark mode of the
+//                   CRUD simulator.  The latency of each workload command
+//                   and of each CRUD request is kept in a log-linear (HDR
+//                   style) histogram, reported as percentiles at the end of
+//                   the run as text and, if asked, as JSON.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:40:44 UTC 2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Project includes
+#include <crud_driver.h>
+#include <crud_workload.h>
+
+// Defines
+#define CRUD_BENCH_SUB_BITS  7    // 64 buckets per power of two (within 1/64, about 1.6%)
+#define CRUD_BENCH_MAX_BITS  40   // Values up to 2^40 ns (about 18 minutes), larger ones are clamped
+#define CRUD_BENCH_BUCKETS   ((CRUD_BENCH_MAX_BITS - CRUD_BENCH_SUB_BITS + 2) << (CRUD_BENCH_SUB_BITS - 1))
+#define CRUD_BENCH_SETTINGS  16   // Settings noted with the results
+
+// Type definitions
+
+// This is a latency histogram, values in nanoseconds
+typedef struct {
+	uint64_t  count;   // Number of values recorded
+	uint64_t  sum;     // Sum of the values
+	uint64_t  min;     // Smallest value
+	uint64_t  max;     // Largest value
+	uint64_t  bytes;   // Bytes moved by the operations recorded
+	uint64_t  counts[CRUD_BENCH_BUCKETS]; // Values in each bucket
+} CrudHistogram;
+
+//
+// Histogram interface
+
+void crud_hist_reset(CrudHistogram *hist);
+	// Empty a histogram
+
+void crud_hist_record(CrudHistogram *hist, uint64_t value, uint32_t bytes);
+	// Record a value (and the bytes moved by the operation)
+
+uint64_t crud_hist_percentile(CrudHistogram *hist, double percentile);
+	// The value at or under which "percentile" percent of the values fall
+
+//
+// Benchmark interface
+
+extern int crud_bench_enabled; // Are the latencies being recorded?
+
+uint64_t crud_bench_now(void);
+	// The time in nanoseconds (monotonic)
+
+void crud_bench_start(void);
+	// Empty the histograms and start recording
+
+void crud_bench_stop(void);
+	// Stop recording, fixing the elapsed time
+
+void crud_bench_setting(const char *name, long value);
+	// Note a setting of the run, reported with the results
+
+void crud_bench_command(CRUD_WORKLOAD_OPS cmd, uint64_t start, uint32_t bytes);
+	// Record a workload command started at "start" (thread safe)
+
+void crud_bench_request(CRUD_REQUEST_TYPES req, uint64_t start);
+	// Record a CRUD request sent at "start" (thread safe)
+
+int crud_bench_report(const char *workload, const char *path);
+	// Log the results, and write them as JSON to "path" ("-" for stdout, NULL for none)
+
+#endif
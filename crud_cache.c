@@ -0,0 +1,764 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_cache.c
+//  Description    : This is the implementation of the client side object
+//                   cache for the CRUD storage system.  Lines are found
+//                   through a chained hash table on the object ID and kept
+//                   on a doubly linked list in least recently used order.
+//                   A single mutex guards the cache, so it may be used from
+//                   several threads at once.  The contents of each line are
+//                   a reference counted buffer, so views handed out stay
+//                   valid (and unchanged) after the line moves on.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 01:15:17 UTC 2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_cache.h>
+#include <crud_pool.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_CACHE_HASH_MULTIPLIER 2654435761U
+
+// Type definitions
+
+// This is a buffer of object contents, shared by a line and its views
+typedef struct {
+	uint32_t  refs;                    // References held (the line and views)
+	uint32_t  capacity;                // The allocated size of the data
+	char      data[];                  // The contents of the object
+} CrudCacheBuffer;
+
+// This is a single line of the cache (one object)
+typedef struct crud_cache_line {
+	CrudOID   oid;                     // The object held in this line
+	uint32_t  length;                  // The length of the object
+	CrudCacheBuffer *buffer;           // The contents of the object, NULL if none
+	struct crud_cache_line *prev;      // Next more recently used line
+	struct crud_cache_line *next;      // Next less recently used line
+	struct crud_cache_line *hnext;     // Next line in the hash chain
+} CrudCacheLine;
+
+//
+// Module static data
+
+static uint32_t       cache_lines = CRUD_DEFAULT_CACHE_LINES; // Configured lines
+static uint32_t       cache_allocated = 0;   // Lines in the current cache
+static uint32_t       cache_buckets = 0;     // Number of hash buckets (power of 2)
+static CrudCacheLine *cache_table = NULL;    // The array of cache lines
+static CrudCacheLine **cache_hash = NULL;    // The hash buckets
+static CrudCacheLine *cache_free = NULL;     // List of unused lines
+static CrudCacheLine *cache_mru = NULL;      // Most recently used line
+static CrudCacheLine *cache_lru = NULL;      // Least recently used line
+static uint64_t       cache_hits = 0;        // Number of cache hits
+static uint64_t       cache_misses = 0;      // Number of cache misses
+static uint64_t       cache_evictions = 0;   // Number of lines evicted
+static uint64_t       cache_inserts = 0;     // Number of objects inserted
+static uint64_t       cache_views = 0;       // Number of views handed out
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; // Guards all of the above
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_buffer
+// Description  : Get the buffer holding the data of a cache buffer
+//
+// Inputs       : data - the data of the buffer
+// Outputs      : the buffer
+
+static CrudCacheBuffer *crud_cache_buffer(void *data) {
+	return( (CrudCacheBuffer *)((char *)data - offsetof(CrudCacheBuffer, data)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_alloc
+// Description  : Get a buffer (with no references) from the buffer pool
+//
+// Inputs       : length - the bytes it must hold
+// Outputs      : the buffer, NULL if failure
+
+static CrudCacheBuffer *crud_cache_alloc(uint32_t length) {
+
+	// Local variables
+	CrudCacheBuffer *buffer;
+
+	if ((buffer = crud_pool_alloc(sizeof(CrudCacheBuffer) + length)) == NULL) {
+		return(NULL);
+	}
+	buffer->refs = 0;
+	buffer->capacity = crud_pool_capacity(buffer) - sizeof(CrudCacheBuffer);
+	return(buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_unref
+// Description  : Give up a reference to a buffer, freeing it with the last
+//
+// Inputs       : buffer - the buffer (may be NULL)
+// Outputs      : none
+
+static void crud_cache_unref(CrudCacheBuffer *buffer) {
+	if ((buffer != NULL) && (--buffer->refs == 0)) {
+		crud_pool_free(buffer);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_reserve
+// Description  : Make sure a line has a buffer of its own, large enough for
+//                an object of the given length.  The current contents are
+//                kept (a buffer shared with views is copied, not changed).
+//
+// Inputs       : line - the line
+//                length - the bytes the buffer must hold
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_cache_reserve(CrudCacheLine *line, uint32_t length) {
+
+	// Local variables
+	CrudCacheBuffer *buffer = line->buffer;
+
+	// A private buffer large enough is kept
+	if ((buffer != NULL) && (buffer->refs == 1) && (buffer->capacity >= length)) {
+		return(0);
+	}
+
+	// Otherwise the line moves to a new buffer, leaving a shared one to the views
+	if (length < line->length) {
+		length = line->length;
+	}
+	if ((buffer = crud_cache_alloc(length)) == NULL) {
+		return(-1);
+	}
+	buffer->refs = 1;
+	if (line->buffer != NULL) {
+		memcpy(buffer->data, line->buffer->data, line->length);
+		crud_cache_unref(line->buffer);
+	}
+	line->buffer = buffer;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_bucket
+// Description  : Compute the hash bucket for an object ID
+//
+// Inputs       : oid - the object ID
+// Outputs      : the index of the bucket
+
+static uint32_t crud_cache_bucket(CrudOID oid) {
+	return( (uint32_t)(oid * CRUD_CACHE_HASH_MULTIPLIER) & (cache_buckets-1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_find
+// Description  : Find the line holding an object
+//
+// Inputs       : oid - the object ID
+// Outputs      : the line, or NULL if not in the cache
+
+static CrudCacheLine *crud_cache_find(CrudOID oid) {
+
+	// Walk the hash chain looking for the object
+	CrudCacheLine *line = cache_hash[crud_cache_bucket(oid)];
+	while ((line != NULL) && (line->oid != oid)) {
+		line = line->hnext;
+	}
+	return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_unlink
+// Description  : Remove a line from the hash chain and the LRU list
+//
+// Inputs       : line - the line to remove
+// Outputs      : none
+
+static void crud_cache_unlink(CrudCacheLine *line) {
+
+	// Remove from the hash chain
+	CrudCacheLine **walk = &cache_hash[crud_cache_bucket(line->oid)];
+	while (*walk != line) {
+		walk = &(*walk)->hnext;
+	}
+	*walk = line->hnext;
+	line->hnext = NULL;
+
+	// Remove from the LRU list
+	if (line->prev != NULL) {
+		line->prev->next = line->next;
+	} else {
+		cache_mru = line->next;
+	}
+	if (line->next != NULL) {
+		line->next->prev = line->prev;
+	} else {
+		cache_lru = line->prev;
+	}
+	line->prev = line->next = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_touch
+// Description  : Move a line to the most recently used end of the list
+//
+// Inputs       : line - the line just used
+// Outputs      : none
+
+static void crud_cache_touch(CrudCacheLine *line) {
+
+	// Already the most recently used, nothing to do
+	if (line == cache_mru) {
+		return;
+	}
+
+	// Pull out of the list
+	line->prev->next = line->next;
+	if (line->next != NULL) {
+		line->next->prev = line->prev;
+	} else {
+		cache_lru = line->prev;
+	}
+
+	// Push on the front
+	line->prev = NULL;
+	line->next = cache_mru;
+	cache_mru->prev = line;
+	cache_mru = line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_drop
+// Description  : Remove a line from the cache, returning it to the free list
+//                (keeping its buffer for reuse unless views share it)
+//
+// Inputs       : line - the line to remove
+// Outputs      : none
+
+static void crud_cache_drop(CrudCacheLine *line) {
+	crud_cache_unlink(line);
+	if ((line->buffer != NULL) && (line->buffer->refs > 1)) {
+		crud_cache_unref(line->buffer);
+		line->buffer = NULL;
+	}
+	line->oid = CRUD_NO_OBJECT;
+	line->length = 0;
+	line->next = cache_free;
+	cache_free = line;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_claim
+// Description  : Get the line of an object, making it the most recently
+//                used.  An object not in the cache takes a free line, or
+//                the least recently used one (cache lock held).
+//
+// Inputs       : oid - the object ID
+// Outputs      : the line (of length 0 if new)
+
+static CrudCacheLine *crud_cache_claim(CrudOID oid) {
+
+	// Local variables
+	CrudCacheLine *line;
+
+	// Find the existing line or get a new one
+	if ((line = crud_cache_find(oid)) != NULL) {
+		crud_cache_touch(line);
+	} else {
+
+		// Pick up a free line, or evict the least recently used
+		if (cache_free != NULL) {
+			line = cache_free;
+			cache_free = line->next;
+		} else {
+			line = cache_lru;
+			crud_cache_unlink(line);
+			cache_evictions ++;
+		}
+
+		// Setup the line, link into hash and LRU list
+		line->oid = oid;
+		line->length = 0;
+		line->hnext = cache_hash[crud_cache_bucket(oid)];
+		cache_hash[crud_cache_bucket(oid)] = line;
+		line->prev = NULL;
+		line->next = cache_mru;
+		if (cache_mru != NULL) {
+			cache_mru->prev = line;
+		} else {
+			cache_lru = line;
+		}
+		cache_mru = line;
+		cache_inserts ++;
+	}
+	return(line);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_release
+// Description  : Free all of the lines and the cache structures
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_cache_release(void) {
+
+	// Local variables
+	uint32_t i;
+
+	// Free the lines and the structures
+	for (i=0; i<cache_allocated; i++) {
+		crud_cache_unref(cache_table[i].buffer);
+	}
+	free(cache_table);
+	free(cache_hash);
+	cache_table = NULL;
+	cache_hash = NULL;
+	cache_free = cache_mru = cache_lru = NULL;
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_crud_cache_size
+// Description  : Set the number of lines the cache holds, takes effect on the
+//                next call to init_crud_cache.
+//
+// Inputs       : lines - the number of cache lines, 0 disables the cache
+// Outputs      : 0 if successful, -1 if failure
+
+int set_crud_cache_size(uint32_t lines) {
+	pthread_mutex_lock(&cache_lock);
+	cache_lines = lines;
+	pthread_mutex_unlock(&cache_lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_crud_cache_size
+// Description  : Get the number of lines in the cache in use
+//
+// Inputs       : none
+// Outputs      : the number of cache lines, 0 if the cache is disabled
+
+uint32_t get_crud_cache_size(void) {
+
+	// Local variables
+	uint32_t lines;
+
+	pthread_mutex_lock(&cache_lock);
+	lines = (cache_table == NULL) ? 0 : cache_allocated;
+	pthread_mutex_unlock(&cache_lock);
+	return(lines);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_crud_cache
+// Description  : Initialize the cache with the configured number of lines
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int init_crud_cache(void) {
+
+	// Local variables
+	uint32_t i;
+
+	// Release anything left over from a previous mount
+	pthread_mutex_lock(&cache_lock);
+	if (cache_table != NULL) {
+		crud_cache_release();
+	}
+	cache_hits = cache_misses = cache_evictions = cache_inserts = cache_views = 0;
+	if (cache_lines == 0) {
+		pthread_mutex_unlock(&cache_lock);
+		return(0);
+	}
+
+	// Size the hash table to the next power of two, allocate structures
+	for (cache_buckets=1; cache_buckets<cache_lines; cache_buckets<<=1);
+	cache_table = calloc(cache_lines, sizeof(CrudCacheLine));
+	cache_hash = calloc(cache_buckets, sizeof(CrudCacheLine *));
+	if ((cache_table == NULL) || (cache_hash == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD cache : failed to allocate %u lines.", cache_lines);
+		free(cache_table);
+		free(cache_hash);
+		cache_table = NULL;
+		cache_hash = NULL;
+		pthread_mutex_unlock(&cache_lock);
+		return(-1);
+	}
+
+	// Put all of the lines on the free list
+	cache_allocated = cache_lines;
+	cache_free = NULL;
+	for (i=0; i<cache_lines; i++) {
+		cache_table[i].next = cache_free;
+		cache_free = &cache_table[i];
+	}
+	cache_mru = cache_lru = NULL;
+	pthread_mutex_unlock(&cache_lock);
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD cache : initialized with %u lines.", cache_lines);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_crud_cache
+// Description  : Log the cache statistics and release all of the cache lines
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int close_crud_cache(void) {
+
+	// Nothing to do if never initialized
+	pthread_mutex_lock(&cache_lock);
+	if (cache_table == NULL) {
+		pthread_mutex_unlock(&cache_lock);
+		return(0);
+	}
+
+	// Report the statistics
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD cache : %lu hits, %lu misses, %lu evictions, %lu inserts, %lu views (%u lines)",
+			cache_hits, cache_misses, cache_evictions, cache_inserts, cache_views, cache_allocated);
+
+	// Free the lines and the structures
+	crud_cache_release();
+	pthread_mutex_unlock(&cache_lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_crud_cache
+// Description  : Place (or replace) the contents of an object in the cache,
+//                evicting the least recently used line if the cache is full.
+//
+// Inputs       : oid - the object ID
+//                buf - the contents of the object
+//                length - the length of the object
+// Outputs      : 0 if successful, -1 if failure
+
+int put_crud_cache(CrudOID oid, void *buf, uint32_t length) {
+
+	// Local variables
+	CrudCacheLine *line;
+
+	// Check for a disabled cache or a bad object
+	pthread_mutex_lock(&cache_lock);
+	if ((cache_table == NULL) || (oid == CRUD_NO_OBJECT)) {
+		pthread_mutex_unlock(&cache_lock);
+		return(0);
+	}
+
+	// Make sure the line's buffer is large enough, then copy the object
+	line = crud_cache_claim(oid);
+	line->length = 0;
+	if (crud_cache_reserve(line, length) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD cache : failed to allocate %u byte line.", length);
+		crud_cache_drop(line);
+		pthread_mutex_unlock(&cache_lock);
+		return(-1);
+	}
+	memcpy(line->buffer->data, buf, length);
+	line->length = length;
+	pthread_mutex_unlock(&cache_lock);
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : has_crud_cache
+// Description  : Check whether an object is in the cache, without counting
+//                a hit or miss or changing its place in the LRU order
+//
+// Inputs       : oid - the object ID
+//                length - the expected length of the object
+// Outputs      : 1 if the object is cached with that length, 0 otherwise
+
+int has_crud_cache(CrudOID oid, uint32_t length) {
+
+	// Local variables
+	CrudCacheLine *line;
+	int found;
+
+	pthread_mutex_lock(&cache_lock);
+	found = (cache_table != NULL) && ((line = crud_cache_find(oid)) != NULL) && (line->length == length);
+	pthread_mutex_unlock(&cache_lock);
+	return(found);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_crud_cache
+// Description  : Copy a range of an object out of the cache, if the cached
+//                copy is the expected length.
+//
+// Inputs       : oid - the object ID
+//                offset - the offset into the object of the range
+//                buf - the place to copy the range to
+//                count - the length of the range
+//                length - the expected length of the object
+// Outputs      : 0 if copied, -1 if not in the cache
+
+int read_crud_cache(CrudOID oid, uint32_t offset, void *buf, uint32_t count, uint32_t length) {
+
+	// Local variables
+	CrudCacheLine *line;
+
+	// Look for the line, count the hit/miss
+	pthread_mutex_lock(&cache_lock);
+	if ((cache_table == NULL) || ((line = crud_cache_find(oid)) == NULL) ||
+			(line->length != length) || (offset+count > length)) {
+		if (cache_table != NULL) {
+			cache_misses ++;
+		}
+		pthread_mutex_unlock(&cache_lock);
+		return(-1);
+	}
+	cache_hits ++;
+	crud_cache_touch(line);
+	memcpy(buf, &line->buffer->data[offset], count);
+	pthread_mutex_unlock(&cache_lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : update_crud_cache
+// Description  : Patch a range of an object if it is in the cache, growing
+//                the cached copy when the range runs past its end.  Objects
+//                not in the cache are left alone (not counted as a miss).
+//
+// Inputs       : oid - the object ID
+//                offset - the offset into the object of the range
+//                buf - the new contents of the range
+//                length - the length of the range
+// Outputs      : 0 if successful, -1 if failure
+
+int update_crud_cache(CrudOID oid, uint32_t offset, void *buf, uint32_t length) {
+
+	// Local variables
+	CrudCacheLine *line;
+
+	// Find the line, a range starting past the end is a hole we can't hold
+	pthread_mutex_lock(&cache_lock);
+	if ((cache_table == NULL) || ((line = crud_cache_find(oid)) == NULL)) {
+		pthread_mutex_unlock(&cache_lock);
+		return(0);
+	}
+	if (offset > line->length) {
+		crud_cache_drop(line);
+		pthread_mutex_unlock(&cache_lock);
+		return(0);
+	}
+
+	// Grow the line (or copy it away from views) if needed, then patch the range in
+	if (crud_cache_reserve(line, offset+length) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD cache : failed to grow %u byte line.", offset+length);
+		crud_cache_drop(line);
+		pthread_mutex_unlock(&cache_lock);
+		return(-1);
+	}
+	memcpy(&line->buffer->data[offset], buf, length);
+	if (offset+length > line->length) {
+		line->length = offset+length;
+	}
+	crud_cache_touch(line);
+	pthread_mutex_unlock(&cache_lock);
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : delete_crud_cache
+// Description  : Remove an object from the cache
+//
+// Inputs       : oid - the object ID
+// Outputs      : 0 if successful, -1 if failure
+
+int delete_crud_cache(CrudOID oid) {
+
+	// Local variables
+	CrudCacheLine *line;
+
+	// Find the line, return it to the free list
+	pthread_mutex_lock(&cache_lock);
+	if ((cache_table != NULL) && ((line = crud_cache_find(oid)) != NULL)) {
+		crud_cache_drop(line);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : view_crud_cache
+// Description  : Borrow the cached contents of an object without copying
+//                them, if the cached copy is the expected length.  The view
+//                holds a reference, so later puts, updates and evictions
+//                leave it alone; it must be given back with
+//                release_crud_cache.
+//
+// Inputs       : oid - the object ID
+//                length - the expected length of the object
+//                view - the place to put the view
+// Outputs      : 0 if successful, -1 if not in the cache
+
+int view_crud_cache(CrudOID oid, uint32_t length, CrudCacheView *view) {
+
+	// Local variables
+	CrudCacheLine *line;
+
+	// Look for the line, count the hit/miss
+	pthread_mutex_lock(&cache_lock);
+	if ((cache_table == NULL) || ((line = crud_cache_find(oid)) == NULL) ||
+			(line->length != length)) {
+		if (cache_table != NULL) {
+			cache_misses ++;
+		}
+		pthread_mutex_unlock(&cache_lock);
+		return(-1);
+	}
+	cache_hits ++;
+	cache_views ++;
+	crud_cache_touch(line);
+	line->buffer->refs ++;
+	view->data = line->buffer->data;
+	view->length = length;
+	view->buffer = line->buffer;
+	pthread_mutex_unlock(&cache_lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : new_crud_cache_buffer
+// Description  : Allocate a buffer that can be handed to the cache with
+//                adopt_crud_cache, saving the copy of put_crud_cache
+//
+// Inputs       : length - the size of the buffer
+// Outputs      : the buffer, NULL if failure
+
+void *new_crud_cache_buffer(uint32_t length) {
+
+	// Local variables
+	CrudCacheBuffer *buffer;
+
+	if ((buffer = crud_cache_alloc(length)) == NULL) {
+		return(NULL);
+	}
+	return(buffer->data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_crud_cache_buffer
+// Description  : Free a buffer from new_crud_cache_buffer never adopted
+//
+// Inputs       : buf - the buffer (may be NULL)
+// Outputs      : none
+
+void free_crud_cache_buffer(void *buf) {
+	if (buf != NULL) {
+		crud_pool_free(crud_cache_buffer(buf));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : adopt_crud_cache
+// Description  : Place the contents of an object in the cache by taking over
+//                a buffer from new_crud_cache_buffer (no copy), optionally
+//                returning a view of it.  With the cache disabled or no
+//                object the view is the only reference, and the buffer is
+//                freed on its release (or at once if there is no view).
+//
+// Inputs       : oid - the object ID (CRUD_NO_OBJECT to only view)
+//                buf - the buffer, which belongs to the cache after the call
+//                length - the length of the object
+//                view - the place to put a view, NULL if none
+// Outputs      : 0 if successful, -1 if failure
+
+int adopt_crud_cache(CrudOID oid, void *buf, uint32_t length, CrudCacheView *view) {
+
+	// Local variables
+	CrudCacheBuffer *buffer = crud_cache_buffer(buf);
+	CrudCacheLine *line;
+
+	// Hand out the view first
+	pthread_mutex_lock(&cache_lock);
+	if (view != NULL) {
+		buffer->refs ++;
+		view->data = buffer->data;
+		view->length = length;
+		view->buffer = buffer;
+	}
+
+	// Then replace the contents of the line with the buffer
+	if ((cache_table != NULL) && (oid != CRUD_NO_OBJECT)) {
+		line = crud_cache_claim(oid);
+		crud_cache_unref(line->buffer);
+		buffer->refs ++;
+		line->buffer = buffer;
+		line->length = length;
+	}
+	if (buffer->refs == 0) {
+		crud_pool_free(buffer);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_crud_cache
+// Description  : Give back a view, freeing its buffer if nothing else holds
+//                it.  Releasing an empty view does nothing.
+//
+// Inputs       : view - the view
+// Outputs      : none
+
+void release_crud_cache(CrudCacheView *view) {
+
+	// Drop the reference, leave the view empty
+	if (view->buffer != NULL) {
+		pthread_mutex_lock(&cache_lock);
+		crud_cache_unref(view->buffer);
+		pthread_mutex_unlock(&cache_lock);
+	}
+	view->data = NULL;
+	view->length = 0;
+	view->buffer = NULL;
+}
@@ -0,0 +1,79 @@
+#ifndef CRUD_CACHE_INCLUDED
+#define CRUD_CACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_cache.h
+//  Description    : This is the header file for the client side object cache
+//                   for the CRUD storage system.  The cache holds whole
+//                   objects keyed by their object ID and is managed with a
+//                   least recently used (LRU) replacement policy.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 01:15:17 UTC 2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_DEFAULT_CACHE_LINES 1024
+
+// Type definitions
+
+// A borrowed (read only) view of cached bytes, valid until released
+typedef struct {
+	char     *data;    // The bytes
+	uint32_t  length;  // The number of bytes
+	void     *buffer;  // The buffer referenced, NULL if none
+} CrudCacheView;
+
+//
+// Cache interface
+
+int set_crud_cache_size(uint32_t lines);
+	// Set the number of lines (objects) the cache holds, 0 disables it
+
+uint32_t get_crud_cache_size(void);
+	// Get the number of lines in the cache in use, 0 if disabled
+
+int init_crud_cache(void);
+	// Initialize the cache with the configured number of lines
+
+int close_crud_cache(void);
+	// Log the cache statistics and release all of the cache lines
+
+int put_crud_cache(CrudOID oid, void *buf, uint32_t length);
+	// Place (or replace) the contents of an object in the cache
+
+int has_crud_cache(CrudOID oid, uint32_t length);
+	// Is the object in the cache with the given length (not counted as a hit or miss)?
+
+int read_crud_cache(CrudOID oid, uint32_t offset, void *buf, uint32_t count, uint32_t length);
+	// Copy a range of an object of the given length out of the cache, -1 if not present
+
+int view_crud_cache(CrudOID oid, uint32_t length, CrudCacheView *view);
+	// Borrow the contents of an object of the given length without copying, -1 if not present
+
+void *new_crud_cache_buffer(uint32_t length);
+	// Allocate a buffer the cache can adopt in place of a copy
+
+void free_crud_cache_buffer(void *buf);
+	// Free a buffer from new_crud_cache_buffer that was never adopted
+
+int adopt_crud_cache(CrudOID oid, void *buf, uint32_t length, CrudCacheView *view);
+	// Place an object in the cache by taking over its buffer, optionally viewing it
+
+void release_crud_cache(CrudCacheView *view);
+	// Give back a view of the cache
+
+int update_crud_cache(CrudOID oid, uint32_t offset, void *buf, uint32_t length);
+	// Patch (or extend) a range of an object if it is in the cache
+
+int delete_crud_cache(CrudOID oid);
+	// Remove an object from the cache
+
+#endif
@@ -11,20 +11,79 @@
 
 // Project Include Files
 #include <crud_network.h>
+#include <crud_bench.h>
+#include <crud_trace.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Defines
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // Vectors per writev (POSIX minimum is 16, Linux allows 1024)
+#endif
+#define CRUD_MAX_SERVERS 16 // Server addresses accepted in crud_network_address
+
+// Type definitions
+
+// States of a slot in the in-flight request queue
+typedef enum {
+	CRUD_SLOT_FREE     = 0, // Slot unused
+	CRUD_SLOT_INFLIGHT = 1, // Request sent, waiting on the response
+	CRUD_SLOT_DONE     = 2, // Response received, waiting on crud_client_wait
+} CRUD_SLOT_STATES;
+
+// This is an outstanding (pipelined) request
+typedef struct {
+	CRUD_SLOT_STATES state;  // State of the slot
+	uint32_t         ticket; // Ticket of the request
+	CrudRequest      op;     // The request that was sent
+	CrudResponse     resp;   // The response, once received
+	void            *buf;    // Buffer for the response data (READ)
+	CrudCompletion   done;   // Completion callback (NULL for waiters)
+	void            *arg;    // Argument to the completion callback
+	uint64_t         start;  // Time the request was sent (benchmarking), else 0
+} CrudInflightRequest;
+
+// This is one connection of the pool, with its own queue of pipelined requests
+typedef struct {
+	int                 sock;        // Socket, -1 if not connected
+	pthread_mutex_t     lock;        // Serializes the users of the connection
+	CrudInflightRequest inflight[CRUD_MAX_INFLIGHT]; // Queue of pipelined requests
+	uint32_t            next_ticket; // Sequence of the next request submitted
+	uint32_t            next_reply;  // Sequence of the next response expected
+	CrudInflightRequest *parked;     // Responses moved out of the queue before collected
+	int                 nparked;     // Number of parked responses
+	int                 parked_size; // Allocated size of parked
+	int                 nreserved;   // Parked entries reserved by uncollected requests
+} CrudConnection;
+
 // Global variables
 int            crud_network_shutdown = 0; // Flag indicating shutdown
 unsigned char *crud_network_address = NULL; // Address of CRUD server 
 unsigned short crud_network_port = 0; // Port of CRUD server
-int sock;
+int            crud_network_version = 0; // Protocol version of the server
+int            crud_network_connections = 1; // Connections in the pool
+CrudConnection crud_pool[CRUD_MAX_CONNECTIONS]; // The connection pool
+int            crud_pool_size = 0; // Connections in use, fixed when the pool is set up
+struct in_addr crud_pool_servers[CRUD_MAX_SERVERS]; // Addresses the connections go to
+int            crud_pool_nservers = 0; // Number of server addresses
+pthread_mutex_t crud_pool_lock = PTHREAD_MUTEX_INITIALIZER; // Guards pool set up and tear down
 //
 // Prototype Functions
 int get_len(CrudResponse cr);
+int8_t get_ret(CrudResponse cr);
+int32_t get_oid(CrudResponse crud);
 
 //Functions
 
@@ -46,96 +105,332 @@ int8_t get_req(CrudResponse cr)
 
 //////////////////////////////////
 //
-// Function: crud_send
+// Function: crud_pool_setup
 //
-// Description: Sends data over to the server
-// Input: CrudRequest and buffer you want to send
+// Description: Sizes the connection pool and parses the server addresses
+//              (crud_network_address, a comma separated list) the first
+//              time it is used
+// Input: none
 // Output: none
 //
 
-void crud_send( CrudRequest op, void *buf)
+void crud_pool_setup( void )
 {
 
 	// Declare Variables
-	struct sockaddr_in caddr;
-	int  len , buf_len = 0, place = 0 ;
-	int req = get_req(op);
+	char addrs[256], *addr, *save;
+	int i;
 
-	// Connect to the network if not connected
-	if(crud_network_shutdown == 0)
+	pthread_mutex_lock(&crud_pool_lock);
+	if(crud_pool_size == 0)
 	{
-		caddr.sin_family = AF_INET;
-		caddr.sin_port = htons(CRUD_DEFAULT_PORT);
-
-		if ( inet_aton(CRUD_DEFAULT_IP , &caddr.sin_addr) == 0)
+		// Every connection goes to one of the servers, round robin
+		crud_pool_nservers = 0;
+		strncpy(addrs, (crud_network_address == NULL) ? CRUD_DEFAULT_IP : (char *)crud_network_address, sizeof(addrs)-1);
+		addrs[sizeof(addrs)-1] = '\0';
+		for(addr = strtok_r(addrs, ",", &save); addr != NULL && crud_pool_nservers < CRUD_MAX_SERVERS;
+				addr = strtok_r(NULL, ",", &save))
+		{
+			if ( inet_aton(addr, &crud_pool_servers[crud_pool_nservers]) == 0)
+			{
+				printf("inet_aton error");
+				exit(1);
+			}
+			crud_pool_nservers++;
+		}
+		if(crud_pool_nservers == 0)
 		{
 			printf("inet_aton error");
 			exit(1);
 		}
 
-		sock = socket(PF_INET, SOCK_STREAM, 0);
+		// Size the pool
+		crud_pool_size = crud_network_connections;
+		if(crud_pool_size < 1)
+			crud_pool_size = 1;
+		if(crud_pool_size > CRUD_MAX_CONNECTIONS)
+			crud_pool_size = CRUD_MAX_CONNECTIONS;
+		for(i=0; i<crud_pool_size; i++)
+		{
+			memset(&crud_pool[i], 0x0, sizeof(CrudConnection));
+			crud_pool[i].sock = -1;
+			pthread_mutex_init(&crud_pool[i].lock, NULL);
+		}
+	}
+	pthread_mutex_unlock(&crud_pool_lock);
+}
+
+//////////////////////////////////
+//
+// Function: crud_pool_index
+//
+// Description: Picks the connection for an object.  Every request for an
+//              object goes down the same connection, so they are served in
+//              order; different objects spread over the pool.  Requests
+//              without an object (INIT, FORMAT, CREATE, CLOSE and the
+//              priority object) use the first connection, as does
+//              everything until the server reports it serves concurrent
+//              connections.
+// Input: the object ID
+// Output: the index of the connection in the pool
+//
+
+int crud_pool_index(CrudOID oid)
+{
+	crud_pool_setup();
+	if(!crud_client_supports(CRUD_PROTOCOL_CONNECTIONS))
+		return 0;
+	return( oid % crud_pool_size );
+}
+
+//////////////////////////////////
+//
+// Function: crud_connect
+//
+// Description: Connects to the server if not already connected
+// Input: the connection (held by the caller)
+// Output: none
+//
+
+void crud_connect( CrudConnection *conn )
+{
+
+	// Declare Variables
+	struct sockaddr_in caddr;
+	int nodelay = 1;
+
+	// Connect to the network if not connected
+	if(conn->sock == -1)
+	{
+		caddr.sin_family = AF_INET;
+		caddr.sin_port = htons((crud_network_port == 0) ? CRUD_DEFAULT_PORT : crud_network_port);
+		caddr.sin_addr = crud_pool_servers[(conn - crud_pool) % crud_pool_nservers];
+
+		conn->sock = socket(PF_INET, SOCK_STREAM, 0);
 
-		if(sock == -1)
+		if(conn->sock == -1)
 		{
 			printf("Sockect error \n" );
 			exit(1);
 		}
 
-		if( connect( sock, (const struct sockaddr *)&caddr, sizeof(struct sockaddr)) == -1)
+		if( connect( conn->sock, (const struct sockaddr *)&caddr, sizeof(struct sockaddr)) == -1)
 		{
 			printf("Connect error \n"  );
 			exit(1);
 
 		}
+
+		// Small requests go out at once rather than waiting on Nagle
+		if( setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == -1)
+		{
+			printf("TCP_NODELAY error \n");
+			exit(1);
+		}
+		CRUD_TRACE_COUNT(CRUD_CTR_CONNECTS, 1);
 	
 		crud_network_shutdown = 1;
 	}
+}
+
+//////////////////////////////////
+//
+// Function: crud_request_has_offset
+//
+// Description: Does the request carry an object offset after the header?
+// Input: request type
+// Output: 1 if it does, 0 otherwise
+//
+
+int crud_request_has_offset(int req)
+{
+	return( req == CRUD_READ_RANGE || req == CRUD_UPDATE_RANGE );
+}
 
-	// get length from CrudRequest
-	len = get_len(op);
+//////////////////////////////////
+//
+// Function: crud_request_has_payload
+//
+// Description: Does the request carry Length bytes of data to the server?
+// Input: request type
+// Output: 1 if it does, 0 otherwise
+//
 
-	// Convert Crudrequest to network order bytes
-	op = htonll64(op);	
+int crud_request_has_payload(int req)
+{
+	return( req == CRUD_CREATE || req == CRUD_UPDATE || req == CRUD_APPEND || req == CRUD_UPDATE_RANGE );
+}
 
-	// Write request to server 
-	buf_len = write(sock,&op, sizeof(op));
-	
-	//Check if request it sent
-	if(buf_len < sizeof(op))
+//////////////////////////////////
+//
+// Function: crud_writev_all
+//
+// Description: Writes all of the vectors to the server, carrying on after
+//              short writes and interrupted calls
+// Input: the connection, the vectors (updated in place) and how many there are
+// Output: none
+//
+
+void crud_writev_all( CrudConnection *conn, struct iovec *iov, int cnt)
+{
+
+	// Declare Variables
+	ssize_t buf_len;
+
+	// Write until every vector is drained
+	while(cnt > 0)
 	{
-		printf("not everything");
-		exit(1);
+		CRUD_TRACE_START(start);
+		buf_len = writev(conn->sock, iov, (cnt > IOV_MAX) ? IOV_MAX : cnt);
+		CRUD_TRACE_STOP(CRUD_TMR_SOCK_SEND, start);
+		CRUD_TRACE_COUNT(CRUD_CTR_SOCK_WRITES, 1);
+		if(buf_len < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			printf("did not write request \n");
+			exit(1);
+		}
+
+		// Skip past whatever went out, trim a partly written vector
+		CRUD_TRACE_COUNT(CRUD_CTR_SOCK_OUT, buf_len);
+		while(cnt > 0 && buf_len >= (ssize_t)iov->iov_len)
+		{
+			buf_len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + buf_len;
+			iov->iov_len -= buf_len;
+		}
 	}
-	if(buf_len < 0)
+}
+
+//////////////////////////////////
+//
+// Function: crud_unpark
+//
+// Description: frees the parked responses of a connection that is going down,
+//              once every request waited on has been collected
+// Input: the connection (held by the caller)
+// Output: none
+//
+
+void crud_unpark( CrudConnection *conn)
+{
+	if(conn->nreserved > 0)
+		return;
+	free(conn->parked);
+	conn->parked = NULL;
+	conn->nparked = 0;
+	conn->parked_size = 0;
+}
+
+//////////////////////////////////
+//
+// Function: crud_read_all
+//
+// Description: Reads exactly len bytes from the server, carrying on after
+//              short reads and interrupted calls
+// Input: the connection, the buffer and number of bytes to read
+// Output: none
+//
+
+void crud_read_all( CrudConnection *conn, void *buf, int len)
+{
+
+	// Declare Variables
+	ssize_t buf_len;
+	int place = 0;
+
+	// Read until we have it all
+	while(place < len)
 	{
-		printf("Didnt send request #1 \n"); 
-		exit(1);
+		CRUD_TRACE_START(start);
+		buf_len = read(conn->sock, (char *)buf + place, len - place);
+		CRUD_TRACE_STOP(CRUD_TMR_SOCK_RECV, start);
+		CRUD_TRACE_COUNT(CRUD_CTR_SOCK_READS, 1);
+		if(buf_len < 0 && errno == EINTR)
+			continue;
+		if(buf_len <= 0)
+		{
+			printf("did not read response \n");
+			exit(1);
+		}
+		CRUD_TRACE_COUNT(CRUD_CTR_SOCK_IN, buf_len);
+		place += buf_len;
+	}
+}
 
+//////////////////////////////////
+//
+// Function: crud_request_vectors
+//
+// Description: Lays out a request as it goes on the wire: the header, the
+//              offset word for ranged requests and the data if any
+// Input: the request, offset and buffer, space for the network order
+//        header and offset, and the vectors to fill (at least 3)
+// Output: the number of vectors used
+//
+
+int crud_request_vectors( CrudRequest op, uint32_t offset, void *buf,
+		CrudRequest *hdr, uint32_t *off, struct iovec *iov)
+{
+
+	// Declare Variables
+	int req = get_req(op), cnt = 0;
+
+	// The header, in network byte order
+	*hdr = htonll64(op);
+	iov[cnt].iov_base = hdr;
+	iov[cnt++].iov_len = sizeof(*hdr);
+
+	// The object offset for the ranged requests
+	if( crud_request_has_offset(req))
+	{
+		*off = htonl(offset);
+		iov[cnt].iov_base = off;
+		iov[cnt++].iov_len = sizeof(*off);
 	}
-	
-	// Restart buf_len
-	buf_len =0;
-		
-	// Send buffer if needed
-	if( req == CRUD_CREATE || req == CRUD_UPDATE)
+
+	// The data if needed
+	if( crud_request_has_payload(req) && get_len(op) > 0)
 	{
-		while( buf_len != len)
-		{
-			buf_len = write(sock,buf + place,len);
-	
-			if(buf_len < 0)
-			{
-				printf("did not write buffer \n"  );
-				exit(1) ;
-			}
-			
-			if(buf_len != len)
-			{
-				len = len - buf_len;
-				place += buf_len;
-			}
-		}	
+		iov[cnt].iov_base = buf;
+		iov[cnt++].iov_len = get_len(op);
 	}
+	return cnt;
+}
+
+//////////////////////////////////
+//
+// Function: crud_send
+//
+// Description: Sends data over to the server, the whole request goes out in
+//              one writev
+// Input: the connection, CrudRequest, object offset (ranged requests) and
+//        buffer you want to send
+// Output: none
+//
+
+void crud_send( CrudConnection *conn, CrudRequest op, uint32_t offset, void *buf)
+{
+
+	// Declare Variables
+	struct iovec iov[3];
+	CrudRequest hdr;
+	uint32_t off;
+	int cnt;
+
+	// Connect to the network if not connected
+	crud_connect(conn);
+
+	// Write the request to the server
+	cnt = crud_request_vectors(op, offset, buf, &hdr, &off, iov);
+	CRUD_TRACE_EVENT(CRUD_EVT_SEND, get_req(op), get_oid(op), get_len(op), offset);
+	crud_writev_all(conn, iov, cnt);
 }
 
 ////////////////////////////////////////
@@ -143,37 +438,27 @@ void crud_send( CrudRequest op, void *buf)
 // Function: crud_receive 
 //
 // Description: receives data from the server
-// Input: buffer pointer to hold all the data you get from the server
+// Input: the connection, buffer pointer to hold all the data you get from
+//        the server
 // Output: CrudResponse response from the server
 //
 
-CrudResponse crud_receive( void *buf)
+CrudResponse crud_receive( CrudConnection *conn, void *buf)
 {
 	// Declare Variable
-	int req, len, buf_len = 0, place = 0 ;
+	int req, len;
 	CrudResponse ret;
 	
 	// Check connection
-	if(crud_network_shutdown ==0)
+	if(conn->sock == -1)
 	{
 
 		printf("Error connect \n");
 		exit(1);
 	}
 
-	// Receive the Response from the server
-	buf_len = read(sock,&ret, sizeof(ret));
-	
-	// Check if we receive the Response
-	if(buf_len < 0)
-	{
-		printf("Didnt read request #1 \n"); 
-		exit(1);
-	
-	}	
-	
-	// Restart buf_len
-	buf_len = 0;
+	// Receive the whole Response header from the server
+	crud_read_all(conn, &ret, sizeof(ret));
 
 	// Convert Response to host order
 	ret = ntohll64(ret);
@@ -181,32 +466,25 @@ CrudResponse crud_receive( void *buf)
 	len = get_len(ret);
 	req = get_req(ret);
 	
-	// Read a buffer if needed
-	if(req == CRUD_READ)
+	// Remember the protocol version the server speaks
+	if(req == CRUD_INIT)
 	{
-		
-		while( buf_len != len)
-		{
-			buf_len = read(sock,buf+place, len);
-			
-			if(buf_len < 0 )
-			{
-				printf("did not read buffer \n"  );
-				exit(1);
-			}
+		crud_network_version = (len < CRUD_PROTOCOL_VERSION) ? len : CRUD_PROTOCOL_VERSION;
+	}
 
-			if(buf_len != len)
-			{
-				len = len - buf_len;
-				place += buf_len;
-			}
-		}
+	// Read a buffer if needed
+	if(req == CRUD_READ || req == CRUD_READ_RANGE)
+	{
+		crud_read_all(conn, buf, len);
 	}
 	
 	// Close the socket when requested
 	if(req == CRUD_CLOSE)
 	{
-		close(sock);
+		close(conn->sock);
+		conn->sock = -1;
+		crud_network_shutdown = 0;
+		crud_unpark(conn);
 	}
 
 	// return the Response
@@ -214,6 +492,468 @@ CrudResponse crud_receive( void *buf)
 	
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_cork
+// Description  : Cork (or uncork) one connection of the pool.
+//
+// Inputs       : conn - the connection (held by the caller)
+//                on - 1 to cork, 0 to uncork
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pool_cork(CrudConnection *conn, int on) {
+
+	// Nothing to do before we are connected
+	if(conn->sock == -1)
+	{
+		return 0;
+	}
+	if(setsockopt(conn->sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) == -1)
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD client : TCP_CORK failed [%s]", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_cork
+// Description  : Cork (or uncork) the connection an object's requests use.
+//                While corked, requests are held by the kernel and sent as
+//                full segments; uncorking pushes out whatever is left.
+//                Uncorked, each request goes out at once (TCP_NODELAY) as a
+//                single segment.
+//
+// Inputs       : oid - the object whose connection to cork
+//                on - 1 to cork, 0 to uncork
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_client_cork(CrudOID oid, int on) {
+
+	// Local variables
+	CrudConnection *conn = &crud_pool[crud_pool_index(oid)];
+	int ret;
+
+	pthread_mutex_lock(&conn->lock);
+	ret = crud_pool_cork(conn, on);
+	pthread_mutex_unlock(&conn->lock);
+	return ret;
+}
+
+//////////////////////////////////////////
+//
+// Function: crud_complete_one
+//
+// Description: receives the response for the oldest outstanding request on
+//              a connection, and hands it to the callback or leaves it for
+//              the waiter
+// Input: the connection (held by the caller)
+// Output: none
+//
+
+void crud_complete_one( CrudConnection *conn )
+{
+	// Declare Variables
+	CrudInflightRequest *slot = &conn->inflight[conn->next_reply % CRUD_MAX_INFLIGHT];
+
+	// Responses come back in the order the requests were sent
+	slot->resp = crud_receive(conn, slot->buf);
+	if(get_req(slot->resp) != get_req(slot->op))
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD client : response type %d for request type %d, stream out of sync",
+				get_req(slot->resp), get_req(slot->op));
+		exit(1);
+	}
+	conn->next_reply++;
+	if(slot->start != 0)
+	{
+		if(crud_bench_enabled)
+			crud_bench_request(get_req(slot->op), slot->start);
+		CRUD_TRACE_REQUEST(slot->op, slot->resp, slot->start);
+	}
+
+	// Complete through the callback, or park the response for the waiter
+	if(slot->done != NULL)
+	{
+		slot->state = CRUD_SLOT_FREE;
+		slot->done(slot->resp, slot->buf, slot->arg);
+	}
+	else
+	{
+		slot->state = CRUD_SLOT_DONE;
+	}
+}
+
+//////////////////////////////////////////
+//
+// Function: crud_drain_one
+//
+// Description: receives every outstanding response on a connection
+// Input: the connection (held by the caller)
+// Output: the number of requests completed
+//
+
+int crud_drain_one( CrudConnection *conn )
+{
+	// Declare Variables
+	int completed = 0;
+
+	// Receive until nothing is left in flight
+	while(conn->next_reply != conn->next_ticket)
+	{
+		crud_complete_one(conn);
+		completed++;
+	}
+	return completed;
+}
+
+//////////////////////////////////////////
+//
+// Function: crud_pool_release
+//
+// Description: drains and disconnects every connection but the first, ahead
+//              of the CRUD_CLOSE that goes down the first one
+// Input: none
+// Output: none
+//
+
+void crud_pool_release( void )
+{
+	// Declare Variables
+	int i;
+
+	for(i=1; i<crud_pool_size; i++)
+	{
+		pthread_mutex_lock(&crud_pool[i].lock);
+		crud_drain_one(&crud_pool[i]);
+		if(crud_pool[i].sock != -1)
+		{
+			close(crud_pool[i].sock);
+			crud_pool[i].sock = -1;
+		}
+		crud_unpark(&crud_pool[i]);
+		pthread_mutex_unlock(&crud_pool[i].lock);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_submit
+// Description  : Send a request to the CRUD server without waiting for the
+//                response.  The request goes down the pool connection for
+//                its object, where up to CRUD_MAX_INFLIGHT requests are kept
+//                in flight; when the queue is full the oldest response is
+//                received first.  Callbacks run with the connection held, so
+//                they must not call back into the client.
+//
+// Inputs       : op - the request opcode for the command
+//                offset - the offset into the object (ranged requests)
+//                buf - the block to be read/written from (READ/WRITE), it
+//                      must stay valid until the request completes
+//                done - callback run with the response, NULL to collect the
+//                       response with crud_client_wait
+//                arg - argument passed to the callback
+// Outputs      : the ticket for the request
+
+uint32_t crud_client_submit(CrudRequest op, uint32_t offset, void *buf, CrudCompletion done, void *arg) {
+
+	// Local variables
+	int idx = crud_pool_index(get_oid(op));
+	CrudConnection *conn = &crud_pool[idx];
+	CrudInflightRequest *slot, *parked;
+	uint32_t ticket;
+	int size;
+
+	// The rest of the pool winds down before the close goes out
+	if(get_req(op) == CRUD_CLOSE)
+	{
+		crud_pool_release();
+	}
+
+	// Reserve a parked entry for a response to be waited on, so it can
+	// always be parked if another thread's request needs its slot
+	pthread_mutex_lock(&conn->lock);
+	if(done == NULL && conn->nreserved == conn->parked_size)
+	{
+		size = (conn->parked_size) ? conn->parked_size*2 : CRUD_MAX_INFLIGHT;
+		parked = realloc(conn->parked, size * sizeof(CrudInflightRequest));
+		if(parked == NULL)
+		{
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : no memory to submit request [OID %d]", get_oid(op));
+			pthread_mutex_unlock(&conn->lock);
+			return CRUD_NO_TICKET;
+		}
+		conn->parked = parked;
+		conn->parked_size = size;
+	}
+	if(done == NULL)
+	{
+		conn->nreserved++;
+	}
+
+	// Make room in the queue, receiving responses until the slot is free
+	if(conn->next_ticket * CRUD_MAX_CONNECTIONS + idx == CRUD_NO_TICKET)
+	{
+		conn->next_ticket++;
+	}
+	ticket = conn->next_ticket * CRUD_MAX_CONNECTIONS + idx;
+	slot = &conn->inflight[conn->next_ticket % CRUD_MAX_INFLIGHT];
+	while(slot->state == CRUD_SLOT_INFLIGHT)
+	{
+		crud_complete_one(conn);
+	}
+
+	// A response its waiter has not collected yet (another thread sharing
+	// the connection) is parked until it is
+	if(slot->state == CRUD_SLOT_DONE)
+	{
+		conn->parked[conn->nparked++] = *slot;
+	}
+
+	// Fill in the slot and send the request
+	slot->state = CRUD_SLOT_INFLIGHT;
+	slot->ticket = ticket;
+	slot->op = op;
+	slot->resp = 0;
+	slot->buf = buf;
+	slot->done = done;
+	slot->arg = arg;
+	slot->start = (crud_bench_enabled || CRUD_TRACE_ENABLED) ? crud_bench_now() : 0;
+	conn->next_ticket++;
+	crud_send(conn, op, offset, buf);
+	pthread_mutex_unlock(&conn->lock);
+	return ticket;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_wait
+// Description  : Wait for a request submitted without a callback to complete
+//
+// Inputs       : ticket - the ticket returned by crud_client_submit
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_client_wait(uint32_t ticket) {
+
+	// Local variables
+	CrudConnection *conn = &crud_pool[ticket % CRUD_MAX_CONNECTIONS];
+	CrudInflightRequest *slot = &conn->inflight[(ticket / CRUD_MAX_CONNECTIONS) % CRUD_MAX_INFLIGHT];
+	CrudResponse resp = 0;
+	int i;
+	CRUD_TRACE_START(start);
+
+	// A request that could not be submitted has no response
+	if(ticket == CRUD_NO_TICKET)
+	{
+		return -1;
+	}
+
+	// Receive responses until ours is in
+	pthread_mutex_lock(&conn->lock);
+	while(slot->ticket == ticket && slot->state == CRUD_SLOT_INFLIGHT)
+	{
+		crud_complete_one(conn);
+	}
+
+	// Hand back the response, free the slot (or the parked copy)
+	if(slot->ticket == ticket && slot->state == CRUD_SLOT_DONE)
+	{
+		slot->state = CRUD_SLOT_FREE;
+		resp = slot->resp;
+	}
+	else
+	{
+		for(i=0; i<conn->nparked && conn->parked[i].ticket != ticket; i++);
+		if(i == conn->nparked)
+		{
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : no response for ticket [%u]", ticket);
+			pthread_mutex_unlock(&conn->lock);
+			return -1;
+		}
+		resp = conn->parked[i].resp;
+		conn->parked[i] = conn->parked[--conn->nparked];
+	}
+
+	// Give back the reservation, the last one of a closed connection
+	// frees the parked responses
+	conn->nreserved--;
+	if(conn->sock == -1)
+	{
+		crud_unpark(conn);
+	}
+	pthread_mutex_unlock(&conn->lock);
+	CRUD_TRACE_STOP(CRUD_TMR_WAIT, start);
+	return resp;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_poll
+// Description  : Complete any requests whose responses have already arrived,
+//                without blocking for more.
+//
+// Inputs       : none
+// Outputs      : the number of requests completed
+
+int crud_client_poll(void) {
+
+	// Local variables
+	struct pollfd pfd;
+	int i, completed = 0;
+
+	// Complete while there is something to read, connection by connection
+	crud_pool_setup();
+	for(i=0; i<crud_pool_size; i++)
+	{
+		pthread_mutex_lock(&crud_pool[i].lock);
+		pfd.fd = crud_pool[i].sock;
+		pfd.events = POLLIN;
+		while(crud_pool[i].next_reply != crud_pool[i].next_ticket && poll(&pfd, 1, 0) == 1)
+		{
+			crud_complete_one(&crud_pool[i]);
+			completed++;
+		}
+		pthread_mutex_unlock(&crud_pool[i].lock);
+	}
+	return completed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_drain
+// Description  : Wait for every outstanding request to complete
+//
+// Inputs       : none
+// Outputs      : the number of requests completed
+
+int crud_client_drain(void) {
+
+	// Local variables
+	int i, completed = 0;
+
+	// Receive until nothing is left in flight on any connection
+	crud_pool_setup();
+	for(i=0; i<crud_pool_size; i++)
+	{
+		pthread_mutex_lock(&crud_pool[i].lock);
+		completed += crud_drain_one(&crud_pool[i]);
+		pthread_mutex_unlock(&crud_pool[i].lock);
+	}
+	return completed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_batch
+// Description  : Send a vector of requests to the server as one CRUD_BATCH
+//                frame (a single write), and collect the vector of
+//                responses.  Servers without batch support get the requests
+//                pipelined instead, each down its object's connection.
+//
+// Inputs       : ops - the requests
+//                offsets - the object offsets (ranged requests), or NULL
+//                bufs - the buffers for each request (may hold NULLs)
+//                resps - the place to put the responses
+//                count - the number of requests (at most CRUD_MAX_BATCH)
+// Outputs      : 0 if every request succeeded, -1 if any failed
+
+int crud_client_batch(CrudRequest *ops, uint32_t *offsets, void **bufs, CrudResponse *resps, int count) {
+
+	// Local variables
+	uint32_t tickets[CRUD_MAX_BATCH], offs[CRUD_MAX_BATCH];
+	CrudRequest hdrs[CRUD_MAX_BATCH+1];
+	struct iovec iov[CRUD_MAX_BATCH*3+1];
+	CrudConnection *conn = &crud_pool[crud_pool_index(0)];
+	uint64_t corked = 0, start;
+	int i, len, failed = 0, cnt;
+
+	// Check the vector, fall back to (corked) pipelining for older servers
+	if(count <= 0 || count > CRUD_MAX_BATCH)
+	{
+		return -1;
+	}
+	if(!crud_client_supports(CRUD_PROTOCOL_BATCH))
+	{
+		for(i=0; i<count; i++)
+		{
+			corked |= 1ULL << crud_pool_index(get_oid(ops[i]));
+		}
+		for(i=0; i<crud_pool_size; i++)
+		{
+			if(corked & (1ULL << i))
+			{
+				pthread_mutex_lock(&crud_pool[i].lock);
+				crud_pool_cork(&crud_pool[i], 1);
+				pthread_mutex_unlock(&crud_pool[i].lock);
+			}
+		}
+		for(i=0; i<count; i++)
+		{
+			tickets[i] = crud_client_submit(ops[i], (offsets == NULL) ? 0 : offsets[i], bufs[i], NULL, NULL);
+		}
+		for(i=0; i<crud_pool_size; i++)
+		{
+			if(corked & (1ULL << i))
+			{
+				pthread_mutex_lock(&crud_pool[i].lock);
+				crud_pool_cork(&crud_pool[i], 0);
+				pthread_mutex_unlock(&crud_pool[i].lock);
+			}
+		}
+		for(i=0; i<count; i++)
+		{
+			resps[i] = crud_client_wait(tickets[i]);
+			failed |= get_ret(resps[i]);
+		}
+		return (failed) ? -1 : 0;
+	}
+
+	// Everything already in flight has to complete ahead of the frame
+	crud_client_drain();
+	pthread_mutex_lock(&conn->lock);
+	crud_drain_one(conn);
+	crud_connect(conn);
+
+	// Lay out the frame: batch header, then each request with its offset and data
+	hdrs[0] = htonll64(construct_crud_request(0, CRUD_BATCH, count, 0, 0));
+	iov[0].iov_base = &hdrs[0];
+	iov[0].iov_len = sizeof(hdrs[0]);
+	cnt = 1;
+	for(i=0; i<count; i++)
+	{
+		cnt += crud_request_vectors(ops[i], (offsets == NULL) ? 0 : offsets[i], bufs[i],
+				&hdrs[i+1], &offs[i], &iov[cnt]);
+	}
+
+	// Send the whole frame, gathered straight from the callers' buffers
+	start = (crud_bench_enabled || CRUD_TRACE_ENABLED) ? crud_bench_now() : 0;
+	CRUD_TRACE_COUNT(CRUD_CTR_BATCHES, 1);
+	CRUD_TRACE_EVENT(CRUD_EVT_BATCH, CRUD_BATCH, 0, count, 0);
+	crud_writev_all(conn, iov, cnt);
+
+	// Receive the batch header, then the responses in order
+	hdrs[0] = crud_receive(conn, NULL);
+	len = get_len(hdrs[0]);
+	if(get_req(hdrs[0]) != CRUD_BATCH || len != count)
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD client : bad batch response [%lx], stream out of sync", hdrs[0]);
+		exit(1);
+	}
+	for(i=0; i<count; i++)
+	{
+		resps[i] = crud_receive(conn, bufs[i]);
+		failed |= get_ret(resps[i]);
+	}
+	if(start != 0)
+	{
+		if(crud_bench_enabled)
+			crud_bench_request(CRUD_BATCH, start);
+		CRUD_TRACE_REQUEST(construct_crud_request(0, CRUD_BATCH, count, 0, 0), hdrs[0], start);
+	}
+	pthread_mutex_unlock(&conn->lock);
+	return (failed) ? -1 : 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -230,8 +970,34 @@ CrudResponse crud_receive( void *buf)
 // Outputs      : the response structure encoded as needed
 
 CrudResponse crud_client_operation(CrudRequest op, void *buf) {
-	crud_send(op, buf);
-	op = crud_receive(buf);
-	return op;
+	return crud_client_wait(crud_client_submit(op, 0, buf, NULL, NULL));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_range_operation
+// Description  : This the client operation for the ranged requests, which
+//                carry an offset into the object after the request.
+//
+// Inputs       : op - the request opcode for the command
+//                offset - the offset into the object
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_client_range_operation(CrudRequest op, uint32_t offset, void *buf) {
+	return crud_client_wait(crud_client_submit(op, offset, buf, NULL, NULL));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_supports
+// Description  : Check if the server (as reported on CRUD_INIT) speaks at
+//                least the given protocol version.
+//
+// Inputs       : version - the protocol version needed
+// Outputs      : 1 if supported, 0 otherwise
+
+int crud_client_supports(int version) {
+	return( crud_network_version >= version );
 }
 
@@ -0,0 +1,933 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_directory.c
+//  Description    : This is the implementation of the file system metadata
+//                   of the CRUD storage system, an extendible hash of
+//                   directory blocks.  A file's name hashes to a slot of the
+//                   directory, which names its block; a full block splits
+//                   in two on one more bit of the hash, doubling the
+//                   directory when it already uses all of them.  Blocks are
+//                   read when first needed and only the changed ranges are
+//                   written back.  Each block keeps its entries (hash, object
+//                   and length) packed at the front, so a lookup scans them
+//                   and only touches the filenames, packed at the back, on a
+//                   hash match.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 01:59:11 UTC 2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <crud_directory.h>
+#include <crud_network.h>
+#include <crud_pool.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_DIR_HASH_OFFSET 2166136261U  // FNV-1a hash of the filenames
+#define CRUD_DIR_HASH_PRIME  16777619U
+#define CRUD_DIR_LOADED 0x1               // Block has been read (or is new)
+#define CRUD_DIR_DIRTY  0x2               // Block differs from the device copy
+#define CRUD_DIR_RANGE_HEADER  0          // Changed ranges of a block: the header,
+#define CRUD_DIR_RANGE_ENTRIES 1          // ... the entries
+#define CRUD_DIR_RANGE_NAMES   2          // ... and the filenames
+#define CRUD_DIR_RANGES        3
+
+// Type definitions
+
+// This is a directory block in memory
+typedef struct {
+	CrudOID             oid;      // Object holding the block, CRUD_NO_OBJECT until created
+	uint8_t             state;    // CRUD_DIR_* flags
+	uint32_t            dirty_lo[CRUD_DIR_RANGES]; // Changed bytes of the block, from ...
+	uint32_t            dirty_hi[CRUD_DIR_RANGES]; // ... up to (not including)
+	CrudDirectoryBlock *data;     // Contents (CRUD_DIR_BLOCK_SIZE bytes), NULL until read
+	int16_t            *handles;  // Open handle of each entry, -1 if none
+} CrudDirBlock;
+
+//
+// Module static data
+
+static CrudSuperblock dir_super;             // The superblock
+static CrudDirBlock **dir_slots = NULL;      // The directory, 2^global_depth slots
+static CrudDirBlock **dir_blocks = NULL;     // Every block, for sync and release
+static uint32_t       dir_nblocks = 0;       // Number of blocks in dir_blocks
+static uint32_t       dir_capacity = 0;      // Allocated size of dir_blocks
+static uint32_t       dir_written_depth = 0; // Depth of the directory object on the device
+static int            dir_dirty = 0;         // Directory needs writing
+static int            super_dirty = 0;       // Superblock needs writing
+static int            dir_mounted = 0;       // Metadata is in memory
+
+// Pick up these definitions from the file IO
+CrudRequest crud_formati(int32_t oid, int8_t req, int32_t len, int8_t flag, int8_t ret);
+int32_t get_oid(CrudResponse crud);
+int32_t get_len(CrudResponse crud);
+int8_t get_ret(CrudResponse crud);
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_hash
+// Description  : Hash a filename (FNV-1a), the low bits pick the slot
+//
+// Inputs       : path - the filename
+// Outputs      : the hash
+
+static uint32_t crud_dir_hash(char *path) {
+	uint32_t hash = CRUD_DIR_HASH_OFFSET;
+	while (*path != '\0') {
+		hash = (hash ^ (uint8_t)*path++) * CRUD_DIR_HASH_PRIME;
+	}
+	return(hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_alias
+// Description  : Find the slot of the directory a slot shares its block
+//                with: the slot less its top bit, if the two name the same
+//                object (blocks are shared by the slots agreeing on their low
+//                local_depth bits)
+//
+// Inputs       : oids - the directory
+//                slot - the slot
+// Outputs      : the lower slot sharing the block, -1 if none
+
+static int32_t crud_dir_alias(CrudOID *oids, uint32_t slot) {
+	uint32_t top;
+	if (slot == 0) {
+		return(-1);
+	}
+	for (top=1; (top<<1) <= slot; top<<=1);
+	return((oids[slot] == oids[slot ^ top]) ? (int32_t)(slot ^ top) : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_alloc
+// Description  : Allocate the in memory contents of a block
+//
+// Inputs       : block - the block
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_alloc(CrudDirBlock *block) {
+	block->data = calloc(1, CRUD_DIR_BLOCK_SIZE);
+	block->handles = malloc(CRUD_DIR_BLOCK_ENTRIES * sizeof(int16_t));
+	if ((block->data == NULL) || (block->handles == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed to allocate a block.");
+		free(block->data);
+		free(block->handles);
+		block->data = NULL;
+		block->handles = NULL;
+		return(-1);
+	}
+	memset(block->handles, 0xff, CRUD_DIR_BLOCK_ENTRIES * sizeof(int16_t));
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_touch
+// Description  : Note a changed range of a block
+//
+// Inputs       : block - the block
+//                range - which part changed (CRUD_DIR_RANGE_*)
+//                lo - the first byte changed
+//                hi - the byte after the last changed
+// Outputs      : none
+
+static void crud_dir_touch(CrudDirBlock *block, int range, uint32_t lo, uint32_t hi) {
+
+	// Local variables
+	int r;
+
+	// Start out clean, then widen the range
+	if (!(block->state & CRUD_DIR_DIRTY)) {
+		for (r=0; r<CRUD_DIR_RANGES; r++) {
+			block->dirty_lo[r] = CRUD_DIR_BLOCK_SIZE;
+			block->dirty_hi[r] = 0;
+		}
+		block->state |= CRUD_DIR_DIRTY;
+	}
+	if (lo < block->dirty_lo[range]) {
+		block->dirty_lo[range] = lo;
+	}
+	if (hi > block->dirty_hi[range]) {
+		block->dirty_hi[range] = hi;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_touch_entry
+// Description  : Note a changed entry of a block
+//
+// Inputs       : block - the block
+//                entry - the index of the entry
+// Outputs      : none
+
+static void crud_dir_touch_entry(CrudDirBlock *block, uint32_t entry) {
+	crud_dir_touch(block, CRUD_DIR_RANGE_ENTRIES, (char *)&block->data->entries[entry] - (char *)block->data,
+			(char *)&block->data->entries[entry+1] - (char *)block->data);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_new_block
+// Description  : Add a block to the list of blocks, once it is built
+//
+// Inputs       : oid - the object holding it, CRUD_NO_OBJECT for a new block
+//                      (which is allocated empty and dirty)
+// Outputs      : the block, NULL if failure (nothing added)
+
+static CrudDirBlock *crud_dir_new_block(CrudOID oid) {
+
+	// Local variables
+	CrudDirBlock *block, **blocks;
+
+	// New blocks start out empty, and have to be written
+	if ((block = calloc(1, sizeof(CrudDirBlock))) == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed to allocate a block.");
+		return(NULL);
+	}
+	block->oid = oid;
+	if (oid == CRUD_NO_OBJECT) {
+		if (crud_dir_alloc(block)) {
+			free(block);
+			return(NULL);
+		}
+		block->data->magic = CRUD_DIR_BLOCK_MAGIC;
+		block->data->names = CRUD_DIR_BLOCK_SIZE;
+		block->state = CRUD_DIR_LOADED;
+		crud_dir_touch(block, CRUD_DIR_RANGE_ENTRIES, 0, CRUD_DIR_BLOCK_SIZE);
+	}
+
+	// Grow the list as needed, then add the block
+	if (dir_nblocks == dir_capacity) {
+		blocks = realloc(dir_blocks, (dir_capacity ? dir_capacity*2 : 64) * sizeof(CrudDirBlock *));
+		if (blocks == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed to grow the block list.");
+			free(block->data);
+			free(block->handles);
+			free(block);
+			return(NULL);
+		}
+		dir_blocks = blocks;
+		dir_capacity = dir_capacity ? dir_capacity*2 : 64;
+	}
+	dir_blocks[dir_nblocks++] = block;
+	return(block);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_room
+// Description  : Check a block has room for one more file
+//
+// Inputs       : block - the block
+//                path - the filename of the file
+// Outputs      : 1 if there is room, 0 if not
+
+static int crud_dir_room(CrudDirBlock *block, char *path) {
+	CrudDirectoryBlock *data = block->data;
+	return((data->count < CRUD_DIR_BLOCK_ENTRIES) && (sizeof(CrudDirectoryBlock) +
+			(data->count+1)*sizeof(CrudDirectoryEntry) + strlen(path) + 1 <= data->names));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_append
+// Description  : Add a file to a block (which has room for it)
+//
+// Inputs       : block - the block
+//                hash - the hash of the filename
+//                path - the filename
+//                oid - the object holding the data
+//                length - the length of the file
+//                flags - the CRUD_FILE_* flags of the file
+//                handle - the open handle of the file, -1 if none
+// Outputs      : the index of the new entry
+
+static uint32_t crud_dir_append(CrudDirBlock *block, uint32_t hash, char *path, CrudOID oid,
+		uint32_t length, uint16_t flags, int16_t handle) {
+
+	// Local variables
+	CrudDirectoryBlock *data = block->data;
+	uint32_t i = data->count++, size = strlen(path) + 1;
+
+	// The name goes below the others, the entry after the others
+	data->names -= size;
+	memcpy((char *)data + data->names, path, size);
+	data->entries[i].hash = hash;
+	data->entries[i].object_id = oid;
+	data->entries[i].length = length;
+	data->entries[i].name = data->names;
+	data->entries[i].flags = flags;
+	block->handles[i] = handle;
+	crud_dir_touch(block, CRUD_DIR_RANGE_HEADER, 0, sizeof(CrudDirectoryBlock));
+	crud_dir_touch_entry(block, i);
+	crud_dir_touch(block, CRUD_DIR_RANGE_NAMES, data->names, data->names + size);
+	return(i);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_load
+// Description  : Read a block from the device
+//
+// Inputs       : block - the block
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_load(CrudDirBlock *block) {
+
+	// Local variables
+	CrudDirectoryBlock *data;
+	CrudResponse ret;
+
+	// Read the block, check it is one
+	if ((block->data == NULL) && crud_dir_alloc(block)) {
+		return(-1);
+	}
+	data = block->data;
+	ret = crud_client_operation(crud_formati(block->oid, CRUD_READ, CRUD_DIR_BLOCK_SIZE, 0, 0), data);
+	if ((get_ret(ret) == 1) || (get_len(ret) != CRUD_DIR_BLOCK_SIZE) || (data->magic != CRUD_DIR_BLOCK_MAGIC) ||
+			(data->count > CRUD_DIR_BLOCK_ENTRIES) || (data->names > CRUD_DIR_BLOCK_SIZE) ||
+			(data->names < sizeof(CrudDirectoryBlock) + data->count*sizeof(CrudDirectoryEntry))) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : bad directory block [%u].", block->oid);
+		return(-1);
+	}
+
+	// The last filename ends the block, which keeps every lookup inside it
+	((char *)data)[CRUD_DIR_BLOCK_SIZE-1] = '\0';
+	block->state = CRUD_DIR_LOADED;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_split
+// Description  : Split a full block on the next bit of the hash, doubling
+//                the directory if the block already uses all of them
+//
+// Inputs       : block - the (full) block
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_split(CrudDirBlock *block) {
+
+	// Local variables
+	CrudDirBlock *split, **slots, *target, fresh;
+	CrudDirectoryBlock *old;
+	CrudDirectoryEntry *entry;
+	int16_t *handles;
+	uint32_t bit, i, count;
+
+	// Double the directory if needed, the new half mirrors the old
+	if (block->data->local_depth == dir_super.global_depth) {
+		if (dir_super.global_depth == CRUD_DIR_MAX_DEPTH) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD directory : directory full (%u files).", dir_super.files);
+			return(-1);
+		}
+		count = 1 << dir_super.global_depth;
+		if ((slots = realloc(dir_slots, 2 * count * sizeof(CrudDirBlock *))) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed to grow the directory.");
+			return(-1);
+		}
+		memcpy(&slots[count], slots, count * sizeof(CrudDirBlock *));
+		dir_slots = slots;
+		dir_super.global_depth ++;
+		dir_dirty = super_dirty = 1;
+	}
+
+	// Get the empty contents and the new block first, so a failure leaves
+	// the block as it was
+	if (crud_dir_alloc(&fresh)) {
+		return(-1);
+	}
+	if ((split = crud_dir_new_block(CRUD_NO_OBJECT)) == NULL) {
+		free(fresh.data);
+		free(fresh.handles);
+		return(-1);
+	}
+
+	// Take the old contents out, empty the block
+	old = block->data;
+	handles = block->handles;
+	block->data = fresh.data;
+	block->handles = fresh.handles;
+	bit = 1 << old->local_depth;
+	block->data->magic = CRUD_DIR_BLOCK_MAGIC;
+	block->data->local_depth = split->data->local_depth = old->local_depth + 1;
+	block->data->names = CRUD_DIR_BLOCK_SIZE;
+	crud_dir_touch(block, CRUD_DIR_RANGE_ENTRIES, 0, CRUD_DIR_BLOCK_SIZE);
+
+	// Then put the entries with the new bit set in the new block, the rest back
+	for (i=0; i<old->count; i++) {
+		entry = &old->entries[i];
+		target = (entry->hash & bit) ? split : block;
+		crud_dir_append(target, entry->hash, (char *)old + entry->name, entry->object_id, entry->length,
+				entry->flags, handles[i]);
+	}
+	free(old);
+	free(handles);
+
+	// Point the slots with the bit set at the new block
+	for (i=0; i<(1U << dir_super.global_depth); i++) {
+		if ((dir_slots[i] == block) && (i & bit)) {
+			dir_slots[i] = split;
+		}
+	}
+	dir_super.blocks ++;
+	dir_dirty = super_dirty = 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_release
+// Description  : Free all of the metadata held in memory
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_dir_release(void) {
+
+	// Local variables
+	uint32_t i;
+
+	for (i=0; i<dir_nblocks; i++) {
+		free(dir_blocks[i]->data);
+		free(dir_blocks[i]->handles);
+		free(dir_blocks[i]);
+	}
+	free(dir_blocks);
+	free(dir_slots);
+	dir_blocks = NULL;
+	dir_slots = NULL;
+	dir_nblocks = dir_capacity = 0;
+	dir_dirty = super_dirty = dir_mounted = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_empty
+// Description  : Set up empty metadata in memory: one empty block
+//
+// Inputs       : size - the length of the priority object holding the
+//                       superblock
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_empty(uint32_t size) {
+
+	// Local variables
+	CrudDirBlock *block;
+
+	crud_dir_release();
+	memset(&dir_super, 0x0, sizeof(dir_super));
+	dir_super.magic = CRUD_SUPERBLOCK_MAGIC;
+	dir_super.version = CRUD_METADATA_VERSION;
+	dir_super.size = size;
+	dir_super.blocks = 1;
+	dir_written_depth = 0;
+	if (((dir_slots = malloc(sizeof(CrudDirBlock *))) == NULL) ||
+			((block = crud_dir_new_block(CRUD_NO_OBJECT)) == NULL)) {
+		return(-1);
+	}
+	dir_slots[0] = block;
+	dir_dirty = super_dirty = dir_mounted = 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_add
+// Description  : Add a file of an older layout being converted
+//
+// Inputs       : path - the filename
+//                oid - the object holding the data
+//                length - the length of the file
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_add(char *path, CrudOID oid, uint32_t length) {
+
+	// Local variables
+	CrudDirectoryRef ref;
+
+	if (crud_dir_find(path, 1, &ref)) {
+		return(-1);
+	}
+	ref.entry->object_id = oid;
+	ref.entry->length = length;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_convert_legacy
+// Description  : Convert a legacy file table (one fixed array of entries in
+//                the priority object) to a directory
+//
+// Inputs       : table - the legacy table
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_convert_legacy(CrudFileAllocationType *table) {
+
+	// Local variables
+	int i;
+
+	// Start empty, the superblock takes over the legacy priority object
+	if (crud_dir_empty(CRUD_LEGACY_TABLE_SIZE)) {
+		return(-1);
+	}
+	for (i=0; i<CRUD_MAX_TOTAL_FILES; i++) {
+		table[i].filename[CRUD_MAX_PATH_LENGTH-1] = '\0';
+		if ((table[i].filename[0] != '\0') && crud_dir_add(table[i].filename, table[i].object_id, table[i].length)) {
+			return(-1);
+		}
+	}
+
+	// Write it all out now, the legacy table is gone once the superblock is
+	logMessage(LOG_INFO_LEVEL, "CRUD directory : converted legacy file table (%u files).", dir_super.files);
+	return(crud_dir_sync(0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_convert_v1
+// Description  : Convert a version 1 directory (fixed entries holding the
+//                filenames) to the current layout, deleting the old objects
+//                once the new ones are written
+//
+// Inputs       : old - the version 1 superblock
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_dir_convert_v1(CrudSuperblock *old) {
+
+	// Local variables
+	CrudDirectoryBlockV1 *block;
+	CrudResponse ret;
+	CrudOID *oids;
+	uint32_t i, j, count = 1 << old->global_depth;
+	int failed = 0;
+
+	// Read the old directory
+	oids = crud_pool_alloc(count * sizeof(CrudOID));
+	block = crud_pool_alloc(sizeof(CrudDirectoryBlockV1));
+	if ((oids == NULL) || (block == NULL)) {
+		crud_pool_free(oids);
+		crud_pool_free(block);
+		return(-1);
+	}
+	ret = crud_client_operation(crud_formati(old->directory, CRUD_READ, count * sizeof(CrudOID), 0, 0), oids);
+	if ((get_ret(ret) == 1) || (get_len(ret) != count * sizeof(CrudOID)) || crud_dir_empty(old->size)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed to read the version 1 directory.");
+		crud_pool_free(oids);
+		crud_pool_free(block);
+		return(-1);
+	}
+
+	// Then every block, adding its files to the new directory
+	for (i=0; (i<count) && !failed; i++) {
+		if (crud_dir_alias(oids, i) != -1) {
+			continue;
+		}
+		ret = crud_client_operation(crud_formati(oids[i], CRUD_READ, sizeof(CrudDirectoryBlockV1), 0, 0), block);
+		if ((get_ret(ret) == 1) || (get_len(ret) != sizeof(CrudDirectoryBlockV1)) ||
+				(block->magic != CRUD_DIR_BLOCK_MAGIC) || (block->count > CRUD_DIR_V1_ENTRIES)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD directory : bad version 1 directory block [%u].", oids[i]);
+			failed = 1;
+			break;
+		}
+		for (j=0; (j<block->count) && !failed; j++) {
+			block->entries[j].filename[CRUD_MAX_PATH_LENGTH-1] = '\0';
+			failed = crud_dir_add(block->entries[j].filename, block->entries[j].object_id, block->entries[j].length);
+		}
+	}
+	crud_pool_free(block);
+
+	// Write the new metadata, then drop the old blocks and directory
+	if (failed || crud_dir_sync(0)) {
+		crud_pool_free(oids);
+		return(-1);
+	}
+	for (i=0; i<count; i++) {
+		if (crud_dir_alias(oids, i) == -1) {
+			crud_client_operation(crud_formati(oids[i], CRUD_DELETE, 0, 0, 0), NULL);
+		}
+	}
+	crud_client_operation(crud_formati(old->directory, CRUD_DELETE, 0, 0, 0), NULL);
+	crud_pool_free(oids);
+	logMessage(LOG_INFO_LEVEL, "CRUD directory : converted version 1 directory (%u files).", dir_super.files);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_wait
+// Description  : Wait on a window of submitted requests
+//
+// Inputs       : tickets - the tickets of the requests
+//                resps - the place to put the responses (or NULL)
+//                count - the number of requests
+// Outputs      : 0 if they all succeeded, -1 if any failed
+
+static int crud_dir_wait(uint32_t *tickets, CrudResponse *resps, int count) {
+
+	// Local variables
+	CrudResponse ret;
+	int i, failed = 0;
+
+	for (i=0; i<count; i++) {
+		ret = crud_client_wait(tickets[i]);
+		failed |= get_ret(ret);
+		if (resps != NULL) {
+			resps[i] = ret;
+		}
+	}
+	return((failed) ? -1 : 0);
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_format
+// Description  : Write empty metadata to a freshly formatted device: the
+//                superblock (the priority object), one empty block and a
+//                directory of one slot
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_dir_format(void) {
+
+	// Local variables
+	CrudResponse ret;
+
+	// Create the superblock, then the rest of the metadata
+	if (crud_dir_empty(sizeof(CrudSuperblock))) {
+		return(-1);
+	}
+	ret = crud_client_operation(crud_formati(0, CRUD_CREATE, sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0), &dir_super);
+	if (get_ret(ret) == 1) {
+		return(-1);
+	}
+	return(crud_dir_sync(0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_mount
+// Description  : Read the superblock and the directory (but not the blocks,
+//                which are read as files are looked up).  A legacy file table
+//                or version 1 directory is converted and written back.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_dir_mount(void) {
+
+	// Local variables
+	CrudSuperblock super;
+	CrudResponse ret;
+	CrudOID *oids;
+	char *buf;
+	uint32_t i, count;
+	int32_t alias;
+	int len;
+
+	// Read the superblock (the head of the priority object if we can)
+	crud_dir_release();
+	if ((buf = crud_pool_alloc(CRUD_MAX_OBJECT_SIZE)) == NULL) {
+		return(-1);
+	}
+	if (crud_client_supports(CRUD_PROTOCOL_READ_RANGE)) {
+		ret = crud_client_range_operation(crud_formati(0, CRUD_READ_RANGE, sizeof(CrudSuperblock), CRUD_PRIORITY_OBJECT, 0), 0, buf);
+		if ((get_ret(ret) == 0) && (((CrudSuperblock *)buf)->magic != CRUD_SUPERBLOCK_MAGIC)) {
+			ret = crud_client_operation(crud_formati(0, CRUD_READ, CRUD_LEGACY_TABLE_SIZE, CRUD_PRIORITY_OBJECT, 0), buf);
+		}
+	} else {
+		ret = crud_client_operation(crud_formati(0, CRUD_READ, CRUD_MAX_OBJECT_SIZE, CRUD_PRIORITY_OBJECT, 0), buf);
+	}
+	len = get_len(ret);
+	if (get_ret(ret) == 1) {
+		crud_pool_free(buf);
+		return(-1);
+	}
+
+	// Convert the legacy table, otherwise check the superblock
+	if (((CrudSuperblock *)buf)->magic != CRUD_SUPERBLOCK_MAGIC) {
+		if (len != CRUD_LEGACY_TABLE_SIZE) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD directory : unknown file system on the device.");
+			crud_pool_free(buf);
+			return(-1);
+		}
+		ret = crud_dir_convert_legacy((CrudFileAllocationType *)buf);
+		crud_pool_free(buf);
+		return((int)ret);
+	}
+	memcpy(&super, buf, sizeof(CrudSuperblock));
+	crud_pool_free(buf);
+	if ((super.version == 1) && (super.global_depth <= CRUD_DIR_MAX_DEPTH)) {
+		return(crud_dir_convert_v1(&super));
+	}
+	if ((super.version < 2) || (super.version > CRUD_METADATA_VERSION) || (super.global_depth > CRUD_DIR_MAX_DEPTH)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : unsupported metadata version %u.", super.version);
+		return(-1);
+	}
+
+	// Version 2 differs only in having no chunked files, so it is kept
+	// as is and just relabelled on the next sync
+	dir_super = super;
+	if (dir_super.version != CRUD_METADATA_VERSION) {
+		dir_super.version = CRUD_METADATA_VERSION;
+		super_dirty = 1;
+	}
+
+	// Read the directory
+	count = 1 << dir_super.global_depth;
+	oids = crud_pool_alloc(count * sizeof(CrudOID));
+	dir_slots = malloc(count * sizeof(CrudDirBlock *));
+	if ((oids == NULL) || (dir_slots == NULL)) {
+		crud_pool_free(oids);
+		return(-1);
+	}
+	ret = crud_client_operation(crud_formati(dir_super.directory, CRUD_READ, count * sizeof(CrudOID), 0, 0), oids);
+	if ((get_ret(ret) == 1) || (get_len(ret) != count * sizeof(CrudOID))) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed to read the directory.");
+		crud_pool_free(oids);
+		return(-1);
+	}
+	dir_written_depth = dir_super.global_depth;
+
+	// Slots sharing a block share its descriptor
+	for (i=0; i<count; i++) {
+		if ((alias = crud_dir_alias(oids, i)) != -1) {
+			dir_slots[i] = dir_slots[alias];
+		} else if ((dir_slots[i] = crud_dir_new_block(oids[i])) == NULL) {
+			crud_pool_free(oids);
+			return(-1);
+		}
+	}
+	crud_pool_free(oids);
+	dir_mounted = 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_sync
+// Description  : Write the changed metadata to the device: the new blocks
+//                (created) and changed ranges of the others, then the
+//                directory if it changed, then the superblock.  Requests go
+//                out pipelined, a window at a time.
+//
+// Inputs       : close_device - 1 to close the device behind the writes
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_dir_sync(int close_device) {
+
+	// Local variables
+	uint32_t tickets[CRUD_MAX_INFLIGHT], i, count, size;
+	CrudResponse resps[CRUD_MAX_INFLIGHT];
+	CrudDirBlock *sent[CRUD_MAX_INFLIGHT], *block;
+	CrudOID *oids;
+	int n = 0, k, r, failed = 0;
+	char *buf;
+
+	// Write the blocks: new ones are created, the rest updated
+	for (i=0; i<dir_nblocks; i++) {
+		block = dir_blocks[i];
+		if (block->state & CRUD_DIR_DIRTY) {
+			if (block->oid == CRUD_NO_OBJECT) {
+				sent[n] = block;
+				tickets[n++] = crud_client_submit(crud_formati(0, CRUD_CREATE, CRUD_DIR_BLOCK_SIZE, 0, 0),
+						0, block->data, NULL, NULL);
+			} else if (crud_client_supports(CRUD_PROTOCOL_UPDATE_RANGE)) {
+				for (r=0; r<CRUD_DIR_RANGES; r++) {
+					if (block->dirty_lo[r] < block->dirty_hi[r]) {
+						sent[n] = block;
+						tickets[n++] = crud_client_submit(crud_formati(block->oid, CRUD_UPDATE_RANGE,
+								block->dirty_hi[r] - block->dirty_lo[r], 0, 0), block->dirty_lo[r],
+								(char *)block->data + block->dirty_lo[r], NULL, NULL);
+					}
+				}
+			} else {
+				sent[n] = block;
+				tickets[n++] = crud_client_submit(crud_formati(block->oid, CRUD_UPDATE, CRUD_DIR_BLOCK_SIZE, 0, 0),
+						0, block->data, NULL, NULL);
+			}
+			block->state &= ~CRUD_DIR_DIRTY;
+		}
+
+		// Collect the window once it may not fit the next block (or after
+		// the last block): the created blocks get their OIDs, the failed
+		// ones stay dirty
+		if ((n > CRUD_MAX_INFLIGHT - CRUD_DIR_RANGES) || ((i == dir_nblocks-1) && (n > 0))) {
+			failed |= crud_dir_wait(tickets, resps, n);
+			for (k=0; k<n; k++) {
+				if (get_ret(resps[k]) == 1) {
+					crud_dir_touch(sent[k], CRUD_DIR_RANGE_ENTRIES, 0, CRUD_DIR_BLOCK_SIZE);
+				} else if (sent[k]->oid == CRUD_NO_OBJECT) {
+					sent[k]->oid = get_oid(resps[k]);
+					dir_dirty = 1;
+				}
+			}
+			n = 0;
+		}
+	}
+	if (failed) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed writing directory blocks.");
+		return(-1);
+	}
+
+	// Write the directory, a new object when it changed size
+	if (dir_dirty) {
+		count = 1 << dir_super.global_depth;
+		if ((oids = crud_pool_alloc(count * sizeof(CrudOID))) == NULL) {
+			return(-1);
+		}
+		for (i=0; i<count; i++) {
+			oids[i] = dir_slots[i]->oid;
+		}
+		if ((dir_super.directory != CRUD_NO_OBJECT) && (dir_written_depth == dir_super.global_depth)) {
+			failed = get_ret(crud_client_operation(crud_formati(dir_super.directory, CRUD_UPDATE, count * sizeof(CrudOID), 0, 0), oids));
+		} else {
+			resps[0] = crud_client_operation(crud_formati(0, CRUD_CREATE, count * sizeof(CrudOID), 0, 0), oids);
+			failed = get_ret(resps[0]);
+			if (!failed && (dir_super.directory != CRUD_NO_OBJECT)){
+				crud_client_operation(crud_formati(dir_super.directory, CRUD_DELETE, 0, 0, 0), NULL);
+			}
+			if (!failed) {
+				dir_super.directory = get_oid(resps[0]);
+				dir_written_depth = dir_super.global_depth;
+				super_dirty = 1;
+			}
+		}
+		crud_pool_free(oids);
+		if (failed) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed writing the directory.");
+			return(-1);
+		}
+		dir_dirty = 0;
+	}
+
+	// Write the superblock (padded out to the priority object), and close
+	buf = NULL;
+	crud_client_cork(0, 1);
+	if (super_dirty) {
+		size = dir_super.size;
+		if ((buf = crud_pool_zalloc(size)) == NULL) {
+			crud_client_cork(0, 0);
+			return(-1);
+		}
+		memcpy(buf, &dir_super, sizeof(CrudSuperblock));
+		tickets[n++] = crud_client_submit(crud_formati(0, CRUD_UPDATE, size, CRUD_PRIORITY_OBJECT, 0), 0, buf, NULL, NULL);
+	}
+	if (close_device) {
+		tickets[n++] = crud_client_submit(crud_formati(0, CRUD_CLOSE, 0, 0, 0), 0, NULL, NULL, NULL);
+	}
+	crud_client_cork(0, 0);
+	failed = crud_dir_wait(tickets, NULL, n);
+	crud_pool_free(buf);
+	if (failed) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : failed writing the superblock.");
+		return(-1);
+	}
+	super_dirty = 0;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_find
+// Description  : Find the entry of a file, reading its block as needed.  If
+//                asked to, a missing file is created (empty), splitting its
+//                block when full.
+//
+// Inputs       : path - the filename
+//                create - 1 to create the file if it is not there
+//                ref - the place to put the reference to the entry
+// Outputs      : 0 if found (or created), -1 if not found or failure
+
+int crud_dir_find(char *path, int create, CrudDirectoryRef *ref) {
+
+	// Local variables
+	CrudDirBlock *block;
+	CrudDirectoryBlock *data;
+	uint32_t hash, i;
+
+	// Nothing to find before a format or mount
+	if (!dir_mounted) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD directory : file system not mounted.");
+		return(-1);
+	}
+	hash = crud_dir_hash(path);
+	for (;;) {
+
+		// Get the block for the slot, look the name up (by hash first)
+		block = dir_slots[hash & ((1U << dir_super.global_depth) - 1)];
+		if (!(block->state & CRUD_DIR_LOADED) && crud_dir_load(block)) {
+			return(-1);
+		}
+		data = block->data;
+		for (i=0; i<data->count; i++) {
+			if ((data->entries[i].hash == hash) && (strcmp((char *)data + data->entries[i].name, path) == 0)) {
+				break;
+			}
+		}
+
+		// Not there, add it if there is room, otherwise split and retry
+		if (i == data->count) {
+			if (!create) {
+				return(-1);
+			}
+			if (!crud_dir_room(block, path)) {
+				if (crud_dir_split(block)) {
+					return(-1);
+				}
+				continue;
+			}
+			i = crud_dir_append(block, hash, path, CRUD_NO_OBJECT, 0, 0, -1);
+			dir_super.files ++;
+			super_dirty = 1;
+		}
+
+		// Hand back the reference
+		ref->entry = &data->entries[i];
+		ref->handle = &block->handles[i];
+		ref->block = block;
+		return(0);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_dirty
+// Description  : Note that the entry of a file has changed
+//
+// Inputs       : ref - the reference to the entry
+// Outputs      : none
+
+void crud_dir_dirty(CrudDirectoryRef *ref) {
+	CrudDirBlock *block = ref->block;
+	crud_dir_touch_entry(block, ref->entry - block->data->entries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dir_files
+// Description  : Get the number of files in the file system
+//
+// Inputs       : none
+// Outputs      : the number of files
+
+uint32_t crud_dir_files(void) {
+	return(dir_super.files);
+}
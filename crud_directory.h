@@ -0,0 +1,111 @@
+#ifndef CRUD_DIRECTORY_INCLUDED
+#define CRUD_DIRECTORY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_directory.h
+//  Description    : This is the header file for the file system metadata of
+//                   the CRUD storage system.  Files are found through an
+//                   extendible hash of directory blocks, each its own object.
+//                   The priority object holds the superblock, which names the
+//                   object holding the directory (one block OID per slot).
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 01:59:11 UTC 2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Project include files
+#include <crud_driver.h>
+#include <crud_file_io.h>
+
+// Defines
+#define CRUD_SUPERBLOCK_MAGIC 0x44555243  // "CRUD", marks the superblock
+#define CRUD_DIR_BLOCK_MAGIC  0x4b4c4244  // "DBLK", marks a directory block
+#define CRUD_METADATA_VERSION 3           // Version of the metadata layout
+#define CRUD_DIR_BLOCK_SIZE   0x8000      // Bytes in a directory block object
+#define CRUD_DIR_MAX_DEPTH    17          // Directory of 2^17 blocks (512 KB object)
+#define CRUD_DIR_BLOCK_ENTRIES ((CRUD_DIR_BLOCK_SIZE - sizeof(CrudDirectoryBlock)) / (sizeof(CrudDirectoryEntry) + 2))
+#define CRUD_DIR_V1_ENTRIES   240         // Entries in a version 1 directory block
+
+// Type definitions
+
+// This is the superblock, at the start of the priority object
+typedef struct {
+	uint32_t  magic;        // CRUD_SUPERBLOCK_MAGIC
+	uint32_t  version;      // CRUD_METADATA_VERSION
+	uint32_t  size;         // Length of the priority object holding it
+	uint32_t  global_depth; // The directory has 2^global_depth slots
+	CrudOID   directory;    // Object holding the directory
+	uint32_t  blocks;       // Number of directory blocks
+	uint32_t  files;        // Number of files
+	uint32_t  reserved;     // Unused, zero
+} CrudSuperblock;
+
+// This is a file in a directory block
+typedef struct {
+	uint32_t  hash;         // Hash of the filename
+	CrudOID   object_id;    // The object holding the data (or chunk map)
+	uint32_t  length;       // The length of the file
+	uint16_t  name;         // Offset of the filename (NUL terminated) in the block
+	uint16_t  flags;        // CRUD_FILE_* flags (zero in version 2)
+} CrudDirectoryEntry;
+
+// This is a directory block, one object each.  The entries fill up from the
+// front and the filenames down from the end of the block.
+typedef struct {
+	uint32_t  magic;        // CRUD_DIR_BLOCK_MAGIC
+	uint16_t  local_depth;  // Hash bits shared by every file in the block
+	uint16_t  count;        // Number of entries in use
+	uint32_t  names;        // Offset of the first filename byte
+	uint32_t  reserved;     // Unused, zero
+	CrudDirectoryEntry entries[]; // The files
+} CrudDirectoryBlock;
+
+// This is a file in a version 1 directory block (converted on mount)
+typedef struct {
+	char      filename[CRUD_MAX_PATH_LENGTH]; // The filename
+	CrudOID   object_id;                      // The object holding the data
+	uint32_t  length;                         // The length of the file
+} CrudDirectoryEntryV1;
+
+// This is a version 1 directory block
+typedef struct {
+	uint32_t  magic;        // CRUD_DIR_BLOCK_MAGIC
+	uint32_t  local_depth;  // Hash bits shared by every file in the block
+	uint32_t  count;        // Number of entries in use
+	uint32_t  reserved;     // Unused, zero
+	CrudDirectoryEntryV1 entries[CRUD_DIR_V1_ENTRIES]; // The files
+} CrudDirectoryBlockV1;
+
+// A reference to a file's entry, valid until the directory next changes
+typedef struct {
+	CrudDirectoryEntry *entry;  // The entry of the file
+	int16_t            *handle; // Open handle of the file, -1 if none
+	void               *block;  // The (in memory) block holding the entry
+} CrudDirectoryRef;
+
+//
+// Directory interface (callers serialize all calls)
+
+int crud_dir_format(void);
+	// Write empty metadata (superblock, directory and one block) to the device
+
+int crud_dir_mount(void);
+	// Read the superblock and the directory, converting older layouts
+
+int crud_dir_sync(int close_device);
+	// Write the changed metadata to the device, then optionally close it
+
+int crud_dir_find(char *path, int create, CrudDirectoryRef *ref);
+	// Find (or create) the entry of a file, 0 if found, -1 if not/failure
+
+void crud_dir_dirty(CrudDirectoryRef *ref);
+	// Note that the entry of a file has changed
+
+uint32_t crud_dir_files(void);
+	// The number of files in the file system
+
+#endif
@@ -0,0 +1,937 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_driver.c
+//  Description    : This is the implementation of the CRUD object store
+//                   behind the CRUD server.  Objects are kept in memory in
+//                   a hash table indexed by object ID, loaded from and saved
+//                   to the store file (CRUD_STORE_FILE) as the device is
+//                   initialized and closed.  The store may be split into
+//                   shards by object ID, each only ever used by one thread;
+//                   all the shards share are the next object ID and the
+//                   priority object, which are kept atomically.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:53:36 UTC 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Project includes
+#include <crud_driver.h>
+#include <cmpsc311_hashtable.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_STORE_FILE "crud_content.crd"  // The file holding the store
+#define CRUD_STORE_ALL_SHARDS -1            // Load every shard from the store file
+#define CRUD_FIRST_OID 4096                 // The first object ID handed out
+#define CRUD_RESULT(resp) ((resp) & 0x1)     // The result bit of a response
+
+//
+// Type definitions
+
+// This is an object in the store
+typedef struct {
+	CrudOID   oid;     // The object ID
+	uint8_t   flags;   // The object flags (CRUD_FLAG_TYPES)
+	uint32_t  length;  // The length of the object
+	char     *data;    // The object contents
+} CrudObject;
+
+// This is a shard of the store
+typedef struct {
+	HashTable objects;      // The objects, by object ID
+	int       initialized;  // Is the shard loaded?
+	char     *packed;       // The objects as written to the store file (see crud_pack_shard)
+	uint32_t  packed_length; // Its length
+	uint32_t  packed_count;  // The number of objects in it
+} CrudStore;
+
+//
+// Global data
+
+const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL] = {
+	"CRUD_INIT", "CRUD_FORMAT", "CRUD_CREATE", "CRUD_READ", "CRUD_UPDATE", "CRUD_DELETE",
+	"CRUD_CLOSE", "CRUD_READ_RANGE", "CRUD_APPEND", "CRUD_UPDATE_RANGE", "CRUD_BATCH", "CRUD_UNKNOWN"
+};
+const char *CRUD_FLAG_TYPE_LABLES[CRUD_FLAGMAX] = { "CRUD_NULL_FLAG", "CRUD_PRIORITY_OBJECT" };
+
+CrudOID   crud_next_oid = CRUD_FIRST_OID; // The next object ID handed out (atomic)
+CrudOID   crud_priority_oid = CRUD_NO_OBJECT; // The priority object, if any (atomic)
+CrudStore crud_stores[CRUD_MAX_SHARDS];  // The shards of the store
+int       crud_store_count = 1;          // The number of shards
+
+//
+// Functional prototypes
+
+int initialize_crud( CrudStore *store );
+int format_crud( CrudStore *store );
+CrudObject *find_crud_object( CrudStore *store, CrudOID oid, uint8_t flags );
+int create_crud_object( CrudStore *store, uint8_t flags, uint32_t length, void *buf, CrudOID *oid );
+int read_crud_object( CrudStore *store, CrudOID oid, uint8_t flags, int whole, uint32_t offset, uint32_t length, void *buf, uint32_t *got );
+int update_crud_object( CrudStore *store, CrudOID oid, uint8_t flags, uint32_t offset, uint32_t length, void *buf, uint32_t *objlen );
+int append_crud_object( CrudStore *store, CrudOID oid, uint8_t flags, uint32_t length, void *buf, uint32_t *objlen );
+int delete_crud_object( CrudStore *store, CrudOID oid, uint8_t flags );
+int shutdown_crud( CrudStore *store );
+int crud_read_store( char *fname, int shard );
+int crud_pack_shard( CrudStore *store );
+int crud_write_packed( char *fname );
+void free_crud_object( void *obj );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bus_request
+// Description  : This is the bus interface for communicating with the CRUD
+//                store (requests without an object offset)
+//
+// Inputs       : request - the request
+//                buf - the data to write (CREATE/UPDATE/APPEND), or the
+//                      place to put the object (READ, Length bytes)
+// Outputs      : the response
+
+CrudResponse crud_bus_request( CrudRequest request, void *buf ) {
+	return( crud_bus_range_request(request, 0, buf) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_bus_range_request
+// Description  : This is the bus interface for communicating with the CRUD
+//                store, for all requests (ranged requests use the offset).
+//                The store must not be sharded.
+//
+// Inputs       : request - the request
+//                offset - the object offset (READ_RANGE/UPDATE_RANGE)
+//                buf - the data to write (CREATE/UPDATE/APPEND/UPDATE_RANGE),
+//                      or the place to put the bytes read (READ/READ_RANGE,
+//                      Length bytes)
+// Outputs      : the response
+
+CrudResponse crud_bus_range_request( CrudRequest request, uint32_t offset, void *buf ) {
+
+	// Local variables
+	CRUD_REQUEST_TYPES req = (request >> 28) & 0xf;
+	CrudResponse resp;
+
+	// Serve it on the one shard (handing out the ID of a new object), the
+	// close writes the store file
+	if ( req == CRUD_CREATE ) {
+		request &= 0xffffffffULL;
+	}
+	resp = crud_shard_request( 0, request, offset, buf );
+	if ( (req == CRUD_CLOSE) && ! CRUD_RESULT(resp) && crud_store_commit() ) {
+		resp |= 0x1;
+	}
+	return( resp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_shards
+// Description  : Split the store into shards, object IDs going to shards
+//                round robin.  Done before any request is served.
+//
+// Inputs       : shards - the number of shards
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_shards( int shards ) {
+	if ( (shards < 1) || (shards > CRUD_MAX_SHARDS) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: bad number of store shards [%d]", shards );
+		return( -1 );
+	}
+	crud_store_count = shards;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_shard
+// Description  : Find the shard an object is kept in
+//
+// Inputs       : oid - the object ID
+// Outputs      : the shard
+
+int crud_store_shard( CrudOID oid ) {
+	return( oid % crud_store_count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_new_oid
+// Description  : Hand out the ID for a new object
+//
+// Inputs       : none
+// Outputs      : the object ID
+
+CrudOID crud_store_new_oid( void ) {
+	return( __atomic_fetch_add(&crud_next_oid, 1, __ATOMIC_RELAXED) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_priority
+// Description  : Find the ID of the priority object
+//
+// Inputs       : none
+// Outputs      : the object ID, CRUD_NO_OBJECT if there is none
+
+CrudOID crud_store_priority( void ) {
+	return( __atomic_load_n(&crud_priority_oid, __ATOMIC_ACQUIRE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_commit
+// Description  : Write the shards packed by CRUD_CLOSE to the store file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_store_commit( void ) {
+	return( crud_write_packed(CRUD_STORE_FILE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shard_request
+// Description  : Serve a request on one shard of the store.  CREATE uses
+//                the object ID of the request if it has one (handed out by
+//                crud_store_new_oid).  INIT, FORMAT and CLOSE work on the
+//                shard alone: CLOSE packs the shard and empties it, the
+//                packed shards are written by crud_store_commit.
+//
+// Inputs       : shard - the shard
+//                request - the request
+//                offset - the object offset (READ_RANGE/UPDATE_RANGE)
+//                buf - the data to write (CREATE/UPDATE/APPEND/UPDATE_RANGE),
+//                      or the place to put the bytes read (READ/READ_RANGE,
+//                      Length bytes)
+// Outputs      : the response
+
+CrudResponse crud_shard_request( int shard, CrudRequest request, uint32_t offset, void *buf ) {
+
+	// Local variables
+	CrudStore *store = &crud_stores[shard];
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, rlen;
+	uint8_t flags, res;
+	int ret = -1;
+
+	// Pull the request apart, log it
+	deconstruct_crud_request( request, &oid, &req, &length, &flags, &res );
+	logMessage( LOG_INFO_LEVEL, "Received CRUD request: %s, len=%d, oid=%d, flgs=%d",
+			CRUD_REQUEST_TYPE_LABLES[(req < CRUD_UNKNOWN) ? req : CRUD_UNKNOWN], length, oid, flags );
+	rlen = length;
+
+	// Everything but the initialization needs a loaded store
+	if ( (req != CRUD_INIT) && ! store->initialized ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD Driver Error: request on an uninitialized store" );
+		req = (req < CRUD_UNKNOWN) ? req : CRUD_UNKNOWN;
+		return( construct_crud_request(oid, req, 0, flags, 1) );
+	}
+
+	// Do the request
+	switch ( req ) {
+	case CRUD_INIT:
+		ret = (store->initialized) ? 0 : initialize_crud( store );
+		break;
+
+	case CRUD_FORMAT:
+		ret = format_crud( store );
+		break;
+
+	case CRUD_CREATE:
+		ret = create_crud_object( store, flags, length, buf, &oid );
+		break;
+
+	case CRUD_READ:
+		ret = read_crud_object( store, oid, flags, 1, 0, length, buf, &rlen );
+		break;
+
+	case CRUD_READ_RANGE:
+		ret = read_crud_object( store, oid, flags, 0, offset, length, buf, &rlen );
+		break;
+
+	case CRUD_UPDATE:
+		ret = update_crud_object( store, oid, flags, CRUD_MAX_OBJECT_SIZE+1, length, buf, &rlen );
+		break;
+
+	case CRUD_UPDATE_RANGE:
+		ret = update_crud_object( store, oid, flags, offset, length, buf, &rlen );
+		break;
+
+	case CRUD_APPEND:
+		ret = append_crud_object( store, oid, flags, length, buf, &rlen );
+		break;
+
+	case CRUD_DELETE:
+		ret = delete_crud_object( store, oid, flags );
+		break;
+
+	case CRUD_CLOSE:
+		ret = shutdown_crud( store );
+		break;
+
+	default:
+		logMessage( LOG_ERROR_LEVEL, "CRUD Driver Error: unkown request type (%u)", req );
+		req = CRUD_UNKNOWN;
+		break;
+	}
+
+	// Failed reads return no data
+	if ( (ret == -1) && ((req == CRUD_READ) || (req == CRUD_READ_RANGE)) ) {
+		rlen = 0;
+	}
+	logMessage( LOG_INFO_LEVEL, "Sending CRUD response: %s, len=%d, oid=%d, flgs=%d",
+			CRUD_REQUEST_TYPE_LABLES[req], rlen, oid, flags );
+	return( construct_crud_request(oid, req, rlen, flags, (ret == -1)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_store
+// Description  : Write the contents of the CRUD store to a disk file: the
+//                next object ID and the number of objects, then each object
+//                (ID, flags, length and contents), in host byte order.  No
+//                request may be running.
+//
+// Inputs       : fname - the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_save_store( char *fname ) {
+
+	// Local variables
+	int i;
+
+	// Pack each shard, then write them out
+	for ( i=0; i<crud_store_count; i++ ) {
+		if ( crud_stores[i].initialized && crud_pack_shard(&crud_stores[i]) ) {
+			return( -1 );
+		}
+	}
+	return( crud_write_packed(fname) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_store
+// Description  : Read the contents of the CRUD store from a disk file (see
+//                crud_save_store) into the shards, a missing file leaves the
+//                store empty
+//
+// Inputs       : fname - the file to read
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_load_store( char *fname ) {
+	return( crud_read_store(fname, CRUD_STORE_ALL_SHARDS) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_unit_test
+// Description  : This is a function used to test the CRUD store: it runs
+//                a series of requests on a scratch store and checks them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_unit_test( void ) {
+
+	// Local variables
+	char block[256], back[256];
+	CrudResponse resp;
+	CrudOID oid, ooid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+	int i;
+
+	// The store must not be in use
+	if ( crud_stores[0].initialized || (crud_store_count != 1) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD_UNIT_TEST : store in use, not testing." );
+		return( -1 );
+	}
+	if ( hashTableUnitTest() || initHashTable(&crud_stores[0].objects, 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD Unit test : HT init failued" );
+		return( -1 );
+	}
+	crud_stores[0].initialized = 1;
+
+	// Create an object, read it back, update and read a range, append and delete it
+	for ( i=0; i<sizeof(block); i++ ) {
+		block[i] = (char)i;
+	}
+	resp = crud_bus_request( construct_crud_request(0, CRUD_CREATE, 128, 0, 0), block );
+	deconstruct_crud_request( resp, &oid, &req, &length, &flags, &res );
+	if ( res || (req != CRUD_CREATE) || (length != 128) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD_UNIT_TEST : Failure creating block." );
+		res = 1;
+	}
+	if ( !res ) {
+		resp = crud_bus_request( construct_crud_request(oid, CRUD_READ, sizeof(back), 0, 0), back );
+		deconstruct_crud_request( resp, &ooid, &req, &length, &flags, &res );
+		if ( res || (length != 128) || memcmp(block, back, 128) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD_UNIT_TEST : Failure read comparison block." );
+			res = 1;
+		}
+	}
+	if ( !res ) {
+		resp = crud_bus_range_request( construct_crud_request(oid, CRUD_UPDATE_RANGE, 16, 0, 0), 100, &block[200] );
+		memcpy( &block[100], &block[200], 16 );
+		i = CRUD_RESULT( resp );
+		resp = crud_bus_range_request( construct_crud_request(oid, CRUD_READ_RANGE, 64, 0, 0), 96, back );
+		deconstruct_crud_request( resp, &ooid, &req, &length, &flags, &res );
+		if ( i || res || (length != 32) || memcmp(&block[96], back, 32) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD_UNIT_TEST : Failure updating block [%d].", oid );
+			res = 1;
+		}
+	}
+	if ( !res ) {
+		resp = crud_bus_range_request( construct_crud_request(oid, CRUD_READ_RANGE, 32, 0, 0), 0, back );
+		deconstruct_crud_request( resp, &ooid, &req, &length, &flags, &res );
+		if ( res || (length != 32) || memcmp(block, back, 32) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD_UNIT_TEST : Failure reading head of block [%d].", oid );
+			res = 1;
+		}
+	}
+	if ( !res ) {
+		resp = crud_bus_request( construct_crud_request(oid, CRUD_APPEND, 128, 0, 0), &block[128] );
+		deconstruct_crud_request( resp, &ooid, &req, &length, &flags, &res );
+		res = res || (length != 256) ||
+				CRUD_RESULT(crud_bus_request(construct_crud_request(oid, CRUD_UPDATE, 256, 0, 0), block)) ||
+				CRUD_RESULT(crud_bus_request(construct_crud_request(oid, CRUD_DELETE, 0, 0, 0), NULL)) ||
+				! CRUD_RESULT(crud_bus_request(construct_crud_request(oid, CRUD_READ, sizeof(back), 0, 0), back));
+		if ( res ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD_UNIT_TEST : Failure deleting block [%d].", oid );
+		}
+	}
+
+	// Throw the scratch store away, log and return
+	cleanupHashTable( &crud_stores[0].objects, free_crud_object );
+	crud_stores[0].initialized = 0;
+	crud_priority_oid = CRUD_NO_OBJECT;
+	crud_next_oid = CRUD_FIRST_OID;
+	if ( res ) {
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD_UNIT_TEST : store unit test successful." );
+	return( 0 );
+}
+
+//
+// Local functions
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : initialize_crud
+// Description  : Set up a shard of the store, loading its objects from the
+//                store file
+//
+// Inputs       : store - the shard
+// Outputs      : 0 if successful, -1 if failure
+
+int initialize_crud( CrudStore *store ) {
+
+	// Set up the table, load the contents
+	if ( initHashTable(&store->objects, 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: initialization of object storage failed." );
+		return( -1 );
+	}
+	store->initialized = 1;
+	if ( crud_read_store(CRUD_STORE_FILE, store - crud_stores) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: unable to load contents of crud device." );
+		format_crud( store );
+		cleanupHashTable( &store->objects, free_crud_object );
+		store->initialized = 0;
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD: Object store initialized [shard %d, next OID %lu, %u objects]",
+			(int)(store - crud_stores), (unsigned long)crud_next_oid, store->objects.count );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : format_crud
+// Description  : Delete every object in a shard (object IDs are not reused)
+//
+// Inputs       : store - the shard
+// Outputs      : 0 if successful, -1 if failure
+
+int format_crud( CrudStore *store ) {
+
+	// Local variables
+	CrudOID prio = crud_store_priority();
+
+	// Empty the table, dropping the priority object if it was here
+	cleanupHashTable( &store->objects, free_crud_object );
+	if ( (prio != CRUD_NO_OBJECT) && (crud_store_shard(prio) == store - crud_stores) ) {
+		__atomic_compare_exchange_n( &crud_priority_oid, &prio, CRUD_NO_OBJECT, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+	}
+	if ( initHashTable(&store->objects, 0) ) {
+		store->initialized = 0;
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD: Object store formatted." );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_crud_object
+// Description  : Find the object a request names (the priority object if
+//                the request carries CRUD_PRIORITY_OBJECT)
+//
+// Inputs       : store - the shard
+//                oid - the object ID
+//                flags - the request flags
+// Outputs      : the object, NULL if none
+
+CrudObject *find_crud_object( CrudStore *store, CrudOID oid, uint8_t flags ) {
+	if ( flags & CRUD_PRIORITY_OBJECT ) {
+		oid = crud_store_priority();
+		return( (oid == CRUD_NO_OBJECT) ? NULL : findValueInHashTable(&store->objects, oid) );
+	}
+	return( findValueInHashTable(&store->objects, oid) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : create_crud_object
+// Description  : Create a new object
+//
+// Inputs       : store - the shard
+//                flags - the object flags
+//                length - the length of the object
+//                buf - the contents
+//                oid - the ID handed out for the object (CRUD_NO_OBJECT to
+//                      hand one out here), set to the new object ID
+// Outputs      : 0 if successful, -1 if failure
+
+int create_crud_object( CrudStore *store, uint8_t flags, uint32_t length, void *buf, CrudOID *oid ) {
+
+	// Local variables
+	CrudOID none = CRUD_NO_OBJECT;
+	CrudObject *obj;
+
+	// Check the request
+	if ( (flags & CRUD_PRIORITY_OBJECT) && (crud_store_priority() != CRUD_NO_OBJECT) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: cannot create priority object, one already exists" );
+		return( -1 );
+	}
+	if ( length > CRUD_MAX_OBJECT_SIZE ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: object too large on create [%u bytes]", length );
+		return( -1 );
+	}
+
+	// Make the object
+	if ( ((obj = calloc(1, sizeof(CrudObject))) == NULL) || ((obj->data = malloc(length + 1)) == NULL) ) {
+		free( obj );
+		return( -1 );
+	}
+	obj->oid = (*oid == CRUD_NO_OBJECT) ? crud_store_new_oid() : *oid;
+	obj->flags = flags;
+	obj->length = length;
+	memcpy( obj->data, buf, length );
+
+	// Claim the priority object (another shard may have got there first), insert it
+	if ( (flags & CRUD_PRIORITY_OBJECT) &&
+			! __atomic_compare_exchange_n(&crud_priority_oid, &none, obj->oid, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: cannot create priority object, one already exists" );
+		free_crud_object( obj );
+		return( -1 );
+	}
+	if ( insertValueInHashTable(&store->objects, obj->oid, obj) ) {
+		logMessage( LOG_ERROR_LEVEL, "Inserting new object that already exists [OID=%d]", obj->oid );
+		if ( flags & CRUD_PRIORITY_OBJECT ) {
+			__atomic_store_n( &crud_priority_oid, CRUD_NO_OBJECT, __ATOMIC_RELEASE );
+		}
+		free_crud_object( obj );
+		return( -1 );
+	}
+	*oid = obj->oid;
+	logMessage( LOG_INFO_LEVEL, "CRUD: new object [OID %lu], length %d bytes", (unsigned long)obj->oid, length );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_crud_object
+// Description  : Read an object, or a range of it
+//
+// Inputs       : store - the shard
+//                oid - the object ID
+//                flags - the request flags
+//                whole - 1 to read the whole object (CRUD_READ), 0 for a range
+//                offset - the offset of the range
+//                length - the bytes wanted (the size of buf)
+//                buf - the place to put the bytes
+//                got - the place to put the number of bytes read
+// Outputs      : 0 if successful, -1 if failure
+
+int read_crud_object( CrudStore *store, CrudOID oid, uint8_t flags, int whole, uint32_t offset, uint32_t length, void *buf, uint32_t *got ) {
+
+	// Local variables
+	CrudObject *obj;
+
+	// Find the object, check the range
+	if ( (obj = find_crud_object(store, oid, flags)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: read non-existent object [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+	if ( offset > obj->length ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: read past end of object [OID %lu, %u>%u]", (unsigned long)oid, offset, obj->length );
+		return( -1 );
+	}
+
+	// Whole objects must fit the buffer, ranges are cut short at the end
+	*got = obj->length - offset;
+	if ( *got > length ) {
+		if ( whole ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD: read target buffer too small [OID %d<%d]", length, obj->length );
+			return( -1 );
+		}
+		*got = length;
+	}
+	memcpy( buf, &obj->data[offset], *got );
+	logMessage( LOG_INFO_LEVEL, "CRUD: object [OID %lu] read %d bytes.", (unsigned long)obj->oid, *got );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : update_crud_object
+// Description  : Update an object, or a range within it (neither may change
+//                the length of the object)
+//
+// Inputs       : store - the shard
+//                oid - the object ID
+//                flags - the request flags
+//                offset - the offset of the range, CRUD_MAX_OBJECT_SIZE+1
+//                         to replace the whole object
+//                length - the bytes to write
+//                buf - the bytes
+//                objlen - the place to put the length of the object
+// Outputs      : 0 if successful, -1 if failure
+
+int update_crud_object( CrudStore *store, CrudOID oid, uint8_t flags, uint32_t offset, uint32_t length, void *buf, uint32_t *objlen ) {
+
+	// Local variables
+	CrudObject *obj;
+	int whole = (offset > CRUD_MAX_OBJECT_SIZE);
+
+	// Find the object, check the update fits it
+	if ( (obj = find_crud_object(store, oid, flags)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: update non-existent object [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+	if ( (whole && (length != obj->length)) || (!whole && ((uint64_t)offset + length > obj->length)) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: update length mismatch [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+	if ( (flags & CRUD_PRIORITY_OBJECT) != (obj->flags & CRUD_PRIORITY_OBJECT) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: trying to change the priority of an object [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+
+	// Copy the bytes in, return the object length
+	memcpy( &obj->data[(whole) ? 0 : offset], buf, length );
+	*objlen = obj->length;
+	logMessage( LOG_INFO_LEVEL, "CRUD: object [OID %lu] update %d bytes.", (unsigned long)obj->oid, length );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : append_crud_object
+// Description  : Add bytes to the end of an object
+//
+// Inputs       : store - the shard
+//                oid - the object ID
+//                flags - the request flags
+//                length - the bytes to add
+//                buf - the bytes
+//                objlen - the place to put the new length of the object
+// Outputs      : 0 if successful, -1 if failure
+
+int append_crud_object( CrudStore *store, CrudOID oid, uint8_t flags, uint32_t length, void *buf, uint32_t *objlen ) {
+
+	// Local variables
+	CrudObject *obj;
+	char *data;
+
+	// Find the object, check it can grow
+	if ( (obj = find_crud_object(store, oid, flags)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: append to non-existent object [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+	if ( obj->length + length > CRUD_MAX_OBJECT_SIZE ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: append past the largest object [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+
+	// Grow the object, add the bytes
+	if ( (data = realloc(obj->data, obj->length + length + 1)) == NULL ) {
+		return( -1 );
+	}
+	obj->data = data;
+	memcpy( &obj->data[obj->length], buf, length );
+	obj->length += length;
+	*objlen = obj->length;
+	logMessage( LOG_INFO_LEVEL, "CRUD: object [OID %lu] append %d bytes.", (unsigned long)obj->oid, length );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : delete_crud_object
+// Description  : Delete an object
+//
+// Inputs       : store - the shard
+//                oid - the object ID
+//                flags - the request flags
+// Outputs      : 0 if successful, -1 if failure
+
+int delete_crud_object( CrudStore *store, CrudOID oid, uint8_t flags ) {
+
+	// Local variables
+	CrudObject *obj;
+	CrudOID prio;
+
+	// Find the object, take it out of the store
+	if ( (obj = find_crud_object(store, oid, flags)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: failure deleting non-existent object [OID %lu]", (unsigned long)oid );
+		return( -1 );
+	}
+	deleteValueFromHashTable( &store->objects, obj->oid );
+	if ( obj->flags & CRUD_PRIORITY_OBJECT ) {
+		prio = obj->oid;
+		__atomic_compare_exchange_n( &crud_priority_oid, &prio, CRUD_NO_OBJECT, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD: object [OID %lu] deleted.", (unsigned long)obj->oid );
+	free_crud_object( obj );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shutdown_crud
+// Description  : Close a shard of the store, packing its objects for the
+//                store file (see crud_store_commit)
+//
+// Inputs       : store - the shard
+// Outputs      : 0 if successful, -1 if failure
+
+int shutdown_crud( CrudStore *store ) {
+
+	// Local variables
+	CrudOID prio = crud_store_priority();
+
+	// Pack the contents, then empty the shard
+	if ( crud_pack_shard(store) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: save crud content failed." );
+		return( -1 );
+	}
+	cleanupHashTable( &store->objects, free_crud_object );
+	if ( (prio != CRUD_NO_OBJECT) && (crud_store_shard(prio) == store - crud_stores) ) {
+		__atomic_compare_exchange_n( &crud_priority_oid, &prio, CRUD_NO_OBJECT, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED );
+	}
+	store->initialized = 0;
+	logMessage( LOG_INFO_LEVEL, "CRUD: Object store closed" );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_store
+// Description  : Read the contents of the CRUD store from a disk file (see
+//                crud_save_store), keeping the objects of one shard (or all
+//                of them).  A missing file leaves the store empty.
+//
+// Inputs       : fname - the file to read
+//                shard - the shard to load, CRUD_STORE_ALL_SHARDS for every
+//                        shard (each must be initialized)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_read_store( char *fname, int shard ) {
+
+	// Local variables
+	CrudObject *obj;
+	CrudOID next, seen;
+	uint32_t count, i;
+	FILE *fh;
+	int mine;
+
+	// Open the file, read the header (the next object ID only ever moves up)
+	if ( access(fname, F_OK) == -1 ) {
+		logMessage( LOG_INFO_LEVEL, "CRUD repository file [%s] does not exist, not loading", fname );
+		return( 0 );
+	}
+	if ( (fh = fopen(fname, "r")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening CRUD data for read [%s], error=[%s]", fname, strerror(errno) );
+		return( -1 );
+	}
+	if ( (fread(&next, sizeof(next), 1, fh) != 1) || (fread(&count, sizeof(count), 1, fh) != 1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure reading CRUD initial data [%s], error=[%s]", fname, strerror(errno) );
+		fclose( fh );
+		return( -1 );
+	}
+	seen = __atomic_load_n( &crud_next_oid, __ATOMIC_RELAXED );
+	while ( (seen < next) &&
+			! __atomic_compare_exchange_n(&crud_next_oid, &seen, next, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+
+	// Read each object, keeping those of the shard
+	for ( i=0; i<count; i++ ) {
+		if ( (obj = calloc(1, sizeof(CrudObject))) == NULL ) {
+			fclose( fh );
+			return( -1 );
+		}
+		if ( (fread(&obj->oid, sizeof(obj->oid), 1, fh) != 1) || (fread(&obj->flags, sizeof(obj->flags), 1, fh) != 1) ||
+				(fread(&obj->length, sizeof(obj->length), 1, fh) != 1) || (obj->length > CRUD_MAX_OBJECT_SIZE) ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure reading CRUD element data [%s], error=[%s]", fname, strerror(errno) );
+			free( obj );
+			fclose( fh );
+			return( -1 );
+		}
+		mine = (shard == CRUD_STORE_ALL_SHARDS) || (crud_store_shard(obj->oid) == shard);
+		if ( ! mine ) {
+			fseek( fh, obj->length, SEEK_CUR );
+			free( obj );
+			continue;
+		}
+		if ( ((obj->data = malloc(obj->length + 1)) == NULL) ||
+				(fread(obj->data, 1, obj->length, fh) != obj->length) ||
+				! crud_stores[crud_store_shard(obj->oid)].initialized ||
+				insertValueInHashTable(&crud_stores[crud_store_shard(obj->oid)].objects, obj->oid, obj) ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure reading CRUD element content [%s], error=[%s]", fname, strerror(errno) );
+			free_crud_object( obj );
+			fclose( fh );
+			return( -1 );
+		}
+		if ( obj->flags & CRUD_PRIORITY_OBJECT ) {
+			__atomic_store_n( &crud_priority_oid, obj->oid, __ATOMIC_RELEASE );
+		}
+	}
+
+	// Close the file and return
+	fclose( fh );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_shard
+// Description  : Serialize the objects of a shard as they are written to the
+//                store file (ID, flags, length and contents)
+//
+// Inputs       : store - the shard
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pack_shard( CrudStore *store ) {
+
+	// Local variables
+	HashTableIterator it;
+	CrudObject *obj;
+	uint32_t length = 0;
+	char *ptr;
+
+	// Size the objects, then copy each in
+	initHashTableIterator( &store->objects, &it );
+	while ( (obj = iterateHashTable(&it, NULL)) != NULL ) {
+		length += sizeof(obj->oid) + sizeof(obj->flags) + sizeof(obj->length) + obj->length;
+	}
+	free( store->packed );
+	if ( (store->packed = malloc(length + 1)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD: allocation of %u bytes packing the store failed", length );
+		store->packed_length = store->packed_count = 0;
+		return( -1 );
+	}
+	ptr = store->packed;
+	initHashTableIterator( &store->objects, &it );
+	while ( (obj = iterateHashTable(&it, NULL)) != NULL ) {
+		memcpy( ptr, &obj->oid, sizeof(obj->oid) );
+		ptr += sizeof(obj->oid);
+		memcpy( ptr, &obj->flags, sizeof(obj->flags) );
+		ptr += sizeof(obj->flags);
+		memcpy( ptr, &obj->length, sizeof(obj->length) );
+		ptr += sizeof(obj->length);
+		memcpy( ptr, obj->data, obj->length );
+		ptr += obj->length;
+	}
+	store->packed_length = length;
+	store->packed_count = store->objects.count;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_packed
+// Description  : Write the packed shards to a disk file (the next object ID
+//                and the number of objects, then the objects) and free them
+//
+// Inputs       : fname - the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_write_packed( char *fname ) {
+
+	// Local variables
+	uint32_t count = 0;
+	FILE *fh;
+	int failed, i;
+
+	// Open the file, write the header
+	logMessage( LOG_INFO_LEVEL, "Storing the CRUD store contents to [%s] ...", fname );
+	for ( i=0; i<crud_store_count; i++ ) {
+		count += crud_stores[i].packed_count;
+	}
+	if ( (fh = fopen(fname, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening array data for store [%s], error=[%s]", fname, strerror(errno) );
+		failed = -1;
+	} else {
+		failed = (fwrite(&crud_next_oid, sizeof(crud_next_oid), 1, fh) != 1) ||
+				(fwrite(&count, sizeof(count), 1, fh) != 1);
+
+		// Write each shard
+		for ( i=0; !failed && (i<crud_store_count); i++ ) {
+			failed = (fwrite(crud_stores[i].packed, 1, crud_stores[i].packed_length, fh) != crud_stores[i].packed_length);
+		}
+		if ( (fclose(fh) != 0) || failed ) {
+			logMessage( LOG_ERROR_LEVEL, "Failure writing CRUD data [%s], error=[%s]", fname, strerror(errno) );
+			failed = -1;
+		}
+	}
+
+	// Free the packed shards and return
+	for ( i=0; i<crud_store_count; i++ ) {
+		free( crud_stores[i].packed );
+		crud_stores[i].packed = NULL;
+		crud_stores[i].packed_length = crud_stores[i].packed_count = 0;
+	}
+	return( (failed) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_crud_object
+// Description  : Free an object and its contents
+//
+// Inputs       : obj - the object
+// Outputs      : none
+
+void free_crud_object( void *obj ) {
+	if ( obj != NULL ) {
+		free( ((CrudObject *)obj)->data );
+		free( obj );
+	}
+	return;
+}
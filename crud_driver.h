@@ -17,6 +17,8 @@
 // Defines
 #define CRUD_MAX_OBJECT_SIZE 0xfffff
 #define CRUD_NO_OBJECT 0
+#define CRUD_RANGE_OFFSET_SIZE sizeof(uint32_t)
+#define CRUD_MAX_SHARDS 64  // Most shards the store can be split into
 
 //
 // Type definitions
@@ -32,8 +34,12 @@ typedef enum {
 	CRUD_UPDATE  = 4, // Update the object
 	CRUD_DELETE  = 5, // Delete an object
 	CRUD_CLOSE   = 6, // Close the CRUD device
-	CRUD_UNKNOWN = 7, // Unknown type
-	CRUD_MAXVAL  = 8, // Max value
+	CRUD_READ_RANGE = 7, // Read a range of bytes from an object
+	CRUD_APPEND  = 8, // Append bytes to the end of an object
+	CRUD_UPDATE_RANGE = 9, // Update a range of bytes within an object
+	CRUD_BATCH   = 10, // A frame of several requests
+	CRUD_UNKNOWN = 11, // Unknown type
+	CRUD_MAXVAL  = 12, // Max value
 } CRUD_REQUEST_TYPES;
 const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL];
 
@@ -69,6 +75,52 @@ typedef uint64_t CrudResponse;
   60-62 - Flags - these are flags for commands (UNUSED)
      63 - R - this is the result bit (0 success, 1 is failure)
 
+ Ranged Requests
+
+  CRUD_READ_RANGE is followed on the wire by a 32-bit offset (network byte
+  order) into the object.  The Length field of the request is the number
+  of bytes wanted starting at that offset.  The response Length is the
+  number of bytes actually returned (short at the end of the object), and
+  those bytes follow the response just like a CRUD_READ.
+
+  CRUD_UPDATE_RANGE is followed by the 32-bit offset and then Length bytes
+  that replace the object contents starting at the offset.  The range must
+  lie inside the object (it cannot change the object length), and the
+  response Length is the length of the object.
+
+ Append
+
+  CRUD_APPEND carries Length bytes after the request (like CRUD_UPDATE)
+  and adds them to the end of the object in place, keeping the object ID.
+  The response Length is the new length of the object.
+
+ Batch Frames
+
+  CRUD_BATCH carries Length requests after it, each laid out exactly as it
+  would be on its own (header, offset word if ranged, data if any).  The
+  server answers with a CRUD_BATCH response whose Length is the number of
+  requests, followed by each response in order (with any read data).  A
+  batch holds at most CRUD_MAX_BATCH requests, and may not be nested.
+
+ Protocol Version
+
+  The Length of the CRUD_INIT response is the protocol version spoken by
+  the server.  Servers that only implement requests CRUD_INIT through
+  CRUD_CLOSE echo the request, so a client that sends a zero Length sees
+  version 0 and must not use the newer requests.  Servers before version 5
+  may serve one connection at a time; from version 5 on a server accepts
+  any number of concurrent connections, all to the same store.
+
+   Version  Adds
+   -------  -----------------------------------------------------------
+      0     CRUD_INIT, CRUD_FORMAT, CRUD_CREATE, CRUD_READ, CRUD_UPDATE,
+            CRUD_DELETE, CRUD_CLOSE
+      1     CRUD_READ_RANGE
+      2     CRUD_APPEND
+      3     CRUD_UPDATE_RANGE
+      4     CRUD_BATCH
+      5     concurrent connections
+
 */
 
 //
@@ -77,6 +129,27 @@ typedef uint64_t CrudResponse;
 CrudResponse crud_bus_request( CrudRequest request, void *buf );
 	// This is the interface to the CRUD interfaces
 
+CrudResponse crud_bus_range_request( CrudRequest request, uint32_t offset, void *buf );
+	// The interface for the ranged requests, which carry an object offset
+
+CrudResponse crud_shard_request( int shard, CrudRequest request, uint32_t offset, void *buf );
+	// Serve a request on one shard of the store (only its owner may call)
+
+int crud_store_shards( int shards );
+	// Split the store into shards by object ID
+
+int crud_store_shard( CrudOID oid );
+	// The shard an object is kept in
+
+CrudOID crud_store_new_oid( void );
+	// Hand out the ID for a new object (any shard may call)
+
+CrudOID crud_store_priority( void );
+	// The ID of the priority object, CRUD_NO_OBJECT if none
+
+int crud_store_commit( void );
+	// Write the shards packed by CRUD_CLOSE to the store file
+
 int crud_save_store(char *fname);
 	// Write the contents of the CRUD store to disk file.
 
@@ -11,15 +11,33 @@
 // Includes
 #include <malloc.h>
 #include <string.h>
+#include <stdio.h>
+#include <pthread.h>
 
 // Project Includes
 #include <crud_file_io.h>
+#include <crud_network.h>
+#include <crud_cache.h>
+#include <crud_pool.h>
+#include <crud_directory.h>
+#include <crud_trace.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define CIO_UNIT_TEST_MAX_WRITE_SIZE 1024
 #define CRUD_IO_UNIT_TEST_ITERATIONS 10240
+#define CRUD_IO_UNIT_TEST_THREADS 8          // Threads in the concurrent unit test
+#define CRUD_IO_CONCURRENT_ITERATIONS 1024   // Operations done by each thread
+#define CRUD_IO_CONCURRENT_MAX_SIZE 0x30000  // Largest file written by a thread (three chunks)
+#define CRUD_IO_VIEW_TEST_ITERATIONS 1024    // Reads done by the view unit test
+#define CRUD_IO_UNIT_TEST_STORE "crud_content.crd" // Shipped store (a legacy file table) the mount test loads
+#define CRUD_IO_CACHE_FILL_LIMIT 0x4000 // Objects up to this size are read whole (and cached)
+#define CRUD_NAME_ARENA_SIZE 0x4000     // First size of the filename arena
+#define CRUD_NO_NAME 0xffffffff         // Name offset of an unused handle
+#define CRUD_READAHEAD_MAX 16           // Most chunks read ahead of a sequential reader
+// Low bits of the generation of a handle table entry, as carried in its file handle
+#define CRUD_HANDLE_GENERATION(i) (crud_file_table[i].generation & ((1 << (15-CRUD_HANDLE_BITS)) - 1))
 
 // Other definitions
 
@@ -31,10 +49,91 @@ typedef enum {
 	CIO_UNIT_TEST_SEEK   = 3,
 } CRUD_UNIT_TEST_TYPE;
 
+// A range of a file written but not yet sent to the device
+typedef struct {
+	uint32_t  offset;  // Where the range starts in the file
+	uint32_t  length;  // Bytes in the range
+	uint32_t  size;    // Allocated size of the data
+	char     *data;    // The bytes written
+} CrudDirtyRange;
+
+// The write-back buffer of a file
+typedef struct {
+	CrudDirtyRange *ranges;   // The ranges, by offset, none overlapping or touching
+	uint32_t        count;    // Number of ranges
+	uint32_t        capacity; // Allocated ranges
+	uint32_t        length;   // Length of the file with the ranges (if any)
+} CrudWriteBack;
+
+// A chunk read ahead of the reader
+typedef struct {
+	uint32_t  ticket;  // Ticket of the read
+	uint32_t  chunk;   // Number of the chunk
+	CrudOID   oid;     // The object of the chunk
+	uint32_t  length;  // The length of the chunk
+	char     *buf;     // Where the read lands
+} CrudPrefetch;
+
+// The read-ahead state of a file
+typedef struct {
+	uint32_t     next;    // Where a sequential read would start
+	uint32_t     window;  // Chunks kept read ahead, 0 if not reading sequentially
+	uint32_t     ahead;   // First chunk not read ahead yet
+	uint32_t     count;   // Number of reads in flight
+	CrudPrefetch reads[CRUD_READAHEAD_MAX]; // The reads in flight, by chunk
+} CrudReadAhead;
+
+// State of one thread of the concurrent unit test
+typedef struct {
+	int      id;      // Number of the thread
+	int16_t  shared;  // Handle the thread got for the shared file
+	int      result;  // 0 if the thread passed, -1 if it failed
+} CrudIOThreadTest;
+
+// An object of the store file loaded by the mount unit test
+typedef struct {
+	CrudOID   oid;     // ID of the object in the store file
+	CrudOID   newoid;  // ID it was created with on the device
+	uint8_t   flags;   // The object flags
+	uint32_t  length;  // The length of the object
+	char     *data;    // The contents
+} CrudIOStoreObject;
+
 // File system Static Data
-// This the definition of the file table
-CrudFileAllocationType crud_file_table[CRUD_MAX_TOTAL_FILES]; // The file handle table
-int p_obj, init = 0;
+// This the definition of the file handle table, one entry per open file
+// (the files themselves are found through the directory)
+CrudFileHandle crud_file_table[CRUD_MAX_OPEN_FILES]; // The file handle table
+int init = 0;
+int16_t crud_free_handles[CRUD_MAX_OPEN_FILES];   // Stack of unused handles
+int     crud_free_count = 0;                      // Number of unused handles
+// Filenames of the open files, interned in one arena (table lock held)
+char    *crud_name_arena = NULL;                  // The filenames, NUL terminated
+uint32_t crud_name_size = 0;                      // Allocated size of the arena
+uint32_t crud_name_used = 0;                      // Bytes handed out
+uint32_t crud_name_garbage = 0;                   // Bytes handed out, then given back
+uint32_t crud_file_names[CRUD_MAX_OPEN_FILES];    // Offset of the filename of each handle
+// Chunk maps of the open chunked files, read on first use (file lock held)
+CrudOID *crud_file_chunks[CRUD_MAX_OPEN_FILES];   // Object of each chunk, NULL if not read
+// Read-ahead of the open files (file lock held)
+CrudReadAhead crud_file_ahead[CRUD_MAX_OPEN_FILES]; // The read-ahead of each handle
+// Write-back buffers of the open files (file lock held)
+CrudWriteBack crud_file_dirty[CRUD_MAX_OPEN_FILES]; // The buffer of each handle
+uint32_t crud_writeback_limit = 0;                // Bytes buffered before writing back (0 writes through)
+uint32_t crud_writeback_bytes = 0;                // Bytes buffered over all files (write-back lock)
+// Writes queued for the next batch frame
+uint32_t     crud_batch_limit = 0;                  // Writes per batch (0 sends each at once)
+int          crud_batch_count = 0;                  // Number of writes queued
+CrudRequest  crud_batch_ops[CRUD_MAX_BATCH];        // The queued requests
+uint32_t     crud_batch_offsets[CRUD_MAX_BATCH];    // Their object offsets
+void        *crud_batch_bufs[CRUD_MAX_BATCH];       // Copies of their data
+CrudResponse crud_batch_resps[CRUD_MAX_BATCH];      // Their responses
+// Locks, a file lock may be held while taking the table, batch or write-back
+// lock (never the reverse)
+pthread_mutex_t crud_file_locks[CRUD_MAX_OPEN_FILES];                   // One per file (handle)
+pthread_once_t  crud_file_locks_once = PTHREAD_ONCE_INIT;              // Initializes the above
+pthread_mutex_t crud_table_lock = PTHREAD_MUTEX_INITIALIZER;          // Handles, the directory and init
+pthread_mutex_t crud_batch_lock = PTHREAD_MUTEX_INITIALIZER;          // The batch queue
+pthread_mutex_t crud_writeback_lock = PTHREAD_MUTEX_INITIALIZER;      // The count of buffered bytes
 // Pick up these definitions from the unit test of the crud driver
 CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
 		uint32_t length, uint8_t flags, uint8_t res);
@@ -46,6 +145,28 @@ int deconstruct_crud_request(CrudRequest request, CrudOID *oid,
 // Implementation
 
 CrudResponse crud_client_operation(CrudRequest , void *);
+static void crud_batch_discard(void);
+static int crud_batch_send(void);
+static void crud_lock_handle(int16_t fd);
+static int16_t crud_lock_file(int16_t fd);
+static void crud_unlock_file(int16_t fd);
+static int32_t crud_read_locked(int16_t fd, void *buf, int32_t count);
+static int32_t crud_read_view_locked(int16_t fd, int32_t count, CrudCacheView *view);
+static int crud_load(int16_t fd, uint32_t position, char *buf, uint32_t count);
+static int32_t crud_write_locked(int16_t fd, void *buf, int32_t count);
+static int crud_object_write(CrudOID *oid, uint32_t *length, uint32_t offset, char *buf, uint32_t count);
+static int crud_store(int16_t fd, uint32_t offset, char *buf, uint32_t count);
+static void crud_readahead(int16_t fd, uint32_t position, uint32_t count);
+static void crud_readahead_collect(int16_t fd, uint32_t upto);
+static uint32_t crud_writeback_find(int16_t fd, uint32_t position);
+static int crud_writeback(int16_t fd);
+static void crud_writeback_discard(int16_t fd);
+static int crud_writeback_all(void);
+static void crud_save_entry(int16_t fd, CrudOID oid, uint32_t length, uint8_t flags);
+static void crud_handles_reset(void);
+static int crud_name_intern(int16_t fd, char *path);
+static void crud_name_release(int16_t fd);
+static char *crud_name(int16_t fd);
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Function   : crud_format
@@ -58,7 +179,7 @@ CrudRequest crud_formati(int32_t oid, int8_t req, int32_t len, int8_t flag, int8
 {
 	CrudRequest retv;
 	retv =  ((int64_t)oid << 32);
-	retv |= ((req & 0xf) << 28);
+	retv |= ((uint64_t)(req & 0xf) << 28);
 	retv |= ((len & 0xffffff) << 4);
 	retv |= ((flag & 0xb) << 1);
 	retv |= (ret & 0x1);
@@ -106,7 +227,7 @@ int8_t get_ret(CrudResponse crud){
 //
 // Function     : crud_format
 // Description  : This function formats the crud drive, and adds the file
-//                allocation table.
+//                system metadata.  No file operations may be running.
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
@@ -116,15 +237,23 @@ uint16_t crud_format(void) {
 	//Declare variables 
 	CrudResponse ret;
 	CrudRequest send;
-	int size = sizeof(crud_file_table[0])*CRUD_MAX_TOTAL_FILES;
+
+	//Nothing queued survives a format
+	pthread_mutex_lock(&crud_batch_lock);
+	crud_batch_discard();
+	pthread_mutex_unlock(&crud_batch_lock);
 
 	//Init the crud device
+	pthread_mutex_lock(&crud_table_lock);
 	if(init == 0)
 	{
 		send = crud_formati( 0, CRUD_INIT,0, 0, 0);
 		ret = crud_client_operation(send, NULL);
 		if( get_ret(ret) == 1)
+		{
+			pthread_mutex_unlock(&crud_table_lock);
 			return -1;
+		}
 		init = 1;
 	}
 
@@ -132,15 +261,24 @@ uint16_t crud_format(void) {
 	send = crud_formati( 0, CRUD_FORMAT,0, 0, 0);
 	ret = crud_client_operation(send, NULL);
 	if( get_ret(ret) == 1)
+	{
+		pthread_mutex_unlock(&crud_table_lock);
+		return -1;
+	}
+	//Empty the table handler and the object cache
+	crud_handles_reset();
+	if (init_crud_cache())
+	{
+		pthread_mutex_unlock(&crud_table_lock);
 		return -1;
-	//Empty the table handler
-	memset(crud_file_table, 0, size);
+	}
 	//Create file system
-	send = crud_formati( 0, CRUD_CREATE,size, CRUD_PRIORITY_OBJECT, 0);
-	ret = crud_client_operation(send, crud_file_table);
-	if( get_ret(ret) == 1)
+	if( crud_dir_format() == -1)
+	{
+		pthread_mutex_unlock(&crud_table_lock);
 		return -1;	
-	p_obj = get_oid(ret);
+	}
+	pthread_mutex_unlock(&crud_table_lock);
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... formatting complete.");
 	return(0);
@@ -149,8 +287,10 @@ uint16_t crud_format(void) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : crud_mount
-// Description  : This function mount the current crud file system and loads
-//                the file allocation table.
+// Description  : This function mount the current crud file system.  Only the
+//                superblock and directory are read here, the directory
+//                blocks as files are looked up.  No file operations may be
+//                running.
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
@@ -160,26 +300,33 @@ uint16_t crud_mount(void) {
 	//Declare the variable 
 	CrudResponse ret;
 	CrudRequest send;
-	char * buffer;
-	uint32_t size =sizeof(crud_file_table[0])*CRUD_MAX_TOTAL_FILES;
-	buffer = malloc(size);
+	//Anything queued belongs to the previous mount
+	if( crud_flush() == -1)
+		return -1;
 	// Init the device 
+	pthread_mutex_lock(&crud_table_lock);
 	if(init == 0)
 	{
 		send = crud_formati( 0, CRUD_INIT,0,0,0);//size, 0, 0);
-		ret = crud_client_operation(send, buffer);
+		ret = crud_client_operation(send, NULL);
 		if( get_ret(ret) == 1)
+		{
+			pthread_mutex_unlock(&crud_table_lock);
 			return -1;
+		}
 		init = 1;
 	}
-	//Read the entire device
-	send = crud_formati(0, CRUD_READ, size, CRUD_PRIORITY_OBJECT, 0);
-	ret = crud_client_operation(send,buffer);
-	if( get_ret(ret) == 1)
+	//Forget the open files, read the directory (which checks it is there)
+	crud_handles_reset();
+	if( crud_dir_mount() == -1)
+	{
+		pthread_mutex_unlock(&crud_table_lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&crud_table_lock);
+	//Start with an empty object cache
+	if (init_crud_cache())
 		return -1;
-	//copy device to local drive
-	memcpy(crud_file_table, buffer, size);
-	free(buffer);
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... mount complete.");
 	return(0);
@@ -189,7 +336,8 @@ uint16_t crud_mount(void) {
 //
 // Function     : crud_unmount
 // Description  : This function unmounts the current crud file system and
-//                saves the file allocation table.
+//                saves the changed file system metadata.  No file operations
+//                may be running.
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
@@ -197,295 +345,1979 @@ uint16_t crud_mount(void) {
 uint16_t crud_unmount(void) {
 
 	//Declare variables
-	CrudResponse ret;
-	CrudRequest send;
-	char * buffer;
-	uint32_t size =sizeof(crud_file_table[0])*CRUD_MAX_TOTAL_FILES;
-	//Store local drive to buffer
-	buffer = malloc(size);
-	memcpy(buffer,crud_file_table, size);
-	//send buffer to the crud device
-	send = crud_formati(0,CRUD_UPDATE, size, CRUD_PRIORITY_OBJECT, 0);
-	ret = crud_client_operation(send, buffer);
-	if( get_ret(ret) == 1)
+	int ret;
+	//Send any buffered and queued writes
+	if( crud_writeback_all() == -1 || crud_flush() == -1)
 		return -1;
-	//close crud device
-	send = crud_formati(0,CRUD_CLOSE, 0, 0, 0);
-	ret = crud_client_operation(send, NULL);
-	if( get_ret(ret) == 1)
+	//Write back the changed metadata and close the device behind it
+	pthread_mutex_lock(&crud_table_lock);
+	ret = crud_dir_sync(1);
+	//the next session starts with a fresh CRUD_INIT
+	init = 0;
+	pthread_mutex_unlock(&crud_table_lock);
+	if( ret == -1)
 		return -1;
 
-	free(buffer);
+	//report and release the object cache, then the buffer pool behind it
+	close_crud_cache();
+	crud_pool_report();
+	crud_pool_trim();
+	CRUD_TRACE_DUMP();
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... unmount complete.");
 	return (0);
 }
 
-// *** INSERT YOUR CODE HERE ***
-
-// Module local methods
-
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crudIOUnitTest
-// Description  : Perform a test of the CRUD IO implementation
+// Function     : crud_checkpoint
+// Description  : Send any buffered and queued writes and the changed file
+//                system metadata to the device, leaving it mounted
 //
-// Inputs       : None
-// Outputs      : 0 if successful or -1 if failure
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-int crudIOUnitTest(void) {
+int crud_checkpoint(void) {
 
 	// Local variables
-	uint8_t ch;
-	int16_t fd, i;
-	int32_t cio_utest_length, cio_utest_position, count, bytes, expected;
-	char *cio_utest_buffer, *tbuf;
-	CRUD_UNIT_TEST_TYPE cmd;
-	char lstr[1024];
-
-	// Setup some operating buffers, zero out the mirrored file contents
-	cio_utest_buffer = malloc(CRUD_MAX_OBJECT_SIZE);
-	tbuf = malloc(CRUD_MAX_OBJECT_SIZE);
-	memset(cio_utest_buffer, 0x0, CRUD_MAX_OBJECT_SIZE);
-	cio_utest_length = 0;
-	cio_utest_position = 0;
-
-	// Format and mount the file system
-	if (crud_format() || crud_mount()) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on format or mount operation.");
-		return(-1);
-	}
-
-	// Start by opening a file
-	fd = crud_open("temp_file.txt");
-	if (fd == -1) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure open operation.");
-		return(-1);
-	}
+	int ret;
 
-	// Now do a bunch of operations
-	for (i=0; i<CRUD_IO_UNIT_TEST_ITERATIONS; i++) {
+	if( crud_writeback_all() == -1 || crud_flush() == -1)
+		return -1;
+	pthread_mutex_lock(&crud_table_lock);
+	ret = crud_dir_sync(0);
+	pthread_mutex_unlock(&crud_table_lock);
+	return ret;
+}
 
-		// Pick a random command
-		if (cio_utest_length == 0) {
-			cmd = CIO_UNIT_TEST_WRITE;
-		} else {
-			cmd = getRandomValue(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_SEEK);
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_batch
+// Description  : Set how many writes are queued up and sent to the device
+//                as a single batch frame.  Queued writes report success
+//                right away; a failure shows up on the flush.
+//
+// Inputs       : ops - writes per batch, 0 sends each write at once
+// Outputs      : 0 if successful, -1 if failure
 
-		// Execute the command
-		switch (cmd) {
+int crud_set_batch(uint32_t ops) {
 
-		case CIO_UNIT_TEST_READ: // read a random set of data
-			count = getRandomValue(0, cio_utest_length);
-			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read %d at position %d", bytes, cio_utest_position);
-			bytes = crud_read(fd, tbuf, count);
-			if (bytes == -1) {
-				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Read failure.");
-				return(-1);
-			}
+	// Local variables
+	int ret;
+
+	pthread_mutex_lock(&crud_batch_lock);
+	ret = crud_batch_send();
+	if(ret == 0)
+		crud_batch_limit = (ops > CRUD_MAX_BATCH) ? CRUD_MAX_BATCH : ops;
+	pthread_mutex_unlock(&crud_batch_lock);
+	return ret;
+}
 
-			// Compare to what we expected
-			if (cio_utest_position+count > cio_utest_length) {
-				expected = cio_utest_length-cio_utest_position;
-			} else {
-				expected = count;
-			}
-			if (bytes != expected) {
-				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : short/long read of [%d!=%d]", bytes, expected);
-				return(-1);
-			}
-			if ( (bytes > 0) && (memcmp(&cio_utest_buffer[cio_utest_position], tbuf, bytes)) ) {
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush
+// Description  : Send any queued writes to the device as one batch
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-				bufToString((unsigned char *)tbuf, bytes, (unsigned char *)lstr, 1024 );
-				logMessage(LOG_INFO_LEVEL, "CIO_UTEST R: %s", lstr);
-				bufToString((unsigned char *)&cio_utest_buffer[cio_utest_position], bytes, (unsigned char *)lstr, 1024 );
-				logMessage(LOG_INFO_LEVEL, "CIO_UTEST U: %s", lstr);
+int crud_flush(void) {
 
-				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read data mismatch (%d)", bytes);
-				return(-1);
-			}
-			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read %d match", bytes);
+	// Local variables
+	int ret;
 
+	pthread_mutex_lock(&crud_batch_lock);
+	ret = crud_batch_send();
+	pthread_mutex_unlock(&crud_batch_lock);
+	return ret;
+}
 
-			// update the crud_file_table[fd].positionition pointer
-			cio_utest_position += bytes;
-			break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_writeback
+// Description  : Set how many bytes of writes are held in the write-back
+//                buffers of the open files.  Buffered writes report
+//                success right away and go to the device, merged into as
+//                few requests as possible, when the file is closed or
+//                synced, the file system unmounted or checkpointed, or the
+//                buffers fill up.
+//
+// Inputs       : limit - bytes to buffer, 0 sends each write at once
+// Outputs      : 0 if successful, -1 if failure
 
-		case CIO_UNIT_TEST_APPEND: // Append data onto the end of the file
-			// Create random block, check to make sure that the write is not too large
-			ch = getRandomValue(0, 0xff);
-			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
-			if (cio_utest_length+count >= CRUD_MAX_OBJECT_SIZE) {
+int crud_set_writeback(uint32_t limit) {
 
-				// Log, seek to end of file, create random value
-				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : append of %d bytes [%x]", count, ch);
-				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : seek to position %d", cio_utest_length);
-				if (crud_seek(fd, cio_utest_length)) {
-					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : seek failed [%d].", cio_utest_length);
-					return(-1);
-				}
-				cio_utest_position = cio_utest_length;
-				memset(&cio_utest_buffer[cio_utest_position], ch, count);
+	// Anything buffered goes out first when turning it off
+	if(limit == 0 && crud_writeback_all() == -1)
+		return -1;
+	crud_writeback_limit = limit;
+	return 0;
+}
 
-				// Now write
-				bytes = crud_write(fd, &cio_utest_buffer[cio_utest_position], count);
-				if (bytes != count) {
-					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : append failed [%d].", count);
-					return(-1);
-				}
-				cio_utest_length = cio_utest_position += bytes;
-			}
-			break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fsync
+// Description  : Send the buffered and queued writes of a file to the device
+//
+// Inputs       : fd - the file handle
+// Outputs      : 0 if successful, -1 if failure
 
-		case CIO_UNIT_TEST_WRITE: // Write random block to the file
-			ch = getRandomValue(0, 0xff);
-			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
-			// Check to make sure that the write is not too large
-			if (cio_utest_length+count < CRUD_MAX_OBJECT_SIZE) {
-				// Log the write, perform it
-				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : write of %d bytes [%x]", count, ch);
-				memset(&cio_utest_buffer[cio_utest_position], ch, count);
-				bytes = crud_write(fd, &cio_utest_buffer[cio_utest_position], count);
-				if (bytes!=count) {
-					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : write failed [%d] .", count, bytes);
-					return(-1);
-				}
-				cio_utest_position += bytes;
-				if (cio_utest_position > cio_utest_length) {
-					cio_utest_length = cio_utest_position;
-				}
-			}
-			break;
+int crud_fsync(int16_t fd) {
 
-		case CIO_UNIT_TEST_SEEK:
-			count = getRandomValue(0, cio_utest_length);
-			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : seek to position %d", count);
-			if (crud_seek(fd, count)) {
-				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : seek failed [%d].", count);
-				return(-1);
-			}
-			cio_utest_position = count;
-			break;
+	// Local variables
+	CrudOID oid;
+	uint32_t length;
+	uint8_t flags;
+	int ret;
 
-		default: // This should never happen
-			CMPSC_ASSERT0(0, "CRUD_IO_UNIT_TEST : illegal test command.");
-			break;
+	if( (fd = crud_lock_file(fd)) == -1)
+		return -1;
+	if(crud_file_table[fd].open == 0)
+	{
+		crud_unlock_file(fd);
+		return -1;
+	}
+	oid = crud_file_table[fd].object_id;
+	length = crud_file_table[fd].length;
+	flags = crud_file_table[fd].flags;
+	ret = crud_writeback(fd);
+	crud_save_entry(fd, oid, length, flags);
+	crud_unlock_file(fd);
+	if(ret == -1 || crud_flush() == -1)
+		return -1;
+	return 0;
+}
 
-		}
+// *** INSERT YOUR CODE HERE ***
 
-#if DEEP_DEBUG
-		// VALIDATION STEP: ENSURE OUR LOCAL IS LIKE OBJECT STORE
-		CrudRequest request;
-		CrudResponse response;
-		CrudOID oid;
-		CRUD_REQUEST_TYPES req;
-		uint32_t length;
-		uint8_t res, flags;
+// Module local methods
 
-		// Make a fake request to get file handle, then check it
-		request = construct_crud_request(crud_file_table[0].object_id, CRUD_READ, CRUD_MAX_OBJECT_SIZE, CRUD_NULL_FLAG, 0);
-		response = crud_client_operation(request, tbuf);
-		if ((deconstruct_crud_request(response, &oid, &req, &length, &flags, &res) != 0) || (res != 0))  {
-			logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
-			return(-1);
-		}
-		if ( (cio_utest_length != length) || (memcmp(cio_utest_buffer, tbuf, length)) ) {
-			logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed [%x]", response);
-			bufToString((unsigned char *)tbuf, length, (unsigned char *)lstr, 1024 );
-			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VR: %s", lstr);
-			bufToString((unsigned char *)cio_utest_buffer, length, (unsigned char *)lstr, 1024 );
-			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VU: %s", lstr);
-			return(-1);
-		}
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_send
+// Description  : Send the queued writes to the device as one batch (batch
+//                lock held)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-		// Print out the buffer
-		bufToString((unsigned char *)cio_utest_buffer, cio_utest_length, (unsigned char *)lstr, 1024 );
-		logMessage(LOG_INFO_LEVEL, "CIO_UTEST: %s", lstr);
-#endif
+static int crud_batch_send(void) {
 
-	}
+	// Local variables
+	int i, failed;
 
-	// Close the files and cleanup buffers, assert on failure
-	if (crud_close(fd)) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure read comparison block.", fd);
-		return(-1);
-	}
-	free(cio_utest_buffer);
-	free(tbuf);
+	// Nothing queued, nothing to do
+	if(crud_batch_count == 0)
+		return 0;
 
-	// Format and mount the file system
-	if (crud_unmount()) {
-		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on unmount operation.");
-		return(-1);
+	// Send the batch, report the failures
+	failed = crud_client_batch(crud_batch_ops, crud_batch_offsets, crud_batch_bufs, crud_batch_resps, crud_batch_count);
+	for(i = 0; i < crud_batch_count; i++)
+	{
+		if( get_ret(crud_batch_resps[i]) == 1)
+			logMessage(LOG_ERROR_LEVEL, "CRUD IO : batched write to object %u failed.", get_oid(crud_batch_ops[i]));
 	}
-
-	// Return successfully
-	return(0);
+	crud_batch_discard();
+	return failed;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_discard
+// Description  : Drop everything queued for the next batch (batch lock held)
+//
+// Inputs       : none
+// Outputs      : none
 
-
+static void crud_batch_discard(void) {
+	int i;
+	for(i = 0; i < crud_batch_count; i++)
+		crud_pool_free(crud_batch_bufs[i]);
+	crud_batch_count = 0;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_open
-// Description  : This function opens the file and returns a file handle
+// Function     : crud_batch_add
+// Description  : Queue a write for the next batch, taking a copy of its data
+//                and flushing when the batch is full.
 //
-// Inputs       : path - the path "in the storage array"
-// Outputs      : file handle if successful, -1 if failure
+// Inputs       : send - the request
+//                offset - the object offset (ranged requests)
+//                buf - the data to write (Length bytes)
+// Outputs      : 0 if successful, -1 if failure
 
-int16_t crud_open(char *path) {
-	// Set values for the file descrptor
-	int i= 0;
-	while(i < CRUD_MAX_TOTAL_FILES)
+static int crud_batch_add(CrudRequest send, uint32_t offset, void *buf) {
+
+	// Local variables
+	int ret = 0;
+
+	// Copy the data, the caller is free to reuse its buffer
+	pthread_mutex_lock(&crud_batch_lock);
+	if((crud_batch_bufs[crud_batch_count] = crud_pool_alloc(get_len(send))) == NULL)
+	{
+		pthread_mutex_unlock(&crud_batch_lock);
+		return -1;
+	}
+	crud_batch_ops[crud_batch_count] = send;
+	crud_batch_offsets[crud_batch_count] = offset;
+	memcpy(crud_batch_bufs[crud_batch_count], buf, get_len(send));
+	crud_batch_count++;
+
+	// Send it off once full
+	if(crud_batch_count >= crud_batch_limit)
+		ret = crud_batch_send();
+	pthread_mutex_unlock(&crud_batch_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fetch_object
+// Description  : Read a whole object from the device into the buffer, and
+//                place it in the object cache.
+//
+// Inputs       : oid - the object to read
+//                length - the length of the object
+//                buf - the buffer to place the object in (at least length)
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_fetch_object(CrudOID oid, uint32_t length, char *buf) {
+	CrudRequest send;
+	CrudResponse ret;
+
+	// The device copy has to include any queued writes
+	if( crud_flush() == -1)
+		return -1;
+
+	// Read the object, then remember it for the next time
+	send = crud_formati(oid, CRUD_READ, length,0,0);
+	ret = crud_client_operation(send, buf);
+	if( get_ret(ret) == 1)
+		return -1;
+	put_crud_cache(oid, buf, length);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_fetch_view
+// Description  : Read a whole object from the device into a buffer the
+//                object cache takes over, returning a view of it.
+//
+// Inputs       : oid - the object to read
+//                length - the length of the object
+//                view - the place to put the view
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_fetch_view(CrudOID oid, uint32_t length, CrudCacheView *view) {
+	CrudResponse ret;
+	char *buf;
+
+	// The device copy has to include any queued writes
+	if( crud_flush() == -1 || (buf = new_crud_cache_buffer(length)) == NULL)
+		return -1;
+
+	// Read the object straight into the buffer the cache keeps
+	ret = crud_client_operation(crud_formati(oid, CRUD_READ, length, 0, 0), buf);
+	if( get_ret(ret) == 1)
+	{
+		free_crud_cache_buffer(buf);
+		return -1;
+	}
+	return adopt_crud_cache(oid, buf, length, view);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_object
+// Description  : Get a whole object into the buffer, from the object cache
+//                if present or the device otherwise.
+//
+// Inputs       : oid - the object to read
+//                length - the length of the object
+//                buf - the buffer to place the object in (at least length)
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_load_object(CrudOID oid, uint32_t length, char *buf) {
+
+	// Copy out of the cache on a hit, otherwise go to the device
+	if (read_crud_cache(oid, 0, buf, length, length) == 0) {
+		return 0;
+	}
+	return crud_fetch_object(oid, length, buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_chunk_count
+// Description  : Get the number of chunks of a chunked file
+//
+// Inputs       : length - the length of the file
+// Outputs      : the number of chunks
+
+static uint32_t crud_chunk_count(uint32_t length) {
+	return (uint32_t)(((uint64_t)length + CRUD_CHUNK_SIZE - 1) / CRUD_CHUNK_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_chunk_length
+// Description  : Get the length of one chunk of a chunked file, every chunk
+//                but the last being full
+//
+// Inputs       : fd - the file handle
+//                chunk - the number of the chunk
+// Outputs      : the length of the chunk, 0 if past the end of the file
+
+static uint32_t crud_chunk_length(int16_t fd, uint32_t chunk) {
+	uint64_t start = (uint64_t)chunk * CRUD_CHUNK_SIZE;
+	if (start >= crud_file_table[fd].length)
+		return 0;
+	if (crud_file_table[fd].length - start > CRUD_CHUNK_SIZE)
+		return CRUD_CHUNK_SIZE;
+	return crud_file_table[fd].length - start;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load_map
+// Description  : Read the chunk map of a chunked file, unless already read
+//                (file lock held)
+//
+// Inputs       : fd - the file handle
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_load_map(int16_t fd) {
+
+	// Local variables
+	uint32_t count = crud_chunk_count(crud_file_table[fd].length);
+	CrudResponse ret;
+
+	if (crud_file_chunks[fd] != NULL)
+		return 0;
+	if ((crud_file_chunks[fd] = malloc(sizeof(CrudOID) * (count + 1))) == NULL)
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD IO : no memory for chunk map [%u].", crud_file_table[fd].object_id);
+		return -1;
+	}
+	ret = crud_client_operation(crud_formati(crud_file_table[fd].object_id, CRUD_READ, count * sizeof(CrudOID), 0, 0),
+			crud_file_chunks[fd]);
+	if (get_ret(ret) == 1 || get_len(ret) != count * sizeof(CrudOID))
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD IO : failed to read chunk map [%u].", crud_file_table[fd].object_id);
+		free(crud_file_chunks[fd]);
+		crud_file_chunks[fd] = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store_map
+// Description  : Write the changes of the chunk map of a file: the slots of
+//                chunks that moved to new objects are patched and those of
+//                new chunks appended where the server can, otherwise the
+//                map is written whole (to a new object if it grew).
+//
+// Inputs       : fd - the file handle
+//                lo - first slot of a moved chunk
+//                hi - slot after the last moved chunk (lo if none)
+//                old - the number of chunks before the write
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_store_map(int16_t fd, uint32_t lo, uint32_t hi, uint32_t old) {
+
+	// Local variables
+	CrudOID oid = crud_file_table[fd].object_id, *chunks = crud_file_chunks[fd];
+	uint32_t count = crud_chunk_count(crud_file_table[fd].length), ticket = 0, ticket2 = 0;
+	CrudResponse ret;
+	int failed = 0;
+
+	// Patch and append in place, both requests in flight together
+	hi = (hi > old) ? old : hi;
+	if(oid != CRUD_NO_OBJECT && (lo >= hi || crud_client_supports(CRUD_PROTOCOL_UPDATE_RANGE)) &&
+			(count == old || crud_client_supports(CRUD_PROTOCOL_APPEND)))
+	{
+		if(lo < hi)
+			ticket = crud_client_submit(crud_formati(oid, CRUD_UPDATE_RANGE, (hi - lo) * sizeof(CrudOID), 0, 0),
+					lo * sizeof(CrudOID), &chunks[lo], NULL, NULL);
+		if(count > old)
+			ticket2 = crud_client_submit(crud_formati(oid, CRUD_APPEND, (count - old) * sizeof(CrudOID), 0, 0),
+					0, &chunks[old], NULL, NULL);
+		if(lo < hi && get_ret(crud_client_wait(ticket)) == 1)
+			failed = 1;
+		if(count > old && get_ret(crud_client_wait(ticket2)) == 1)
+			failed = 1;
+		return failed ? -1 : 0;
+	}
+
+	// Otherwise a map of the same size is rewritten whole
+	if(oid != CRUD_NO_OBJECT && count == old)
+	{
+		ret = crud_client_operation(crud_formati(oid, CRUD_UPDATE, count * sizeof(CrudOID), 0, 0), chunks);
+		return (get_ret(ret) == 1) ? -1 : 0;
+	}
+
+	// and one that grew (or is new) replaces the old
+	ret = crud_client_operation(crud_formati(0, CRUD_CREATE, count * sizeof(CrudOID), 0, 0), chunks);
+	if(get_ret(ret) == 1)
+		return -1;
+	crud_file_table[fd].object_id = get_oid(ret);
+	if(oid != CRUD_NO_OBJECT)
+	{
+		ret = crud_client_operation(crud_formati(oid, CRUD_DELETE, 0, 0, 0), NULL);
+		if(get_ret(ret) == 1)
+			return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_chunks
+// Description  : Write to a chunked file, touching only the chunks the
+//                write covers, then save the changes of the chunk map (file
+//                lock held, map read)
+//
+// Inputs       : fd - the file handle
+//                position - where to write (at most the length)
+//                buf - the data to write
+//                count - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_write_chunks(int16_t fd, uint32_t position, char *buf, uint32_t count) {
+
+	// Local variables
+	uint32_t old = crud_chunk_count(crud_file_table[fd].length), needed, end = position + count;
+	uint32_t i, offset, size, length, lo, hi = 0;
+	CrudOID oid, *chunks;
+	int failed = 0;
+
+	// Make room for the new chunks
+	needed = crud_chunk_count(end);
+	if(needed > old)
+	{
+		if((chunks = realloc(crud_file_chunks[fd], sizeof(CrudOID) * (needed + 1))) == NULL)
+			return -1;
+		for(i = old; i < needed; i++)
+			chunks[i] = CRUD_NO_OBJECT;
+		crud_file_chunks[fd] = chunks;
+	}
+	chunks = crud_file_chunks[fd];
+	lo = needed;
+
+	// Write the piece of each chunk, noting those that moved to new objects
+	for(i = position / CRUD_CHUNK_SIZE; position < end; i++)
+	{
+		offset = position % CRUD_CHUNK_SIZE;
+		size = (end - position < CRUD_CHUNK_SIZE - offset) ? end - position : CRUD_CHUNK_SIZE - offset;
+		length = crud_chunk_length(fd, i);
+		oid = chunks[i];
+		if( crud_object_write(&chunks[i], &length, offset, buf, size) == -1)
+		{
+			failed = 1;
+			break;
+		}
+		if(chunks[i] != oid)
+		{
+			lo = (i < lo) ? i : lo;
+			hi = i + 1;
+		}
+		buf += size;
+		position += size;
+	}
+
+	// The file grows as far as the write got, which the map has to follow
+	if(position > crud_file_table[fd].length)
+		crud_file_table[fd].length = position;
+	if((lo < hi || crud_chunk_count(crud_file_table[fd].length) != old) && crud_store_map(fd, lo, hi, old) == -1)
+		failed = 1;
+	return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_chunk_file
+// Description  : Turn a file kept in one object into a chunked file (file
+//                lock held).  A file of at most one chunk keeps its object
+//                as the first chunk, a longer one (from before files were
+//                chunked) is copied into chunks.
+//
+// Inputs       : fd - the file handle
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_chunk_file(int16_t fd) {
+
+	// Local variables
+	CrudOID oid = crud_file_table[fd].object_id;
+	uint32_t length = crud_file_table[fd].length;
+	CrudResponse ret;
+	CrudOID *chunks;
+	uint32_t i;
+	char *buf;
+	int failed;
+
+	// The object becomes the first chunk, the map is created on the write
+	if(length <= CRUD_CHUNK_SIZE)
+	{
+		if((crud_file_chunks[fd] = malloc(sizeof(CrudOID) * 2)) == NULL)
+			return -1;
+		crud_file_chunks[fd][0] = oid;
+		crud_file_table[fd].object_id = CRUD_NO_OBJECT;
+		crud_file_table[fd].flags |= CRUD_FILE_CHUNKED;
+		return 0;
+	}
+
+	// Otherwise the whole object is written out again as chunks
+	buf = crud_pool_alloc(length);
+	if( buf == NULL || crud_flush() == -1 || crud_load_object(oid, length, buf) == -1)
+	{
+		crud_pool_free(buf);
+		return -1;
+	}
+	crud_file_table[fd].object_id = CRUD_NO_OBJECT;
+	crud_file_table[fd].length = 0;
+	crud_file_table[fd].flags |= CRUD_FILE_CHUNKED;
+	failed = crud_write_chunks(fd, 0, buf, length);
+	crud_pool_free(buf);
+
+	// On failure the file stays in its object, the chunks made so far go
+	if(failed)
+	{
+		chunks = crud_file_chunks[fd];
+		for(i = 0; chunks != NULL && i < crud_chunk_count(crud_file_table[fd].length); i++)
+		{
+			if(chunks[i] != CRUD_NO_OBJECT)
+			{
+				delete_crud_cache(chunks[i]);
+				crud_client_operation(crud_formati(chunks[i], CRUD_DELETE, 0, 0, 0), NULL);
+			}
+		}
+		if(crud_file_table[fd].object_id != CRUD_NO_OBJECT)
+			crud_client_operation(crud_formati(crud_file_table[fd].object_id, CRUD_DELETE, 0, 0, 0), NULL);
+		free(chunks);
+		crud_file_chunks[fd] = NULL;
+		crud_file_table[fd].object_id = oid;
+		crud_file_table[fd].length = length;
+		crud_file_table[fd].flags &= ~CRUD_FILE_CHUNKED;
+		return -1;
+	}
+
+	// then the old object goes
+	delete_crud_cache(oid);
+	ret = crud_client_operation(crud_formati(oid, CRUD_DELETE, 0, 0, 0), NULL);
+	if(get_ret(ret) == 1)
+		return -1;
+	logMessage(LOG_INFO_LEVEL, "CRUD IO : chunked file of %u bytes (object %u).", length, oid);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_wait
+// Description  : Wait for a set of ranged reads in flight
+//
+// Inputs       : tickets - the tickets of the reads
+//                sizes - the bytes each read asked for
+//                count - the number of reads
+// Outputs      : 0 if all successful, -1 if any failed
+
+static int crud_read_wait(uint32_t *tickets, uint32_t *sizes, int count) {
+
+	// Local variables
+	CrudResponse ret;
+	int i, failed = 0;
+
+	// Collect every one, even after a failure
+	for(i = 0; i < count; i++)
+	{
+		ret = crud_client_wait(tickets[i]);
+		if( get_ret(ret) == 1 || get_len(ret) != sizes[i])
+			failed = 1;
+	}
+	return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_readahead
+// Description  : Track how a file is read and keep the chunks after a
+//                sequential reader in flight.  Each read continuing the last
+//                doubles the window of chunks read ahead, any other read
+//                closes it.  The reads ahead land (in buffers the object
+//                cache takes over) as the reader reaches them (file lock
+//                held).
+//
+// Inputs       : fd - the file handle
+//                position - where the read starts
+//                count - the number of bytes read from the device
+// Outputs      : none
+
+static void crud_readahead(int16_t fd, uint32_t position, uint32_t count) {
+
+	// Local variables
+	CrudReadAhead *ra = &crud_file_ahead[fd];
+	CrudPrefetch *read;
+	uint32_t lines = get_crud_cache_size(), limit, last, chunks, length, i;
+
+	// Grow the window on a sequential read (it needs the cache to land in)
+	limit = (lines / 4 < CRUD_READAHEAD_MAX) ? lines / 4 : CRUD_READAHEAD_MAX;
+	if(position == ra->next && position != 0 && limit > 0)
+	{
+		ra->window = (ra->window == 0) ? 1 : ra->window * 2;
+		ra->window = (ra->window > limit) ? limit : ra->window;
+	}
+	else
+	{
+		crud_readahead_collect(fd, UINT32_MAX);
+		ra->window = 0;
+		ra->ahead = 0;
+	}
+	ra->next = position + count;
+	if(!(crud_file_table[fd].flags & CRUD_FILE_CHUNKED))
+		return;
+
+	// Take in the reads ahead this read needs
+	last = (position + count - 1) / CRUD_CHUNK_SIZE;
+	crud_readahead_collect(fd, last + 1);
+	if(ra->window == 0 || crud_load_map(fd) == -1)
+		return;
+
+	// Then send those of the window after it (with anything queued first)
+	chunks = crud_chunk_count(crud_file_table[fd].length);
+	i = (ra->ahead > last + 1) ? ra->ahead : last + 1;
+	if(i < chunks && i <= last + ra->window && crud_flush() == -1)
+		return;
+	for(; i < chunks && i <= last + ra->window && ra->count < CRUD_READAHEAD_MAX; i++)
+	{
+		length = crud_chunk_length(fd, i);
+		if(has_crud_cache(crud_file_chunks[fd][i], length))
+			continue;
+		read = &ra->reads[ra->count++];
+		read->chunk = i;
+		read->oid = crud_file_chunks[fd][i];
+		read->length = length;
+		read->buf = new_crud_cache_buffer(length);
+		if(read->buf == NULL)
+		{
+			ra->count--;
+			break;
+		}
+		read->ticket = crud_client_submit(crud_formati(read->oid, CRUD_READ, length, 0, 0), 0, read->buf, NULL, NULL);
+		CRUD_TRACE_COUNT(CRUD_CTR_READAHEAD, 1);
+	}
+	ra->ahead = i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_readahead_collect
+// Description  : Wait for the reads ahead of a file up to a chunk, placing
+//                them in the object cache (file lock held, or no file
+//                operations running).  Everything is collected before the
+//                file is written, so what lands is never older than the
+//                cache.
+//
+// Inputs       : fd - the file handle
+//                upto - the chunk to stop at (UINT32_MAX for all)
+// Outputs      : none
+
+static void crud_readahead_collect(int16_t fd, uint32_t upto) {
+
+	// Local variables
+	CrudReadAhead *ra = &crud_file_ahead[fd];
+	CrudResponse ret;
+	uint32_t i;
+
+	for(i = 0; i < ra->count && ra->reads[i].chunk < upto; i++)
+	{
+		ret = crud_client_wait(ra->reads[i].ticket);
+		if(get_ret(ret) == 0 && get_len(ret) == ra->reads[i].length)
+			adopt_crud_cache(ra->reads[i].oid, ra->reads[i].buf, ra->reads[i].length, NULL);
+		else
+			free_crud_cache_buffer(ra->reads[i].buf);
+	}
+	memmove(ra->reads, &ra->reads[i], sizeof(CrudPrefetch) * (ra->count - i));
+	ra->count -= i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_file_length
+// Description  : Get the length of a file, including its buffered writes
+//
+// Inputs       : fd - the file handle
+// Outputs      : the length of the file
+
+static uint32_t crud_file_length(int16_t fd) {
+	if(crud_file_dirty[fd].count > 0)
+		return crud_file_dirty[fd].length;
+	return crud_file_table[fd].length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writeback_add
+// Description  : Buffer a write to a file, merging it with the ranges it
+//                overlaps or touches, and write the file back if the
+//                buffers are full (file lock held)
+//
+// Inputs       : fd - the file handle
+//                offset - where to write (at most the length)
+//                buf - the data to write
+//                count - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_writeback_add(int16_t fd, uint32_t offset, char *buf, uint32_t count) {
+
+	// Local variables
+	CrudWriteBack *wb = &crud_file_dirty[fd];
+	CrudDirtyRange *range;
+	uint32_t length = crud_file_length(fd), first, last, mid, lo, hi, size, i;
+	int64_t grown = 0;
+	char *data;
+	int full;
+
+	// Find the ranges the write overlaps or touches
+	first = 0;
+	last = wb->count;
+	while(first < last)
+	{
+		mid = (first + last) / 2;
+		if(wb->ranges[mid].offset + wb->ranges[mid].length < offset)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	for(last = first; last < wb->count && wb->ranges[last].offset <= offset + count; last++);
+
+	// None, the write becomes a range of its own (without room for one
+	// more, write the file back and send this write now)
+	if(first == last)
+	{
+		if(wb->count == wb->capacity)
+		{
+			size = (wb->capacity) ? wb->capacity * 2 : 16;
+			if((range = realloc(wb->ranges, sizeof(CrudDirtyRange) * size)) == NULL)
+			{
+				logMessage(LOG_ERROR_LEVEL, "CRUD IO : no memory to buffer a write of file %d, writing it now.", fd);
+				if(crud_writeback(fd) == -1)
+					return -1;
+				return crud_store(fd, offset, buf, count);
+			}
+			wb->ranges = range;
+			wb->capacity = size;
+		}
+		if((data = crud_pool_alloc(count)) == NULL)
+			return -1;
+		memmove(&wb->ranges[first + 1], &wb->ranges[first], sizeof(CrudDirtyRange) * (wb->count - first));
+		wb->count++;
+		range = &wb->ranges[first];
+		range->offset = offset;
+		range->length = range->size = count;
+		range->data = data;
+		memcpy(range->data, buf, count);
+		grown = count;
+	}
+
+	// Otherwise the first of them grows to take in the write and the rest
+	else
+	{
+		range = &wb->ranges[first];
+		lo = (offset < range->offset) ? offset : range->offset;
+		hi = wb->ranges[last - 1].offset + wb->ranges[last - 1].length;
+		hi = (offset + count > hi) ? offset + count : hi;
+		size = range->size;
+		if(hi - lo > size)
+			size = (hi - lo > size * 2) ? hi - lo : size * 2;
+		if(lo < range->offset || crud_pool_capacity(range->data) < size)
+		{
+			if((data = crud_pool_alloc(size)) == NULL)
+				return -1;
+			memcpy(&data[range->offset - lo], range->data, range->length);
+			crud_pool_free(range->data);
+		}
+		else
+			data = range->data;
+		grown = (int64_t)size - range->size;
+		for(i = first + 1; i < last; i++)
+		{
+			memcpy(&data[wb->ranges[i].offset - lo], wb->ranges[i].data, wb->ranges[i].length);
+			crud_pool_free(wb->ranges[i].data);
+			grown -= wb->ranges[i].size;
+		}
+		memcpy(&data[offset - lo], buf, count);
+		range->offset = lo;
+		range->length = hi - lo;
+		range->size = size;
+		range->data = data;
+		memmove(&wb->ranges[first + 1], &wb->ranges[last], sizeof(CrudDirtyRange) * (wb->count - last));
+		wb->count -= last - first - 1;
+	}
+	wb->length = (offset + count > length) ? offset + count : length;
+
+	// Write the file back once the buffers are full
+	pthread_mutex_lock(&crud_writeback_lock);
+	crud_writeback_bytes += grown;
+	full = (crud_writeback_bytes > crud_writeback_limit);
+	pthread_mutex_unlock(&crud_writeback_lock);
+	if(full)
+		return crud_writeback(fd);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writeback_find
+// Description  : Find the first buffered write of a file ending past a
+//                position (file lock held)
+//
+// Inputs       : fd - the file handle
+//                position - the position
+// Outputs      : the index of the range, the count of ranges if none
+
+static uint32_t crud_writeback_find(int16_t fd, uint32_t position) {
+
+	// Local variables
+	CrudWriteBack *wb = &crud_file_dirty[fd];
+	uint32_t first = 0, last = wb->count, mid;
+
+	// Binary search of the ranges (sorted, never overlapping)
+	while(first < last)
+	{
+		mid = (first + last) / 2;
+		if(wb->ranges[mid].offset + wb->ranges[mid].length <= position)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+	return first;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writeback_read
+// Description  : Copy the buffered writes of a file over what was read of it
+//                from the device (file lock held)
+//
+// Inputs       : fd - the file handle
+//                position - where the read started
+//                buf - the bytes read
+//                count - the number of bytes read
+// Outputs      : none
+
+static void crud_writeback_read(int16_t fd, uint32_t position, char *buf, uint32_t count) {
+
+	// Local variables
+	CrudWriteBack *wb = &crud_file_dirty[fd];
+	CrudDirtyRange *range;
+	uint32_t first, from, to, end = position + count;
+
+	// Copy the overlap of each range from the first ending past the position
+	for(first = crud_writeback_find(fd, position); first < wb->count && wb->ranges[first].offset < end; first++)
+	{
+		range = &wb->ranges[first];
+		from = (range->offset > position) ? range->offset : position;
+		to = (range->offset + range->length < end) ? range->offset + range->length : end;
+		memcpy(&buf[from - position], &range->data[from - range->offset], to - from);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writeback
+// Description  : Send the buffered writes of a file to the device, in
+//                order of offset so each starts within what is stored
+//                (file lock held).  They are dropped if that fails.
+//
+// Inputs       : fd - the file handle
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_writeback(int16_t fd) {
+
+	// Local variables
+	CrudWriteBack *wb = &crud_file_dirty[fd];
+	uint32_t i;
+	int failed = 0;
+
+	for(i = 0; i < wb->count && !failed; i++)
+	{
+		failed = (crud_store(fd, wb->ranges[i].offset, wb->ranges[i].data, wb->ranges[i].length) == -1);
+	}
+	if(failed)
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD IO : write back of file %d failed, dropping its buffered writes.", fd);
+	}
+	crud_writeback_discard(fd);
+	return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writeback_discard
+// Description  : Drop the buffered writes of a file (file lock held, or no
+//                file operations running)
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+
+static void crud_writeback_discard(int16_t fd) {
+
+	// Local variables
+	CrudWriteBack *wb = &crud_file_dirty[fd];
+	uint32_t i, freed = 0;
+
+	for(i = 0; i < wb->count; i++)
+	{
+		freed += wb->ranges[i].size;
+		crud_pool_free(wb->ranges[i].data);
+	}
+	free(wb->ranges);
+	memset(wb, 0x0, sizeof(CrudWriteBack));
+	pthread_mutex_lock(&crud_writeback_lock);
+	crud_writeback_bytes -= freed;
+	pthread_mutex_unlock(&crud_writeback_lock);
+
+	// A failed write back can leave the position past the end
+	if(crud_file_table[fd].position > crud_file_table[fd].length)
+		crud_file_table[fd].position = crud_file_table[fd].length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writeback_all
+// Description  : Send the buffered writes of every file to the device
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_writeback_all(void) {
+
+	// Local variables
+	CrudOID oid;
+	uint32_t length;
+	uint8_t flags;
+	int16_t fd;
+	int failed = 0;
+
+	for(fd = 0; fd < CRUD_MAX_OPEN_FILES; fd++)
+	{
+		crud_lock_handle(fd);
+		if(crud_file_dirty[fd].count > 0)
+		{
+			oid = crud_file_table[fd].object_id;
+			length = crud_file_table[fd].length;
+			flags = crud_file_table[fd].flags;
+			if( crud_writeback(fd) == -1)
+				failed = 1;
+			crud_save_entry(fd, oid, length, flags);
+		}
+		crud_unlock_file(fd);
+	}
+	return failed ? -1 : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_save_entry
+// Description  : Save the object, length and flags of a file in its
+//                directory entry if they changed (file lock held)
+//
+// Inputs       : fd - the file handle
+//                oid, length, flags - what they were before the change
+// Outputs      : none
+
+static void crud_save_entry(int16_t fd, CrudOID oid, uint32_t length, uint8_t flags) {
+
+	// Local variables
+	CrudDirectoryRef ref;
+
+	if(oid == crud_file_table[fd].object_id && length == crud_file_table[fd].length &&
+			flags == crud_file_table[fd].flags)
+		return;
+	pthread_mutex_lock(&crud_table_lock);
+	if( crud_dir_find(crud_name(fd), 0, &ref) == 0)
+	{
+		ref.entry->object_id = crud_file_table[fd].object_id;
+		ref.entry->length = crud_file_table[fd].length;
+		ref.entry->flags = crud_file_table[fd].flags;
+		crud_dir_dirty(&ref);
+	}
+	pthread_mutex_unlock(&crud_table_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_handles_reset
+// Description  : Empty the file handle table (table lock held, no file
+//                operations running)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_handles_reset(void) {
+
+	// Local variables
+	int i;
+
+	// Walk down the table so the lowest handle ends up on top of the stack
+	for (i=0; i<CRUD_MAX_OPEN_FILES; i++) {
+		crud_readahead_collect(i, UINT32_MAX);
+		crud_writeback_discard(i);
+		free(crud_file_chunks[i]);
+		crud_file_chunks[i] = NULL;
+	}
+	memset(crud_file_table, 0x0, sizeof(crud_file_table));
+	memset(crud_file_ahead, 0x0, sizeof(crud_file_ahead));
+	crud_free_count = 0;
+	for (i=CRUD_MAX_OPEN_FILES-1; i>=0; i--) {
+		crud_free_handles[crud_free_count++] = i;
+	}
+	memset(crud_file_names, 0xff, sizeof(crud_file_names));
+	crud_name_used = crud_name_garbage = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_name_intern
+// Description  : Place the filename of a handle in the name arena, packing
+//                the names still in use first when half of it is garbage
+//                (table lock held)
+//
+// Inputs       : fd - the file handle
+//                path - the filename
+// Outputs      : 0 if successful, -1 if failure (the arena is unchanged)
+
+static int crud_name_intern(int16_t fd, char *path) {
+
+	// Local variables
+	uint32_t size = strlen(path) + 1, used = 0, asize = crud_name_size;
+	char *arena;
+	int i;
+
+	// Pack the names in use into a fresh arena, big enough for this one
+	if (crud_name_used + size > crud_name_size) {
+		if (asize == 0) {
+			asize = CRUD_NAME_ARENA_SIZE;
+		} else if (crud_name_garbage < crud_name_used/2) {
+			asize *= 2;
+		}
+		while (crud_name_used - crud_name_garbage + size > asize) {
+			asize *= 2;
+		}
+		if ((arena = malloc(asize)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD IO : no memory for the filename [%s].", path);
+			return(-1);
+		}
+		for (i=0; i<CRUD_MAX_OPEN_FILES; i++) {
+			if (crud_file_names[i] != CRUD_NO_NAME) {
+				strcpy(&arena[used], &crud_name_arena[crud_file_names[i]]);
+				crud_file_names[i] = used;
+				used += strlen(&arena[used]) + 1;
+			}
+		}
+		free(crud_name_arena);
+		crud_name_arena = arena;
+		crud_name_size = asize;
+		crud_name_used = used;
+		crud_name_garbage = 0;
+	}
+
+	// Then add the name at the end
+	memcpy(&crud_name_arena[crud_name_used], path, size);
+	crud_file_names[fd] = crud_name_used;
+	crud_name_used += size;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_name_release
+// Description  : Give back the filename of a handle (table lock held)
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+
+static void crud_name_release(int16_t fd) {
+	crud_name_garbage += strlen(crud_name(fd)) + 1;
+	crud_file_names[fd] = CRUD_NO_NAME;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_name
+// Description  : Get the filename of a handle (table lock held)
+//
+// Inputs       : fd - the file handle
+// Outputs      : the filename
+
+static char *crud_name(int16_t fd) {
+	return(&crud_name_arena[crud_file_names[fd]]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_file_locks_init
+// Description  : Initialize the file locks (run once)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void crud_file_locks_init(void) {
+	int i;
+	for (i=0; i<CRUD_MAX_OPEN_FILES; i++)
+		pthread_mutex_init(&crud_file_locks[i], NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_lock_handle
+// Description  : Take the lock of an entry of the file handle table
+//
+// Inputs       : fd - the index of the entry
+// Outputs      : none
+
+static void crud_lock_handle(int16_t fd) {
+	pthread_once(&crud_file_locks_once, crud_file_locks_init);
+	pthread_mutex_lock(&crud_file_locks[fd]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_lock_file
+// Description  : Check a file handle and take its lock, rejecting a handle
+//                whose entry was given back (its generation moved on)
+//
+// Inputs       : fd - the file handle
+// Outputs      : the index of the entry if successful, -1 if failure (bad
+//                or stale handle)
+
+static int16_t crud_lock_file(int16_t fd) {
+
+	// Local variables
+	int16_t i;
+
+	if (fd < 0)
+		return -1;
+	i = fd & (CRUD_MAX_OPEN_FILES-1);
+	crud_lock_handle(i);
+	if ((fd >> CRUD_HANDLE_BITS) != CRUD_HANDLE_GENERATION(i)) {
+		crud_unlock_file(i);
+		return -1;
+	}
+	return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_unlock_file
+// Description  : Release the lock of a file handle
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+
+static void crud_unlock_file(int16_t fd) {
+	pthread_mutex_unlock(&crud_file_locks[fd]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_io_read_views
+// Description  : Read through views of the file for the unit tests, copying
+//                each out and giving it back
+//
+// Inputs       : fd - the file handle
+//                buf - the buffer to copy into
+//                count - the number of bytes to read
+// Outputs      : the number of bytes read or -1 if failure
+
+static int32_t crud_io_read_views(int16_t fd, char *buf, int32_t count) {
+
+	// Local variables
+	CrudCacheView view;
+	int32_t bytes, total = 0;
+
+	// Views stop at the end of an object, so take as many as it needs
+	do {
+		if ((bytes = crud_read_view(fd, count - total, &view)) == -1) {
+			return(-1);
+		}
+		memcpy(&buf[total], view.data, bytes);
+		crud_release_view(&view);
+		total += bytes;
+	} while ((bytes > 0) && (total < count));
+	return(total);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudIOUnitTest
+// Description  : Perform a test of the CRUD IO implementation
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudIOUnitTest(void) {
+
+	// Local variables
+	uint8_t ch;
+	int16_t fd, i;
+	int32_t cio_utest_length, cio_utest_position, count, bytes, expected;
+	char *cio_utest_buffer, *tbuf;
+	CRUD_UNIT_TEST_TYPE cmd;
+	char lstr[1024];
+
+	// Setup some operating buffers, zero out the mirrored file contents
+	cio_utest_buffer = malloc(CRUD_MAX_OBJECT_SIZE);
+	tbuf = malloc(CRUD_MAX_OBJECT_SIZE);
+	memset(cio_utest_buffer, 0x0, CRUD_MAX_OBJECT_SIZE);
+	cio_utest_length = 0;
+	cio_utest_position = 0;
+
+	// Format and mount the file system
+	if (crud_format() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on format or mount operation.");
+		return(-1);
+	}
+
+	// Start by opening a file
+	fd = crud_open("temp_file.txt");
+	if (fd == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure open operation.");
+		return(-1);
+	}
+
+	// Now do a bunch of operations
+	for (i=0; i<CRUD_IO_UNIT_TEST_ITERATIONS; i++) {
+
+		// Pick a random command
+		if (cio_utest_length == 0) {
+			cmd = CIO_UNIT_TEST_WRITE;
+		} else {
+			cmd = getRandomValue(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_SEEK);
+		}
+
+		// Execute the command
+		switch (cmd) {
+
+		case CIO_UNIT_TEST_READ: // read a random set of data
+			count = getRandomValue(0, cio_utest_length);
+			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read %d at position %d", bytes, cio_utest_position);
+			bytes = crud_read(fd, tbuf, count);
+			if (bytes == -1) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Read failure.");
+				return(-1);
+			}
+
+			// Compare to what we expected
+			if (cio_utest_position+count > cio_utest_length) {
+				expected = cio_utest_length-cio_utest_position;
+			} else {
+				expected = count;
+			}
+			if (bytes != expected) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : short/long read of [%d!=%d]", bytes, expected);
+				return(-1);
+			}
+			if ( (bytes > 0) && (memcmp(&cio_utest_buffer[cio_utest_position], tbuf, bytes)) ) {
+
+				bufToString((unsigned char *)tbuf, bytes, (unsigned char *)lstr, 1024 );
+				logMessage(LOG_INFO_LEVEL, "CIO_UTEST R: %s", lstr);
+				bufToString((unsigned char *)&cio_utest_buffer[cio_utest_position], bytes, (unsigned char *)lstr, 1024 );
+				logMessage(LOG_INFO_LEVEL, "CIO_UTEST U: %s", lstr);
+
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : read data mismatch (%d)", bytes);
+				return(-1);
+			}
+			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read %d match", bytes);
+
+
+			// update the crud_file_table[fd].positionition pointer
+			cio_utest_position += bytes;
+			break;
+
+		case CIO_UNIT_TEST_APPEND: // Append data onto the end of the file
+			// Create random block, check to make sure that the write is not too large
+			ch = getRandomValue(0, 0xff);
+			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			if (cio_utest_length+count >= CRUD_MAX_OBJECT_SIZE) {
+
+				// Log, seek to end of file, create random value
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : append of %d bytes [%x]", count, ch);
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : seek to position %d", cio_utest_length);
+				if (crud_seek(fd, cio_utest_length)) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : seek failed [%d].", cio_utest_length);
+					return(-1);
+				}
+				cio_utest_position = cio_utest_length;
+				memset(&cio_utest_buffer[cio_utest_position], ch, count);
+
+				// Now write
+				bytes = crud_write(fd, &cio_utest_buffer[cio_utest_position], count);
+				if (bytes != count) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : append failed [%d].", count);
+					return(-1);
+				}
+				cio_utest_length = cio_utest_position += bytes;
+			}
+			break;
+
+		case CIO_UNIT_TEST_WRITE: // Write random block to the file
+			ch = getRandomValue(0, 0xff);
+			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			// Check to make sure that the write is not too large
+			if (cio_utest_length+count < CRUD_MAX_OBJECT_SIZE) {
+				// Log the write, perform it
+				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : write of %d bytes [%x]", count, ch);
+				memset(&cio_utest_buffer[cio_utest_position], ch, count);
+				bytes = crud_write(fd, &cio_utest_buffer[cio_utest_position], count);
+				if (bytes!=count) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : write failed [%d] .", count, bytes);
+					return(-1);
+				}
+				cio_utest_position += bytes;
+				if (cio_utest_position > cio_utest_length) {
+					cio_utest_length = cio_utest_position;
+				}
+			}
+			break;
+
+		case CIO_UNIT_TEST_SEEK:
+			count = getRandomValue(0, cio_utest_length);
+			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : seek to position %d", count);
+			if (crud_seek(fd, count)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : seek failed [%d].", count);
+				return(-1);
+			}
+			cio_utest_position = count;
+			break;
+
+		default: // This should never happen
+			CMPSC_ASSERT0(0, "CRUD_IO_UNIT_TEST : illegal test command.");
+			break;
+
+		}
+
+#if DEEP_DEBUG
+		// VALIDATION STEP: ENSURE OUR LOCAL IS LIKE OBJECT STORE
+		CrudRequest request;
+		CrudResponse response;
+		CrudOID oid;
+		CRUD_REQUEST_TYPES req;
+		uint32_t length;
+		uint8_t res, flags;
+
+		// Make a fake request to get file handle, then check it
+		request = construct_crud_request(crud_file_table[0].object_id, CRUD_READ, CRUD_MAX_OBJECT_SIZE, CRUD_NULL_FLAG, 0);
+		response = crud_client_operation(request, tbuf);
+		if ((deconstruct_crud_request(response, &oid, &req, &length, &flags, &res) != 0) || (res != 0))  {
+			logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
+			return(-1);
+		}
+		if ( (cio_utest_length != length) || (memcmp(cio_utest_buffer, tbuf, length)) ) {
+			logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed [%x]", response);
+			bufToString((unsigned char *)tbuf, length, (unsigned char *)lstr, 1024 );
+			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VR: %s", lstr);
+			bufToString((unsigned char *)cio_utest_buffer, length, (unsigned char *)lstr, 1024 );
+			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VU: %s", lstr);
+			return(-1);
+		}
+
+		// Print out the buffer
+		bufToString((unsigned char *)cio_utest_buffer, cio_utest_length, (unsigned char *)lstr, 1024 );
+		logMessage(LOG_INFO_LEVEL, "CIO_UTEST: %s", lstr);
+#endif
+
+	}
+
+	// Close the files and cleanup buffers, assert on failure
+	if (crud_close(fd)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure read comparison block.", fd);
+		return(-1);
+	}
+	free(cio_utest_buffer);
+	free(tbuf);
+
+	// Format and mount the file system
+	if (crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure on unmount operation.");
+		return(-1);
+	}
+
+	// Return successfully
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudIOViewTest
+// Description  : Perform a test of the zero-copy reads: reads through views
+//                and positional reads of a file of several chunks, checked
+//                against a local mirror, with writes between them
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudIOViewTest(void) {
+
+	// Local variables
+	int32_t length, position, offset, count, bytes, expected, i;
+	CrudCacheView view;
+	char *mirror, *tbuf;
+	int16_t fd;
+
+	// Format and mount the file system, write the file
+	if (crud_format() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : Failure on format or mount operation.");
+		return(-1);
+	}
+	mirror = malloc(CRUD_IO_CONCURRENT_MAX_SIZE);
+	tbuf = malloc(CRUD_IO_CONCURRENT_MAX_SIZE);
+	length = CRUD_IO_CONCURRENT_MAX_SIZE;
+	for (i=0; i<length; i++) {
+		mirror[i] = (char)getRandomValue(0, 0xff);
+	}
+	fd = crud_open("view_file.txt");
+	if ((fd == -1) || (crud_write(fd, mirror, length) != length)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : Failure writing the file.");
+		free(mirror);
+		free(tbuf);
+		return(-1);
+	}
+
+	// Seek somewhere, read at another offset (which must not move the
+	// position) and then through views from the position
+	for (i=0; i<CRUD_IO_VIEW_TEST_ITERATIONS; i++) {
+		position = getRandomValue(0, length);
+		offset = getRandomValue(0, length);
+		count = getRandomValue(0, length);
+		if (crud_seek(fd, position)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : seek failed [%d].", position);
+			break;
+		}
+		bytes = crud_pread(fd, tbuf, count, offset);
+		expected = (offset+count > length) ? length-offset : count;
+		if ((bytes != expected) || ((bytes > 0) && memcmp(&mirror[offset], tbuf, bytes))) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : positional read mismatch [%d!=%d]", bytes, expected);
+			break;
+		}
+		bytes = crud_io_read_views(fd, tbuf, count);
+		expected = (position+count > length) ? length-position : count;
+		if ((bytes != expected) || ((bytes > 0) && memcmp(&mirror[position], tbuf, bytes))) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : view read mismatch [%d!=%d]", bytes, expected);
+			break;
+		}
+
+		// Now and then change a block under a view of it, which must keep
+		// the bytes it was handed (later reads see the new ones)
+		if (i % 8 == 0) {
+			count = getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			offset = getRandomValue(0, length-count);
+			if (crud_seek(fd, offset) || ((bytes = crud_read_view(fd, count, &view)) == -1)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : view failed [%d].", offset);
+				break;
+			}
+			memcpy(tbuf, &mirror[offset], bytes);
+			memset(&mirror[offset], (char)getRandomValue(0, 0xff), count);
+			if (crud_seek(fd, offset) || (crud_write(fd, &mirror[offset], count) != count) ||
+					memcmp(view.data, tbuf, bytes)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : write under a view failed [%d].", count);
+				crud_release_view(&view);
+				break;
+			}
+			crud_release_view(&view);
+		}
+	}
+	free(mirror);
+	free(tbuf);
+	if (i < CRUD_IO_VIEW_TEST_ITERATIONS) {
+		return(-1);
+	}
+
+	// Close the file and unmount the file system
+	if (crud_close(fd) || crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_VIEW_TEST : Failure on close or unmount operation.");
+		return(-1);
+	}
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_VIEW_TEST : %d view and positional reads completed.", CRUD_IO_VIEW_TEST_ITERATIONS);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_io_thread_test
+// Description  : One thread of the concurrent unit test: open the shared
+//                file, then do random reads, writes and seeks on a file of
+//                its own, checking every read against a local mirror.
+//
+// Inputs       : arg - the CrudIOThreadTest for the thread
+// Outputs      : NULL
+
+static void *crud_io_thread_test(void *arg) {
+
+	// Local variables
+	CrudIOThreadTest *test = arg;
+	char path[CRUD_MAX_PATH_LENGTH], *mirror, *tbuf;
+	int32_t length = 0, position = 0, count, bytes, expected, i;
+	int16_t fd;
+	uint8_t ch;
+	CRUD_UNIT_TEST_TYPE cmd;
+
+	// Setup the buffers, every thread opens the shared file and its own
+	test->result = -1;
+	mirror = malloc(CRUD_IO_CONCURRENT_MAX_SIZE);
+	tbuf = malloc(CRUD_IO_CONCURRENT_MAX_SIZE);
+	snprintf(path, CRUD_MAX_PATH_LENGTH, "concurrent_%d.txt", test->id);
+	test->shared = crud_open("concurrent_shared.txt");
+	fd = crud_open(path);
+	if ((test->shared == -1) || (fd == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : thread %d open failed.", test->id);
+		free(mirror);
+		free(tbuf);
+		return(NULL);
+	}
+
+	// Now do a bunch of operations
+	for (i=0; i<CRUD_IO_CONCURRENT_ITERATIONS; i++) {
+
+		// Pick a random command (appends are writes at the end)
+		cmd = (length == 0) ? CIO_UNIT_TEST_WRITE : getRandomValue(CIO_UNIT_TEST_READ, CIO_UNIT_TEST_SEEK);
+		switch (cmd) {
+
+		case CIO_UNIT_TEST_READ: // read a random set of data, compare to the mirror
+			// (by copy, through views, or at the position without moving it)
+			count = getRandomValue(0, length);
+			if (i % 3 == 0) {
+				bytes = crud_read(fd, tbuf, count);
+			} else if (i % 3 == 1) {
+				bytes = crud_io_read_views(fd, tbuf, count);
+			} else {
+				bytes = crud_pread(fd, tbuf, count, position);
+			}
+			expected = (position+count > length) ? length-position : count;
+			if ((bytes != expected) || ((bytes > 0) && memcmp(&mirror[position], tbuf, bytes))) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : thread %d read mismatch [%d!=%d]",
+						test->id, bytes, expected);
+				i = -1;
+				break;
+			}
+			position += (i % 3 == 2) ? 0 : bytes;
+			break;
+
+		case CIO_UNIT_TEST_APPEND: // Append data onto the end of the file
+			if (crud_seek(fd, length)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : thread %d seek failed [%d].", test->id, length);
+				i = -1;
+				break;
+			}
+			position = length;
+			// Fall through
+
+		case CIO_UNIT_TEST_WRITE: // Write random block to the file
+			ch = getRandomValue(0, 0xff);
+			count = getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
+			if (position+count < CRUD_IO_CONCURRENT_MAX_SIZE) {
+				memset(&mirror[position], ch, count);
+				bytes = crud_write(fd, &mirror[position], count);
+				if (bytes != count) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : thread %d write failed [%d].", test->id, count);
+					i = -1;
+					break;
+				}
+				position += bytes;
+				if (position > length) {
+					length = position;
+				}
+			}
+			break;
+
+		case CIO_UNIT_TEST_SEEK:
+			count = getRandomValue(0, length);
+			if (crud_seek(fd, count)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : thread %d seek failed [%d].", test->id, count);
+				i = -1;
+				break;
+			}
+			position = count;
+			break;
+
+		default: // This should never happen
+			CMPSC_ASSERT0(0, "CRUD_IO_CONCURRENT_TEST : illegal test command.");
+			break;
+		}
+		if (i == -1) {
+			break;
+		}
+	}
+
+	// Close the files (the shared one stays open for the other threads),
+	// the closed handle has to be refused after, cleanup buffers
+	if ((i == CRUD_IO_CONCURRENT_ITERATIONS) && (crud_close(fd) == 0) &&
+			(crud_close(test->shared) == 0) && (crud_close(fd) == -1)) {
+		test->result = 0;
+	}
+	free(mirror);
+	free(tbuf);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudIOConcurrentTest
+// Description  : Perform a test of the CRUD IO implementation from several
+//                threads at once, each working its own file
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudIOConcurrentTest(void) {
+
+	// Local variables
+	pthread_t threads[CRUD_IO_UNIT_TEST_THREADS];
+	CrudIOThreadTest tests[CRUD_IO_UNIT_TEST_THREADS];
+	int i, failed = 0;
+
+	// Format and mount the file system
+	if (crud_format() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : Failure on format or mount operation.");
+		return(-1);
+	}
+
+	// Start the threads, then wait for them all
+	for (i=0; i<CRUD_IO_UNIT_TEST_THREADS; i++) {
+		tests[i].id = i;
+		if (pthread_create(&threads[i], NULL, crud_io_thread_test, &tests[i]) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : Failure starting thread %d.", i);
+			return(-1);
+		}
+	}
+	for (i=0; i<CRUD_IO_UNIT_TEST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	// Every thread has to pass, and agree on the handle of the shared file
+	for (i=0; i<CRUD_IO_UNIT_TEST_THREADS; i++) {
+		if ((tests[i].result != 0) || (tests[i].shared != tests[0].shared)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : thread %d failed.", i);
+			failed = 1;
+		}
+	}
+	if (failed) {
+		return(-1);
+	}
+
+	// The last close gave the shared handle back
+	if (crud_seek(tests[0].shared, 0) != -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : shared handle still open after every close.");
+		return(-1);
+	}
+
+	// Unmount the file system
+	if (crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_CONCURRENT_TEST : Failure on unmount operation.");
+		return(-1);
+	}
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_CONCURRENT_TEST : %d threads completed %d operations each.",
+			CRUD_IO_UNIT_TEST_THREADS, CRUD_IO_CONCURRENT_ITERATIONS);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_io_mount_store
+// Description  : Create the objects of a store file on a freshly formatted
+//                device (the legacy table pointing at their new IDs), then
+//                mount the device and read each file back
+//
+// Inputs       : objs - the objects of the store file
+//                count - the number of objects
+//                table - the legacy table (the data of one of the objects)
+// Outputs      : the number of files read back, -1 if failure
+
+static int crud_io_mount_store(CrudIOStoreObject *objs, uint32_t count, CrudFileAllocationType *table) {
+
+	// Local variables
+	CrudResponse ret;
+	uint32_t i, j;
+	int16_t fd;
+	char *tbuf;
+	int files = 0;
+
+	// Start from an empty device, create the objects and then the table
+	if (crud_format() || (get_ret(crud_client_operation(crud_formati(0, CRUD_FORMAT, 0, 0, 0), NULL)) == 1)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure on format operation.");
+		return(-1);
+	}
+	for (i=0; i<count; i++) {
+		if (objs[i].data == (char *)table) {
+			continue;
+		}
+		ret = crud_client_operation(crud_formati(0, CRUD_CREATE, objs[i].length, 0, 0), objs[i].data);
+		if (get_ret(ret) == 1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure creating object [OID %u].", objs[i].oid);
+			return(-1);
+		}
+		objs[i].newoid = get_oid(ret);
+		for (j=0; j<CRUD_MAX_TOTAL_FILES; j++) {
+			if ((table[j].filename[0] != '\0') && (table[j].object_id == objs[i].oid)) {
+				table[j].object_id = objs[i].newoid;
+			}
+		}
+	}
+	ret = crud_client_operation(crud_formati(0, CRUD_CREATE, CRUD_LEGACY_TABLE_SIZE, CRUD_PRIORITY_OBJECT, 0), table);
+	if (get_ret(ret) == 1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure creating the legacy table.");
+		return(-1);
+	}
+
+	// Mount (converting the table), then read every file back in two
+	// pieces (the first a range at offset 0 shorter than the object)
+	if (crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure on mount operation.");
+		return(-1);
+	}
+	if ((tbuf = malloc(CRUD_MAX_OBJECT_SIZE)) == NULL) {
+		return(-1);
+	}
+	for (j=0; j<CRUD_MAX_TOTAL_FILES; j++) {
+		if (table[j].filename[0] == '\0') {
+			continue;
+		}
+		for (i=0; (i<count) && (objs[i].newoid != table[j].object_id); i++);
+		if ((i == count) || (table[j].length > objs[i].length) ||
+				((fd = crud_open(table[j].filename)) == -1) ||
+				(crud_read(fd, tbuf, table[j].length/2) != table[j].length/2) ||
+				(crud_read(fd, &tbuf[table[j].length/2], CRUD_MAX_OBJECT_SIZE) != table[j].length - table[j].length/2) ||
+				memcmp(tbuf, objs[i].data, table[j].length) || crud_close(fd)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : file [%s] not read back.", table[j].filename);
+			free(tbuf);
+			return(-1);
+		}
+		files++;
+	}
+	free(tbuf);
+
+	// Unmount the file system
+	if (crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure on unmount operation.");
+		return(-1);
+	}
+	return(files);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudIOMountTest
+// Description  : Perform a test of mounting the shipped store, whose priority
+//                object is a legacy file table
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudIOMountTest(void) {
+
+	// Local variables
+	CrudIOStoreObject *objs;
+	CrudFileAllocationType *table = NULL;
+	CrudOID next;
+	uint32_t count, i;
+	int files = -1;
+	FILE *fh;
+
+	// Read the store file (ID, flags, length and contents of each object)
+	if ((fh = fopen(CRUD_IO_UNIT_TEST_STORE, "r")) == NULL) {
+		logMessage(LOG_INFO_LEVEL, "CRUD_IO_MOUNT_TEST : no store [%s], skipped.", CRUD_IO_UNIT_TEST_STORE);
+		return(0);
+	}
+	if ((fread(&next, sizeof(next), 1, fh) != 1) || (fread(&count, sizeof(count), 1, fh) != 1) ||
+			((objs = calloc(count, sizeof(CrudIOStoreObject))) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure reading store [%s].", CRUD_IO_UNIT_TEST_STORE);
+		fclose(fh);
+		return(-1);
+	}
+	for (i=0; i<count; i++) {
+		if ((fread(&objs[i].oid, sizeof(objs[i].oid), 1, fh) != 1) || (fread(&objs[i].flags, sizeof(objs[i].flags), 1, fh) != 1) ||
+				(fread(&objs[i].length, sizeof(objs[i].length), 1, fh) != 1) || (objs[i].length > CRUD_MAX_OBJECT_SIZE) ||
+				((objs[i].data = malloc(objs[i].length)) == NULL) ||
+				(fread(objs[i].data, 1, objs[i].length, fh) != objs[i].length)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_MOUNT_TEST : Failure reading store object %u.", i);
+			table = NULL;
+			count = i + 1;
+			break;
+		}
+		if ((objs[i].flags & CRUD_PRIORITY_OBJECT) && (objs[i].length == CRUD_LEGACY_TABLE_SIZE)) {
+			table = (CrudFileAllocationType *)objs[i].data;
+		}
+	}
+	fclose(fh);
+
+	// Load it on the device and mount it
+	if ((i == count) && (table == NULL)) {
+		logMessage(LOG_INFO_LEVEL, "CRUD_IO_MOUNT_TEST : store [%s] holds no legacy table, skipped.", CRUD_IO_UNIT_TEST_STORE);
+		files = 0;
+	} else if (table != NULL) {
+		files = crud_io_mount_store(objs, count, table);
+	}
+	for (i=0; i<count; i++) {
+		free(objs[i].data);
+	}
+	free(objs);
+	if (files == -1) {
+		return(-1);
+	}
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_MOUNT_TEST : mounted [%s], %d files read back.", CRUD_IO_UNIT_TEST_STORE, files);
+	return(0);
+}
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_open
+// Description  : This function opens the file and returns a file handle.
+//                Threads opening the same path share the handle, which is
+//                given back when each of them has closed it.
+//
+// Inputs       : path - the path "in the storage array"
+// Outputs      : file handle if successful, -1 if failure
+
+int16_t crud_open(char *path) {
+	// Set values for the file descrptor
+	CrudDirectoryRef ref;
+	uint16_t generation;
+	int16_t i;
+	if(path == NULL || path[0] == '\0' || strlen(path) >= CRUD_MAX_PATH_LENGTH)
 	{
-		if(strcmp(path,crud_file_table[i].filename)==0)
-		{
-			break;
-		}
-		i++;
+		logMessage(LOG_ERROR_LEVEL, "CRUD IO : bad path for open.");
+		return -1;
 	}
-	if(i  >= CRUD_MAX_TOTAL_FILES)
+	for(;;)
 	{
-		for(  i = 0; strcmp(crud_file_table[i].filename,"") !=0; i++){}
-		crud_file_table[i].length = 0;
-		strcpy(crud_file_table[i].filename , path);
-		crud_file_table[i].object_id = 0;
-	}
-	crud_file_table[i].position = 0;
+		// Look the file up in the directory, creating it if not there
+		pthread_mutex_lock(&crud_table_lock);
+		if( crud_dir_find(path, 1, &ref) == -1)
+		{
+			pthread_mutex_unlock(&crud_table_lock);
+			return -1;
+		}
+		// Threads share the handle of an open file, otherwise take an
+		// unused one (nobody else works on it, so it is filled in here)
+		i = *ref.handle;
+		if(i == -1)
+		{
+			if(crud_free_count == 0)
+			{
+				pthread_mutex_unlock(&crud_table_lock);
+				logMessage(LOG_ERROR_LEVEL, "CRUD IO : too many open files, cannot open [%s].", path);
+				return -1;
+			}
+			i = crud_free_handles[crud_free_count-1];
+			if(crud_name_intern(i, path) == -1)
+			{
+				pthread_mutex_unlock(&crud_table_lock);
+				return -1;
+			}
+			crud_free_count--;
+			crud_file_table[i].object_id = ref.entry->object_id;
+			crud_file_table[i].length = ref.entry->length;
+			crud_file_table[i].flags = ref.entry->flags;
+			crud_file_table[i].position = 0;
+			*ref.handle = i;
+		}
+		generation = crud_file_table[i].generation;
 
+		// Call a request to init the fd
+		if(init == 0)
+		{
+			CrudRequest cr;
+			cr = crud_formati( 0, CRUD_INIT,0, 0, 0);
+			CrudResponse cret = crud_client_operation( cr, NULL);
+			init = 1;
+			
+			if((cret & 1) == 1)
+			{
+				pthread_mutex_unlock(&crud_table_lock);
+				return -1;
+			}
+		}
+		pthread_mutex_unlock(&crud_table_lock);
 
-	// Call a request to init the fd
-	if(init == 0)
-	{
-		CrudRequest cr;
-		cr = crud_formati( 0, CRUD_INIT,crud_file_table[i].length, 0, 0);
-		CrudResponse cret = crud_client_operation( cr, NULL);
-		init = 1;
-		
-		if((cret & 1) == 1)
+		// Count the open (the first one rewinds the file), unless the
+		// handle was given back in the meantime
+		crud_lock_handle(i);
+		if(crud_file_table[i].generation == generation)
 		{
-			return -1;
+			if(crud_file_table[i].open == 0)
+				crud_file_table[i].position = 0;
+			crud_file_table[i].open++;
+			crud_unlock_file(i);
+			CRUD_TRACE_COUNT(CRUD_CTR_OPENS, 1);
+			// Return fd
+			return (int16_t)((CRUD_HANDLE_GENERATION(i) << CRUD_HANDLE_BITS) | i);
 		}
+		crud_unlock_file(i);
 	}
-	crud_file_table[i].open = 1;
-	// Return fd
-	return i;
 
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : crud_close
-// Description  : This function closes the file
+// Description  : This function closes the file, sending its buffered writes;
+//                the last close of a shared handle gives the handle back
 //
 // Inputs       : fd - the file handle of the object to close
 // Outputs      : 0 if successful, -1 if failure
 
 int16_t crud_close(int16_t fd) {
-	crud_file_table[fd].open = 0;
-	return 0;
+	CrudDirectoryRef ref;
+	CrudOID oid;
+	uint32_t length;
+	uint8_t flags;
+	int ret;
+	if( (fd = crud_lock_file(fd)) == -1)
+		return -1;
+	if(crud_file_table[fd].open == 0)
+	{
+		crud_unlock_file(fd);
+		return -1;
+	}
+	oid = crud_file_table[fd].object_id;
+	length = crud_file_table[fd].length;
+	flags = crud_file_table[fd].flags;
+	ret = crud_writeback(fd);
+	crud_save_entry(fd, oid, length, flags);
+	if(--crud_file_table[fd].open > 0)
+	{
+		// Other threads still have the file open
+		crud_unlock_file(fd);
+		CRUD_TRACE_COUNT(CRUD_CTR_CLOSES, 1);
+		return ret;
+	}
+	crud_file_table[fd].generation++;
+	crud_readahead_collect(fd, UINT32_MAX);
+	memset(&crud_file_ahead[fd], 0x0, sizeof(CrudReadAhead));
+	free(crud_file_chunks[fd]);
+	crud_file_chunks[fd] = NULL;
+	// The file stays in the directory, only the handle goes
+	pthread_mutex_lock(&crud_table_lock);
+	if( crud_dir_find(crud_name(fd), 0, &ref) == 0)
+		*ref.handle = -1;
+	crud_name_release(fd);
+	crud_free_handles[crud_free_count++] = fd;
+	pthread_mutex_unlock(&crud_table_lock);
+	crud_unlock_file(fd);
+	CRUD_TRACE_COUNT(CRUD_CTR_CLOSES, 1);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -500,41 +2332,314 @@ int16_t crud_close(int16_t fd) {
 // Outputs      : the number of bytes read or -1 if failures
 
 int32_t crud_read(int16_t fd, void *buf, int32_t count) {
+
+	// Local variables
+	int32_t ret;
+	CRUD_TRACE_START(start);
+
+	// Only one thread works on a file at a time
+	if( (fd = crud_lock_file(fd)) == -1)
+		return -1;
+	ret = crud_read_locked(fd, buf, count);
+	crud_unlock_file(fd);
+	CRUD_TRACE_FILE_OP(CRUD_EVT_READ, fd, ret, start);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_locked
+// Description  : Reads up to "count" bytes from the file handle "fd" into the
+//                buffer "buf", with the file lock held.
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+// Outputs      : the number of bytes read or -1 if failures
+
+static int32_t crud_read_locked(int16_t fd, void *buf, int32_t count) {
 	// Check the fd is right
 	if(crud_file_table[fd].open == 0)
 		return -1;
 	//initialize variables 
-	CrudResponse ret;
-	CrudRequest send;
-	char* buf2;
+	uint32_t length = crud_file_length(fd), stored = crud_file_table[fd].length;
 	// Check the count and buf is right
 	if(buf == NULL || count < 0)
 	{
 		return -1;
 	}
 	// crud_file_table[fd].position and len are fixed when crud_file_table[fd].position >= len
-	if(crud_file_table[fd].position >= crud_file_table[fd].length)
+	if(crud_file_table[fd].position >= length)
 	{
-		crud_file_table[fd].position = crud_file_table[fd].length;
+		crud_file_table[fd].position = length;
 		return 0;
 	}
 	// calculate the count when read calls for more then available spots
-	if((crud_file_table[fd].position + count) > crud_file_table[fd].length){
-		count =   crud_file_table[fd].length - crud_file_table[fd].position;
+	if((crud_file_table[fd].position + count) > length){
+		count =   length - crud_file_table[fd].position;
 	}
-	// call request with read and make a buffer to hold them
-	buf2 = malloc( sizeof(buf[0]) * CRUD_MAX_OBJECT_SIZE);
-	send = crud_formati(crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length,0,0);
-	ret = crud_client_operation(send, buf2);
-	if( get_ret(ret) == 1)
-		return -1;
-	//copy the read info into the buffer passed
-	memcpy(buf, &buf2[ crud_file_table[fd].position],count);
-	crud_file_table[fd].position = count + crud_file_table[fd].position;
-	//free the buffer
-	free(buf2);
+
+	// Read what is on the device (reading ahead if sequential), then lay the
+	// buffered writes over it
+	if(crud_file_table[fd].position < stored)
+	{
+		if(crud_file_table[fd].position + count < stored)
+			stored = crud_file_table[fd].position + count;
+		crud_readahead(fd, crud_file_table[fd].position, stored - crud_file_table[fd].position);
+		if( crud_load(fd, crud_file_table[fd].position, buf, stored - crud_file_table[fd].position) == -1)
+			return -1;
+	}
+	crud_writeback_read(fd, crud_file_table[fd].position, buf, count);
+	crud_file_table[fd].position += count;
 	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pread
+// Description  : Reads up to "count" bytes at "offset" in the file straight
+//                into the buffer "buf", leaving the file position alone
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+//                offset - where in the file to read
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_pread(int16_t fd, void *buf, int32_t count, uint32_t offset) {
+
+	// Local variables
+	uint32_t position;
+	int32_t ret;
+	CRUD_TRACE_START(start);
+
+	// Read at the offset, then put the position back
+	if( (fd = crud_lock_file(fd)) == -1)
+		return -1;
+	position = crud_file_table[fd].position;
+	crud_file_table[fd].position = offset;
+	ret = crud_read_locked(fd, buf, count);
+	crud_file_table[fd].position = position;
+	crud_unlock_file(fd);
+	CRUD_TRACE_FILE_OP(CRUD_EVT_READ, fd, ret, start);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_view
+// Description  : Reads up to "count" bytes from the file handle "fd" without
+//                copying them, by borrowing a view of the cached object
+//                holding them.  A view never spans objects, so it may hold
+//                fewer bytes than asked for (like a short read).  Bytes with
+//                buffered writes over them are copied into a view of their
+//                own.  The view must be given back with crud_release_view.
+//
+// Inputs       : fd - the file descriptor for the read
+//                count - the number of bytes to read
+//                view - the place to put the view
+// Outputs      : the number of bytes in the view or -1 if failures
+
+int32_t crud_read_view(int16_t fd, int32_t count, CrudCacheView *view) {
+
+	// Local variables
+	int32_t ret;
+	CRUD_TRACE_START(start);
+
+	// Only one thread works on a file at a time
+	view->data = NULL;
+	view->length = 0;
+	view->buffer = NULL;
+	if( (fd = crud_lock_file(fd)) == -1)
+		return -1;
+	ret = crud_read_view_locked(fd, count, view);
+	crud_unlock_file(fd);
+	CRUD_TRACE_FILE_OP(CRUD_EVT_READ, fd, ret, start);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_view_locked
+// Description  : Reads up to "count" bytes from the file handle "fd" into a
+//                view, with the file lock held.
+//
+// Inputs       : fd - the file descriptor for the read
+//                count - the number of bytes to read
+//                view - the place to put the (empty) view
+// Outputs      : the number of bytes in the view or -1 if failures
+
+static int32_t crud_read_view_locked(int16_t fd, int32_t count, CrudCacheView *view) {
+
+	// Local variables
+	uint32_t length, stored, position, offset, size, i;
+	CrudOID oid;
+	char *buf;
+
+	// Check the fd and count, clamp the count to the end of the file
+	if(crud_file_table[fd].open == 0 || count < 0)
+		return -1;
+	length = crud_file_length(fd);
+	stored = crud_file_table[fd].length;
+	position = crud_file_table[fd].position;
+	if(position >= length)
+	{
+		crud_file_table[fd].position = length;
+		return 0;
+	}
+	if(position + count > length)
+		count = length - position;
+	if(count == 0)
+		return 0;
+
+	// Stored bytes are viewed in the object holding them, up to its end
+	if(position < stored)
+	{
+		if(crud_file_table[fd].flags & CRUD_FILE_CHUNKED)
+		{
+			if( crud_load_map(fd) == -1)
+				return -1;
+			i = position / CRUD_CHUNK_SIZE;
+			oid = crud_file_chunks[fd][i];
+			offset = position % CRUD_CHUNK_SIZE;
+			size = crud_chunk_length(fd, i);
+		}
+		else
+		{
+			oid = crud_file_table[fd].object_id;
+			offset = position;
+			size = stored;
+		}
+		if((uint32_t)count > size - offset)
+			count = size - offset;
+
+		// unless a buffered write lies over them
+		i = crud_writeback_find(fd, position);
+		if(i == crud_file_dirty[fd].count || crud_file_dirty[fd].ranges[i].offset >= position + count)
+		{
+			crud_readahead(fd, position, count);
+			if( view_crud_cache(oid, size, view) == -1 && crud_fetch_view(oid, size, view) == -1)
+				return -1;
+			view->data += offset;
+			view->length = count;
+			crud_file_table[fd].position += count;
+			return count;
+		}
+	}
+
+	// Anything else is read into a buffer of the view's own
+	if((buf = new_crud_cache_buffer(count)) == NULL)
+		return -1;
+	if( crud_read_locked(fd, buf, count) == -1)
+	{
+		free_crud_cache_buffer(buf);
+		return -1;
+	}
+	return adopt_crud_cache(CRUD_NO_OBJECT, buf, count, view) == -1 ? -1 : count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_release_view
+// Description  : Give back a view from crud_read_view
+//
+// Inputs       : view - the view
+// Outputs      : none
+
+void crud_release_view(CrudCacheView *view) {
+	release_crud_cache(view);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_load
+// Description  : Reads "count" bytes at an offset of the file from the
+//                device (or the object cache), with the file lock held
+//
+// Inputs       : fd - the file descriptor for the read
+//                position - where to read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read (all stored)
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_load(int16_t fd, uint32_t position, char *buf, uint32_t count) {
+
+	// Local variables
+	uint32_t tickets[CRUD_MAX_INFLIGHT], sizes[CRUD_MAX_INFLIGHT];
+	uint32_t end = position + count, offset, size, length, i;
+	CrudOID oid;
+	CrudCacheView view = {NULL, 0, NULL};
+	char *out = buf;
+	int chunked = crud_file_table[fd].flags & CRUD_FILE_CHUNKED, n = 0, failed = 0;
+
+	if(chunked && crud_load_map(fd) == -1)
+		return -1;
+
+	// Read the piece of each chunk involved (or of the one object)
+	for(i = chunked ? position / CRUD_CHUNK_SIZE : 0; position < end && !failed; i++)
+	{
+		if(chunked)
+		{
+			oid = crud_file_chunks[fd][i];
+			offset = position % CRUD_CHUNK_SIZE;
+			length = crud_chunk_length(fd, i);
+		}
+		else
+		{
+			oid = crud_file_table[fd].object_id;
+			offset = position;
+			length = crud_file_table[fd].length;
+		}
+		size = (end - position < length - offset) ? end - position : length - offset;
 
+		// use the cached object if we have it
+		if(read_crud_cache(oid, offset, out, size, length) == 0)
+		{
+			out += size;
+			position += size;
+			continue;
+		}
+
+		// large objects are read by range straight into the caller's buffer,
+		// a window of them in flight at once (unless read sequentially, when
+		// the rest of the object is wanted next)
+		if(length > CRUD_IO_CACHE_FILL_LIMIT && crud_client_supports(CRUD_PROTOCOL_READ_RANGE) &&
+				crud_file_ahead[fd].window == 0)
+		{
+			if(n == 0 && crud_flush() == -1)
+			{
+				failed = 1;
+				break;
+			}
+			sizes[n] = size;
+			tickets[n++] = crud_client_submit(crud_formati(oid, CRUD_READ_RANGE, size, 0, 0), offset, out, NULL, NULL);
+			if(n == CRUD_MAX_INFLIGHT)
+			{
+				failed = (crud_read_wait(tickets, sizes, n) == -1);
+				n = 0;
+			}
+		}
+		// otherwise read the whole object from the device, which caches it:
+		// straight into the caller's buffer if it wants it all, else into a
+		// cache buffer the piece is copied out of
+		else if(offset == 0 && size == length)
+		{
+			failed = (crud_fetch_object(oid, length, out) == -1);
+		}
+		else
+		{
+			if( crud_fetch_view(oid, length, &view) == -1)
+				failed = 1;
+			else
+				memcpy(out, &view.data[offset], size);
+			release_crud_cache(&view);
+		}
+		out += size;
+		position += size;
+	}
+	if(n > 0 && crud_read_wait(tickets, sizes, n) == -1)
+		failed = 1;
+	return failed ? -1 : 0;
 }
 //////////////////////////////////////////////////////////////////////////////////////////
 //
@@ -548,95 +2653,237 @@ int32_t crud_read(int16_t fd, void *buf, int32_t count) {
 // Outputs      : the number of bytes written or -1 if failure
 
 int32_t crud_write(int16_t fd, void *buf, int32_t count) {
+
+	// Local variables
+	int32_t ret;
+	CrudOID oid;
+	uint32_t length;
+	uint8_t flags;
+	CRUD_TRACE_START(start);
+
+	// Only one thread works on a file at a time
+	if( (fd = crud_lock_file(fd)) == -1)
+		return -1;
+	oid = crud_file_table[fd].object_id;
+	length = crud_file_table[fd].length;
+	flags = crud_file_table[fd].flags;
+	ret = crud_write_locked(fd, buf, count);
+
+	// The directory entry needs saving if the object changed
+	crud_save_entry(fd, oid, length, flags);
+	crud_unlock_file(fd);
+	CRUD_TRACE_FILE_OP(CRUD_EVT_WRITE, fd, ret, start);
+	return ret;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_locked
+// Description  : Writes "count" bytes to the file handle "fd" from the
+//                buffer "buf", with the file lock held.
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                buf - the buffer to write
+//                count - the number of bytes to write
+// Outputs      : the number of bytes written or -1 if failure
+
+static int32_t crud_write_locked(int16_t fd, void *buf, int32_t count) {
 	//check the fd is right
 	if(crud_file_table[fd].open == 0)
 		return -1;
-	//initialize variable
-	CrudRequest send;
-	CrudResponse ret;
-	int temp;
 	//check the count and buf are right
 	if( buf == NULL || count <= 0)
 	{
 		return -1;
 	}
+	if((uint32_t)count > UINT32_MAX - crud_file_table[fd].position)
+	{
+		logMessage(LOG_ERROR_LEVEL, "CRUD IO : write past the largest file size.");
+		return -1;
+	}
+
+	// Buffer the write in write-back mode, otherwise send it now
+	if(crud_writeback_limit > 0)
+	{
+		if( crud_writeback_add(fd, crud_file_table[fd].position, buf, count) == -1)
+			return -1;
+	}
+	else if( crud_store(fd, crud_file_table[fd].position, buf, count) == -1)
+		return -1;
+	crud_file_table[fd].position += count;
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_store
+// Description  : Writes "count" bytes at an offset of the file to the device
+//                (file lock held)
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                offset - where to write (at most the stored length)
+//                buf - the buffer to write
+//                count - the number of bytes to write
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_store(int16_t fd, uint32_t offset, char *buf, uint32_t count) {
+
+	// Reads ahead still in flight land before the file changes
+	crud_readahead_collect(fd, UINT32_MAX);
+
+	// A file outgrowing one chunk (or still longer than one) is chunked
+	if(!(crud_file_table[fd].flags & CRUD_FILE_CHUNKED) && (offset + count > CRUD_CHUNK_SIZE ||
+			crud_file_table[fd].length > CRUD_CHUNK_SIZE) && crud_chunk_file(fd) == -1)
+		return -1;
+
+	// Chunked files write the chunks involved, the others their one object
+	if(crud_file_table[fd].flags & CRUD_FILE_CHUNKED)
+	{
+		if( crud_load_map(fd) == -1 || crud_write_chunks(fd, offset, buf, count) == -1)
+			return -1;
+	}
+	else if( crud_object_write(&crud_file_table[fd].object_id, &crud_file_table[fd].length,
+			offset, buf, count) == -1)
+		return -1;
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_object_write
+// Description  : Writes "count" bytes at an offset of an object (a file or
+//                one of its chunks), creating it if empty.  An object that
+//                has to move (it grows on a server without appends) gets
+//                its new id and length back.
+//
+// Inputs       : oid - the object, replaced if it moves
+//                length - the length of the object, updated
+//                offset - where to write (at most the length)
+//                buf - the buffer to write
+//                count - the number of bytes to write
+// Outputs      : 0 if successful or -1 if failure
+
+static int crud_object_write(CrudOID *oid, uint32_t *length, uint32_t offset, char *buf, uint32_t count) {
+	//initialize variable
+	CrudRequest send;
+	CrudResponse ret;
+	CrudOID old;
+	uint32_t temp, ticket = 0, ticket2;
+	char *buf2;
+
 	// Call request with creates the  Object
-	if(crud_file_table[fd].length == 0)
+	if(*length == 0)
 	{
+		if( crud_flush() == -1)
+			return -1;
 		send = crud_formati(0,CRUD_CREATE,count,0,0);
 		ret = crud_client_operation(send, buf);
 		if( get_ret(ret) == 1)
 			return -1;
-		crud_file_table[fd].position = count;
-		crud_file_table[fd].length  =get_len(ret) ;
-		crud_file_table[fd].object_id = get_oid(ret);
-		return get_len(ret);
-		
+		*length = get_len(ret);
+		*oid = get_oid(ret);
+		put_crud_cache(*oid, buf, *length);
+		return 0;
 	}
 
-	else
+	// Writes inside the object send only the modified range
+	if(offset + count <= *length && crud_client_supports(CRUD_PROTOCOL_UPDATE_RANGE))
 	{
-		// Make a new buffer to hold temp 
-		char *buf2;
-		
-		if((crud_file_table[fd].position + count) > crud_file_table[fd].length )
+		send = crud_formati(*oid, CRUD_UPDATE_RANGE, count, 0, 0);
+		if(crud_batch_limit > 0)
 		{
-
-			//Make Request to read
-			buf2 = malloc( sizeof(buf[0]) * (crud_file_table[fd].position + count));
-			send = crud_formati(crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length,0,0);
-			ret = crud_client_operation(send, buf2);
-			if( get_ret(ret) == 1)
+			if( crud_batch_add(send, offset, buf) == -1)
 				return -1;
-			//Make Request to Create
-			send = crud_formati(0,CRUD_CREATE,count+crud_file_table[fd].position,0,0);
-			ret = crud_client_operation(send, buf2);
+		}
+		else
+		{
+			ret = crud_client_range_operation(send, offset, buf);
 			if( get_ret(ret) == 1)
 				return -1;
-			// Change the len and write the buf
-			crud_file_table[fd].length = get_len(ret);
-			memcpy(&buf2[crud_file_table[fd].position], buf, count);
-			//get old object idea
-			temp = get_oid(ret);
-			// Call Request to delete
-			send = crud_formati(crud_file_table[fd].object_id,CRUD_DELETE,0,0,0);
-			ret = crud_client_operation(send, NULL);
-			if( get_ret(ret) == 1)
+		}
+		update_crud_cache(*oid, offset, buf, count);
+		return 0;
+	}
+
+	// Writes over the end of the object patch the overlap, then append the new bytes in place
+	temp = *length - offset;
+	if(offset + count > *length && crud_client_supports(CRUD_PROTOCOL_APPEND) &&
+			(temp == 0 || crud_client_supports(CRUD_PROTOCOL_UPDATE_RANGE)))
+	{
+		if(crud_batch_limit > 0)
+		{
+			// Queue both for the next batch
+			if(temp > 0 && crud_batch_add(crud_formati(*oid, CRUD_UPDATE_RANGE, temp, 0, 0), offset, buf) == -1)
 				return -1;
-			//Change values for the fd
-			crud_file_table[fd].object_id = temp;
-			crud_file_table[fd].position = crud_file_table[fd].length;
-			//make request to delete
-			send = crud_formati(crud_file_table[fd].object_id,CRUD_UPDATE, crud_file_table[fd].length, 0, 0);
-			ret = crud_client_operation(send, buf2);
-			if( get_ret(ret) == 1)
+			if( crud_batch_add(crud_formati(*oid, CRUD_APPEND, count - temp, 0, 0), 0, buf + temp) == -1)
 				return -1;
-			//free buf2
-			free(buf2);
 		}
-
 		else
 		{
-			//make Request to read
-			buf2 = malloc( sizeof(buf[0]) * crud_file_table[fd].length);
-			send = crud_formati(crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length,0,0);
-			ret = crud_client_operation(send, buf2);
-			if( get_ret(ret) == 1)
+			// Both requests go out back to back, then wait on the pair
+			crud_client_cork(*oid, 1);
+			if(temp > 0)
+			{
+				send = crud_formati(*oid, CRUD_UPDATE_RANGE, temp, 0, 0);
+				ticket = crud_client_submit(send, offset, buf, NULL, NULL);
+			}
+			send = crud_formati(*oid, CRUD_APPEND, count - temp, 0, 0);
+			ticket2 = crud_client_submit(send, 0, buf + temp, NULL, NULL);
+			crud_client_cork(*oid, 0);
+			ret = crud_client_wait(ticket2);
+			if(temp > 0 && get_ret(crud_client_wait(ticket)) == 1)
 				return -1;
-			//copy buf to read 
-			memcpy(&buf2[crud_file_table[fd].position], buf, count);
-			//make request to update
-			crud_file_table[fd].position = count + crud_file_table[fd].position;
-			send = crud_formati(crud_file_table[fd].object_id,CRUD_UPDATE, crud_file_table[fd].length, 0, 0);
-			ret = crud_client_operation(send, buf2);
-			if( get_ret(ret) == 1)
+			if( get_ret(ret) == 1 || get_len(ret) != offset + count)
 				return -1;
-			free(buf2);
 		}
+		update_crud_cache(*oid, offset, buf, temp);
+		update_crud_cache(*oid, *length, buf + temp, count - temp);
+		*length = offset + count;
+		return 0;
+	}
+
+	// The whole-object paths below need every queued write applied first
+	if( crud_flush() == -1)
+		return -1;
 
-		return count;
+	// Patch the write into a copy of the whole object (which the cache keeps)
+	buf2 = new_crud_cache_buffer((offset + count > *length) ? offset + count : *length);
+	if( buf2 == NULL || crud_load_object(*oid, *length, buf2) == -1)
+	{
+		free_crud_cache_buffer(buf2);
+		return -1;
 	}
+	memcpy(&buf2[offset], buf, count);
 
+	if(offset + count > *length)
+	{
+		// A new object of the new length replaces the old
+		send = crud_formati(0,CRUD_CREATE,offset + count,0,0);
+		ret = crud_client_operation(send, buf2);
+		if( get_ret(ret) == 1)
+		{
+			free_crud_cache_buffer(buf2);
+			return -1;
+		}
+		old = *oid;
+		*oid = get_oid(ret);
+		*length = get_len(ret);
+		delete_crud_cache(old);
+		send = crud_formati(old,CRUD_DELETE,0,0,0);
+		ret = crud_client_operation(send, NULL);
+	}
+	else
+	{
+		//make request to update
+		send = crud_formati(*oid,CRUD_UPDATE, *length, 0, 0);
+		ret = crud_client_operation(send, buf2);
+	}
+	if( get_ret(ret) == 1)
+	{
+		free_crud_cache_buffer(buf2);
+		return -1;
+	}
+	return adopt_crud_cache(*oid, buf2, *length, NULL);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -651,15 +2898,18 @@ int32_t crud_write(int16_t fd, void *buf, int32_t count) {
 int32_t crud_seek(int16_t fd, uint32_t loc) {
 
 	// Check the fd is right 
-	if(crud_file_table[fd].open == 0)
+	if( (fd = crud_lock_file(fd)) == -1)
 		return -1;
 	// Check the loc is right
-	if(loc < 0 || loc > crud_file_table[fd].length)
+	if(crud_file_table[fd].open == 0 || loc > crud_file_length(fd))
 	{
+		crud_unlock_file(fd);
 		return -1;
 	}
 	//seek the fd
 	crud_file_table[fd].position = loc;
+	crud_unlock_file(fd);
+	CRUD_TRACE_COUNT(CRUD_CTR_SEEKS, 1);
 	return 0;
 }
 
@@ -16,14 +16,34 @@
 
 // Project include files
 #include <crud_driver.h>
+#include <crud_cache.h>
 
 // Defines
-#define CRUD_MAX_TOTAL_FILES 1024
+#define CRUD_MAX_TOTAL_FILES 1024  // Entries of the legacy (fixed) file table
+#define CRUD_LEGACY_TABLE_SIZE (sizeof(CrudFileAllocationType)*CRUD_MAX_TOTAL_FILES)
+#define CRUD_MAX_OPEN_FILES 1024   // Files open at once (a power of two)
+#define CRUD_HANDLE_BITS 10        // Bits of a file handle naming the table entry
 #define CRUD_MAX_PATH_LENGTH 128
+#define CRUD_CHUNK_SIZE 0x10000    // Bytes in each object of a chunked file
+#define CRUD_FILE_CHUNKED 0x1      // File flag: the object holds the chunk map
 
 // Type definitions
 
-// This is the basic file handle structure (note: index into file table is fh)
+// This is the state of an open file (note: index into file table is fh).  A
+// file up to CRUD_CHUNK_SIZE long is kept in one object; a longer one is
+// chunked, its object then holding the chunk map: the object of each
+// CRUD_CHUNK_SIZE piece of the file, in order.  The handle given out for an
+// entry carries the low bits of its generation above CRUD_HANDLE_BITS.
+typedef struct {
+	CrudOID   object_id;  // The handle of the object (or chunk map)
+	uint32_t  position;   // This is the position of the file
+	uint32_t  length;     // This is the length of the file
+	uint16_t  open;       // Opens of the file not yet closed (0 if not open)
+	uint8_t   flags;      // CRUD_FILE_* flags
+	uint16_t  generation; // Bumped each time the handle is given back
+} CrudFileHandle;
+
+// This is the entry of the legacy file table (converted on mount)
 typedef struct {
 	char      filename[CRUD_MAX_PATH_LENGTH]; // The filename of the data to be manipulated
 	CrudOID   object_id;                      // The handle of the object
@@ -44,6 +64,9 @@ uint16_t crud_mount(void);
 uint16_t crud_unmount(void);
 	// This function unmounts the current crud file system and saves the file allocation table.
 
+int crud_checkpoint(void);
+	// Save queued writes and the changed parts of the file allocation table, staying mounted
+
 //
 // Interface functions
 
@@ -56,18 +79,48 @@ int16_t crud_close(int16_t fd);
 int32_t crud_read(int16_t fd, void *buf, int32_t count);
 	// Reads "count" bytes from the file handle "fh" into the buffer  "buf"
 
+int32_t crud_pread(int16_t fd, void *buf, int32_t count, uint32_t offset);
+	// Reads "count" bytes at "offset" straight into "buf", leaving the position alone
+
+int32_t crud_read_view(int16_t fd, int32_t count, CrudCacheView *view);
+	// Reads up to "count" bytes as a borrowed view of the cache (no copy)
+
+void crud_release_view(CrudCacheView *view);
+	// Gives back a view from crud_read_view
+
 int32_t crud_write(int16_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
 int32_t crud_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int crud_set_batch(uint32_t ops);
+	// Queue up to "ops" writes and send them to the device as one batch
+
+int crud_flush(void);
+	// Send any queued writes to the device
+
+int crud_set_writeback(uint32_t limit);
+	// Buffer up to "limit" bytes of writes in the open files before writing them back
+
+int crud_fsync(int16_t fd);
+	// Send the buffered and queued writes of a file to the device
+
 //
 // Unit testing for the module
 
 int crudIOUnitTest(void);
 	// Perform a test of the CRUD IO implementation
 
+int crudIOViewTest(void);
+	// Perform a test of the reads through views and at an offset
+
+int crudIOConcurrentTest(void);
+	// Perform a test of the CRUD IO implementation from several threads
+
+int crudIOMountTest(void);
+	// Perform a test of mounting the shipped store (a legacy file table)
+
 #endif
 
 
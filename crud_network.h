@@ -20,6 +20,28 @@
 #define CRUD_NET_HEADER_SIZE sizeof(CrudResponse)
 #define CRUD_DEFAULT_IP "127.0.0.1"
 #define CRUD_DEFAULT_PORT 19876
+#define CRUD_MAX_INFLIGHT 64        // Requests pipelined on each connection
+#define CRUD_MAX_CONNECTIONS 64     // Connections in the pool (a power of two)
+#define CRUD_NO_TICKET 0xffffffff   // Ticket of a request that could not be submitted
+#define CRUD_MAX_BATCH 64           // Requests carried in one CRUD_BATCH frame
+#define CRUD_PROTOCOL_VERSION 5     // Highest protocol version we speak
+#define CRUD_PROTOCOL_READ_RANGE 1  // First version with CRUD_READ_RANGE
+#define CRUD_PROTOCOL_APPEND 2      // First version with CRUD_APPEND
+#define CRUD_PROTOCOL_UPDATE_RANGE 3 // First version with CRUD_UPDATE_RANGE
+#define CRUD_PROTOCOL_BATCH 4       // First version with CRUD_BATCH
+#define CRUD_PROTOCOL_CONNECTIONS 5 // First version serving concurrent connections
+#define CRUD_SERVER_BACKLOG 1024    // Pending connections the server's listen queue holds
+#define CRUD_SERVER_EVENTS 256      // Events the server takes from each epoll_wait
+#define CRUD_SERVER_BUFFER 0x4000   // Initial (and idle) size of a connection's buffers
+#define CRUD_SERVER_MAX_PENDING 0x400000 // Unsent response bytes before a connection's reads stop
+#define CRUD_SERVER_MAX_QUEUED 1024 // Requests a connection has waiting on other workers before its reads stop
+#define CRUD_SERVER_MIGRATE 64      // Requests in a row for another worker's shard before a connection moves there
+
+//
+// Type definitions
+
+typedef void (*CrudCompletion)(CrudResponse resp, void *buf, void *arg);
+	// Callback run when a submitted request completes
 
 //
 // Functional Prototypes
@@ -27,6 +49,30 @@
 CrudResponse crud_client_operation(CrudRequest op, void *buf);
     // This is the implementation of the client operation (crud_client.c)
 
+CrudResponse crud_client_range_operation(CrudRequest op, uint32_t offset, void *buf);
+    // Client operation for the ranged requests, which carry an object offset
+
+uint32_t crud_client_submit(CrudRequest op, uint32_t offset, void *buf, CrudCompletion done, void *arg);
+    // Send a request without waiting for the response, returns a ticket
+
+CrudResponse crud_client_wait(uint32_t ticket);
+    // Wait for a request submitted without a callback, returns the response
+
+int crud_client_poll(void);
+    // Complete requests whose responses have arrived, without blocking
+
+int crud_client_drain(void);
+    // Wait for all outstanding requests to complete
+
+int crud_client_batch(CrudRequest *ops, uint32_t *offsets, void **bufs, CrudResponse *resps, int count);
+    // Send a vector of requests in one batch frame, collecting the responses
+
+int crud_client_cork(CrudOID oid, int on);
+    // Hold back (1) or push out (0) an object's requests so they share TCP segments
+
+int crud_client_supports(int version);
+    // Does the connected server speak (at least) this protocol version?
+
 int crud_server( void );
     // This is the implementation of the server application (crud_server.c)
 
@@ -34,7 +80,10 @@ int crud_server( void );
 // Network Global Data
 
 extern int            crud_network_shutdown; // Flag indicating shutdown
-extern unsigned char *crud_network_address;  // Address of CRUD server 
+extern unsigned char *crud_network_address;  // Address(es) of CRUD server, comma separated
 extern unsigned short crud_network_port;     // Port of CRUD server
+extern int            crud_network_version;  // Protocol version of the server
+extern int            crud_network_connections; // Connections in the pool
+extern int            crud_network_workers;  // Worker threads of the server (shards of its store)
 
 #endif
@@ -0,0 +1,272 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_pool.c
+//  Description    : This is the implementation of the buffer pool of the
+//                   CRUD client.  Each buffer carries a small header naming
+//                   its class; freed buffers go on the free list of the
+//                   class until CRUD_POOL_MAX_IDLE bytes are held, past
+//                   which they go back to the allocator.  Requests larger
+//                   than the largest class are allocated directly.  Each
+//                   class holds CRUD_POOL_SLACK bytes over its power of two,
+//                   so a power of two payload with a small header of its
+//                   own (a cache buffer, say) does not take the next class.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:33:21 UTC 2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_pool.h>
+#include <cmpsc311_log.h>
+
+// Type definitions
+
+// This is the header in front of each buffer (16 bytes, keeping alignment)
+typedef struct crud_pool_buffer {
+	struct crud_pool_buffer *next;     // Next free buffer of the class
+	uint32_t  size_class;              // The class, CRUD_POOL_CLASSES if oversized
+	uint32_t  capacity;                // The bytes the buffer holds
+} CrudPoolBuffer;
+
+//
+// Module static data
+
+static CrudPoolBuffer *pool_free[CRUD_POOL_CLASSES];   // Free buffers of each class
+static uint32_t       pool_idle[CRUD_POOL_CLASSES];    // Number of free buffers of each class
+static uint64_t       pool_idle_bytes = 0;   // Bytes held in free buffers
+static uint64_t       pool_used_bytes = 0;   // Bytes handed out
+static uint64_t       pool_peak_bytes = 0;   // Most bytes handed out at once
+static uint64_t       pool_allocs = 0;       // Number of buffers handed out
+static uint64_t       pool_reuses = 0;       // Of those, taken from a free list
+static uint64_t       pool_oversized = 0;    // Of those, larger than any class
+static uint64_t       pool_releases = 0;     // Buffers given back to the allocator
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER; // Guards all of the above
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_class_size
+// Description  : Get the bytes held by the buffers of a class
+//
+// Inputs       : size_class - the class
+// Outputs      : the capacity of its buffers
+
+static uint32_t crud_pool_class_size(uint32_t size_class) {
+	return( (1U << (CRUD_POOL_MIN_SHIFT + size_class)) + CRUD_POOL_SLACK );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_class
+// Description  : Find the smallest class holding a number of bytes
+//
+// Inputs       : size - the number of bytes
+// Outputs      : the class, CRUD_POOL_CLASSES if larger than all of them
+
+static uint32_t crud_pool_class(uint32_t size) {
+
+	// Local variables
+	uint32_t size_class = 0;
+
+	while ((size_class < CRUD_POOL_CLASSES) && (size > crud_pool_class_size(size_class))) {
+		size_class ++;
+	}
+	return(size_class);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_header
+// Description  : Get the header of a buffer
+//
+// Inputs       : buf - the buffer
+// Outputs      : the header
+
+static CrudPoolBuffer *crud_pool_header(void *buf) {
+	return( (CrudPoolBuffer *)buf - 1 );
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_alloc
+// Description  : Get a buffer of at least the size asked for, from the free
+//                list of its class if there is one there
+//
+// Inputs       : size - the number of bytes needed
+// Outputs      : the buffer, NULL if failure
+
+void *crud_pool_alloc(uint32_t size) {
+
+	// Local variables
+	uint32_t size_class = crud_pool_class(size), capacity;
+	CrudPoolBuffer *buffer = NULL;
+
+	// Take a free buffer of the class if we have one
+	capacity = (size_class < CRUD_POOL_CLASSES) ? crud_pool_class_size(size_class) : size;
+	pthread_mutex_lock(&pool_lock);
+	if ((size_class < CRUD_POOL_CLASSES) && (pool_free[size_class] != NULL)) {
+		buffer = pool_free[size_class];
+		pool_free[size_class] = buffer->next;
+		pool_idle[size_class] --;
+		pool_idle_bytes -= capacity;
+		pool_reuses ++;
+	}
+	pool_allocs ++;
+	pool_oversized += (size_class == CRUD_POOL_CLASSES);
+	pool_used_bytes += capacity;
+	if (pool_used_bytes > pool_peak_bytes) {
+		pool_peak_bytes = pool_used_bytes;
+	}
+	pthread_mutex_unlock(&pool_lock);
+
+	// Otherwise go to the allocator
+	if ((buffer == NULL) && ((buffer = malloc(sizeof(CrudPoolBuffer) + capacity)) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD pool : failed to allocate %u byte buffer.", capacity);
+		pthread_mutex_lock(&pool_lock);
+		pool_used_bytes -= capacity;
+		pthread_mutex_unlock(&pool_lock);
+		return(NULL);
+	}
+	buffer->next = NULL;
+	buffer->size_class = size_class;
+	buffer->capacity = capacity;
+	return(buffer + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_zalloc
+// Description  : Get a zeroed buffer of at least the size asked for
+//
+// Inputs       : size - the number of bytes needed
+// Outputs      : the buffer, NULL if failure
+
+void *crud_pool_zalloc(uint32_t size) {
+
+	// Local variables
+	void *buf;
+
+	if ((buf = crud_pool_alloc(size)) != NULL) {
+		memset(buf, 0x0, size);
+	}
+	return(buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_free
+// Description  : Give a buffer back, keeping it for reuse unless the pool
+//                already holds its limit of free bytes
+//
+// Inputs       : buf - the buffer (NULL is ignored)
+// Outputs      : none
+
+void crud_pool_free(void *buf) {
+
+	// Local variables
+	CrudPoolBuffer *buffer;
+
+	// Nothing to do for no buffer
+	if (buf == NULL) {
+		return;
+	}
+	buffer = crud_pool_header(buf);
+
+	// Put it on the free list of its class, if there is room
+	pthread_mutex_lock(&pool_lock);
+	pool_used_bytes -= buffer->capacity;
+	if ((buffer->size_class < CRUD_POOL_CLASSES) && (pool_idle_bytes + buffer->capacity <= CRUD_POOL_MAX_IDLE)) {
+		buffer->next = pool_free[buffer->size_class];
+		pool_free[buffer->size_class] = buffer;
+		pool_idle[buffer->size_class] ++;
+		pool_idle_bytes += buffer->capacity;
+		buffer = NULL;
+	} else {
+		pool_releases ++;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	free(buffer);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_capacity
+// Description  : Get the number of bytes a buffer can hold
+//
+// Inputs       : buf - the buffer
+// Outputs      : the capacity (at least the size it was allocated with)
+
+uint32_t crud_pool_capacity(void *buf) {
+	return(crud_pool_header(buf)->capacity);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_trim
+// Description  : Give every free buffer back to the allocator
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_pool_trim(void) {
+
+	// Local variables
+	CrudPoolBuffer *buffer;
+	uint32_t i;
+
+	// Empty the free list of each class
+	pthread_mutex_lock(&pool_lock);
+	for (i=0; i<CRUD_POOL_CLASSES; i++) {
+		while ((buffer = pool_free[i]) != NULL) {
+			pool_free[i] = buffer->next;
+			pool_releases ++;
+			free(buffer);
+		}
+		pool_idle[i] = 0;
+	}
+	pool_idle_bytes = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pool_report
+// Description  : Log the pool statistics, with the free buffers of each class
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_pool_report(void) {
+
+	// Local variables
+	char classes[CRUD_POOL_CLASSES * 24], *out = classes;
+	uint32_t i;
+
+	// Summary, then the classes holding free buffers
+	pthread_mutex_lock(&pool_lock);
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD pool : %lu allocations, %lu reused, %lu oversized, %lu released, "
+			"%lu bytes in use (%lu peak), %lu bytes idle",
+			pool_allocs, pool_reuses, pool_oversized, pool_releases,
+			pool_used_bytes, pool_peak_bytes, pool_idle_bytes);
+	classes[0] = '\0';
+	for (i=0; i<CRUD_POOL_CLASSES; i++) {
+		if (pool_idle[i] > 0) {
+			out += sprintf(out, " %u:%u", crud_pool_class_size(i), pool_idle[i]);
+		}
+	}
+	pthread_mutex_unlock(&pool_lock);
+	if (out != classes) {
+		logMessage(LOG_OUTPUT_LEVEL, "CRUD pool : idle buffers (size:count)%s", classes);
+	}
+}
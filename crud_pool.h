@@ -0,0 +1,47 @@
+#ifndef CRUD_POOL_INCLUDED
+#define CRUD_POOL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_pool.h
+//  Description    : This is the header file for the buffer pool of the CRUD
+//                   client.  Buffers come in power of two size classes and
+//                   freed ones are kept on a list per class for reuse, so
+//                   request payloads and object copies do not go back to the
+//                   allocator on every operation.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:33:21 UTC 2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_POOL_MIN_SHIFT 8         // The smallest class holds 256 bytes
+#define CRUD_POOL_CLASSES   13        // Classes of 256 bytes up to 1 MB
+#define CRUD_POOL_SLACK     64        // Bytes past the power of two (room for a caller's header)
+#define CRUD_POOL_MAX_IDLE  0x2000000 // Bytes of free buffers kept over all classes
+
+//
+// Pool interface (thread safe)
+
+void *crud_pool_alloc(uint32_t size);
+	// Get a buffer of at least size bytes, NULL if failure
+
+void *crud_pool_zalloc(uint32_t size);
+	// Get a buffer of at least size bytes, zeroed, NULL if failure
+
+void crud_pool_free(void *buf);
+	// Give a buffer back to the pool (NULL is ignored)
+
+uint32_t crud_pool_capacity(void *buf);
+	// The bytes a buffer can hold (at least the size asked for)
+
+void crud_pool_trim(void);
+	// Release the free buffers held by the pool
+
+void crud_pool_report(void);
+	// Log the pool statistics
+
+#endif
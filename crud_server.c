@@ -0,0 +1,1343 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_server.c
+//  Description    : This is the network side of the CRUD server.  The store
+//                   is split into one shard per worker thread (by object
+//                   ID), each worker the only thread touching its shard.
+//                   A worker runs an epoll loop over its own connections,
+//                   on non-blocking sockets.  Each connection is a small
+//                   state machine (request header, offset word, request
+//                   data) run over what has arrived in its input buffer,
+//                   with responses gathered in an output buffer flushed as
+//                   the socket takes them.
+//
+//                   Requests for the worker's own shard are served at once.
+//                   The rest are posted to the inbox of the worker owning
+//                   the shard (a lock-free list, the worker woken through
+//                   an eventfd), which posts the response back.  Until it
+//                   can be sent a response waits in the connection's queue,
+//                   so responses go out in the order the requests came in.
+//                   INIT, FORMAT and CLOSE go to every shard.  A connection
+//                   that keeps asking for the same other shard moves to the
+//                   worker owning it.  A client that stops reading its
+//                   responses only stops its own connection, once it has
+//                   CRUD_SERVER_MAX_PENDING bytes waiting.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:53:36 UTC 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project includes
+#include <crud_driver.h>
+#include <crud_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_SERVER_ALL_SHARDS -1 // The request goes to every shard
+#define CRUD_SERVER_NEW_SHARD -2  // The shard is that of the object ID handed out (CREATE)
+#define CRUD_RESPONSE_LENGTH(resp) (((resp) >> 4) & 0xffffff) // The length of a response
+
+//
+// Type definitions
+
+// The states of a connection (what its input is waiting for)
+typedef enum {
+	CRUD_CONN_HEADER  = 0, // The next request header
+	CRUD_CONN_OFFSET  = 1, // The offset word of a ranged request
+	CRUD_CONN_DATA    = 2, // The data of a request
+	CRUD_CONN_CLOSING = 3, // Nothing, the responses are sent and the connection closed
+} CRUD_CONNECTION_STATES;
+
+// The messages the workers post to each other
+typedef enum {
+	CRUD_MSG_REQUEST    = 0, // Serve a request on the shard of the worker
+	CRUD_MSG_RESPONSE   = 1, // The response to a request the worker posted
+	CRUD_MSG_CONNECTION = 2, // A connection moving to the worker
+} CRUD_MESSAGE_TYPES;
+
+struct CrudServerConnection;
+
+// This is a request whose response is not yet sent, and the message
+// carrying it between the workers
+typedef struct CrudServerMessage {
+	CRUD_MESSAGE_TYPES type;  // The message type
+	struct CrudServerConnection *conn; // The connection (of the request, or moving)
+	int          from;        // The worker posting the request
+	CrudRequest  request;     // The request
+	uint32_t     offset;      // Its offset word (ranged requests)
+	CrudResponse resp;        // The response (host byte order)
+	int          done;        // Is the response in?
+	struct CrudServerMessage *parent; // The request this is the part of on one shard
+	int          waiting;     // Parts of the request still out
+	int          failed;      // Did any part of it fail?
+	struct CrudServerMessage *link; // The next message in an inbox
+	struct CrudServerMessage *next; // The next request in the connection's queue
+	char         data[];      // The request data, or the bytes read
+} CrudServerMessage;
+
+// This is a worker thread, owning a shard of the store
+typedef struct {
+	int          id;          // The worker, and the shard it owns
+	pthread_t    thread;      // The thread running it
+	int          epfd;        // Its epoll instance
+	int          wakefd;      // The eventfd waking it for its inbox
+	CrudServerMessage *inbox; // Messages posted to it, newest first (atomic)
+	struct CrudServerConnection *connections; // The connections it serves
+	uint64_t     served;      // Requests served on its shard
+	uint64_t     forwarded;   // Requests posted to other shards
+	uint64_t     moved;       // Connections moved to it
+} CrudServerWorker;
+
+// This is a client connection
+typedef struct CrudServerConnection {
+	int         sock;      // The socket
+	CrudServerWorker *worker; // The worker serving it (NULL while moving)
+	CRUD_CONNECTION_STATES state; // What the input is waiting for
+	CrudRequest request;   // The request being read
+	uint32_t    offset;    // Its offset word (ranged requests)
+	uint32_t    batch;     // Requests left in the current batch frame
+	uint32_t    events;    // The epoll events asked for
+	int         watched;   // Is the socket in the worker's epoll instance?
+	int         blocked;   // Is the input held back (output full, or waiting on other shards)?
+	int         dead;      // Is the socket closed (the queue draining)?
+	int         streak;    // Requests in a row for streak_shard
+	int         streak_shard; // The other shard asked for last
+	int         move_to;   // The worker the connection moves to, -1 if none
+	CrudServerMessage *queue, *tail; // Requests whose responses are not yet sent, in order
+	uint32_t    queued;    // Their number
+	char       *in;        // Input buffer
+	uint32_t    in_size;   // Its size
+	uint32_t    in_start;  // First byte not yet consumed
+	uint32_t    in_end;    // End of the bytes received
+	char       *out;       // Output buffer
+	uint32_t    out_size;  // Its size
+	uint32_t    out_start; // First byte not yet sent
+	uint32_t    out_end;   // End of the bytes to send
+	char        name[32];  // Address/port of the client
+	struct CrudServerConnection *prev, *next; // The worker's list of connections
+} CrudServerConnection;
+
+//
+// Global data
+
+int            crud_network_shutdown = 0;    // Flag indicating shutdown
+unsigned char *crud_network_address = NULL;  // Address of CRUD server (unused)
+unsigned short crud_network_port = 0;        // Port of CRUD server
+int            crud_network_version = CRUD_PROTOCOL_VERSION; // Protocol version spoken
+int            crud_network_workers = 1;     // Worker threads (shards of the store)
+int            crud_server_listener = -1;    // The listening socket
+CrudServerWorker crud_server_workers[CRUD_MAX_SHARDS]; // The workers
+
+//
+// Functional prototypes
+
+void crud_signal_handler( int sig );
+void *crud_server_thread( void *arg );
+int crud_server_run( CrudServerWorker *worker );
+int crud_server_accept( CrudServerWorker *worker );
+int crud_server_input( CrudServerConnection *conn );
+int crud_server_process( CrudServerConnection *conn );
+int crud_server_hold( CrudServerConnection *conn );
+int crud_server_route( CrudServerConnection *conn, CrudRequest request );
+int crud_server_execute( CrudServerConnection *conn, char *data );
+CrudResponse crud_server_serve( CrudServerWorker *worker, CrudServerConnection *conn,
+		CrudRequest request, uint32_t offset, void *buf );
+int crud_server_supported( CRUD_REQUEST_TYPES req );
+void crud_server_finish( CrudServerMessage *msg );
+int crud_server_deliver( CrudServerConnection *conn );
+int crud_server_inbox( CrudServerWorker *worker );
+void crud_server_post( CrudServerWorker *worker, CrudServerMessage *msg );
+int crud_server_flush( CrudServerConnection *conn );
+int crud_server_watch( CrudServerConnection *conn );
+void crud_server_close( CrudServerConnection *conn );
+void crud_server_free( CrudServerConnection *conn );
+void crud_server_link( CrudServerWorker *worker, CrudServerConnection *conn );
+void crud_server_unlink( CrudServerConnection *conn );
+CrudServerMessage *crud_server_message( CRUD_MESSAGE_TYPES type, CrudServerConnection *conn, uint32_t length );
+void crud_server_queue( CrudServerConnection *conn, CrudServerMessage *msg );
+int crud_server_reserve( char **buf, uint32_t *size, uint32_t *start, uint32_t *end, uint32_t need );
+uint32_t crud_server_needs( CrudServerConnection *conn );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server
+// Description  : Run the CRUD server: listen on crud_network_port and serve
+//                the connections with crud_network_workers threads (this
+//                one the first) until a signal shuts the server down
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_server( void ) {
+
+	// Local variables
+	struct epoll_event ev;
+	struct sockaddr_in addr;
+	struct sigaction act;
+	sigset_t block, old;
+	CrudServerWorker *worker;
+	CrudServerMessage *msg, *next;
+	uint64_t wake = 1;
+	int i, workers, started, ret = 0, on = 1;
+
+	// Shut down on SIGINT/SIGTERM (interrupting epoll_wait), ignore SIGPIPE
+	memset( &act, 0x0, sizeof(act) );
+	act.sa_handler = crud_signal_handler;
+	sigaction( SIGINT, &act, NULL );
+	sigaction( SIGTERM, &act, NULL );
+	signal( SIGPIPE, SIG_IGN );
+
+	// One shard of the store for each worker
+	if ( crud_store_shards(crud_network_workers) ) {
+		return( -1 );
+	}
+
+	// Create the listening socket
+	if ( (crud_server_listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD socket() create failed : [%s]", strerror(errno) );
+		return( -1 );
+	}
+	if ( setsockopt(crud_server_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD set socket option create failed : [%s]", strerror(errno) );
+		close( crud_server_listener );
+		return( -1 );
+	}
+	memset( &addr, 0x0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( (crud_network_port == 0) ? CRUD_DEFAULT_PORT : crud_network_port );
+	addr.sin_addr.s_addr = htonl( INADDR_ANY );
+	if ( bind(crud_server_listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD bind() create failed : [%s]", strerror(errno) );
+		close( crud_server_listener );
+		return( -1 );
+	}
+	if ( listen(crud_server_listener, CRUD_SERVER_BACKLOG) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD listen() create failed : [%s]", strerror(errno) );
+		close( crud_server_listener );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "Server bound and listening on port [%d] (protocol version %d, %d workers)",
+			ntohs(addr.sin_port), crud_network_version, crud_network_workers );
+
+	// Each worker watches the listener (only one woken for a connection)
+	// and its eventfd, the connections carry their own pointers
+	for ( workers=0; (ret == 0) && (workers<crud_network_workers); workers++ ) {
+		worker = &crud_server_workers[workers];
+		memset( worker, 0x0, sizeof(CrudServerWorker) );
+		worker->id = workers;
+		worker->wakefd = -1;
+		if ( ((worker->epfd = epoll_create1(0)) == -1) || ((worker->wakefd = eventfd(0, EFD_NONBLOCK)) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD worker setup failed : [%s]", strerror(errno) );
+			ret = -1;
+			continue;
+		}
+		ev.events = EPOLLIN | ((crud_network_workers > 1) ? EPOLLEXCLUSIVE : 0);
+		ev.data.ptr = NULL;
+		epoll_ctl( worker->epfd, EPOLL_CTL_ADD, crud_server_listener, &ev );
+		ev.events = EPOLLIN;
+		ev.data.ptr = worker;
+		epoll_ctl( worker->epfd, EPOLL_CTL_ADD, worker->wakefd, &ev );
+	}
+
+	// Start the other workers (the signals only come to this one), then serve
+	sigemptyset( &block );
+	sigaddset( &block, SIGINT );
+	sigaddset( &block, SIGTERM );
+	pthread_sigmask( SIG_BLOCK, &block, &old );
+	for ( started=1; (ret == 0) && (started<workers); started++ ) {
+		if ( pthread_create(&crud_server_workers[started].thread, NULL, crud_server_thread, &crud_server_workers[started]) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD worker thread create failed, aborting." );
+			ret = -1;
+			break;
+		}
+	}
+	pthread_sigmask( SIG_SETMASK, &old, NULL );
+	if ( ret == 0 ) {
+		ret = crud_server_run( &crud_server_workers[0] );
+	}
+
+	// Stop the other workers, and wait for them
+	logMessage( LOG_INFO_LEVEL, "Shutting down CRUD server ..." );
+	__atomic_store_n( &crud_network_shutdown, 1, __ATOMIC_RELEASE );
+	for ( i=1; i<started; i++ ) {
+		if ( write(crud_server_workers[i].wakefd, &wake, sizeof(wake)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD worker wakeup failed : [%s]", strerror(errno) );
+		}
+		pthread_join( crud_server_workers[i].thread, NULL );
+	}
+
+	// Free the messages left in the inboxes (requests in a connection's
+	// queue go with the connection), then the connections
+	for ( i=0; i<workers; i++ ) {
+		for ( msg = crud_server_workers[i].inbox; msg != NULL; msg = next ) {
+			next = msg->link;
+			if ( msg->type == CRUD_MSG_CONNECTION ) {
+				crud_server_free( msg->conn );
+				free( msg );
+			} else if ( msg->parent != NULL ) {
+				free( msg );
+			}
+		}
+	}
+	for ( i=0; i<workers; i++ ) {
+		worker = &crud_server_workers[i];
+		while ( worker->connections != NULL ) {
+			crud_server_free( worker->connections );
+		}
+		logMessage( LOG_INFO_LEVEL, "CRUD worker %d: %lu requests served, %lu forwarded, %lu connections moved in",
+				i, (unsigned long)worker->served, (unsigned long)worker->forwarded, (unsigned long)worker->moved );
+		if ( worker->wakefd != -1 ) {
+			close( worker->wakefd );
+		}
+		if ( worker->epfd != -1 ) {
+			close( worker->epfd );
+		}
+	}
+	close( crud_server_listener );
+	return( ret );
+}
+
+//
+// Local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_signal_handler
+// Description  : Ask the server to shut down
+//
+// Inputs       : sig - the signal received
+// Outputs      : none
+
+void crud_signal_handler( int sig ) {
+	__atomic_store_n( &crud_network_shutdown, 1, __ATOMIC_RELEASE );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_thread
+// Description  : The thread of a worker (after the first)
+//
+// Inputs       : arg - the worker
+// Outputs      : NULL
+
+void *crud_server_thread( void *arg ) {
+	crud_server_run( (CrudServerWorker *)arg );
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_run
+// Description  : Run the epoll loop of a worker until the server shuts down
+//
+// Inputs       : worker - the worker
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_server_run( CrudServerWorker *worker ) {
+
+	// Local variables
+	struct epoll_event events[CRUD_SERVER_EVENTS];
+	CrudServerConnection *conn;
+	int n, i, woken;
+
+	// Serve until shut down
+	while ( ! __atomic_load_n(&crud_network_shutdown, __ATOMIC_ACQUIRE) ) {
+		if ( (n = epoll_wait(worker->epfd, events, CRUD_SERVER_EVENTS, -1)) == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			logMessage( LOG_ERROR_LEVEL, "CRUD server wait failued, aborting." );
+			return( -1 );
+		}
+
+		// New connections, then input and output on each connection
+		for ( i=0, woken=0; i<n; i++ ) {
+			if ( (conn = events[i].data.ptr) == NULL ) {
+				crud_server_accept( worker );
+				continue;
+			}
+			if ( events[i].data.ptr == worker ) {
+				woken = 1;
+				continue;
+			}
+			if ( ((events[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP)) && crud_server_input(conn)) ||
+					((events[i].events & EPOLLOUT) && crud_server_flush(conn)) ||
+					crud_server_watch(conn) ) {
+				crud_server_close( conn );
+			}
+		}
+
+		// The inbox last, as it may close or move connections with events
+		if ( woken ) {
+			crud_server_inbox( worker );
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_accept
+// Description  : Accept a waiting connection, watching it for input (one
+//                per wakeup, so the workers share the connections)
+//
+// Inputs       : worker - the worker
+// Outputs      : the number of connections accepted
+
+int crud_server_accept( CrudServerWorker *worker ) {
+
+	// Local variables
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	CrudServerConnection *conn;
+	char ip[INET_ADDRSTRLEN];
+	int sock, on = 1;
+
+	// Take the connection, if another worker has not
+	if ( (sock = accept(crud_server_listener, (struct sockaddr *)&addr, &len)) == -1 ) {
+		if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD server accept failed : [%s]", strerror(errno) );
+		}
+		return( 0 );
+	}
+	fcntl( sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK );
+	setsockopt( sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on) );
+	if ( (conn = calloc(1, sizeof(CrudServerConnection))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD server connection allocation failed" );
+		close( sock );
+		return( 0 );
+	}
+	conn->sock = sock;
+	conn->state = CRUD_CONN_HEADER;
+	conn->streak_shard = conn->move_to = -1;
+	snprintf( conn->name, sizeof(conn->name), "%s/%d",
+			inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip)), ntohs(addr.sin_port) );
+
+	// Link it in, and watch it for input
+	crud_server_link( worker, conn );
+	if ( crud_server_watch(conn) ) {
+		crud_server_close( conn );
+		return( 0 );
+	}
+	logMessage( LOG_INFO_LEVEL, "Server new client connection [%s]", conn->name );
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_input
+// Description  : Read what has arrived on a connection, serve the requests
+//                it completes and send the responses
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is to be closed
+
+int crud_server_input( CrudServerConnection *conn ) {
+
+	// Local variables
+	uint32_t want = crud_server_needs(conn);
+	ssize_t got;
+
+	// A closing connection is not read, so this is an error or the client
+	// hanging up
+	if ( conn->state == CRUD_CONN_CLOSING ) {
+		return( -1 );
+	}
+
+	// One read per wakeup of what fits (epoll reports any more), with room
+	// for at least the rest of what the state waits for
+	want = (want > conn->in_end - conn->in_start) ? want - (conn->in_end - conn->in_start) : 0;
+	want = (want < CRUD_SERVER_BUFFER/2) ? CRUD_SERVER_BUFFER/2 : want;
+	if ( crud_server_reserve(&conn->in, &conn->in_size, &conn->in_start, &conn->in_end, want) ) {
+		return( -1 );
+	}
+	if ( (got = recv(conn->sock, &conn->in[conn->in_end], conn->in_size - conn->in_end, 0)) == -1 ) {
+		if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) {
+			return( 0 );
+		}
+		logMessage( LOG_ERROR_LEVEL, "CRUD read bytes failed : [%s]", strerror(errno) );
+		return( -1 );
+	}
+	if ( got == 0 ) {
+		logMessage( LOG_INFO_LEVEL, "Closing client connection [%s]", conn->name );
+		return( -1 );
+	}
+	conn->in_end += got;
+
+	// Serve the requests that are complete, then send the responses
+	if ( crud_server_process(conn) ) {
+		return( -1 );
+	}
+	return( crud_server_flush(conn) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_needs
+// Description  : The number of bytes the state of a connection waits for
+//
+// Inputs       : conn - the connection
+// Outputs      : the bytes needed
+
+uint32_t crud_server_needs( CrudServerConnection *conn ) {
+	switch ( conn->state ) {
+	case CRUD_CONN_OFFSET:
+		return( CRUD_RANGE_OFFSET_SIZE );
+	case CRUD_CONN_DATA:
+		return( (conn->request >> 4) & 0xffffff );
+	default:
+		return( CRUD_NET_HEADER_SIZE );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_process
+// Description  : Step the state machine of a connection through its input,
+//                serving each request as it completes.  Stops when the
+//                input runs out, the connection has too many response
+//                bytes (or requests) waiting, or the next request has to
+//                wait for those before it or move the connection.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is to be closed
+
+int crud_server_process( CrudServerConnection *conn ) {
+
+	// Local variables
+	CrudServerMessage *msg;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, need, batch;
+	uint8_t flags, res;
+	CrudResponse resp;
+	char *data;
+
+	// Step while the next piece is here and the connection can take more
+	conn->blocked = 0;
+	while ( (conn->state != CRUD_CONN_CLOSING) && (conn->move_to == -1) &&
+			(conn->in_end - conn->in_start >= (need = crud_server_needs(conn))) ) {
+		if ( (conn->out_end - conn->out_start >= CRUD_SERVER_MAX_PENDING) || (conn->queued >= CRUD_SERVER_MAX_QUEUED) ) {
+			conn->blocked = 1;
+			break;
+		}
+		data = &conn->in[conn->in_start];
+		if ( conn->state == CRUD_CONN_HEADER ) {
+			memcpy( &conn->request, data, sizeof(CrudRequest) );
+			conn->request = ntohll64( conn->request );
+			if ( crud_server_hold(conn) ) {
+				break;
+			}
+		}
+		conn->in_start += need;
+
+		switch ( conn->state ) {
+		case CRUD_CONN_HEADER:
+			// Decode the request, and work out what follows it
+			deconstruct_crud_request( conn->request, &oid, &req, &length, &flags, &res );
+
+			// A batch frame is answered at once (behind any waiting
+			// responses), its requests follow
+			if ( (req == CRUD_BATCH) && (crud_network_version >= CRUD_PROTOCOL_BATCH) && (conn->batch == 0) ) {
+				if ( (length == 0) || (length > CRUD_MAX_BATCH) ) {
+					logMessage( LOG_ERROR_LEVEL, "Bad CRUD batch of %u requests [%s]", length, conn->name );
+					return( -1 );
+				}
+				batch = length;
+				resp = construct_crud_request( oid, CRUD_BATCH, length, flags, 0 );
+				if ( conn->queue != NULL ) {
+					if ( (msg = crud_server_message(CRUD_MSG_REQUEST, conn, 0)) == NULL ) {
+						return( -1 );
+					}
+					msg->resp = resp;
+					msg->done = 1;
+					crud_server_queue( conn, msg );
+				} else {
+					resp = htonll64( resp );
+					if ( crud_server_reserve(&conn->out, &conn->out_size, &conn->out_start, &conn->out_end, sizeof(resp)) ) {
+						return( -1 );
+					}
+					memcpy( &conn->out[conn->out_end], &resp, sizeof(resp) );
+					conn->out_end += sizeof(resp);
+				}
+				conn->batch = batch;
+				break;
+			}
+			if ( ((req == CRUD_READ_RANGE) && (crud_network_version >= CRUD_PROTOCOL_READ_RANGE)) ||
+					((req == CRUD_UPDATE_RANGE) && (crud_network_version >= CRUD_PROTOCOL_UPDATE_RANGE)) ) {
+				conn->state = CRUD_CONN_OFFSET;
+			} else if ( (req == CRUD_CREATE) || (req == CRUD_UPDATE) ||
+					((req == CRUD_APPEND) && (crud_network_version >= CRUD_PROTOCOL_APPEND)) ) {
+				conn->state = CRUD_CONN_DATA;
+			} else if ( crud_server_execute(conn, NULL) ) {
+				return( -1 );
+			}
+			break;
+
+		case CRUD_CONN_OFFSET:
+			// The offset, then the data if any
+			memcpy( &conn->offset, data, sizeof(conn->offset) );
+			conn->offset = ntohl( conn->offset );
+			if ( ((conn->request >> 28) & 0xf) == CRUD_UPDATE_RANGE ) {
+				conn->state = CRUD_CONN_DATA;
+			} else if ( crud_server_execute(conn, NULL) ) {
+				return( -1 );
+			}
+			break;
+
+		default:
+			// The data, so the request is complete
+			if ( crud_server_execute(conn, data) ) {
+				return( -1 );
+			}
+			break;
+		}
+
+		// Large data is read in place, check it will fit
+		if ( (conn->state == CRUD_CONN_DATA) && (crud_server_needs(conn) > CRUD_MAX_OBJECT_SIZE) ) {
+			logMessage( LOG_ERROR_LEVEL, "Write failure, bad CRUD request length [%s]", conn->name );
+			return( -1 );
+		}
+	}
+
+	// Drop consumed input, so the buffer is reused from the front (giving
+	// back a large one)
+	if ( conn->in_start == conn->in_end ) {
+		conn->in_start = conn->in_end = 0;
+		if ( conn->in_size > CRUD_SERVER_BUFFER ) {
+			free( conn->in );
+			conn->in = NULL;
+			conn->in_size = 0;
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_hold
+// Description  : Decide whether the request just decoded has to wait:
+//                requests on every shard or on the priority object wait
+//                for those ahead of them (so they see their effects), and
+//                a connection that keeps asking for one other shard moves
+//                to its worker once nothing is waiting
+//
+// Inputs       : conn - the connection
+// Outputs      : 1 if the request waits (or the connection moves), 0 if not
+
+int crud_server_hold( CrudServerConnection *conn ) {
+
+	// Local variables
+	int shard = crud_server_route( conn, conn->request );
+
+	// Wait for the requests ahead
+	if ( ((shard == CRUD_SERVER_ALL_SHARDS) || (((conn->request >> 1) & 0x7) & CRUD_PRIORITY_OBJECT)) &&
+			(conn->queued > 0) ) {
+		conn->blocked = 1;
+		return( 1 );
+	}
+
+	// Move to the shard asked for in a row, when the queue is empty
+	if ( (shard >= 0) && (shard != conn->worker->id) && (shard == conn->streak_shard) &&
+			(conn->streak >= CRUD_SERVER_MIGRATE) ) {
+		if ( conn->queued > 0 ) {
+			conn->blocked = 1;
+		} else {
+			conn->move_to = shard;
+		}
+		return( 1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_route
+// Description  : Find the shard that serves a request
+//
+// Inputs       : conn - the connection
+//                request - the request
+// Outputs      : the shard, CRUD_SERVER_ALL_SHARDS for every shard or
+//                CRUD_SERVER_NEW_SHARD for the shard of a new object
+
+int crud_server_route( CrudServerConnection *conn, CrudRequest request ) {
+
+	// Local variables
+	CRUD_REQUEST_TYPES req = (request >> 28) & 0xf;
+	CrudOID prio;
+
+	// The device requests go everywhere, objects to their shard (requests
+	// the store does not see stay here)
+	switch ( req ) {
+	case CRUD_INIT:
+	case CRUD_FORMAT:
+	case CRUD_CLOSE:
+		return( CRUD_SERVER_ALL_SHARDS );
+
+	case CRUD_CREATE:
+		return( CRUD_SERVER_NEW_SHARD );
+
+	case CRUD_READ:
+	case CRUD_UPDATE:
+	case CRUD_DELETE:
+	case CRUD_READ_RANGE:
+	case CRUD_APPEND:
+	case CRUD_UPDATE_RANGE:
+		if ( ! crud_server_supported(req) ) {
+			break;
+		}
+		if ( ((request >> 1) & 0x7) & CRUD_PRIORITY_OBJECT ) {
+			prio = crud_store_priority();
+			return( (prio == CRUD_NO_OBJECT) ? conn->worker->id : crud_store_shard(prio) );
+		}
+		return( crud_store_shard(request >> 32) );
+
+	default:
+		break;
+	}
+	return( conn->worker->id );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_execute
+// Description  : Serve the complete request of a connection.  A request for
+//                this worker's shard with nothing waiting ahead of it puts
+//                its response (and any data read) straight in the output,
+//                others are queued until their response is in.
+//
+// Inputs       : conn - the connection
+//                data - the request data (NULL if none)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_server_execute( CrudServerConnection *conn, char *data ) {
+
+	// Local variables
+	CrudServerWorker *worker = conn->worker;
+	CRUD_REQUEST_TYPES req = (conn->request >> 28) & 0xf;
+	uint32_t length = (conn->request >> 4) & 0xffffff, sent;
+	CrudServerMessage *msg, *part;
+	CrudResponse resp;
+	CrudOID oid;
+	int reads = ((req == CRUD_READ) || (req == CRUD_READ_RANGE)), shard, i;
+
+	// Find the shard (handing out the ID of a new object), count the
+	// requests in a row for another shard
+	if ( (shard = crud_server_route(conn, conn->request)) == CRUD_SERVER_NEW_SHARD ) {
+		oid = crud_store_new_oid();
+		conn->request = (conn->request & 0xffffffffULL) | ((CrudRequest)oid << 32);
+		shard = crud_store_shard( oid );
+	} else if ( (shard == worker->id) || (shard == CRUD_SERVER_ALL_SHARDS) ) {
+		conn->streak = 0;
+	} else if ( shard == conn->streak_shard ) {
+		conn->streak++;
+	} else {
+		conn->streak_shard = shard;
+		conn->streak = 1;
+	}
+	length = (length > CRUD_MAX_OBJECT_SIZE) ? CRUD_MAX_OBJECT_SIZE : length;
+
+	if ( (shard == worker->id) && (conn->queue == NULL) ) {
+		// Make room for the response and anything read (no object is
+		// larger), serve it into the output
+		if ( crud_server_reserve(&conn->out, &conn->out_size, &conn->out_start, &conn->out_end,
+				sizeof(CrudResponse) + ((reads) ? length : 0)) ) {
+			return( -1 );
+		}
+		resp = crud_server_serve( worker, conn, conn->request, conn->offset,
+				(reads) ? &conn->out[conn->out_end + sizeof(CrudResponse)] : data );
+		sent = (reads) ? CRUD_RESPONSE_LENGTH(resp) : 0;
+		resp = htonll64( resp );
+		memcpy( &conn->out[conn->out_end], &resp, sizeof(resp) );
+		conn->out_end += sizeof(resp) + sent;
+	} else {
+		// Queue it (with a copy of the data, or room for the bytes read)
+		if ( (msg = crud_server_message(CRUD_MSG_REQUEST, conn, (reads || (data != NULL)) ? length : 0)) == NULL ) {
+			return( -1 );
+		}
+		msg->request = conn->request;
+		msg->offset = conn->offset;
+		if ( data != NULL ) {
+			memcpy( msg->data, data, length );
+		}
+		crud_server_queue( conn, msg );
+
+		// Serve it here, on every shard (this one last), or post it to
+		// the worker owning its shard
+		if ( shard == worker->id ) {
+			msg->resp = crud_server_serve( worker, conn, msg->request, msg->offset, msg->data );
+			msg->done = 1;
+		} else if ( shard == CRUD_SERVER_ALL_SHARDS ) {
+			for ( i=0; i<crud_network_workers; i++ ) {
+				if ( i == worker->id ) {
+					continue;
+				}
+				if ( (part = crud_server_message(CRUD_MSG_REQUEST, conn, 0)) == NULL ) {
+					msg->failed = 1;
+					continue;
+				}
+				part->request = msg->request;
+				part->parent = msg;
+				msg->waiting++;
+				crud_server_post( &crud_server_workers[i], part );
+			}
+			msg->resp = crud_server_serve( worker, conn, msg->request, 0, NULL );
+			if ( msg->waiting == 0 ) {
+				crud_server_finish( msg );
+			}
+		} else {
+			worker->forwarded++;
+			crud_server_post( &crud_server_workers[shard], msg );
+		}
+	}
+
+	// Back to the next request, the close ends the connection
+	conn->state = (req == CRUD_CLOSE) ? CRUD_CONN_CLOSING : CRUD_CONN_HEADER;
+	conn->offset = 0;
+	if ( conn->batch > 0 ) {
+		conn->batch--;
+	}
+	return( crud_server_deliver(conn) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_serve
+// Description  : Serve a request on the shard of a worker
+//
+// Inputs       : worker - the worker
+//                conn - the connection of the request
+//                request - the request
+//                offset - the object offset (READ_RANGE/UPDATE_RANGE)
+//                buf - the request data, or the place to put the bytes read
+// Outputs      : the response
+
+CrudResponse crud_server_serve( CrudServerWorker *worker, CrudServerConnection *conn,
+		CrudRequest request, uint32_t offset, void *buf ) {
+
+	// Local variables
+	CRUD_REQUEST_TYPES req = (request >> 28) & 0xf;
+
+	// Requests newer than the version spoken fail, the rest go to the store
+	if ( ! crud_server_supported(req) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unsupported CRUD request %u (protocol version %d) [%s]", req, crud_network_version, conn->name );
+		return( (request & ~(0xffffffULL << 4)) | 0x1 );
+	}
+	worker->served++;
+	return( crud_shard_request(worker->id, request, offset, buf) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_supported
+// Description  : Is a request part of the protocol version spoken?
+//
+// Inputs       : req - the request type
+// Outputs      : 1 if it is, 0 if not
+
+int crud_server_supported( CRUD_REQUEST_TYPES req ) {
+	switch ( req ) {
+	case CRUD_READ_RANGE:
+		return( crud_network_version >= CRUD_PROTOCOL_READ_RANGE );
+	case CRUD_APPEND:
+		return( crud_network_version >= CRUD_PROTOCOL_APPEND );
+	case CRUD_UPDATE_RANGE:
+		return( crud_network_version >= CRUD_PROTOCOL_UPDATE_RANGE );
+	default:
+		return( req <= CRUD_CLOSE );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_finish
+// Description  : Complete a request on every shard once all parts are in
+//                (the response is this worker's, failing if any did)
+//
+// Inputs       : msg - the request
+// Outputs      : none
+
+void crud_server_finish( CrudServerMessage *msg ) {
+
+	// Local variables
+	CRUD_REQUEST_TYPES req = (msg->request >> 28) & 0xf;
+
+	// A close writes the store file once every shard is packed
+	if ( msg->failed ) {
+		msg->resp |= 0x1;
+	}
+	if ( (req == CRUD_CLOSE) && !(msg->resp & 0x1) && crud_store_commit() ) {
+		msg->resp |= 0x1;
+	}
+
+	// The initialization reports the protocol version
+	if ( req == CRUD_INIT ) {
+		msg->resp = (msg->resp & ~(0xffffffULL << 4)) | ((uint64_t)crud_network_version << 4);
+	}
+	msg->done = 1;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_deliver
+// Description  : Move the responses at the head of a connection's queue
+//                that are in to its output (dropping them if the
+//                connection is closed)
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is to be closed
+
+int crud_server_deliver( CrudServerConnection *conn ) {
+
+	// Local variables
+	CrudServerMessage *msg;
+	CRUD_REQUEST_TYPES req;
+	CrudResponse resp;
+	uint32_t sent;
+
+	// Take responses off the head until one is still out
+	while ( ((msg = conn->queue) != NULL) && msg->done ) {
+		req = (msg->resp >> 28) & 0xf;
+		sent = ((req == CRUD_READ) || (req == CRUD_READ_RANGE)) ? CRUD_RESPONSE_LENGTH(msg->resp) : 0;
+		if ( ! conn->dead ) {
+			if ( crud_server_reserve(&conn->out, &conn->out_size, &conn->out_start, &conn->out_end, sizeof(resp) + sent) ) {
+				return( -1 );
+			}
+			resp = htonll64( msg->resp );
+			memcpy( &conn->out[conn->out_end], &resp, sizeof(resp) );
+			memcpy( &conn->out[conn->out_end + sizeof(resp)], msg->data, sent );
+			conn->out_end += sizeof(resp) + sent;
+		}
+		if ( (conn->queue = msg->next) == NULL ) {
+			conn->tail = NULL;
+		}
+		conn->queued--;
+		free( msg );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_inbox
+// Description  : Handle the messages posted to a worker: serve requests
+//                on its shard and post them back, take in responses and
+//                moving connections
+//
+// Inputs       : worker - the worker
+// Outputs      : the number of messages handled
+
+int crud_server_inbox( CrudServerWorker *worker ) {
+
+	// Local variables
+	CrudServerMessage *msg, *next, *list = NULL, *parent;
+	CrudServerConnection *conn;
+	uint64_t wakes;
+	int count = 0;
+
+	// Clear the wakeup, then take the messages and put them oldest first
+	if ( (read(worker->wakefd, &wakes, sizeof(wakes)) == -1) && (errno != EAGAIN) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD worker wakeup read failed : [%s]", strerror(errno) );
+	}
+	for ( msg = __atomic_exchange_n(&worker->inbox, NULL, __ATOMIC_ACQUIRE); msg != NULL; msg = next ) {
+		next = msg->link;
+		msg->link = list;
+		list = msg;
+	}
+
+	// Handle each message
+	for ( msg = list; msg != NULL; msg = next, count++ ) {
+		next = msg->link;
+		conn = msg->conn;
+		switch ( msg->type ) {
+		case CRUD_MSG_REQUEST:
+			// Serve it here, the connection is the other worker's
+			msg->resp = crud_server_serve( worker, conn, msg->request, msg->offset, msg->data );
+			msg->type = CRUD_MSG_RESPONSE;
+			crud_server_post( &crud_server_workers[msg->from], msg );
+			continue;
+
+		case CRUD_MSG_RESPONSE:
+			// The response is in (a part completing its request)
+			if ( (parent = msg->parent) != NULL ) {
+				parent->failed |= (msg->resp & 0x1);
+				free( msg );
+				if ( --parent->waiting == 0 ) {
+					crud_server_finish( parent );
+				}
+			} else {
+				msg->done = 1;
+			}
+			break;
+
+		default:
+			// Take the connection over
+			free( msg );
+			crud_server_link( worker, conn );
+			conn->watched = 0;
+			conn->move_to = conn->streak_shard = -1;
+			conn->streak = 0;
+			worker->moved++;
+			break;
+		}
+
+		// Send what can go, and carry on with the input held back
+		if ( conn->dead ) {
+			crud_server_close( conn );
+		} else if ( crud_server_deliver(conn) || crud_server_process(conn) ||
+				crud_server_flush(conn) || crud_server_watch(conn) ) {
+			crud_server_close( conn );
+		}
+	}
+	return( count );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_post
+// Description  : Post a message to a worker, waking it if its inbox was
+//                empty (it takes the whole inbox when woken)
+//
+// Inputs       : worker - the worker
+//                msg - the message
+// Outputs      : none
+
+void crud_server_post( CrudServerWorker *worker, CrudServerMessage *msg ) {
+
+	// Local variables
+	CrudServerMessage *head = __atomic_load_n( &worker->inbox, __ATOMIC_RELAXED );
+	uint64_t wake = 1;
+
+	// Push it on the inbox, then wake the worker
+	do {
+		msg->link = head;
+	} while ( ! __atomic_compare_exchange_n(&worker->inbox, &head, msg, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+	if ( (head == NULL) && (write(worker->wakefd, &wake, sizeof(wake)) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD worker wakeup failed : [%s]", strerror(errno) );
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_flush
+// Description  : Send what the socket will take of a connection's responses,
+//                serving any input held back while the output was full
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is to be closed
+
+int crud_server_flush( CrudServerConnection *conn ) {
+
+	// Local variables
+	ssize_t sent;
+	int backed = (conn->out_end - conn->out_start >= CRUD_SERVER_MAX_PENDING);
+
+	// Send until done or the socket is full
+	while ( conn->out_start < conn->out_end ) {
+		if ( (sent = send(conn->sock, &conn->out[conn->out_start], conn->out_end - conn->out_start, MSG_NOSIGNAL)) == -1 ) {
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) ) {
+				break;
+			}
+			if ( errno == EINTR ) {
+				continue;
+			}
+			logMessage( LOG_ERROR_LEVEL, "CRUD send bytes failed : [%s]", strerror(errno) );
+			return( -1 );
+		}
+		conn->out_start += sent;
+	}
+
+	// Start the buffer over when empty (giving back a large one)
+	if ( conn->out_start == conn->out_end ) {
+		conn->out_start = conn->out_end = 0;
+		if ( conn->out_size > CRUD_SERVER_BUFFER ) {
+			free( conn->out );
+			conn->out = NULL;
+			conn->out_size = 0;
+		}
+	}
+
+	// Input held back by a full output can go now
+	if ( backed && (conn->out_end - conn->out_start < CRUD_SERVER_MAX_PENDING) ) {
+		if ( crud_server_process(conn) ) {
+			return( -1 );
+		}
+		return( crud_server_flush(conn) );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_watch
+// Description  : Ask epoll for the events a connection is waiting on: input
+//                unless closing or held back, output while there is some
+//                to send.  A closing connection with nothing left to send
+//                is done, a moving one leaves for its new worker.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, -1 if the connection is to be closed
+
+int crud_server_watch( CrudServerConnection *conn ) {
+
+	// Local variables
+	struct epoll_event ev;
+	CrudServerWorker *worker = conn->worker;
+	CrudServerMessage *msg;
+	uint32_t pending = conn->out_end - conn->out_start;
+	int to = conn->move_to;
+
+	// Hand a moving connection over (nothing of it is left here)
+	if ( to != -1 ) {
+		if ( (msg = crud_server_message(CRUD_MSG_CONNECTION, conn, 0)) == NULL ) {
+			return( -1 );
+		}
+		if ( conn->watched ) {
+			epoll_ctl( worker->epfd, EPOLL_CTL_DEL, conn->sock, NULL );
+		}
+		logMessage( LOG_INFO_LEVEL, "Moving client connection [%s] to worker %d", conn->name, to );
+		crud_server_unlink( conn );
+		crud_server_post( &crud_server_workers[to], msg );
+		return( 0 );
+	}
+
+	// Work out the events wanted
+	if ( (conn->state == CRUD_CONN_CLOSING) && (pending == 0) && (conn->queued == 0) ) {
+		logMessage( LOG_INFO_LEVEL, "Closing client connection [%s]", conn->name );
+		return( -1 );
+	}
+	ev.events = 0;
+	if ( (conn->state != CRUD_CONN_CLOSING) && (pending < CRUD_SERVER_MAX_PENDING) && ! conn->blocked ) {
+		ev.events |= EPOLLIN;
+	}
+	if ( pending > 0 ) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.ptr = conn;
+
+	// Register or change them (level triggered), if they changed
+	if ( ! conn->watched ) {
+		conn->watched = 1;
+		conn->events = ev.events;
+		return( (epoll_ctl(worker->epfd, EPOLL_CTL_ADD, conn->sock, &ev) == -1) ? -1 : 0 );
+	}
+	if ( conn->events != ev.events ) {
+		conn->events = ev.events;
+		return( (epoll_ctl(worker->epfd, EPOLL_CTL_MOD, conn->sock, &ev) == -1) ? -1 : 0 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_close
+// Description  : Close a connection (closing the socket takes it out of the
+//                epoll instance), freeing it once no other worker holds a
+//                request of it
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void crud_server_close( CrudServerConnection *conn ) {
+
+	// Close the socket, drop the responses that are in
+	if ( ! conn->dead ) {
+		close( conn->sock );
+		conn->dead = 1;
+		conn->state = CRUD_CONN_CLOSING;
+	}
+	crud_server_deliver( conn );
+
+	// Free it when nothing is out
+	if ( conn->queued == 0 ) {
+		crud_server_free( conn );
+	}
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_free
+// Description  : Unlink a connection and free it, with its queue
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void crud_server_free( CrudServerConnection *conn ) {
+
+	// Local variables
+	CrudServerMessage *msg;
+
+	// Unlink it, close the socket and free it
+	if ( conn->worker != NULL ) {
+		crud_server_unlink( conn );
+	}
+	if ( ! conn->dead ) {
+		close( conn->sock );
+	}
+	while ( (msg = conn->queue) != NULL ) {
+		conn->queue = msg->next;
+		free( msg );
+	}
+	free( conn->in );
+	free( conn->out );
+	free( conn );
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_link
+// Description  : Add a connection to the ones a worker serves
+//
+// Inputs       : worker - the worker
+//                conn - the connection
+// Outputs      : none
+
+void crud_server_link( CrudServerWorker *worker, CrudServerConnection *conn ) {
+	conn->worker = worker;
+	conn->prev = NULL;
+	conn->next = worker->connections;
+	if ( conn->next != NULL ) {
+		conn->next->prev = conn;
+	}
+	worker->connections = conn;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_unlink
+// Description  : Take a connection off the ones its worker serves
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void crud_server_unlink( CrudServerConnection *conn ) {
+	if ( conn->prev != NULL ) {
+		conn->prev->next = conn->next;
+	} else {
+		conn->worker->connections = conn->next;
+	}
+	if ( conn->next != NULL ) {
+		conn->next->prev = conn->prev;
+	}
+	conn->worker = NULL;
+	conn->prev = conn->next = NULL;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_message
+// Description  : Allocate a message from the worker of a connection
+//
+// Inputs       : type - the message type
+//                conn - the connection
+//                length - the bytes of data it carries
+// Outputs      : the message, NULL if failure
+
+CrudServerMessage *crud_server_message( CRUD_MESSAGE_TYPES type, CrudServerConnection *conn, uint32_t length ) {
+
+	// Local variables
+	CrudServerMessage *msg;
+
+	// Allocate it (the data is not cleared), fill in the header
+	if ( (msg = malloc(sizeof(CrudServerMessage) + length)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD server message allocation failed [%u bytes]", length );
+		return( NULL );
+	}
+	memset( msg, 0x0, sizeof(CrudServerMessage) );
+	msg->type = type;
+	msg->conn = conn;
+	msg->from = conn->worker->id;
+	return( msg );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_queue
+// Description  : Add a request to the end of a connection's queue
+//
+// Inputs       : conn - the connection
+//                msg - the request
+// Outputs      : none
+
+void crud_server_queue( CrudServerConnection *conn, CrudServerMessage *msg ) {
+	if ( conn->tail != NULL ) {
+		conn->tail->next = msg;
+	} else {
+		conn->queue = msg;
+	}
+	conn->tail = msg;
+	conn->queued++;
+	return;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server_reserve
+// Description  : Make sure a buffer has room for need more bytes past its
+//                end, moving its contents to the front or growing it
+//
+// Inputs       : buf - the buffer
+//                size - its size
+//                start - the first byte in use
+//                end - the end of the bytes in use
+//                need - the bytes wanted past the end
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_server_reserve( char **buf, uint32_t *size, uint32_t *start, uint32_t *end, uint32_t need ) {
+
+	// Local variables
+	uint32_t used = *end - *start, newsize;
+	char *newbuf;
+
+	// There is room already
+	if ( (*buf != NULL) && (*end + need <= *size) ) {
+		return( 0 );
+	}
+
+	// Move the contents to the front if that makes room, grow otherwise
+	if ( (*buf != NULL) && (used + need <= *size) ) {
+		memmove( *buf, &(*buf)[*start], used );
+	} else {
+		for ( newsize = CRUD_SERVER_BUFFER; newsize < used + need; newsize *= 2 );
+		if ( (newbuf = malloc(newsize)) == NULL ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD server buffer allocation failed [%u bytes]", newsize );
+			return( -1 );
+		}
+		if ( *buf != NULL ) {
+			memcpy( newbuf, &(*buf)[*start], used );
+			free( *buf );
+		}
+		*buf = newbuf;
+		*size = newsize;
+	}
+	*start = 0;
+	*end = used;
+	return( 0 );
+}
@@ -25,25 +25,41 @@
 #include <crud_driver.h>
 #include <crud_network.h>
 #include <crud_file_io.h>
+#include <crud_cache.h>
+#include <crud_pool.h>
+#include <crud_workload.h>
+#include <crud_bench.h>
+#include <crud_trace.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define CRUD_SIM_MAX_OPEN_FILES 128
-#define CRUD_ARGUMENTS "hvul:x:a:p:"
+#define CRUD_ARGUMENTS "hvubADl:R:c:B:w:x:C:o:t:a:p:n:"
 #define USAGE \
-	"USAGE: crud [-h] [-v] [-l <logfile>] [-c <sz>] [-x <file>] [-a <ip addr>] [-p <port>] <workload-file>\n" \
+	"USAGE: crud [-h] [-v] [-b] [-o <results>] [-t <trace>] [-A] [-D] [-R <binlog>] [-l <logfile>] [-c <sz>] [-B <ops>] [-w <bytes>] [-x <file>] [-C <compiled>] [-a <ip addr>[,<ip addr>...]] [-p <port>] [-n <conns>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -u - run the unit tests instead of the simulator\n" \
 	"    -v - verbose output\n" \
+	"    -b - benchmark mode, report throughput and latency percentiles of the run\n" \
+	"    -o - write the benchmark results as JSON to the file <results> (- for stdout)\n" \
+	"    -t - write the trace dump as JSON to the file <trace> (TRACE=1 builds)\n" \
+	"    -A - asynchronous logging (a writer thread batches the log writes)\n" \
+	"    -D - binary logging (entries recorded unformatted, see -R)\n" \
+	"    -R - render the binary log <binlog> as text to stdout and exit\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - number of objects held in the client cache (0 disables)\n" \
+	"    -B - send up to <ops> consecutive writes as one batch (0 disables)\n" \
+	"    -w - buffer up to <bytes> of writes before writing them back (0 disables)\n" \
 	"    -x - extract a file <file> from the crud filesystem\n" \
-	"    -a - IP address of server to connect to.\n" \
+	"    -C - compile the workload into the file <compiled> (which replays in its place)\n" \
+	"    -a - IP address(es) of server to connect to (comma separated).\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -n - number of connections in the client connection pool\n" \
 	"\n" \
-	"    <workload-file> - file contain the workload to simulate\n" \
+	"    <workload-file> - file contain the workload to simulate (text or compiled)\n" \
 	"\n" \
 
 // This is the file table
@@ -60,7 +76,10 @@ int verbose;
 // Functional Prototypes
 
 int simulate_CRUD( char *wload );
+int replay_CRUD( CrudWorkload *wl );
+int compile_CRUD( char *wload, char *compiled );
 int extract_file_from_crud(char *ex_file);
+int render_log( char *binlog );
 
 //
 // Functions
@@ -76,9 +95,11 @@ int extract_file_from_crud(char *ex_file);
 
 int main( int argc, char *argv[] ) {
 	// Local variables
-	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0;
-	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
-	char *ex_file = NULL;
+	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0, benchmark = 0, async_log = 0, binary_log = 0;
+	uint32_t cache_size = CRUD_DEFAULT_CACHE_LINES; // Defaults to 1024 cache lines
+	uint32_t batch_size = 0; // Defaults to sending each write at once
+	uint32_t writeback_size = 0; // Defaults to no write-back buffering
+	char *ex_file = NULL, *compiled = NULL, *results = NULL, *trace = NULL, *addr, *save;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CRUD_ARGUMENTS)) != -1) {
@@ -96,6 +117,30 @@ int main( int argc, char *argv[] ) {
 			unit_tests = 1;
 			break;
 
+		case 'b': // Benchmark Flag
+			benchmark = 1;
+			break;
+
+		case 'o': // Set the benchmark results filename
+			results = optarg;
+			benchmark = 1;
+			break;
+
+		case 't': // Set the trace dump filename
+			trace = optarg;
+			break;
+
+		case 'A': // Asynchronous logging Flag
+			async_log = 1;
+			break;
+
+		case 'D': // Binary logging Flag
+			binary_log = 1;
+			break;
+
+		case 'R': // Render a binary log and exit
+			return( render_log(optarg) );
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
@@ -106,6 +151,10 @@ int main( int argc, char *argv[] ) {
 			extract_file = 1;
 			break;
 
+		case 'C': // Set the compiled workload filename
+			compiled = optarg;
+			break;
+
 		case 'c': // Set cache line size
 			if ( sscanf( optarg, "%u", &cache_size ) != 1 ) {
 			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
@@ -113,12 +162,28 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
-        case 'a': // Get the IP address
-            if (inet_addr(optarg) == INADDR_NONE) {
-			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
+		case 'B': // Set the write batch size
+			if ( sscanf( optarg, "%u", &batch_size ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  batch size [%s]", optarg );
                 return(-1);
-            } 
+			}
+			break;
+
+		case 'w': // Set the write-back buffer size
+			if ( sscanf( optarg, "%u", &writeback_size ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  write-back size [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+        case 'a': // Get the IP address(es)
             crud_network_address = (unsigned char *)strdup(optarg);
+            for (addr = strtok_r(optarg, ",", &save); addr != NULL; addr = strtok_r(NULL, ",", &save)) {
+                if (inet_addr(addr) == INADDR_NONE) {
+			        logMessage( LOG_ERROR_LEVEL, "Bad  IP address [%s]", addr );
+                    return(-1);
+                }
+            }
 			break;
 
         case 'p': // Set the network port number
@@ -128,6 +193,14 @@ int main( int argc, char *argv[] ) {
 			}
             break;
 
+		case 'n': // Set the size of the connection pool
+			if ( (sscanf(optarg, "%d", &crud_network_connections) != 1) ||
+					(crud_network_connections < 1) || (crud_network_connections > CRUD_MAX_CONNECTIONS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  connection count [%s]", optarg );
+                return(-1);
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -141,13 +214,30 @@ int main( int argc, char *argv[] ) {
 	if ( verbose ) {
 		enableLogLevels( LOG_INFO_LEVEL );
 	}
+	if ( async_log && enableAsyncLog() ) {
+		logMessage( LOG_WARNING_LEVEL, "Asynchronous logging unavailable, logging synchronously." );
+	}
+	if ( binary_log && enableBinaryLog() ) {
+		logMessage( LOG_WARNING_LEVEL, "Binary logging unavailable, logging text." );
+	}
+
+	// Start tracing (dumped on unmount and on CRUD_TRACE_SIGNAL), if built in
+	if ( (trace != NULL) && ! CRUD_TRACE_ENABLED ) {
+		logMessage( LOG_WARNING_LEVEL, "Tracing is not built in (make TRACE=1), no trace written to [%s]", trace );
+	}
+	CRUD_TRACE_INIT( trace );
+
+	// Size the client object cache, the write batches and write-back buffers
+	set_crud_cache_size( cache_size );
+	crud_set_batch( batch_size );
+	crud_set_writeback( writeback_size );
 
 	// If we are running the unit tests, do that
 	if ( unit_tests ) {
 
 		// Enable verbose, run the tests and check the results
 		enableLogLevels( LOG_INFO_LEVEL );
-		if ( b64UnitTest() || crudIOUnitTest() ) {
+		if ( b64UnitTest() || crudIOUnitTest() || crudIOViewTest() || crudIOConcurrentTest() || crudIOMountTest() ) {
 			logMessage( LOG_ERROR_LEVEL, "CRUD unit tests failed.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD unit tests completed successfully.\n\n" );
@@ -173,9 +263,31 @@ int main( int argc, char *argv[] ) {
 
 		}
 
-		// Run the simulation
+		// Compile the workload instead if asked
+		if ( compiled != NULL ) {
+			if ( compile_CRUD(argv[optind], compiled) == 0 ) {
+				logMessage( LOG_INFO_LEVEL, "Workload [%s] compiled into [%s].\n\n", argv[optind], compiled );
+			} else {
+				logMessage( LOG_ERROR_LEVEL, "Workload [%s] compile failed.\n\n", argv[optind] );
+			}
+			return( 0 );
+		}
+
+		// Run the simulation (timing it if benchmarking)
+		if ( benchmark ) {
+			crud_bench_setting( "cache_lines", cache_size );
+			crud_bench_setting( "batch_ops", batch_size );
+			crud_bench_setting( "writeback_bytes", writeback_size );
+			crud_bench_setting( "connections", crud_network_connections );
+			crud_bench_start();
+		}
 		if ( simulate_CRUD(argv[optind]) == 0 ) {
 			logMessage( LOG_INFO_LEVEL, "CRUD simulation completed successfully.\n\n" );
+			if ( benchmark ) {
+				crud_bench_stop();
+				crud_bench_setting( "server_version", crud_network_version );
+				crud_bench_report( argv[optind], results );
+			}
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD simulation failed.\n\n" );
 		}
@@ -189,246 +301,242 @@ int main( int argc, char *argv[] ) {
 //
 // Function     : simulate_CRUD
 // Description  : The main control loop for the processing of the CRUD
-//                simulation.
+//                simulation.  A compiled workload is mapped as is, a text
+//                one is compiled in memory first.
 //
-// Inputs       : wload - the name of the workload file
+// Inputs       : wload - the name of the workload file (text or compiled)
 // Outputs      : 0 if successful test, -1 if failure
 
 int simulate_CRUD( char *wload ) {
 
 	// Local variables
-	char line[2048], fname[128], command[128], text[2048], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
-	CrudSimulationTable ftable[CRUD_SIM_MAX_OPEN_FILES];
-	int idx, i;
-
-	// Setup the file table
-	memset(ftable, 0x0, sizeof(CrudSimulationTable)*CRUD_SIM_MAX_OPEN_FILES);
-
-	// Open the workload file
-	linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
-		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
-			wload, strerror(errno) );
+	CrudWorkload wl;
+	int ret;
+
+	// Open (compiling a text workload), then replay it
+	if ( crud_workload_open(wload, &wl) ) {
+		return( -1 );
+	}
+	ret = replay_CRUD( &wl );
+	crud_workload_close( &wl );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compile_CRUD
+// Description  : Compile a workload into a file the simulator replays
+//                without parsing
+//
+// Inputs       : wload - the name of the workload file
+//                compiled - the name of the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int compile_CRUD( char *wload, char *compiled ) {
+
+	// Local variables
+	CrudWorkload wl;
+	int ret;
+
+	// Open (compiling), then save the stream
+	if ( crud_workload_open(wload, &wl) ) {
+		return( -1 );
+	}
+	ret = crud_workload_save( &wl, compiled );
+	logMessage( LOG_INFO_LEVEL, "CRUD_SIM : %u operations on %u files, %u bytes compiled.",
+			wl.header->ops, wl.header->files, wl.size );
+	crud_workload_close( &wl );
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_CRUD
+// Description  : Replay the operations of a compiled workload.  Files are
+//                opened on their first operation and closed (in the order
+//                opened) on unmount.
+//
+// Inputs       : wl - the workload
+// Outputs      : 0 if successful test, -1 if failure
+
+int replay_CRUD( CrudWorkload *wl ) {
+
+	// Local variables
+	CrudWorkloadOp *op, *last = wl->ops + wl->header->ops;
+	uint16_t opened[CRUD_SIM_MAX_OPEN_FILES];
+	uint64_t start = 0;
+	int16_t *fhandle;
+	char *fname, *rbuf;
+	int nopen = 0, idx, ret;
+
+	// Setup the file handles (none open) and the read buffer
+	fhandle = malloc( sizeof(int16_t) * (wl->header->files + 1) );
+	rbuf = crud_pool_alloc( wl->header->max_read );
+	if ( (fhandle == NULL) || (rbuf == NULL) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD_SIM : failed to allocate the replay state." );
+		free( fhandle );
+		crud_pool_free( rbuf );
 		return( -1 );
 	}
+	memset( fhandle, 0xff, sizeof(int16_t) * (wl->header->files + 1) );
+
+	// Replay the operations in order
+	for ( op = wl->ops; op < last; op++ ) {
 
-	// While file not done
-	while (!feof(fhandle)) {
-
-		// Get the line and bail out on fail
-		if (fgets(line, 2048, fhandle) != NULL) {
-
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
-				return( -1 );
+		// Time the command if benchmarking (recorded once it succeeds)
+		if ( crud_bench_enabled ) {
+			start = crud_bench_now();
+		}
+
+		// Now process the commands
+		if (op->opcode == CRUD_WL_FORMAT) {
+
+			// Log the command executed
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+
+			// Now perform the format
+			if (crud_format() != op->length) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
+				break;
 			}
 
-			// Just log the contents
-			logMessage(LOG_INFO_LEVEL, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
+		} else if (op->opcode == CRUD_WL_MOUNT) {
 
-			// Now process the commands
-			if (strncmp(command, "FORMAT", 6) == 0) {
+			// Log the command executed
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Formatting CRUD filesystem");
+			// Now perform the filesystem mount
+			if (crud_mount() != op->length) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+				break;
+			}
+
+		} else if (op->opcode == CRUD_WL_UNMOUNT) {
 
-				// Now perform the format
-				if (crud_format() != len) {
+			// Log the command executed
+			logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
+
+			// Finished, close all of the files
+			for (idx=0; idx<nopen; idx++) {
+				fname = crud_workload_name(wl, opened[idx]);
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", fname);
+				if (crud_close(fhandle[opened[idx]]) == -1) {
 					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Formatting failed, aborting simulation.");
-					return(-1);
+					logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", fname);
+					break;
 				}
+				fhandle[opened[idx]] = -1;
+			}
+			if (idx < nopen) {
+				break;
+			}
+			nopen = 0;
 
-			} else if (strncmp(command, "MOUNT", 5) == 0) {
+			// Now perform the filesystem unmount
+			if (crud_unmount() != op->length) {
+				// Failed, error out
+				logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
+				break;
+			}
 
-				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Mounting CRUD filesystem");
+		} else {
+
+			//
+			// File operations
 
-				// Now perform the filesystem mount
-				if (crud_mount() != len) {
+			// File is not open, open the file
+			fname = crud_workload_name(wl, op->file);
+			if (fhandle[op->file] == -1) {
+
+				// Log message, note the file for closing on unmount
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
+				CMPSC_ASSERT1(nopen<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", nopen);
+				opened[nopen++] = op->file;
+
+				// Now perform the open
+				fhandle[op->file] = crud_open(fname);
+				if (fhandle[op->file] == -1) {
 					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
-					return(-1);
+					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
+					nopen--;
+					break;
 				}
 
-			} else if (strncmp(command, "UNMOUNT", 5) == 0) {
+			}
+
+			// Now execute the specific command
+			if (op->opcode == CRUD_WL_WRITEAT) {
 
 				// Log the command executed
-				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Un-mounting CRUD filesystem");
-
-				// Finished, close all of the files
-				for (idx=0; idx<CRUD_SIM_MAX_OPEN_FILES; idx++) {
-
-					// If file in use, close if
-					if (ftable[idx].filename != NULL) {
-						// Log the file close
-						logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Closing file [%s]", ftable[idx].filename);
-						if (crud_close(ftable[idx].fhandle) == -1) {
-							// Failed, error out
-							logMessage(LOG_ERROR_LEVEL, "Close file [%s] failed, aborting simulation.", ftable[idx].filename);
-							return(-1);
-						}
-						free(ftable[idx].filename);
-						ftable[idx].filename = NULL;
-					}
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", op->length, op->offset, fname);
 
+				// First perform the seek
+				if (crud_seek(fhandle[op->file], op->offset)) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, op->offset);
+					break;
 				}
 
-				// Now perform the filesystem unmount
-				if (crud_unmount() != len) {
+				// Now perform the write
+				if (crud_write(fhandle[op->file], crud_workload_data(wl, op), op->length) != op->length) {
 					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Mount failed, aborting simulation.");
-					return(-1);
+					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, op->length);
+					break;
 				}
 
+			} else if (op->opcode == CRUD_WL_WRITE) {
 
-			} else {
+				// Log the command executed
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", op->length, fname);
 
-				//
-				// File operations
-
-				// Now walk the the table looking for the file
-				idx = -1;
-				i = 0;
-				while ( (i < CRUD_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-					if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-						idx = i;
-					}
-					i++;
+				// Now perform the write
+				if (crud_write(fhandle[op->file], crud_workload_data(wl, op), op->length) != op->length) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, op->length);
+					break;
 				}
 
-				// File is not found, open the file
-				if (idx == -1) {
-
-					// Log message, find unused index and save filename for later use
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
-					idx = 0;
-					while ((ftable[idx].filename != NULL) && (idx < CRUD_SIM_MAX_OPEN_FILES)) {
-						idx++;
-					}
-					CMPSC_ASSERT1(idx<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", idx);
-					ftable[idx].filename = strdup(fname);
-
-					// Now perform the open
-					ftable[idx].fhandle = crud_open(ftable[idx].filename);
-					if (ftable[idx].fhandle == -1) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-						return(-1);
-					}
+			} else if (op->opcode == CRUD_WL_SEEK) {
+
+				// Log the command executed
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", op->offset, fname);
 
+				// Now perform the seek
+				if (crud_seek(fhandle[op->file], op->offset) != op->length) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, op->offset);
+					break;
 				}
 
-				// Now execute the specific command
-				if (strncmp(command, "WRITEAT", 7) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
-
-					// First perform the seek
-					if (crud_seek(ftable[idx].fhandle, off)) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
-
-					// Now perform the write
-					if (crud_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "WRITE", 5) == 0) {
-
-					// Now see if we need more data to fill, terminate the lines
-					CMPSC_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-					CMPSC_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-					strncpy(text, sep+1, len);
-					text[len] = 0x0;
-					for (i=0; i<strlen(text); i++) {
-						if (text[i] == '*') {
-							text[i] = '\n';
-						}
-					}
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Writing %d bytes to file [%s]", len, fname);
-
-					// Now perform the write
-					if (crud_write(ftable[idx].fhandle, text, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "SEEK", 4) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Seeking to position %d in file [%s]", off, fname);
-
-					// Now perform the seek
-					if (crud_seek(ftable[idx].fhandle, off) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-
-				} else if (strncmp(command, "READ", 4) == 0) {
-
-					// Log the command executed
-					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", len, fname);
-
-					// Now perform the read
-					rbuf = malloc(len);
-					if (crud_read(ftable[idx].fhandle, rbuf, len) != len) {
-						// Failed, error out
-						logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-						return(-1);
-					}
-					free(rbuf);
-					rbuf = NULL;
-
-				} else {
-
-					// Bomb out, don't understand the command
-					CMPSC_ASSERT1(0, "CRUD_SIM : Failed, unknown command [%s]", command);
+			} else {
+
+				// Log the command executed
+				logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", op->length, fname);
 
+				// Now perform the read
+				if (crud_read(fhandle[op->file], rbuf, op->length) != op->length) {
+					// Failed, error out
+					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, op->offset);
+					break;
 				}
-			}
 
-			// Check for the virtual level failing
-			if ( err ) {
-				logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
-				fclose( fhandle );
-				return( -1 );
 			}
 		}
+
+		// Record the latency of the command
+		if ( crud_bench_enabled ) {
+			crud_bench_command( op->opcode, start,
+					((op->opcode == CRUD_WL_WRITE) || (op->opcode == CRUD_WL_WRITEAT) || (op->opcode == CRUD_WL_READ)) ? op->length : 0 );
+		}
 	}
 
-	// Close the workload file, successfully
-	fclose( fhandle );
-	return( 0 );
+	// Cleanup the replay state, failed unless every operation ran
+	ret = (op == last) ? 0 : -1;
+	free( fhandle );
+	crud_pool_free( rbuf );
+	return( ret );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -447,10 +555,8 @@ int extract_file_from_crud(char *ex_file) {
 	char buf[CRUD_MAX_OBJECT_SIZE];
     int fhandle, flags;
     mode_t mode;
-	// Open the file, read from it, close it
-	if ( (crud_mount()) || ((fd = crud_open(ex_file)) == -1) ||
-		 ((len = crud_read(fd, buf, CRUD_MAX_OBJECT_SIZE)) == -1) ||
-		 (crud_close(fd) == -1)	) {
+	// Open the file
+	if ( (crud_mount()) || ((fd = crud_open(ex_file)) == -1) ) {
 		// Error out
 		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
 		return(-1);
@@ -465,13 +571,43 @@ int extract_file_from_crud(char *ex_file) {
         return( -1 );
     }
 
-    // Now write the read bytes to the file, then close
-    if (write(fhandle, buf, len) != len) {
-        fprintf( stderr, "CRUD: extraction write() failed, error=%s\n", strerror(errno) );
-        return( -1 );
+    // Now copy the file a buffer at a time (files may be larger), then close
+    while ( (len = crud_read(fd, buf, CRUD_MAX_OBJECT_SIZE)) > 0 ) {
+        if (write(fhandle, buf, len) != len) {
+            fprintf( stderr, "CRUD: extraction write() failed, error=%s\n", strerror(errno) );
+            close( fhandle );
+            return( -1 );
+        }
     }
     close( fhandle );
+	if ( (len == -1) || (crud_close(fd) == -1) ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
+		return(-1);
+	}
 
     // Return successfully
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : render_log
+// Description  : Write a binary log (made with -D) to stdout as text
+//
+// Inputs       : binlog - the binary log file
+// Outputs      : 0 if successful, -1 if failure
+
+int render_log( char *binlog ) {
+
+	// Local variables
+	int fhandle, ret;
+
+	// Open the binary log, render it and close
+	if ( (fhandle = open(binlog, O_RDONLY)) == -1 ) {
+		fprintf( stderr, "CRUD: binary log open() failed [%s], error=%s\n", binlog, strerror(errno) );
+		return( -1 );
+	}
+	ret = renderBinaryLog( fhandle, STDOUT_FILENO );
+	close( fhandle );
+	return( ret );
+}
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_srv.c
+//  Description    : This is the main program for the CRUD server, which
+//                   serves the CRUD object store to the CRUD clients.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:53:36 UTC 2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// Project Includes
+#include <crud_driver.h>
+#include <crud_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_SRV_ARGUMENTS "hvul:p:V:t:"
+#define USAGE \
+	"USAGE: crud_server [-h] [-v] [-u] [-l <logfile>] [-p <port>] [-V <version>] [-t <threads>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -u - run the unit tests instead of the server\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to serve on\n" \
+	"    -V - protocol version to speak (0 to 5, the newest by default)\n" \
+	"    -t - worker threads to serve with, each owning a shard of the store (1 by default)\n" \
+	"\n" \
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CRUD server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, unit_tests = 0, log_initialized = 0;
+	struct rlimit lim;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CRUD_SRV_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'u': // Unit Tests Flag
+			unit_tests = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &crud_network_port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'V': // Set the protocol version
+			if ( (sscanf(optarg, "%d", &crud_network_version) != 1) ||
+					(crud_network_version < 0) || (crud_network_version > CRUD_PROTOCOL_VERSION) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  protocol version [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 't': // Set the number of worker threads
+			if ( (sscanf(optarg, "%d", &crud_network_workers) != 1) ||
+					(crud_network_workers < 1) || (crud_network_workers > CRUD_MAX_SHARDS) ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  number of worker threads [%s]", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// If we are running the unit tests, do that
+	if ( unit_tests ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+		if ( b64UnitTest() || crud_unit_test() ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD server unit tests failed.\n\n" );
+			return( -1 );
+		}
+		logMessage( LOG_INFO_LEVEL, "CRUD server unit tests completed successfully.\n\n" );
+		return( 0 );
+	}
+
+	// Each client takes a descriptor, allow as many as we may
+	if ( (getrlimit(RLIMIT_NOFILE, &lim) == 0) && (lim.rlim_cur < lim.rlim_max) ) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit( RLIMIT_NOFILE, &lim );
+	}
+
+	// Run the server
+	if ( crud_server() ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD server failed, aborting.\n\n" );
+		return( -1 );
+	}
+	return( 0 );
+}
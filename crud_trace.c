@@ -0,0 +1,442 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_trace.c
+//  Description    : This is the implementation of the instrumentation of the
+//                   CRUD client.  Counters and timers are updated with atomic
+//                   adds, and events go into a fixed ring whose slots are
+//                   claimed with an atomic increment and stamped with their
+//                   sequence number once written, so no lock is taken on any
+//                   path being measured.  A dump reads the ring as it goes,
+//                   skipping slots caught mid write.  The whole module is
+//                   empty unless CRUD_TRACE is defined.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:44:21 UTC 2026
+//
+
+#ifdef CRUD_TRACE
+
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+// Project Includes
+#include <crud_trace.h>
+#include <crud_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_TRACE_TEXT_EVENTS 16 // Most recent events put in the text dump
+
+// Type definitions
+
+// This is a timer
+typedef struct {
+	uint64_t  count;   // Times measured
+	uint64_t  total;   // Total time (ns)
+	uint64_t  max;     // Longest time (ns)
+} CrudTraceTimer;
+
+// These are the statistics of a request type
+typedef struct {
+	uint64_t  count;      // Requests completed
+	uint64_t  failures;   // Of those, failed by the server
+	uint64_t  bytes_out;  // Bytes of data sent
+	uint64_t  bytes_in;   // Bytes of data received
+	CrudTraceTimer rtt;   // Round trip times
+} CrudTraceRequest;
+
+// This is an event of the ring
+typedef struct {
+	uint64_t  seq;     // Sequence number plus one once written, 0 while writing
+	uint64_t  time;    // When it happened (ns)
+	uint64_t  arg;     // Argument of the event (see CRUD_TRACE_EVENTS)
+	uint32_t  oid;     // Object (or file handle)
+	uint32_t  length;  // Length of the request or operation
+	uint32_t  thread;  // Thread it happened on
+	uint8_t   event;   // CRUD_TRACE_EVENTS
+	uint8_t   req;     // Request type, if any
+} CrudTraceEvent;
+
+//
+// Module static data
+
+static uint64_t trace_counters[CRUD_CTR_MAXVAL];      // The counters
+static CrudTraceTimer trace_timers[CRUD_TMR_MAXVAL];  // The timers
+static CrudTraceRequest trace_requests[CRUD_MAXVAL];  // By request type
+static CrudTraceEvent trace_ring[CRUD_TRACE_RING_SIZE]; // The recent events
+static uint64_t trace_next = 0;       // Sequence of the next event
+static uint32_t trace_threads = 0;    // Threads seen so far
+static __thread uint32_t trace_thread = 0; // This thread's number (0 until it traces)
+static uint64_t trace_epoch = 0;      // Time tracing started
+static const char *trace_path = NULL; // JSON dump file, NULL for none
+static pthread_mutex_t trace_dump_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes dumps
+
+static const char *trace_counter_names[CRUD_CTR_MAXVAL] = {
+	"opens", "closes", "seeks", "reads", "read_bytes", "writes", "write_bytes", "readahead_chunks",
+	"batches", "connects", "sock_writes", "sock_bytes_out", "sock_reads", "sock_bytes_in"
+};
+static const char *trace_timer_names[CRUD_TMR_MAXVAL] = {
+	"read", "write", "client_wait", "sock_send", "sock_recv"
+};
+static const char *trace_event_names[CRUD_EVT_MAXVAL] = {
+	"send", "recv", "read", "write", "batch"
+};
+static const char *trace_request_names[CRUD_MAXVAL+1] = {
+	"CRUD_INIT", "CRUD_FORMAT", "CRUD_CREATE", "CRUD_READ", "CRUD_UPDATE", "CRUD_DELETE",
+	"CRUD_CLOSE", "CRUD_READ_RANGE", "CRUD_APPEND", "CRUD_UPDATE_RANGE", "CRUD_BATCH", "CRUD_UNKNOWN",
+	"-" // Events without a request
+};
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_add_time
+// Description  : Add a time to a timer
+//
+// Inputs       : tmr - the timer
+//                elapsed - the time (ns)
+// Outputs      : none
+
+static void crud_trace_add_time(CrudTraceTimer *tmr, uint64_t elapsed) {
+
+	// Local variables
+	uint64_t max = __atomic_load_n(&tmr->max, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&tmr->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tmr->total, elapsed, __ATOMIC_RELAXED);
+	while ((elapsed > max) && !__atomic_compare_exchange_n(&tmr->max, &max, elapsed, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_read_event
+// Description  : Copy an event out of the ring, if it is whole
+//
+// Inputs       : seq - the sequence number of the event
+//                evt - the place to put it
+// Outputs      : 1 if copied, 0 if overwritten or being written
+
+static int crud_trace_read_event(uint64_t seq, CrudTraceEvent *evt) {
+
+	// Local variables
+	CrudTraceEvent *slot = &trace_ring[seq & (CRUD_TRACE_RING_SIZE - 1)];
+
+	// The stamp has to match before and after the copy
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq + 1) {
+		return(0);
+	}
+	memcpy(evt, slot, sizeof(CrudTraceEvent));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_json
+// Description  : Write the whole dump as JSON
+//
+// Inputs       : out - the file to write to
+// Outputs      : none
+
+static void crud_trace_json(FILE *out) {
+
+	// Local variables
+	uint64_t seq, next = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+	CrudTraceEvent evt;
+	CrudTraceRequest *rq;
+	int i, first;
+
+	// Counters and timers
+	fprintf(out, "{\n  \"uptime_ns\": %lu,\n  \"counters\": {", crud_trace_now() - trace_epoch);
+	for (i=0; i<CRUD_CTR_MAXVAL; i++) {
+		fprintf(out, "%s\"%s\": %lu", (i) ? ", " : "", trace_counter_names[i],
+				__atomic_load_n(&trace_counters[i], __ATOMIC_RELAXED));
+	}
+	fprintf(out, "},\n  \"timers\": {");
+	for (i=0; i<CRUD_TMR_MAXVAL; i++) {
+		fprintf(out, "%s\n    \"%s\": {\"count\": %lu, \"total_ns\": %lu, \"max_ns\": %lu}",
+				(i) ? "," : "", trace_timer_names[i], trace_timers[i].count,
+				trace_timers[i].total, trace_timers[i].max);
+	}
+
+	// Requests by type
+	fprintf(out, "\n  },\n  \"requests\": {");
+	for (i=0, first=1; i<CRUD_MAXVAL; i++) {
+		rq = &trace_requests[i];
+		if (rq->count > 0) {
+			fprintf(out, "%s\n    \"%s\": {\"count\": %lu, \"failures\": %lu, \"bytes_out\": %lu, "
+					"\"bytes_in\": %lu, \"rtt_total_ns\": %lu, \"rtt_max_ns\": %lu}",
+					(first) ? "" : ",", trace_request_names[i], rq->count, rq->failures,
+					rq->bytes_out, rq->bytes_in, rq->rtt.total, rq->rtt.max);
+			first = 0;
+		}
+	}
+
+	// The ring, oldest first
+	fprintf(out, "\n  },\n  \"events_total\": %lu,\n  \"events\": [", next);
+	seq = (next > CRUD_TRACE_RING_SIZE) ? next - CRUD_TRACE_RING_SIZE : 0;
+	for (first=1; seq<next; seq++) {
+		if (crud_trace_read_event(seq, &evt)) {
+			fprintf(out, "%s\n    {\"seq\": %lu, \"time_ns\": %lu, \"thread\": %u, \"event\": \"%s\", "
+					"\"req\": \"%s\", \"oid\": %u, \"length\": %u, \"arg\": %lu}",
+					(first) ? "" : ",", seq, evt.time - trace_epoch, evt.thread,
+					trace_event_names[evt.event], trace_request_names[evt.req], evt.oid, evt.length, evt.arg);
+			first = 0;
+		}
+	}
+	fprintf(out, "\n  ]\n}\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_signal_thread
+// Description  : Wait for CRUD_TRACE_SIGNAL and dump on each one
+//
+// Inputs       : arg - the signals waited on
+// Outputs      : never returns
+
+static void *crud_trace_signal_thread(void *arg) {
+
+	// Local variables
+	int sig;
+
+	while (1) {
+		if (sigwait((sigset_t *)arg, &sig) == 0) {
+			crud_trace_dump();
+		}
+	}
+	return(NULL);
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_init
+// Description  : Start tracing: note the dump file and start the thread
+//                that dumps on CRUD_TRACE_SIGNAL.  The signal is blocked in
+//                the calling thread, so this should be called before any
+//                other thread is started (which then inherit the mask).
+//
+// Inputs       : path - the JSON dump file, NULL for none
+// Outputs      : none
+
+void crud_trace_init(const char *path) {
+
+	// Local variables
+	static sigset_t signals;
+	pthread_t thread;
+
+	trace_path = path;
+	trace_epoch = crud_trace_now();
+	sigemptyset(&signals);
+	sigaddset(&signals, CRUD_TRACE_SIGNAL);
+	if ((pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) ||
+			(pthread_create(&thread, NULL, crud_trace_signal_thread, &signals) != 0)) {
+		logMessage(LOG_WARNING_LEVEL, "CRUD trace : failed to catch the dump signal, dumping on unmount only.");
+		return;
+	}
+	pthread_detach(thread);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_now
+// Description  : Get the time for the timers and events
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds (monotonic)
+
+uint64_t crud_trace_now(void) {
+	return(crud_bench_now());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_count
+// Description  : Add to a counter
+//
+// Inputs       : ctr - the counter
+//                n - the amount to add
+// Outputs      : none
+
+void crud_trace_count(CRUD_TRACE_COUNTERS ctr, uint64_t n) {
+	__atomic_fetch_add(&trace_counters[ctr], n, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_time
+// Description  : Add the time since a start to a timer
+//
+// Inputs       : tmr - the timer
+//                start - the time measuring started (crud_trace_now)
+// Outputs      : none
+
+void crud_trace_time(CRUD_TRACE_TIMERS tmr, uint64_t start) {
+	crud_trace_add_time(&trace_timers[tmr], crud_trace_now() - start);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_event
+// Description  : Put an event in the ring, over the oldest one
+//
+// Inputs       : evt - the event
+//                req - the request type (CRUD_MAXVAL if none)
+//                oid - the object or file handle
+//                len - the length of the request or operation
+//                arg - the argument of the event
+// Outputs      : none
+
+void crud_trace_event(CRUD_TRACE_EVENTS evt, uint32_t req, uint32_t oid, uint32_t len, uint64_t arg) {
+
+	// Local variables
+	uint64_t seq = __atomic_fetch_add(&trace_next, 1, __ATOMIC_RELAXED);
+	CrudTraceEvent *slot = &trace_ring[seq & (CRUD_TRACE_RING_SIZE - 1)];
+
+	// Number the thread the first time it traces
+	if (trace_thread == 0) {
+		trace_thread = __atomic_add_fetch(&trace_threads, 1, __ATOMIC_RELAXED);
+	}
+
+	// Mark the slot as being written, fill it in, then stamp it
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->time = crud_trace_now();
+	slot->arg = arg;
+	slot->oid = oid;
+	slot->length = len;
+	slot->thread = trace_thread;
+	slot->event = evt;
+	slot->req = (req < CRUD_MAXVAL) ? req : CRUD_MAXVAL;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_request
+// Description  : Account for a completed request: its count, data bytes
+//                each way and round trip, and a receive event
+//
+// Inputs       : op - the request sent
+//                resp - the response received
+//                start - the time the request was sent
+// Outputs      : none
+
+void crud_trace_request(CrudRequest op, CrudResponse resp, uint64_t start) {
+
+	// Local variables
+	uint32_t req = (op >> 28) & 0xf, len = (op >> 4) & 0xffffff, rlen = (resp >> 4) & 0xffffff;
+	uint64_t rtt = crud_trace_now() - start;
+	CrudTraceRequest *rq = &trace_requests[(req < CRUD_MAXVAL) ? req : CRUD_UNKNOWN];
+
+	__atomic_fetch_add(&rq->failures, resp & 0x1, __ATOMIC_RELAXED);
+	if ((req == CRUD_CREATE) || (req == CRUD_UPDATE) || (req == CRUD_APPEND) || (req == CRUD_UPDATE_RANGE)) {
+		__atomic_fetch_add(&rq->bytes_out, len, __ATOMIC_RELAXED);
+	}
+	if ((req == CRUD_READ) || (req == CRUD_READ_RANGE)) {
+		__atomic_fetch_add(&rq->bytes_in, rlen, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add(&rq->count, 1, __ATOMIC_RELAXED);
+	crud_trace_add_time(&rq->rtt, rtt);
+	crud_trace_event(CRUD_EVT_RECV, req, (uint32_t)(resp >> 32), rlen, rtt);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_file_op
+// Description  : Account for a file read or write: its count, bytes, time
+//                and an event
+//
+// Inputs       : evt - CRUD_EVT_READ or CRUD_EVT_WRITE
+//                fd - the file handle
+//                ret - the result (bytes moved, -1 if failed)
+//                start - the time the operation started
+// Outputs      : none
+
+void crud_trace_file_op(CRUD_TRACE_EVENTS evt, int16_t fd, int32_t ret, uint64_t start) {
+
+	// Local variables
+	uint64_t elapsed = crud_trace_now() - start;
+	int write = (evt == CRUD_EVT_WRITE);
+
+	crud_trace_count((write) ? CRUD_CTR_WRITES : CRUD_CTR_READS, 1);
+	crud_trace_count((write) ? CRUD_CTR_WRITE_BYTES : CRUD_CTR_READ_BYTES, (ret > 0) ? ret : 0);
+	crud_trace_add_time(&trace_timers[(write) ? CRUD_TMR_WRITE : CRUD_TMR_READ], elapsed);
+	crud_trace_event(evt, CRUD_MAXVAL, (uint32_t)fd, (uint32_t)ret, elapsed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_trace_dump
+// Description  : Log the counters, timers, request statistics and the most
+//                recent events, then write everything (with the whole
+//                ring) to the JSON dump file if there is one
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_trace_dump(void) {
+
+	// Local variables
+	char line[CRUD_CTR_MAXVAL * 40], *out = line;
+	uint64_t seq, next;
+	CrudTraceEvent evt;
+	CrudTraceRequest *rq;
+	FILE *json;
+	int i;
+
+	// Counters on one line, a line per timer and request type
+	pthread_mutex_lock(&trace_dump_lock);
+	for (i=0; i<CRUD_CTR_MAXVAL; i++) {
+		out += sprintf(out, " %s=%lu", trace_counter_names[i], __atomic_load_n(&trace_counters[i], __ATOMIC_RELAXED));
+	}
+	logMessage(LOG_OUTPUT_LEVEL, "CRUD trace : counters%s", line);
+	for (i=0; i<CRUD_TMR_MAXVAL; i++) {
+		if (trace_timers[i].count > 0) {
+			logMessage(LOG_OUTPUT_LEVEL, "CRUD trace : timer %-12s %9lu calls, %12.3f ms total, %9.1f us mean, %9.1f us max",
+					trace_timer_names[i], trace_timers[i].count, trace_timers[i].total / 1e6,
+					trace_timers[i].total / 1e3 / trace_timers[i].count, trace_timers[i].max / 1e3);
+		}
+	}
+	for (i=0; i<CRUD_MAXVAL; i++) {
+		rq = &trace_requests[i];
+		if (rq->count > 0) {
+			logMessage(LOG_OUTPUT_LEVEL, "CRUD trace : %-17s %9lu done, %lu failed, %lu bytes out, %lu bytes in, "
+					"%.1f us mean rtt, %.1f us max rtt", trace_request_names[i], rq->count, rq->failures,
+					rq->bytes_out, rq->bytes_in, rq->rtt.total / 1e3 / rq->count, rq->rtt.max / 1e3);
+		}
+	}
+
+	// The last few events
+	next = __atomic_load_n(&trace_next, __ATOMIC_ACQUIRE);
+	seq = (next > CRUD_TRACE_TEXT_EVENTS) ? next - CRUD_TRACE_TEXT_EVENTS : 0;
+	for (; seq<next; seq++) {
+		if (crud_trace_read_event(seq, &evt)) {
+			logMessage(LOG_OUTPUT_LEVEL, "CRUD trace : event %lu at %.6f s, thread %u, %s %s oid %u length %u arg %lu",
+					seq, (evt.time - trace_epoch) / 1e9, evt.thread, trace_event_names[evt.event],
+					trace_request_names[evt.req], evt.oid, evt.length, evt.arg);
+		}
+	}
+
+	// Then the JSON (replacing the last dump)
+	if (trace_path != NULL) {
+		if ((json = fopen(trace_path, "w")) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD trace : failed to open dump file [%s].", trace_path);
+		} else {
+			crud_trace_json(json);
+			fclose(json);
+		}
+	}
+	pthread_mutex_unlock(&trace_dump_lock);
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef CRUD_TRACE_INCLUDED
+#define CRUD_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_trace.h
+//  Description    : This is the header file for the instrumentation of the
+//                   CRUD client: counters, timers, per request statistics
+//                   and a ring of the most recent trace events, dumped on
+//                   unmount or on CRUD_TRACE_SIGNAL.  It is built in only
+//                   when CRUD_TRACE is defined ("make TRACE=1"); otherwise
+//                   every CRUD_TRACE_ macro below compiles to nothing.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:44:21 UTC 2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Project includes
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_TRACE_RING_SIZE 1024    // Trace events kept (a power of two)
+#define CRUD_TRACE_SIGNAL    SIGUSR1 // Signal asking for a dump
+
+// Type definitions
+
+// The event counters
+typedef enum {
+	CRUD_CTR_OPENS         = 0,  // Files opened
+	CRUD_CTR_CLOSES        = 1,  // Files closed
+	CRUD_CTR_SEEKS         = 2,  // Seeks
+	CRUD_CTR_READS         = 3,  // Reads (crud_read, crud_pread, crud_read_view)
+	CRUD_CTR_READ_BYTES    = 4,  // Bytes read
+	CRUD_CTR_WRITES        = 5,  // Writes
+	CRUD_CTR_WRITE_BYTES   = 6,  // Bytes written
+	CRUD_CTR_READAHEAD     = 7,  // Chunks read ahead
+	CRUD_CTR_BATCHES       = 8,  // Batch frames sent
+	CRUD_CTR_CONNECTS      = 9,  // Connections made
+	CRUD_CTR_SOCK_WRITES   = 10, // writev calls
+	CRUD_CTR_SOCK_OUT      = 11, // Bytes sent
+	CRUD_CTR_SOCK_READS    = 12, // read calls
+	CRUD_CTR_SOCK_IN       = 13, // Bytes received
+	CRUD_CTR_MAXVAL        = 14, // Number of counters
+} CRUD_TRACE_COUNTERS;
+
+// The timers (each keeps a count, total and longest time)
+typedef enum {
+	CRUD_TMR_READ       = 0, // In crud_read, crud_pread and crud_read_view
+	CRUD_TMR_WRITE      = 1, // In crud_write
+	CRUD_TMR_WAIT       = 2, // Waiting in crud_client_wait
+	CRUD_TMR_SOCK_SEND  = 3, // Writing to the sockets
+	CRUD_TMR_SOCK_RECV  = 4, // Reading from the sockets
+	CRUD_TMR_MAXVAL     = 5, // Number of timers
+} CRUD_TRACE_TIMERS;
+
+// The trace events
+typedef enum {
+	CRUD_EVT_SEND    = 0, // Request sent (arg: object offset)
+	CRUD_EVT_RECV    = 1, // Response received (arg: round trip in ns)
+	CRUD_EVT_READ    = 2, // File read (oid: the fd, arg: time in ns)
+	CRUD_EVT_WRITE   = 3, // File write (oid: the fd, arg: time in ns)
+	CRUD_EVT_BATCH   = 4, // Batch frame sent (length: requests in it)
+	CRUD_EVT_MAXVAL  = 5, // Number of events
+} CRUD_TRACE_EVENTS;
+
+//
+// Trace interface (the macros are what the code uses)
+
+#ifdef CRUD_TRACE
+
+#define CRUD_TRACE_ENABLED 1
+#define CRUD_TRACE_INIT(path)              crud_trace_init(path)
+#define CRUD_TRACE_COUNT(ctr, n)           crud_trace_count((ctr), (n))
+#define CRUD_TRACE_START(var)              uint64_t var = crud_trace_now()
+#define CRUD_TRACE_STOP(tmr, var)          crud_trace_time((tmr), (var))
+#define CRUD_TRACE_EVENT(evt, req, oid, len, arg) crud_trace_event((evt), (req), (oid), (len), (arg))
+#define CRUD_TRACE_REQUEST(op, resp, start) crud_trace_request((op), (resp), (start))
+#define CRUD_TRACE_FILE_OP(evt, fd, ret, start) crud_trace_file_op((evt), (fd), (ret), (start))
+#define CRUD_TRACE_DUMP()                  crud_trace_dump()
+
+void crud_trace_init(const char *path);
+	// Set the JSON dump file (NULL for none) and catch CRUD_TRACE_SIGNAL
+
+uint64_t crud_trace_now(void);
+	// The time in nanoseconds (monotonic)
+
+void crud_trace_count(CRUD_TRACE_COUNTERS ctr, uint64_t n);
+	// Add to a counter
+
+void crud_trace_time(CRUD_TRACE_TIMERS tmr, uint64_t start);
+	// Add the time since "start" to a timer
+
+void crud_trace_event(CRUD_TRACE_EVENTS evt, uint32_t req, uint32_t oid, uint32_t len, uint64_t arg);
+	// Put an event in the ring
+
+void crud_trace_request(CrudRequest op, CrudResponse resp, uint64_t start);
+	// Account for a completed request sent at "start"
+
+void crud_trace_file_op(CRUD_TRACE_EVENTS evt, int16_t fd, int32_t ret, uint64_t start);
+	// Account for a file read or write (CRUD_EVT_READ/WRITE) started at "start"
+
+void crud_trace_dump(void);
+	// Log the counters, timers, requests and events, and write the JSON dump
+
+#else
+
+#define CRUD_TRACE_ENABLED 0
+#define CRUD_TRACE_INIT(path)              do { } while (0)
+#define CRUD_TRACE_COUNT(ctr, n)           do { } while (0)
+#define CRUD_TRACE_START(var)              do { } while (0)
+#define CRUD_TRACE_STOP(tmr, var)          do { } while (0)
+#define CRUD_TRACE_EVENT(evt, req, oid, len, arg) do { } while (0)
+#define CRUD_TRACE_REQUEST(op, resp, start) do { } while (0)
+#define CRUD_TRACE_FILE_OP(evt, fd, ret, start) do { } while (0)
+#define CRUD_TRACE_DUMP()                  do { } while (0)
+
+#endif
+
+#endif
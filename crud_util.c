@@ -34,7 +34,7 @@ CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
 	// Build up the request fields
 	CrudRequest request = 0;
 	request = ((uint64_t) oid) << 32;
-	request |= req << 28;
+	request |= ((uint64_t) req) << 28;
 	request |= length << 4;
 	request |= flags << 1;
 	request |= res;
@@ -0,0 +1,520 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_workload.c
+//  Description    : This is the implementation of the compiled workloads of
+//                   the CRUD simulator.  The compiler makes one pass over the
+//                   text, numbering the files as they first appear and
+//                   storing the write data with its '*'s already turned into
+//                   newlines.  A compiled stream is checked once when mapped,
+//                   so the replay can trust every operation in it.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:38:15 UTC 2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <crud_workload.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_WORKLOAD_MAX_LINE 2048      // Longest line of a text workload
+#define CRUD_WORKLOAD_MAX_FILES 0xffff   // Most distinct files in a workload
+
+// Type definitions
+
+// A growing array used while compiling
+typedef struct {
+	char     *data;      // The bytes
+	uint32_t  used;      // Bytes in use
+	uint32_t  size;      // Bytes allocated
+} CrudWorkloadBuffer;
+
+// The state of a compile
+typedef struct {
+	CrudWorkloadBuffer ops;      // The operations
+	CrudWorkloadBuffer names;    // The file names (NUL terminated)
+	CrudWorkloadBuffer offsets;  // Offset of each file name in names
+	CrudWorkloadBuffer payload;  // The write data
+	int32_t  *slots;             // Hash of the file names, file index or -1
+	uint32_t  nslots;            // Number of slots (power of 2)
+	uint32_t  files;             // Number of files
+	uint32_t  max_read;          // Longest read
+} CrudWorkloadCompile;
+
+//
+// Module local functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_append
+// Description  : Append bytes to a growing array, doubling it as needed
+//
+// Inputs       : buf - the array
+//                data - the bytes (NULL to only make room)
+//                length - the number of bytes
+// Outputs      : offset of the bytes in the array, -1 if failure
+
+static int64_t crud_workload_append(CrudWorkloadBuffer *buf, const void *data, uint32_t length) {
+
+	// Local variables
+	uint32_t size = buf->size ? buf->size : 0x1000;
+	uint32_t at = buf->used;
+	char *grown;
+
+	// Grow, then copy the bytes in
+	if ((uint64_t)buf->used + length > UINT32_MAX / 2) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD workload : compiled workload too large.");
+		return(-1);
+	}
+	while (size < buf->used + length) {
+		size *= 2;
+	}
+	if (size != buf->size) {
+		if ((grown = realloc(buf->data, size)) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD workload : failed to allocate %u bytes.", size);
+			return(-1);
+		}
+		buf->data = grown;
+		buf->size = size;
+	}
+	if (data != NULL) {
+		memcpy(&buf->data[at], data, length);
+	}
+	buf->used += length;
+	return(at);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_hash
+// Description  : Hash a file name
+//
+// Inputs       : name - the name
+// Outputs      : the hash
+
+static uint32_t crud_workload_hash(const char *name) {
+
+	// Local variables
+	uint32_t hash = 2166136261U;
+
+	// FNV-1a over the bytes
+	while (*name) {
+		hash = (hash ^ (uint8_t)*name++) * 16777619U;
+	}
+	return(hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_file
+// Description  : Get the index of a file, numbering it if new
+//
+// Inputs       : comp - the compile
+//                name - the file name
+// Outputs      : the index of the file, -1 if failure
+
+static int32_t crud_workload_file(CrudWorkloadCompile *comp, const char *name) {
+
+	// Local variables
+	uint32_t slot, i, *offsets, offset;
+	int32_t *slots;
+	int64_t at;
+
+	// Keep the hash at most half full, rehashing the names into a larger one
+	if (comp->files * 2 >= comp->nslots) {
+		if ((slots = malloc(sizeof(int32_t) * comp->nslots * 2)) == NULL) {
+			return(-1);
+		}
+		memset(slots, 0xff, sizeof(int32_t) * comp->nslots * 2);
+		offsets = (uint32_t *)comp->offsets.data;
+		for (i=0; i<comp->files; i++) {
+			slot = crud_workload_hash(&comp->names.data[offsets[i]]) & (comp->nslots * 2 - 1);
+			while (slots[slot] != -1) {
+				slot = (slot + 1) & (comp->nslots * 2 - 1);
+			}
+			slots[slot] = i;
+		}
+		free(comp->slots);
+		comp->slots = slots;
+		comp->nslots *= 2;
+	}
+
+	// Look for the name, add it at the empty slot the probe ends on
+	offsets = (uint32_t *)comp->offsets.data;
+	slot = crud_workload_hash(name) & (comp->nslots - 1);
+	while (comp->slots[slot] != -1) {
+		if (strcmp(&comp->names.data[offsets[comp->slots[slot]]], name) == 0) {
+			return(comp->slots[slot]);
+		}
+		slot = (slot + 1) & (comp->nslots - 1);
+	}
+	if (comp->files == CRUD_WORKLOAD_MAX_FILES) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD workload : more than %u files.", CRUD_WORKLOAD_MAX_FILES);
+		return(-1);
+	}
+	if ((at = crud_workload_append(&comp->names, name, strlen(name) + 1)) == -1) {
+		return(-1);
+	}
+	offset = at;
+	if (crud_workload_append(&comp->offsets, &offset, sizeof(uint32_t)) == -1) {
+		return(-1);
+	}
+	comp->slots[slot] = comp->files;
+	return(comp->files++);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_line
+// Description  : Compile one line of a text workload
+//
+// Inputs       : comp - the compile
+//                line - the line (NUL terminated, with its newline)
+//                linecount - the number of the line
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_workload_line(CrudWorkloadCompile *comp, char *line, int linecount) {
+
+	// Local variables
+	char fname[CRUD_WORKLOAD_MAX_LINE], command[CRUD_WORKLOAD_MAX_LINE], *sep, *data;
+	CrudWorkloadOp op;
+	int32_t len, off, file;
+	int64_t at;
+	int i;
+
+	// Parse out the string
+	sep = strchr(line, ':');
+	if ((sscanf(line, "%s %s %d %d", fname, command, &len, &off) != 4) || (sep == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD un-parsable workload string, aborting [%s], line %d", line, linecount);
+		return(-1);
+	}
+	memset(&op, 0x0, sizeof(CrudWorkloadOp));
+	op.length = len;
+	op.offset = off;
+
+	// The file system commands (file ignored), then the file commands
+	if (strncmp(command, "FORMAT", 6) == 0) {
+		op.opcode = CRUD_WL_FORMAT;
+	} else if (strncmp(command, "MOUNT", 5) == 0) {
+		op.opcode = CRUD_WL_MOUNT;
+	} else if (strncmp(command, "UNMOUNT", 5) == 0) {
+		op.opcode = CRUD_WL_UNMOUNT;
+	} else {
+		if (strncmp(command, "WRITEAT", 7) == 0) {
+			op.opcode = CRUD_WL_WRITEAT;
+		} else if (strncmp(command, "WRITE", 5) == 0) {
+			op.opcode = CRUD_WL_WRITE;
+		} else if (strncmp(command, "SEEK", 4) == 0) {
+			op.opcode = CRUD_WL_SEEK;
+		} else if (strncmp(command, "READ", 4) == 0) {
+			op.opcode = CRUD_WL_READ;
+			comp->max_read = (len > 0 && len > comp->max_read) ? len : comp->max_read;
+		} else {
+			logMessage(LOG_ERROR_LEVEL, "CRUD workload : unknown command [%s], line %d", command, linecount);
+			return(-1);
+		}
+		if ((file = crud_workload_file(comp, fname)) == -1) {
+			return(-1);
+		}
+		op.file = file;
+	}
+
+	// Store the data of a write, the lines terminated
+	if ((op.opcode == CRUD_WL_WRITE) || (op.opcode == CRUD_WL_WRITEAT)) {
+		if ((len < 0) || (len >= CRUD_WORKLOAD_MAX_TEXT) || (strlen(sep+1) < len)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD workload : bad write of %d bytes, line %d", len, linecount);
+			return(-1);
+		}
+		if ((at = crud_workload_append(&comp->payload, sep+1, len)) == -1) {
+			return(-1);
+		}
+		data = &comp->payload.data[at];
+		for (i=0; i<len; i++) {
+			if (data[i] == '*') {
+				data[i] = '\n';
+			}
+		}
+		op.data = at;
+	}
+	return(crud_workload_append(&comp->ops, &op, sizeof(CrudWorkloadOp)) == -1 ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_compile
+// Description  : Compile a text workload into a stream in memory
+//
+// Inputs       : text - the text
+//                length - its length
+//                wl - the workload to fill in
+// Outputs      : 0 if successful, -1 if failure
+
+static int crud_workload_compile(char *text, uint32_t length, CrudWorkload *wl) {
+
+	// Local variables
+	CrudWorkloadCompile comp;
+	CrudWorkloadHeader header;
+	char line[CRUD_WORKLOAD_MAX_LINE], *next = text, *end = text + length, *nl;
+	uint32_t *offsets, i;
+	int linecount = 0, failed = 0;
+
+	// Compile each line (the last may have no newline)
+	memset(&comp, 0x0, sizeof(CrudWorkloadCompile));
+	comp.nslots = 64;
+	if ((comp.slots = malloc(sizeof(int32_t) * comp.nslots)) == NULL) {
+		return(-1);
+	}
+	memset(comp.slots, 0xff, sizeof(int32_t) * comp.nslots);
+	while ((next < end) && !failed) {
+		nl = memchr(next, '\n', end - next);
+		nl = (nl == NULL) ? end : nl + 1;
+		linecount ++;
+		if (nl - next >= CRUD_WORKLOAD_MAX_LINE) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD workload : line %d too long, aborting.", linecount);
+			failed = 1;
+			break;
+		}
+		memcpy(line, next, nl - next);
+		line[nl - next] = '\0';
+		failed = (crud_workload_line(&comp, line, linecount) == -1);
+		next = nl;
+	}
+
+	// Lay out the stream: head, operations, name offsets, names, data
+	memset(&header, 0x0, sizeof(CrudWorkloadHeader));
+	header.magic = CRUD_WORKLOAD_MAGIC;
+	header.version = CRUD_WORKLOAD_VERSION;
+	header.ops = comp.ops.used / sizeof(CrudWorkloadOp);
+	header.files = comp.files;
+	header.names = sizeof(CrudWorkloadHeader) + comp.ops.used;
+	header.payload = header.names + comp.offsets.used + comp.names.used;
+	header.size = header.payload + comp.payload.used;
+	header.max_read = comp.max_read;
+	memset(wl, 0x0, sizeof(CrudWorkload));
+	if (!failed && ((wl->base = malloc(header.size)) == NULL)) {
+		failed = 1;
+	}
+	if (!failed) {
+		memcpy(wl->base, &header, sizeof(CrudWorkloadHeader));
+		memcpy(&wl->base[sizeof(CrudWorkloadHeader)], comp.ops.data, comp.ops.used);
+		wl->ops = (CrudWorkloadOp *)&wl->base[sizeof(CrudWorkloadHeader)];
+		for (i=0; i<header.ops; i++) {
+			if ((wl->ops[i].opcode == CRUD_WL_WRITE) || (wl->ops[i].opcode == CRUD_WL_WRITEAT)) {
+				wl->ops[i].data += header.payload;
+			}
+		}
+		offsets = (uint32_t *)&wl->base[header.names];
+		for (i=0; i<comp.files; i++) {
+			offsets[i] = ((uint32_t *)comp.offsets.data)[i] + header.names + comp.offsets.used;
+		}
+		memcpy(&wl->base[header.names + comp.offsets.used], comp.names.data, comp.names.used);
+		memcpy(&wl->base[header.payload], comp.payload.data, comp.payload.used);
+		wl->size = header.size;
+		wl->header = (CrudWorkloadHeader *)wl->base;
+		wl->names = offsets;
+	}
+
+	// Cleanup the compile
+	free(comp.ops.data);
+	free(comp.names.data);
+	free(comp.offsets.data);
+	free(comp.payload.data);
+	free(comp.slots);
+	return(failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_check
+// Description  : Check a mapped stream is whole and every operation in it
+//                refers only to what is there, so it can be replayed as is
+//
+// Inputs       : wl - the workload
+// Outputs      : 0 if good, -1 if not
+
+static int crud_workload_check(CrudWorkload *wl) {
+
+	// Local variables
+	CrudWorkloadHeader *header = wl->header;
+	CrudWorkloadOp *op;
+	uint64_t names_end;
+	uint32_t i;
+
+	// The layout first
+	names_end = (uint64_t)header->names + (uint64_t)header->files * sizeof(uint32_t);
+	if ((header->version != CRUD_WORKLOAD_VERSION) || (header->size != wl->size) ||
+			((uint64_t)sizeof(CrudWorkloadHeader) + (uint64_t)header->ops * sizeof(CrudWorkloadOp) != header->names) ||
+			(names_end > header->payload) || (header->payload > header->size) ||
+			((header->files > 0) && (wl->base[header->payload - 1] != '\0'))) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD workload : bad compiled workload (version %u).", header->version);
+		return(-1);
+	}
+	for (i=0; i<header->files; i++) {
+		if ((wl->names[i] < names_end) || (wl->names[i] >= header->payload)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD workload : bad name of file %u.", i);
+			return(-1);
+		}
+	}
+
+	// Then the operations
+	for (i=0; i<header->ops; i++) {
+		op = &wl->ops[i];
+		if ((op->opcode >= CRUD_WL_MAXVAL) || ((op->opcode >= CRUD_WL_WRITE) && (op->file >= header->files)) ||
+				(((op->opcode == CRUD_WL_WRITE) || (op->opcode == CRUD_WL_WRITEAT)) &&
+				 ((op->length < 0) || (op->data < header->payload) ||
+				  ((uint64_t)op->data + op->length > header->size))) ||
+				((op->opcode == CRUD_WL_READ) && (op->length > 0) && ((uint32_t)op->length > header->max_read))) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD workload : bad operation %u in compiled workload.", i);
+			return(-1);
+		}
+	}
+	return(0);
+}
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_open
+// Description  : Open a workload: a compiled one is mapped and checked, a
+//                text one is compiled into memory
+//
+// Inputs       : path - the workload file
+//                wl - the workload to fill in
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_workload_open(char *path, CrudWorkload *wl) {
+
+	// Local variables
+	struct stat st;
+	char *base = NULL;
+	int fd, ret;
+
+	// Map the file
+	memset(wl, 0x0, sizeof(CrudWorkload));
+	if ((fd = open(path, O_RDONLY)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n", path, strerror(errno));
+		return(-1);
+	}
+	if (fstat(fd, &st) == -1 || st.st_size >= UINT32_MAX) {
+		logMessage(LOG_ERROR_LEVEL, "Failure sizing the workload file [%s].", path);
+		close(fd);
+		return(-1);
+	}
+	if ((st.st_size > 0) &&
+			((base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		logMessage(LOG_ERROR_LEVEL, "Failure mapping the workload file [%s], error: %s.\n", path, strerror(errno));
+		close(fd);
+		return(-1);
+	}
+	close(fd);
+
+	// A compiled stream is replayed straight from the mapping
+	if ((st.st_size >= sizeof(CrudWorkloadHeader)) && (((CrudWorkloadHeader *)base)->magic == CRUD_WORKLOAD_MAGIC)) {
+		wl->base = base;
+		wl->size = st.st_size;
+		wl->mapped = 1;
+		wl->header = (CrudWorkloadHeader *)base;
+		wl->ops = (CrudWorkloadOp *)&base[sizeof(CrudWorkloadHeader)];
+		wl->names = (uint32_t *)&base[wl->header->names < wl->size ? wl->header->names : 0];
+		if (crud_workload_check(wl) == -1) {
+			crud_workload_close(wl);
+			return(-1);
+		}
+		madvise(base, st.st_size, MADV_SEQUENTIAL);
+		return(0);
+	}
+
+	// Otherwise compile the text
+	ret = crud_workload_compile(base, st.st_size, wl);
+	if (base != NULL) {
+		munmap(base, st.st_size);
+	}
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_save
+// Description  : Write the compiled stream of a workload to a file
+//
+// Inputs       : wl - the workload
+//                path - the file to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_workload_save(CrudWorkload *wl, char *path) {
+
+	// Local variables
+	uint32_t done = 0;
+	ssize_t ret;
+	int fd;
+
+	// Write the stream whole
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure creating compiled workload [%s], error: %s.", path, strerror(errno));
+		return(-1);
+	}
+	while (done < wl->size) {
+		if ((ret = write(fd, &wl->base[done], wl->size - done)) <= 0) {
+			logMessage(LOG_ERROR_LEVEL, "Failure writing compiled workload [%s], error: %s.", path, strerror(errno));
+			close(fd);
+			return(-1);
+		}
+		done += ret;
+	}
+	return(close(fd) == -1 ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_close
+// Description  : Release a workload (unmapping or freeing the stream)
+//
+// Inputs       : wl - the workload
+// Outputs      : none
+
+void crud_workload_close(CrudWorkload *wl) {
+	if (wl->mapped) {
+		munmap(wl->base, wl->size);
+	} else {
+		free(wl->base);
+	}
+	memset(wl, 0x0, sizeof(CrudWorkload));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_name
+// Description  : Get the name of a file of the workload
+//
+// Inputs       : wl - the workload
+//                file - the index of the file
+// Outputs      : the name
+
+char *crud_workload_name(CrudWorkload *wl, uint16_t file) {
+	return(&wl->base[wl->names[file]]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_workload_data
+// Description  : Get the data of a write of the workload
+//
+// Inputs       : wl - the workload
+//                op - the write
+// Outputs      : the data (op->length bytes)
+
+char *crud_workload_data(CrudWorkload *wl, CrudWorkloadOp *op) {
+	return(&wl->base[op->data]);
+}
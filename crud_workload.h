@@ -0,0 +1,91 @@
+#ifndef CRUD_WORKLOAD_INCLUDED
+#define CRUD_WORKLOAD_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : crud_workload.h
+//  Description    : This is the header file for the compiled workloads of the
+//                   CRUD simulator.  A text workload is compiled once into a
+//                   binary stream of fixed size operations (with the file
+//                   names and the write data in tables behind them), which
+//                   the simulator maps and replays without parsing.
+//
+//  Author         : agent
+//  Last Modified  : Sat Oct 17 02:38:15 UTC 2026
+//
+
+// Include files
+#include <stdint.h>
+
+// Defines
+#define CRUD_WORKLOAD_MAGIC   0x4c575243  // "CRWL", marks a compiled workload
+#define CRUD_WORKLOAD_VERSION 1           // Version of the stream layout
+#define CRUD_WORKLOAD_MAX_TEXT 1024       // Longest write in a workload line
+
+// Type definitions
+
+// The operations of a workload
+typedef enum {
+	CRUD_WL_FORMAT  = 0, // Format the file system
+	CRUD_WL_MOUNT   = 1, // Mount the file system
+	CRUD_WL_UNMOUNT = 2, // Close the open files and unmount
+	CRUD_WL_WRITE   = 3, // Write at the file position
+	CRUD_WL_WRITEAT = 4, // Seek, then write
+	CRUD_WL_SEEK    = 5, // Seek in the file
+	CRUD_WL_READ    = 6, // Read at the file position
+	CRUD_WL_MAXVAL  = 7, // Number of operations
+} CRUD_WORKLOAD_OPS;
+
+// This is the head of a compiled workload.  The operations follow it, then
+// the offset of each file name, the names and the write data (all offsets
+// are from the start of the stream).
+typedef struct {
+	uint32_t  magic;     // CRUD_WORKLOAD_MAGIC
+	uint32_t  version;   // CRUD_WORKLOAD_VERSION
+	uint32_t  size;      // Bytes in the stream
+	uint32_t  ops;       // Number of operations
+	uint32_t  files;     // Number of distinct files
+	uint32_t  names;     // Offset of the file name offsets
+	uint32_t  payload;   // Offset of the write data
+	uint32_t  max_read;  // Longest read of the workload
+} CrudWorkloadHeader;
+
+// This is one operation
+typedef struct {
+	uint8_t   opcode;    // CRUD_WORKLOAD_OPS
+	uint8_t   reserved;  // Unused, zero
+	uint16_t  file;      // Index of the file (file operations)
+	int32_t   length;    // Length of the write or read (expected result otherwise)
+	int32_t   offset;    // Position of the seek or write
+	uint32_t  data;      // Offset of the write data
+} CrudWorkloadOp;
+
+// This is a workload ready to replay
+typedef struct {
+	char               *base;    // The stream
+	uint32_t            size;    // Its length
+	int                 mapped;  // Mapped from a file (else allocated)
+	CrudWorkloadHeader *header;  // The head of the stream
+	CrudWorkloadOp     *ops;     // The operations
+	uint32_t           *names;   // Offset of the name of each file
+} CrudWorkload;
+
+//
+// Workload interface
+
+int crud_workload_open(char *path, CrudWorkload *wl);
+	// Map a compiled workload, or compile a text one in memory
+
+int crud_workload_save(CrudWorkload *wl, char *path);
+	// Write the compiled stream of a workload to a file
+
+void crud_workload_close(CrudWorkload *wl);
+	// Release a workload
+
+char *crud_workload_name(CrudWorkload *wl, uint16_t file);
+	// The name of a file of the workload
+
+char *crud_workload_data(CrudWorkload *wl, CrudWorkloadOp *op);
+	// The data of a write of the workload
+
+#endif